@@ -5,6 +5,7 @@
 #include <click/vector.hh>
 #include <click/string.hh>
 #include <click/packet.hh>
+#include <click/packetbatch.hh>
 #include <click/handler.hh>
 CLICK_DECLS
 class Router;
@@ -36,6 +37,8 @@ class Element { public:
     virtual void push(int port, Packet *p);
     virtual Packet *pull(int port) CLICK_WARN_UNUSED_RESULT;
     virtual Packet *simple_action(Packet *p);
+    virtual void push_batch(int port, PacketBatch &batch);
+    virtual void pull_batch(int port, unsigned max, PacketBatch &batch);
 
     virtual bool run_task(Task *task);  // return true iff did useful work
     virtual void run_timer(Timer *timer);
@@ -47,6 +50,7 @@ class Element { public:
 
     inline void checked_output_push(int port, Packet *p) const;
     inline Packet* checked_input_pull(int port) const;
+    inline void checked_output_push_batch(int port, PacketBatch &batch) const;
 
     // ELEMENT CHARACTERISTICS
     virtual const char *class_name() const = 0;
@@ -219,6 +223,8 @@ class Element { public:
 
         inline void push(Packet* p) const;
         inline Packet* pull() const;
+        inline void push_batch(PacketBatch &batch) const;
+        inline void pull_batch(unsigned max, PacketBatch &batch) const;
 
 #if CLICK_STATS >= 1
         unsigned npackets() const       { return _packets; }
@@ -684,6 +690,58 @@ Element::Port::pull() const
     return p;
 }
 
+/** @brief Push the packets in @a batch over this port.
+ *
+ * Calls the next element's @link Element::push_batch() push_batch() @endlink
+ * function, which takes ownership of the packets.  On return, @a batch is
+ * empty.  Elements without a batch implementation receive the packets one
+ * at a time through push().
+ *
+ * This port must be an active() push output port.
+ */
+inline void
+Element::Port::push_batch(PacketBatch &batch) const
+{
+    assert(_e);
+    if (batch.empty())
+	return;
+#if CLICK_STATS >= 1
+    _packets += batch.count();
+#endif
+#if CLICK_STATS >= 2
+    _e->input(_port)._packets += batch.count();
+    _e->_xfer_calls += 1;
+#endif
+    _e->push_batch(_port, batch);
+    batch.clear();
+}
+
+/** @brief Pull up to @a max packets over this port, appending them to
+ * @a batch.
+ *
+ * Calls the previous element's @link Element::pull_batch() pull_batch()
+ * @endlink function.  Fewer than @a max packets are appended if the upstream
+ * element runs dry.
+ *
+ * This port must be an active() pull input port.
+ */
+inline void
+Element::Port::pull_batch(unsigned max, PacketBatch &batch) const
+{
+    assert(_e);
+#if CLICK_STATS >= 1
+    unsigned old_count = batch.count();
+#endif
+    _e->pull_batch(_port, max, batch);
+#if CLICK_STATS >= 1
+    _packets += batch.count() - old_count;
+#endif
+#if CLICK_STATS >= 2
+    _e->output(_port)._packets += batch.count() - old_count;
+    _e->_xfer_calls += 1;
+#endif
+}
+
 /** @brief Push packet @a p to output @a port, or kill it if @a port is out of
  * range.
  *
@@ -724,6 +782,20 @@ Element::checked_input_pull(int port) const
         return 0;
 }
 
+/** @brief Push the packets in @a batch to output @a port, or kill them if
+ * @a port is out of range.
+ *
+ * On return, @a batch is empty.
+ */
+inline void
+Element::checked_output_push_batch(int port, PacketBatch &batch) const
+{
+    if ((unsigned) port < (unsigned) noutputs())
+        _ports[1][port].push_batch(batch);
+    else
+        batch.kill();
+}
+
 #undef PORT_ASSIGN
 CLICK_ENDDECLS
 #endif
@@ -3,6 +3,7 @@
 #define CLICK_FROMFILE_HH
 #include <click/string.hh>
 #include <click/vector.hh>
+#include <click/timestamp.hh>
 #include <stdio.h>
 CLICK_DECLS
 class ErrorHandler;
@@ -27,6 +28,7 @@ class FromFile { public:
     void set_lineno(int lineno)		{ _lineno = lineno; }
 
     off_t file_pos() const		{ return _file_offset + _pos; }
+    off_t file_size() const;
 
     int configure_keywords(Vector<String>& conf, Element* e, ErrorHandler* errh);
     int set_data(const String& data, ErrorHandler* errh);
@@ -37,6 +39,12 @@ class FromFile { public:
 
     int seek(off_t want, ErrorHandler *);
 
+    bool has_index() const		{ return _index && !_index_build; }
+    bool building_index() const		{ return _index_build; }
+    bool index_first_timestamp(Timestamp &ts) const;
+    int seek_time(const Timestamp &ts, ErrorHandler *errh);
+    inline void index_record(off_t pos, const Timestamp &ts);
+
     int read(void*, uint32_t, ErrorHandler * = 0);
     const uint8_t* get_unaligned(size_t, void*, ErrorHandler* = 0);
     const uint8_t* get_aligned(size_t, void*, ErrorHandler* = 0);
@@ -55,6 +63,10 @@ class FromFile { public:
 
     enum { BUFFER_SIZE = 32768 };
 
+    class Readahead;
+    class Decompressor;
+    class Index;
+
     int _fd;
     const uint8_t *_buffer;
     uint32_t _pos;
@@ -72,6 +84,20 @@ class FromFile { public:
     off_t _mmap_off;
 #endif
 
+    int _readahead_depth;
+    bool _direct;
+    Readahead *_readahead;
+    bool _decompress;
+    int _decompress_threads;
+    Decompressor *_decompressor;
+
+    String _index_filename;
+    bool _index_build;
+    uint32_t _index_span;
+    Index *_index;
+    off_t _index_next;
+    Timestamp _index_max_ts;
+
     String _filename;
     FILE *_pipe;
     off_t _file_offset;
@@ -81,16 +107,40 @@ class FromFile { public:
 #ifdef ALLOW_MMAP
     int read_buffer_mmap(ErrorHandler *);
 #endif
+    int read_buffer_readahead(ErrorHandler *);
+    int read_buffer_decompress(ErrorHandler *);
+    int initialize_index(ErrorHandler *);
+    int write_index(ErrorHandler *);
+    void index_mark(off_t pos, const Timestamp &ts);
     int read_buffer(ErrorHandler *);
+    int fill_buffer(ErrorHandler *);
     bool read_packet(ErrorHandler *);
     int skip_ahead(ErrorHandler *);
 
     static String filename_handler(Element *, void *);
     static String filesize_handler(Element *, void *);
     static String filepos_handler(Element *, void *);
+    static String raw_filepos_handler(Element *, void *);
     static int filepos_write_handler(const String&, Element*, void*, ErrorHandler*);
 
 };
 
+/** @brief Note a record boundary for an index under construction.
+ * @param pos file position of the record
+ * @param ts the record's timestamp
+ *
+ * Elements call this for every record when BUILD_INDEX is set; it is
+ * cheap otherwise. */
+inline void
+FromFile::index_record(off_t pos, const Timestamp &ts)
+{
+    if (_index_build) {
+	if (pos >= _index_next)
+	    index_mark(pos, ts);
+	if (ts > _index_max_ts)
+	    _index_max_ts = ts;
+    }
+}
+
 CLICK_ENDDECLS
 #endif
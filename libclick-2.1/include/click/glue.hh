@@ -151,6 +151,24 @@ void click_srandom(uint32_t seed);
  * if available. */
 void click_random_srandom();
 
+/** @brief Set the click_random() seed to @a seed for the rest of the run.
+ *
+ * Later calls to click_random_srandom(), including the one in
+ * Router::initialize(), have no effect, so runs with the same seed make the
+ * same random choices. */
+void click_random_fix_seed(uint32_t seed);
+
+/** @brief Return a number between 0 and 2^31 - 1, inclusive, from the
+ * private generator state @a state, which is updated.
+ *
+ * Unlike click_random(), this touches no global state, so an element that
+ * may run on its own thread can keep its own @a state.  Seed @a state from
+ * click_random() to keep runs with a fixed seed repeatable. */
+inline uint32_t click_random_r(uint64_t &state) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t) (state >> 33);
+}
+
 #if CLICK_BSDMODULE
 # define CLICK_RAND_MAX 0x7FFFFFFFU
 #elif !CLICK_LINUXMODULE && RAND_MAX >= 0x7FFFFFFFU
@@ -65,6 +65,7 @@ class NotifierSignal {
     };
     static atomic_uint32_t static_value;
 
+    static inline uint32_t load_value(const atomic_uint32_t *v);
     void hard_assign_vm(const NotifierSignal &x);
     void hard_derive_one(atomic_uint32_t *value, uint32_t mask);
     static bool hard_equals(const vmpair *a, const vmpair *b);
@@ -230,16 +231,29 @@ inline NotifierSignal NotifierSignal::uninitialized_signal() {
     return NotifierSignal(&static_value, uninitialized_mask);
 }
 
+/** @cond never */
+/* Signal words hold the bits of several notifiers.  Even without
+   multithreading, TimeSortedSched's PARALLEL inputs set and test their
+   notifiers on helper threads, so read and change the words atomically. */
+inline uint32_t NotifierSignal::load_value(const atomic_uint32_t *v) {
+#if CLICK_USERLEVEL && !HAVE_MULTITHREAD
+    return __atomic_load_n(reinterpret_cast<const uint32_t *>(v), __ATOMIC_RELAXED);
+#else
+    return *v;
+#endif
+}
+/** @endcond never */
+
 /** @brief Test if the signal is active. */
 inline bool NotifierSignal::active() const {
     // 2012.May.16 This fence is necessary; consider, for example,
     // InfiniteSource's checking of nonfull notifiers.
     click_fence();
     if (likely(_mask))
-	return (*_v.v1 & _mask) != 0;
+	return (load_value(_v.v1) & _mask) != 0;
     else {
 	for (vmpair *vm = _v.vm; vm->mask; ++vm)
-	    if ((*vm->value & vm->mask) != 0)
+	    if ((load_value(vm->value) & vm->mask) != 0)
 		return true;
 	return false;
     }
@@ -291,7 +305,7 @@ inline bool NotifierSignal::initialized() const {
  * failure. */
 inline bool NotifierSignal::set_active(bool active) {
     assert(_v.v1 != &static_value && !(_mask & (_mask - 1)));
-    uint32_t expected = *_v.v1;
+    uint32_t expected = load_value(_v.v1);
 #if !CLICK_USERLEVEL || HAVE_MULTITHREAD
     while (_mask) {
 	uint32_t desired = (active ? expected | _mask : expected & ~_mask);
@@ -301,7 +315,13 @@ inline bool NotifierSignal::set_active(bool active) {
 	expected = actual;
     }
 #else
-    *_v.v1 = (active ? expected | _mask : expected & ~_mask);
+    if (!(expected & _mask) != !active) {
+	uint32_t *v = reinterpret_cast<uint32_t *>(_v.v1);
+	if (active)
+	    expected = __atomic_fetch_or(v, _mask, __ATOMIC_SEQ_CST);
+	else
+	    expected = __atomic_fetch_and(v, ~_mask, __ATOMIC_SEQ_CST);
+    }
 #endif
     return expected & _mask;
 }
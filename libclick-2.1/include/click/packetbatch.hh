@@ -0,0 +1,122 @@
+// -*- c-basic-offset: 4; related-file-name: "../../lib/element.cc" -*-
+#ifndef CLICK_PACKETBATCH_HH
+#define CLICK_PACKETBATCH_HH
+#include <click/packet.hh>
+CLICK_DECLS
+
+/** @file <click/packetbatch.hh>
+ * @brief A burst of packets passed between elements in one call.
+ */
+
+/** @class PacketBatch
+ * @brief A list of packets linked through their next() annotations.
+ *
+ * Elements that process packets in bursts pass PacketBatch objects with
+ * Element::Port::push_batch() and Element::Port::pull_batch().  A batch
+ * owns its packets: whoever holds a batch must push, kill, or otherwise
+ * dispose of every packet in it.  Packets in a batch are linked through
+ * their next() annotations, so a packet can belong to at most one batch (or
+ * queue) at a time.  Packets removed with pop_front() have a null next().
+ *
+ * @code
+ * PacketBatch out;
+ * while (Packet *p = batch.pop_front())
+ *     if ((p = simple_action(p)))
+ *         out.append(p);
+ * output(0).push_batch(out);
+ * @endcode
+ */
+class PacketBatch { public:
+
+    /** @brief Construct an empty batch. */
+    PacketBatch()
+	: _head(0), _tail(0), _count(0) {
+    }
+
+    /** @brief Return the first packet in the batch, or null if empty. */
+    Packet *front() const {
+	return _head;
+    }
+    /** @brief Return the number of packets in the batch. */
+    unsigned count() const {
+	return _count;
+    }
+    /** @brief Return true iff the batch is empty. */
+    bool empty() const {
+	return !_head;
+    }
+
+    /** @brief Append @a p to the batch. */
+    inline void append(Packet *p);
+    /** @brief Append the packets of @a x to the batch, leaving @a x empty. */
+    inline void append(PacketBatch &x);
+    /** @brief Remove and return the first packet, or null if empty. */
+    inline Packet *pop_front();
+
+    /** @brief Forget the batch's packets without freeing them. */
+    void clear() {
+	_head = _tail = 0;
+	_count = 0;
+    }
+    /** @brief Kill the batch's packets, leaving it empty. */
+    inline void kill();
+
+  private:
+
+    Packet *_head;
+    Packet *_tail;
+    unsigned _count;
+
+    PacketBatch(const PacketBatch &);
+    PacketBatch &operator=(const PacketBatch &);
+
+};
+
+inline void
+PacketBatch::append(Packet *p)
+{
+    p->set_next(0);
+    if (_tail)
+	_tail->set_next(p);
+    else
+	_head = p;
+    _tail = p;
+    ++_count;
+}
+
+inline void
+PacketBatch::append(PacketBatch &x)
+{
+    if (!x._head)
+	return;
+    if (_tail)
+	_tail->set_next(x._head);
+    else
+	_head = x._head;
+    _tail = x._tail;
+    _count += x._count;
+    x.clear();
+}
+
+inline Packet *
+PacketBatch::pop_front()
+{
+    Packet *p = _head;
+    if (p) {
+	if (!(_head = p->next()))
+	    _tail = 0;
+	p->set_next(0);
+	--_count;
+    }
+    return p;
+}
+
+inline void
+PacketBatch::kill()
+{
+    while (Packet *p = pop_front())
+	p->kill();
+}
+
+CLICK_ENDDECLS
+#endif
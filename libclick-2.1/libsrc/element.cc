@@ -2916,6 +2916,48 @@ Element::pull(int port)
     return p;
 }
 
+/** @brief Push a batch of packets onto push input @a port.
+ *
+ * @param port the input port number on which the packets arrive
+ * @param batch the packets
+ *
+ * An upstream element transferred several packets to this element at once
+ * using output(i).push_batch().  push_batch() must account for every packet
+ * in @a batch, in order, just as push() accounts for a single packet.
+ * Elements that override push_batch() generally forward the surviving
+ * packets with output(i).push_batch(), which keeps bursts intact across
+ * consecutive batch-aware elements and saves a virtual call per packet per
+ * element.
+ *
+ * The default implementation unpacks the batch and calls push() on each
+ * packet, so elements that handle only single packets work unchanged.
+ */
+void
+Element::push_batch(int port, PacketBatch &batch)
+{
+    while (Packet *p = batch.pop_front())
+	push(port, p);
+}
+
+/** @brief Pull up to @a max packets from pull output @a port.
+ *
+ * @param port the output port number receiving the pull request
+ * @param max the maximum number of packets to return
+ * @param batch batch to which packets are appended
+ *
+ * The default implementation calls pull() until it has appended @a max
+ * packets or pull() returns null.
+ */
+void
+Element::pull_batch(int port, unsigned max, PacketBatch &batch)
+{
+    for (unsigned i = 0; i < max; ++i)
+	if (Packet *p = pull(port))
+	    batch.append(p);
+	else
+	    break;
+}
+
 /** @brief Process a packet for a simple packet filter.
  *
  * @param p the input packet
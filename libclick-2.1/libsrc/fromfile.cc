@@ -31,13 +31,1677 @@
 #ifdef ALLOW_MMAP
 # include <sys/mman.h>
 #endif
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_BZLIB
+# include <bzlib.h>
+#endif
+#if HAVE_LZMA
+# include <lzma.h>
+#endif
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
+#if HAVE_LINUX_IO_URING_H
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#  define FROMFILE_IO_URING 1
+# endif
+#endif
 CLICK_DECLS
 
+/** @class FromFile::Readahead
+ * @brief Asynchronous read-ahead for regular files.
+ *
+ * Keeps up to depth() large reads in flight, each into its own aligned
+ * buffer.  Reads complete in any order but are consumed in file order.  Uses
+ * io_uring where available, and otherwise a single thread calling pread().
+ * Buffers no longer referenced by any packet are recycled. */
+class FromFile::Readahead { public:
+
+    enum { UNIT = 1048576, ALIGN = 4096 };
+
+    Readahead(int fd, int depth);
+    ~Readahead();
+
+    int start(off_t off, ErrorHandler *errh);
+    WritablePacket *next(off_t &off, int &len);
+    void release(Packet *p);
+    void restart(off_t off);
+
+    const char *method() const {
+	return _ring_fd >= 0 ? "io_uring" : "pread";
+    }
+
+  private:
+
+    enum { S_EMPTY, S_QUEUED, S_READING, S_DONE, S_EOF };
+    struct Slot {
+	WritablePacket *p;
+	off_t off;
+	int result;
+	int state;
+	struct iovec iov;
+    };
+
+    int _fd;
+    int _depth;
+    Slot *_slot;
+    int _head;			// next slot to consume, in file order
+    off_t _next_off;		// file offset of next read to submit
+    off_t _file_size;
+    int _inflight;
+    Vector<WritablePacket *> _free;
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    pthread_t _thread;
+    bool _have_thread;
+    bool _stopping;
+
+    int _ring_fd;
+#if FROMFILE_IO_URING
+    void *_sq_ptr;
+    size_t _sq_size;
+    void *_cq_ptr;
+    size_t _cq_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    struct io_uring_cqe *_cqes;
+
+    bool setup_ring();
+    void reap_ring(bool wait);
+#endif
+
+    WritablePacket *make_buffer();
+    void fill();
+    void submit(Slot &s);
+    void wait_all();
+    static void complete_read(Slot &s, int fd);
+    static void *thread_main(void *);
+    static void free_destructor(unsigned char *buf, size_t, void *);
+
+};
+
+void
+FromFile::Readahead::free_destructor(unsigned char *buf, size_t, void *)
+{
+    free(buf);
+}
+
+FromFile::Readahead::Readahead(int fd, int depth)
+    : _fd(fd), _depth(depth), _slot(new Slot[depth]), _head(0),
+      _next_off(0), _file_size(0), _inflight(0),
+      _have_thread(false), _stopping(false), _ring_fd(-1)
+{
+    for (int i = 0; i < _depth; i++) {
+	_slot[i].p = 0;
+	_slot[i].state = S_EMPTY;
+    }
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_cond, 0);
+}
+
+FromFile::Readahead::~Readahead()
+{
+    wait_all();
+    if (_have_thread) {
+	pthread_mutex_lock(&_lock);
+	_stopping = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+	pthread_join(_thread, 0);
+    }
+#if FROMFILE_IO_URING
+    if (_ring_fd >= 0) {
+	munmap(_sqes, _sqes_size);
+	if (_cq_ptr != _sq_ptr)
+	    munmap(_cq_ptr, _cq_size);
+	munmap(_sq_ptr, _sq_size);
+	close(_ring_fd);
+    }
+#endif
+    for (int i = 0; i < _depth; i++)
+	if (_slot[i].p)
+	    _slot[i].p->kill();
+    for (int i = 0; i < _free.size(); i++)
+	_free[i]->kill();
+    delete[] _slot;
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_cond);
+}
+
+#if FROMFILE_IO_URING
+bool
+FromFile::Readahead::setup_ring()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, _depth, &params);
+    if (fd < 0)
+	return false;
+
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	_sq_size = _cq_size = (_sq_size > _cq_size ? _sq_size : _cq_size);
+    _sq_ptr = mmap(0, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED) {
+	close(fd);
+	return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	_cq_ptr = _sq_ptr;
+    else if ((_cq_ptr = mmap(0, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+	munmap(_sq_ptr, _sq_size);
+	close(fd);
+	return false;
+    }
+    _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+	if (_cq_ptr != _sq_ptr)
+	    munmap(_cq_ptr, _cq_size);
+	munmap(_sq_ptr, _sq_size);
+	close(fd);
+	return false;
+    }
+
+    char *sq = reinterpret_cast<char *>(_sq_ptr);
+    char *cq = reinterpret_cast<char *>(_cq_ptr);
+    _sqes = reinterpret_cast<struct io_uring_sqe *>(sqes);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    _cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    _ring_fd = fd;
+    return true;
+}
+
+void
+FromFile::Readahead::reap_ring(bool wait)
+{
+    while (1) {
+	unsigned head = *_cq_head;
+	unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+	if (head != tail) {
+	    for (; head != tail; ++head) {
+		struct io_uring_cqe *cqe = &_cqes[head & *_cq_mask];
+		Slot &s = _slot[cqe->user_data];
+		s.result = cqe->res;
+		if (s.result >= 0 && (size_t) s.result < s.iov.iov_len
+		    && s.off + s.result < _file_size)
+		    // short read before EOF: finish synchronously
+		    complete_read(s, _fd);
+		s.state = S_DONE;
+		--_inflight;
+	    }
+	    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+	    return;
+	} else if (!wait)
+	    return;
+	else if (syscall(__NR_io_uring_enter, _ring_fd, 0, 1, IORING_ENTER_GETEVENTS, (void *) 0, 0) < 0
+		 && errno != EINTR) {
+	    // give up on the ring: fail every outstanding read
+	    for (int i = 0; i < _depth; i++)
+		if (_slot[i].state == S_QUEUED) {
+		    _slot[i].result = -errno;
+		    _slot[i].state = S_DONE;
+		}
+	    _inflight = 0;
+	    return;
+	}
+    }
+}
+#endif
+
+int
+FromFile::Readahead::start(off_t off, ErrorHandler *errh)
+{
+    struct stat statbuf;
+    if (fstat(_fd, &statbuf) < 0)
+	return errh->error("stat: %s", strerror(errno));
+    _file_size = statbuf.st_size;
+    _next_off = off;
+
+#if FROMFILE_IO_URING
+    if (setup_ring()) {
+	fill();
+	return 0;
+    }
+#endif
+    if (int e = pthread_create(&_thread, 0, thread_main, this))
+	return errh->error("pthread_create: %s", strerror(e));
+    _have_thread = true;
+    fill();
+    return 0;
+}
+
+WritablePacket *
+FromFile::Readahead::make_buffer()
+{
+    if (_free.size()) {
+	WritablePacket *p = _free.back();
+	_free.pop_back();
+	return p;
+    }
+    void *buf;
+    if (posix_memalign(&buf, ALIGN, UNIT) != 0)
+	return 0;
+    WritablePacket *p = Packet::make(reinterpret_cast<unsigned char *>(buf), UNIT, free_destructor);
+    if (!p)
+	free(buf);
+    return p;
+}
+
+void
+FromFile::Readahead::complete_read(Slot &s, int fd)
+{
+    // pread until the buffer is full or EOF
+    size_t pos = (s.result > 0 ? s.result : 0);
+    while (pos < s.iov.iov_len) {
+	ssize_t r = pread(fd, reinterpret_cast<char *>(s.iov.iov_base) + pos, s.iov.iov_len - pos, s.off + pos);
+	if (r > 0)
+	    pos += r;
+	else if (r == 0)
+	    break;
+	else if (errno != EINTR && errno != EAGAIN) {
+	    s.result = -errno;
+	    return;
+	}
+    }
+    s.result = pos;
+}
+
+void
+FromFile::Readahead::submit(Slot &s)
+{
+    s.iov.iov_base = s.p->data();
+    s.iov.iov_len = UNIT;
+    s.off = _next_off;
+    s.result = 0;
+    s.state = S_QUEUED;
+    _next_off += UNIT;
+    ++_inflight;
+#if FROMFILE_IO_URING
+    if (_ring_fd >= 0) {
+	unsigned tail = *_sq_tail;
+	unsigned idx = tail & *_sq_mask;
+	struct io_uring_sqe *sqe = &_sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = _fd;
+	sqe->addr = reinterpret_cast<uintptr_t>(&s.iov);
+	sqe->len = 1;
+	sqe->off = s.off;
+	sqe->user_data = &s - _slot;
+	_sq_array[idx] = idx;
+	__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+void
+FromFile::Readahead::fill()
+{
+    // submit reads into empty slots, in ring order starting from _head
+    int nsubmit = 0;
+    if (_have_thread)
+	pthread_mutex_lock(&_lock);
+    for (int i = 0; i < _depth; i++) {
+	Slot &s = _slot[(_head + i) % _depth];
+	if (s.state != S_EMPTY)
+	    continue;
+	if (_next_off >= _file_size) {
+	    s.state = S_EOF;
+	    continue;
+	}
+	if (!s.p && !(s.p = make_buffer()))
+	    break;
+	submit(s);
+	++nsubmit;
+    }
+    if (_have_thread) {
+	if (nsubmit)
+	    pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+    }
+#if FROMFILE_IO_URING
+    while (nsubmit && _ring_fd >= 0) {
+	int r = syscall(__NR_io_uring_enter, _ring_fd, nsubmit, 0, 0, (void *) 0, 0);
+	if (r > 0)
+	    nsubmit -= r;
+	else if (r < 0 && errno != EINTR && errno != EAGAIN)
+	    break;
+    }
+#endif
+}
+
+void *
+FromFile::Readahead::thread_main(void *arg)
+{
+    Readahead *ra = reinterpret_cast<Readahead *>(arg);
+    pthread_mutex_lock(&ra->_lock);
+    while (!ra->_stopping) {
+	// service the queued read with the lowest file offset first
+	Slot *s = 0;
+	for (int i = 0; i < ra->_depth; i++) {
+	    Slot &x = ra->_slot[i];
+	    if (x.state == S_QUEUED && (!s || x.off < s->off))
+		s = &x;
+	}
+	if (!s) {
+	    pthread_cond_wait(&ra->_cond, &ra->_lock);
+	    continue;
+	}
+	s->state = S_READING;
+	pthread_mutex_unlock(&ra->_lock);
+	complete_read(*s, ra->_fd);
+	pthread_mutex_lock(&ra->_lock);
+	s->state = S_DONE;
+	--ra->_inflight;
+	pthread_cond_broadcast(&ra->_cond);
+    }
+    pthread_mutex_unlock(&ra->_lock);
+    return 0;
+}
+
+WritablePacket *
+FromFile::Readahead::next(off_t &off, int &len)
+{
+    fill();
+    Slot &s = _slot[_head];
+#if FROMFILE_IO_URING
+    if (_ring_fd >= 0)
+	while (s.state == S_QUEUED)
+	    reap_ring(true);
+    else
+#endif
+    {
+	pthread_mutex_lock(&_lock);
+	while (s.state == S_QUEUED || s.state == S_READING)
+	    pthread_cond_wait(&_cond, &_lock);
+	pthread_mutex_unlock(&_lock);
+    }
+
+    if (s.state != S_DONE) {
+	// S_EMPTY means fill() could not allocate a buffer
+	len = (s.state == S_EOF ? 0 : -ENOMEM);
+	return 0;
+    }
+    WritablePacket *p = s.p;
+    off = s.off;
+    len = s.result;
+    s.p = 0;
+    s.state = S_EMPTY;
+    _head = (_head + 1) % _depth;
+    if (len <= 0) {
+	release(p);
+	return 0;
+    }
+    return p;
+}
+
+void
+FromFile::Readahead::release(Packet *p)
+{
+    // recycle the buffer if no clone still refers to it
+    if (p && !p->shared() && _free.size() < _depth)
+	_free.push_back(static_cast<WritablePacket *>(p));
+    else if (p)
+	p->kill();
+}
+
+void
+FromFile::Readahead::wait_all()
+{
+#if FROMFILE_IO_URING
+    if (_ring_fd >= 0) {
+	while (_inflight > 0)
+	    reap_ring(true);
+	return;
+    }
+#endif
+    pthread_mutex_lock(&_lock);
+    while (_inflight > 0)
+	pthread_cond_wait(&_cond, &_lock);
+    pthread_mutex_unlock(&_lock);
+}
+
+void
+FromFile::Readahead::restart(off_t off)
+{
+    wait_all();
+    for (int i = 0; i < _depth; i++)
+	_slot[i].state = S_EMPTY;
+    _head = 0;
+    _next_off = off;
+}
+
+// CODECS FOR IN-PROCESS DECOMPRESSION
+
+namespace {
+
+/* An IndexPoint marks a place where decompression can restart: uoff bytes
+ * into the decompressed data, at compressed offset coff.  Restarting inside
+ * a gzip member also needs the last 32KB of output (the window) and a few
+ * bits of the byte before coff. */
+struct IndexPoint {
+    uint64_t uoff;
+    uint64_t coff;
+    int bits;
+    uint32_t window_len;
+    unsigned char *window;
+};
+
+/* A Codec decompresses one region of compressed data.  The region may hold
+ * several concatenated streams (gzip members, bzip2 streams, xz streams, zstd
+ * frames); the codec decodes them back to back, as zcat does. */
+class Codec { public:
+
+    Codec()
+	: _error(0) {
+    }
+    virtual ~Codec() {
+    }
+
+    // Decompress from [in, in + inlen) into [out, out + outlen), advancing
+    // all four.  Return 1 if the output buffer filled, 0 if the input ended
+    // at a stream boundary, and -1 on error (see error()).
+    virtual int decode(const unsigned char *&in, size_t &inlen,
+		       unsigned char *&out, size_t &outlen) = 0;
+
+    // Record a restart point in *points about every span bytes of output.
+    // Offsets are relative to the start of this codec's output and to data.
+    virtual void set_index(const unsigned char *data, uint64_t span,
+			   Vector<IndexPoint> *points) {
+	(void) data, (void) span, (void) points;
+    }
+
+    // Prepare to decode from p, whose state was recorded by set_index().
+    // Codecs without restart state can only restart at stream boundaries.
+    virtual bool restart(const unsigned char *data, const IndexPoint &p) {
+	(void) data;
+	return !p.bits && !p.window;
+    }
+
+    const char *error() const {
+	return _error;
+    }
+
+  protected:
+
+    const char *_error;
+
+    int fail(const char *error) {
+	_error = error;
+	return -1;
+    }
+
+};
+
+/* A CodecType matches a compressed file's magic number, creates codecs,
+ * and optionally finds independently decodable regions.  split(data, pos,
+ * size, want) returns the end of a region starting at pos, preferably at
+ * least want, or 0 if it cannot tell.  Speculative splits might be wrong;
+ * the decompressor then falls back to serial decoding. */
+struct CodecType {
+    const char *name;
+    bool (*match)(const unsigned char *, int);
+    size_t (*split)(const unsigned char *, size_t, size_t, size_t);
+    bool speculative;
+    Codec *(*make)(int nthreads);
+};
+
+inline size_t
+min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+#if HAVE_ZLIB
+class GzipCodec : public Codec { public:
+
+    GzipCodec()
+	: _between(true), _raw(false), _data(0), _span(0), _points(0),
+	  _out_total(0), _last_point(0) {
+	memset(&_z, 0, sizeof(_z));
+	_ok = inflateInit2(&_z, 15 + 16) == Z_OK;
+    }
+    ~GzipCodec() {
+	if (_ok)
+	    inflateEnd(&_z);
+    }
+
+    void set_index(const unsigned char *data, uint64_t span,
+		   Vector<IndexPoint> *points) {
+	_data = data;
+	_span = span;
+	_points = points;
+    }
+
+    bool restart(const unsigned char *data, const IndexPoint &p) {
+	if (!p.bits && !p.window)
+	    return true;
+	// like zran.c: raw inflate from a block boundary, primed with the
+	// leftover bits and the window
+	if (!_ok || inflateReset2(&_z, -15) != Z_OK
+	    || (p.bits && inflatePrime(&_z, p.bits, data[p.coff - 1] >> (8 - p.bits)) != Z_OK)
+	    || (p.window_len && inflateSetDictionary(&_z, p.window, p.window_len) != Z_OK))
+	    return false;
+	_between = false;
+	_raw = true;
+	return true;
+    }
+
+    int decode(const unsigned char *&in, size_t &inlen,
+	       unsigned char *&out, size_t &outlen) {
+	if (!_ok)
+	    return fail("zlib initialization failed");
+	while (1) {
+	    if (_between) {
+		// like gzip, ignore trailing garbage after the last member
+		if (inlen < 2 || in[0] != 037 || in[1] != 0213) {
+		    in += inlen;
+		    inlen = 0;
+		    return 0;
+		}
+		inflateReset(&_z);
+		_between = false;
+	    }
+	    if (!outlen)
+		return 1;
+	    _z.next_in = const_cast<Bytef *>(in);
+	    _z.avail_in = min_size(inlen, 1U << 30);
+	    _z.next_out = out;
+	    _z.avail_out = min_size(outlen, 1U << 30);
+	    uInt avail_in = _z.avail_in, avail_out = _z.avail_out;
+	    // Z_BLOCK stops at deflate block boundaries, where restart
+	    // points can go
+	    int r = inflate(&_z, _points ? Z_BLOCK : Z_NO_FLUSH);
+	    in += avail_in - _z.avail_in;
+	    inlen -= avail_in - _z.avail_in;
+	    out += avail_out - _z.avail_out;
+	    outlen -= avail_out - _z.avail_out;
+	    _out_total += avail_out - _z.avail_out;
+	    if (r == Z_STREAM_END && _raw) {
+		// skip the member trailer (CRC and length) and resume
+		// parsing gzip headers
+		size_t trailer = min_size(inlen, 8);
+		in += trailer;
+		inlen -= trailer;
+		_raw = false;
+		if (inflateReset2(&_z, 15 + 16) != Z_OK)
+		    return fail("zlib initialization failed");
+		_between = true;
+	    } else if (r == Z_STREAM_END)
+		_between = true;
+	    else if (r == Z_BUF_ERROR && outlen && !inlen)
+		return fail("compressed data truncated");
+	    else if (r != Z_OK && r != Z_BUF_ERROR)
+		return fail(_z.msg ? _z.msg : "gzip data error");
+	    else if (_points && (_z.data_type & 128) && !(_z.data_type & 64)
+		     && _out_total - _last_point >= _span)
+		add_point(in);
+	}
+    }
+
+  private:
+
+    z_stream _z;
+    bool _ok;
+    bool _between;
+    bool _raw;
+    const unsigned char *_data;
+    uint64_t _span;
+    Vector<IndexPoint> *_points;
+    uint64_t _out_total;
+    uint64_t _last_point;
+
+    void add_point(const unsigned char *in) {
+	IndexPoint p;
+	p.uoff = _out_total;
+	p.coff = in - _data;
+	p.bits = _z.data_type & 7;
+	p.window = reinterpret_cast<unsigned char *>(malloc(32768));
+	uInt len = 32768;
+	if (!p.window || inflateGetDictionary(&_z, p.window, &len) != Z_OK) {
+	    free(p.window);
+	    return;
+	}
+	p.window_len = len;
+	_points->push_back(p);
+	_last_point = _out_total;
+    }
+
+};
+
+bool
+gzip_match(const unsigned char *buf, int len)
+{
+    return len >= 3 && buf[0] == 037 && buf[1] == 0213 && buf[2] == 8;
+}
+
+size_t
+gzip_split(const unsigned char *data, size_t pos, size_t size, size_t want)
+{
+    // BGZF members (bgzip, samtools) record their compressed length in a
+    // "BC" extra subfield; other gzip files must be decoded serially
+    size_t start = pos;
+    while (pos < want && pos < size) {
+	const unsigned char *h = data + pos;
+	size_t blen = 0;
+	if (size - pos >= 18 && h[0] == 037 && h[1] == 0213 && h[2] == 8
+	    && (h[3] & 4)) {
+	    const unsigned char *x = h + 12;
+	    const unsigned char *xend = x + (h[10] | (h[11] << 8));
+	    if (xend > data + size)
+		xend = x;
+	    for (; x + 4 <= xend; x += 4 + (x[2] | (x[3] << 8)))
+		if (x[0] == 'B' && x[1] == 'C' && x[2] == 2 && x[3] == 0
+		    && x + 6 <= xend) {
+		    blen = (x[4] | (x[5] << 8)) + 1;
+		    break;
+		}
+	}
+	if (!blen || blen > size - pos)
+	    break;
+	pos += blen;
+    }
+    return pos > start ? pos : 0;
+}
+
+Codec *
+gzip_make(int)
+{
+    return new GzipCodec;
+}
+#endif
+
+#if HAVE_BZLIB
+class Bzip2Codec : public Codec { public:
+
+    Bzip2Codec()
+	: _between(true), _ok(false) {
+	memset(&_bz, 0, sizeof(_bz));
+    }
+    ~Bzip2Codec() {
+	if (_ok)
+	    BZ2_bzDecompressEnd(&_bz);
+    }
+
+    int decode(const unsigned char *&in, size_t &inlen,
+	       unsigned char *&out, size_t &outlen) {
+	while (1) {
+	    if (_between) {
+		if (inlen < 4 || memcmp(in, "BZh", 3) != 0) {
+		    in += inlen;
+		    inlen = 0;
+		    return 0;
+		}
+		if (_ok)
+		    BZ2_bzDecompressEnd(&_bz);
+		if (!(_ok = BZ2_bzDecompressInit(&_bz, 0, 0) == BZ_OK))
+		    return fail("bzip2 initialization failed");
+		_between = false;
+	    }
+	    if (!outlen)
+		return 1;
+	    _bz.next_in = reinterpret_cast<char *>(const_cast<unsigned char *>(in));
+	    _bz.avail_in = min_size(inlen, 1U << 30);
+	    _bz.next_out = reinterpret_cast<char *>(out);
+	    _bz.avail_out = min_size(outlen, 1U << 30);
+	    unsigned avail_in = _bz.avail_in, avail_out = _bz.avail_out;
+	    int r = BZ2_bzDecompress(&_bz);
+	    in += avail_in - _bz.avail_in;
+	    inlen -= avail_in - _bz.avail_in;
+	    out += avail_out - _bz.avail_out;
+	    outlen -= avail_out - _bz.avail_out;
+	    if (r == BZ_STREAM_END)
+		_between = true;
+	    else if (r != BZ_OK)
+		return fail("bzip2 data error");
+	    else if (outlen && !inlen)
+		return fail("compressed data truncated");
+	}
+    }
+
+  private:
+
+    bz_stream _bz;
+    bool _between;
+    bool _ok;
+
+};
+
+bool
+bzip2_match(const unsigned char *buf, int len)
+{
+    return len >= 4 && buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h'
+	&& buf[3] >= '1' && buf[3] <= '9';
+}
+
+size_t
+bzip2_split(const unsigned char *data, size_t pos, size_t size, size_t want)
+{
+    // pbzip2 and lbzip2 write concatenated streams, each starting with
+    // "BZh[1-9]1AY&SY".  That pattern might also occur by accident inside
+    // compressed data, so these splits are speculative.
+    if (want <= pos)
+	want = pos + 1;
+    const unsigned char *s = data + want, *end = data + size;
+    while (end - s >= 10
+	   && (s = reinterpret_cast<const unsigned char *>(memchr(s, 'B', end - s - 9))))
+	if (s[1] == 'Z' && s[2] == 'h' && s[3] >= '1' && s[3] <= '9'
+	    && memcmp(s + 4, "1AY&SY", 6) == 0)
+	    return s - data;
+	else
+	    ++s;
+    return 0;
+}
+
+Codec *
+bzip2_make(int)
+{
+    return new Bzip2Codec;
+}
+#endif
+
+#if HAVE_LZMA
+class XzCodec : public Codec { public:
+
+    XzCodec(int nthreads) {
+	lzma_stream init = LZMA_STREAM_INIT;
+	_s = init;
+	lzma_ret r;
+# if LZMA_VERSION >= 50040002U
+	// liblzma decodes multi-block files in parallel itself
+	lzma_mt mt;
+	memset(&mt, 0, sizeof(mt));
+	mt.flags = LZMA_CONCATENATED;
+	mt.threads = nthreads;
+	mt.memlimit_threading = lzma_physmem() / 4;
+	mt.memlimit_stop = UINT64_MAX;
+	r = lzma_stream_decoder_mt(&_s, &mt);
+# else
+	(void) nthreads;
+	r = lzma_stream_decoder(&_s, UINT64_MAX, LZMA_CONCATENATED);
+# endif
+	_ok = r == LZMA_OK;
+    }
+    ~XzCodec() {
+	lzma_end(&_s);
+    }
+
+    int decode(const unsigned char *&in, size_t &inlen,
+	       unsigned char *&out, size_t &outlen) {
+	if (!_ok)
+	    return fail("liblzma initialization failed");
+	while (outlen) {
+	    _s.next_in = in;
+	    _s.avail_in = inlen;
+	    _s.next_out = out;
+	    _s.avail_out = outlen;
+	    // all input is present up front, so always finish
+	    lzma_ret r = lzma_code(&_s, LZMA_FINISH);
+	    in += inlen - _s.avail_in;
+	    inlen = _s.avail_in;
+	    out += outlen - _s.avail_out;
+	    outlen = _s.avail_out;
+	    if (r == LZMA_STREAM_END)
+		return 0;
+	    else if (r == LZMA_BUF_ERROR)
+		return fail("compressed data truncated");
+	    else if (r == LZMA_MEM_ERROR || r == LZMA_MEMLIMIT_ERROR)
+		return fail("out of memory");
+	    else if (r != LZMA_OK)
+		return fail("xz data error");
+	}
+	return 1;
+    }
+
+  private:
+
+    lzma_stream _s;
+    bool _ok;
+
+};
+
+bool
+xz_match(const unsigned char *buf, int len)
+{
+    return len >= 6 && memcmp(buf, "\3757zXZ\0", 6) == 0;
+}
+
+Codec *
+xz_make(int nthreads)
+{
+    return new XzCodec(nthreads);
+}
+#endif
+
+#if HAVE_ZSTD
+class ZstdCodec : public Codec { public:
+
+    ZstdCodec()
+	: _d(ZSTD_createDStream()) {
+	if (_d)
+	    ZSTD_initDStream(_d);
+    }
+    ~ZstdCodec() {
+	ZSTD_freeDStream(_d);
+    }
+
+    int decode(const unsigned char *&in, size_t &inlen,
+	       unsigned char *&out, size_t &outlen) {
+	if (!_d)
+	    return fail("zstd initialization failed");
+	while (1) {
+	    ZSTD_inBuffer ib = { in, inlen, 0 };
+	    ZSTD_outBuffer ob = { out, outlen, 0 };
+	    size_t r = ZSTD_decompressStream(_d, &ob, &ib);
+	    if (ZSTD_isError(r))
+		return fail(ZSTD_getErrorName(r));
+	    in += ib.pos;
+	    inlen -= ib.pos;
+	    out += ob.pos;
+	    outlen -= ob.pos;
+	    if (r == 0 && !inlen)
+		return 0;
+	    else if (!outlen)
+		return 1;
+	    else if (!inlen)
+		return fail("compressed data truncated");
+	}
+    }
+
+  private:
+
+    ZSTD_DStream *_d;
+
+};
+
+bool
+zstd_match(const unsigned char *buf, int len)
+{
+    return len >= 4 && memcmp(buf, "\050\265\057\375", 4) == 0;
+}
+
+size_t
+zstd_split(const unsigned char *data, size_t pos, size_t size, size_t want)
+{
+    // zstd frames are independent and self-delimiting
+    size_t start = pos;
+    while (pos < want && pos < size) {
+	size_t flen = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+	if (ZSTD_isError(flen))
+	    break;
+	pos += flen;
+    }
+    return pos > start ? pos : 0;
+}
+
+Codec *
+zstd_make(int)
+{
+    return new ZstdCodec;
+}
+#endif
+
+const CodecType codec_types[] = {
+#if HAVE_ZLIB
+    { "gzip", gzip_match, gzip_split, false, gzip_make },
+#endif
+#if HAVE_BZLIB
+    { "bzip2", bzip2_match, bzip2_split, true, bzip2_make },
+#endif
+#if HAVE_LZMA
+    { "xz", xz_match, 0, false, xz_make },
+#endif
+#if HAVE_ZSTD
+    { "zstd", zstd_match, zstd_split, false, zstd_make },
+#endif
+    { 0, 0, 0, false, 0 }
+};
+
+}
+
+
+/** @class FromFile::Decompressor
+ * @brief In-process, parallel decompression of a compressed file.
+ *
+ * The compressed file is mapped into memory and divided into regions that
+ * can be decoded independently, where the format allows it (BGZF members,
+ * concatenated bzip2 streams, zstd frames).  Worker threads decode regions
+ * concurrently into 1MB chunks, which are consumed in file order.  Formats
+ * that cannot be divided are decoded by one worker running ahead of the
+ * reader, much like a zcat process would.
+ *
+ * When building an index, the decompressor collects restart points: region
+ * starts, which are stream boundaries, and whatever points the codec
+ * records inside streams.  restart() resumes decompression at such a
+ * point. */
+class FromFile::Decompressor { public:
+
+    enum { UNIT = 1048576, REGION = 1048576, MAX_CHUNKS = 4 };
+
+    static const CodecType *find_type(const unsigned char *buf, int len);
+
+    Decompressor(const CodecType *type, int nthreads, uint64_t span);
+    ~Decompressor();
+
+    int start(int fd, ErrorHandler *errh);
+    unsigned char *next(size_t &len, const char *&error);
+    void restart(const IndexPoint &p);	// takes ownership of p.window
+    void take_points(Vector<IndexPoint> &points);
+
+    off_t compressed_pos() const {
+	return _cpos;
+    }
+
+    static void free_destructor(unsigned char *buf, size_t, void *);
+
+  private:
+
+    struct Chunk {
+	unsigned char *data;
+	size_t len;
+	size_t cpos;
+	Chunk *next;
+    };
+
+    struct Region {
+	size_t coff;
+	size_t cend;
+	size_t skip;		// discard this much output first
+	size_t delivered;
+	bool start;		// restart from _start
+	Vector<IndexPoint> points;
+	Chunk *head;
+	Chunk **tail;
+	int nchunks;
+	bool done;
+	bool cancelled;
+	const char *error;
+	Region *next;
+    };
+
+    const CodecType *_type;
+    int _nthreads;
+    const unsigned char *_data;
+    size_t _size;
+    off_t _cpos;
+    uint64_t _uoff;
+
+    uint64_t _span;		// 0 unless collecting restart points
+    uint64_t _next_point;
+    Vector<IndexPoint> _points;
+    IndexPoint _start;
+    bool _start_pending;
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    Vector<pthread_t> _threads;
+    Region *_head;
+    Region **_tail;
+    int _nregions;
+    int _busy;
+    size_t _split_pos;
+    size_t _skip;
+    bool _splitting;
+    bool _restarting;
+    bool _stopping;
+
+    size_t split(size_t pos) const;
+    void decode(Region *r);
+    void free_region(Region *r);
+    void collect_points(Region *r);
+    static void *thread_main(void *);
+
+};
+
+const CodecType *
+FromFile::Decompressor::find_type(const unsigned char *buf, int len)
+{
+    for (const CodecType *t = codec_types; t->name; ++t)
+	if (t->match(buf, len))
+	    return t;
+    return 0;
+}
+
+void
+FromFile::Decompressor::free_destructor(unsigned char *buf, size_t, void *)
+{
+    free(buf);
+}
+
+FromFile::Decompressor::Decompressor(const CodecType *type, int nthreads,
+				     uint64_t span)
+    : _type(type), _nthreads(nthreads), _data(0), _size(0), _cpos(0),
+      _uoff(0), _span(span), _next_point(0), _start_pending(false),
+      _head(0), _tail(&_head), _nregions(0), _busy(0), _split_pos(0),
+      _skip(0), _splitting(type->split != 0), _restarting(false),
+      _stopping(false)
+{
+    memset(&_start, 0, sizeof(_start));
+    pthread_mutex_init(&_lock, 0);
+    pthread_cond_init(&_cond, 0);
+}
+
+FromFile::Decompressor::~Decompressor()
+{
+    pthread_mutex_lock(&_lock);
+    _stopping = true;
+    for (Region *r = _head; r; r = r->next)
+	r->cancelled = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_lock);
+    for (int i = 0; i < _threads.size(); i++)
+	pthread_join(_threads[i], 0);
+    while (Region *r = _head) {
+	_head = r->next;
+	free_region(r);
+    }
+    for (int i = 0; i < _points.size(); i++)
+	free(_points[i].window);
+    free(_start.window);
+#ifdef ALLOW_MMAP
+    if (_data)
+	munmap(const_cast<unsigned char *>(_data), _size);
+#endif
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_cond);
+}
+
+int
+FromFile::Decompressor::start(int fd, ErrorHandler *errh)
+{
+#ifdef ALLOW_MMAP
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) < 0)
+	return errh->error("stat: %s", strerror(errno));
+    _size = statbuf.st_size;
+    void *data = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+	return errh->error("mmap: %s", strerror(errno));
+    _data = reinterpret_cast<const unsigned char *>(data);
+# ifdef HAVE_MADVISE
+    (void) madvise((caddr_t) data, _size, MADV_SEQUENTIAL);
+# endif
+#else
+    (void) fd;
+    return errh->error("mmap not supported");
+#endif
+
+    // only divisible formats can use more than one worker
+    int nworkers = _type->split ? _nthreads : 1;
+    for (int i = 0; i < nworkers; i++) {
+	pthread_t t;
+	if (pthread_create(&t, 0, thread_main, this) != 0)
+	    break;
+	_threads.push_back(t);
+    }
+    if (!_threads.size())
+	return errh->error("pthread_create: %s", strerror(errno));
+    return 0;
+}
+
+size_t
+FromFile::Decompressor::split(size_t pos) const
+{
+    if (!_splitting)
+	return _size;
+    size_t end = _type->split(_data, pos, _size, pos + REGION);
+    return end > pos && end < _size ? end : _size;
+}
+
+void
+FromFile::Decompressor::free_region(Region *r)
+{
+    while (Chunk *c = r->head) {
+	r->head = c->next;
+	free(c->data);
+	delete c;
+    }
+    for (int i = 0; i < r->points.size(); i++)
+	free(r->points[i].window);
+    delete r;
+}
+
+void *
+FromFile::Decompressor::thread_main(void *arg)
+{
+    Decompressor *d = static_cast<Decompressor *>(arg);
+    pthread_mutex_lock(&d->_lock);
+    while (1) {
+	while (!d->_stopping
+	       && (d->_restarting || d->_split_pos >= d->_size
+		   || d->_nregions >= 2 * d->_nthreads))
+	    pthread_cond_wait(&d->_cond, &d->_lock);
+	if (d->_stopping)
+	    break;
+
+	// claim the next region
+	Region *r = new Region;
+	r->coff = d->_split_pos;
+	r->start = d->_start_pending;
+	// a region that starts inside a stream must run to the end
+	r->cend = r->start ? d->_size : d->split(r->coff);
+	r->skip = d->_skip;
+	r->delivered = 0;
+	r->head = 0;
+	r->tail = &r->head;
+	r->nchunks = 0;
+	r->done = r->cancelled = false;
+	r->error = 0;
+	r->next = 0;
+	*d->_tail = r;
+	d->_tail = &r->next;
+	d->_split_pos = r->cend;
+	d->_skip = 0;
+	d->_start_pending = false;
+	++d->_nregions;
+	++d->_busy;
+
+	pthread_mutex_unlock(&d->_lock);
+	d->decode(r);
+	pthread_mutex_lock(&d->_lock);
+
+	--d->_busy;
+	pthread_cond_broadcast(&d->_cond);
+    }
+    pthread_mutex_unlock(&d->_lock);
+    return 0;
+}
+
+void
+FromFile::Decompressor::decode(Region *r)
+{
+    Codec *codec = _type->make(_nthreads);
+    const unsigned char *in = _data + r->coff;
+    size_t inlen = r->cend - r->coff;
+    size_t skip = r->skip;
+    int result;
+
+    // r->points is private to this thread until r->done is set
+    if (_span && !r->start)
+	codec->set_index(_data, _span, &r->points);
+    if (r->start && !codec->restart(_data, _start)) {
+	pthread_mutex_lock(&_lock);
+	r->error = "cannot restart decompression";
+	r->done = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+	delete codec;
+	return;
+    }
+
+    do {
+	unsigned char *buf = reinterpret_cast<unsigned char *>(malloc(UNIT));
+	if (!buf) {
+	    result = -1;
+	    pthread_mutex_lock(&_lock);
+	    r->error = "out of memory";
+	    r->done = true;
+	    pthread_cond_broadcast(&_cond);
+	    pthread_mutex_unlock(&_lock);
+	    break;
+	}
+	unsigned char *out = buf;
+	size_t outlen = UNIT;
+	result = codec->decode(in, inlen, out, outlen);
+
+	size_t len = out - buf;
+	if (skip >= len) {
+	    skip -= len;
+	    len = 0;
+	} else if (skip) {
+	    memmove(buf, buf + skip, len - skip);
+	    len -= skip;
+	    skip = 0;
+	}
+
+	pthread_mutex_lock(&_lock);
+	if (len && !r->cancelled) {
+	    Chunk *c = new Chunk;
+	    c->data = buf;
+	    c->len = len;
+	    c->cpos = in - _data;
+	    c->next = 0;
+	    *r->tail = c;
+	    r->tail = &c->next;
+	    ++r->nchunks;
+	} else
+	    free(buf);
+	while (result > 0 && r->nchunks >= MAX_CHUNKS && !r->cancelled)
+	    pthread_cond_wait(&_cond, &_lock);
+	if (r->cancelled)
+	    result = 0;
+	if (result <= 0) {
+	    r->done = true;
+	    if (result < 0)
+		r->error = codec->error() ? codec->error() : "decompression error";
+	}
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+    } while (result > 0);
+
+    delete codec;
+}
+
+unsigned char *
+FromFile::Decompressor::next(size_t &len, const char *&error)
+{
+    unsigned char *data = 0;
+    len = 0;
+    error = 0;
+    pthread_mutex_lock(&_lock);
+    while (1) {
+	Region *r = _head;
+	if (!r) {
+	    if (_split_pos >= _size || _threads.empty())
+		break;
+	    pthread_cond_wait(&_cond, &_lock);
+	} else if (Chunk *c = r->head) {
+	    if (!(r->head = c->next))
+		r->tail = &r->head;
+	    --r->nchunks;
+	    r->delivered += c->len;
+	    data = c->data;
+	    len = c->len;
+	    _cpos = c->cpos;
+	    _uoff += c->len;
+	    delete c;
+	    pthread_cond_broadcast(&_cond);
+	    break;
+	} else if (!r->done)
+	    pthread_cond_wait(&_cond, &_lock);
+	else if (r->error && _splitting && _type->speculative) {
+	    // a speculative split was wrong: cancel later regions, then
+	    // decode the rest of the file serially, skipping output that
+	    // was already delivered
+	    _restarting = true;
+	    for (Region *rr = r->next; rr; rr = rr->next)
+		rr->cancelled = true;
+	    pthread_cond_broadcast(&_cond);
+	    while (_busy)
+		pthread_cond_wait(&_cond, &_lock);
+	    _split_pos = r->coff;
+	    _skip = r->delivered;
+	    while ((r = _head)) {
+		_head = r->next;
+		free_region(r);
+	    }
+	    _tail = &_head;
+	    _nregions = 0;
+	    _splitting = false;
+	    _restarting = false;
+	    pthread_cond_broadcast(&_cond);
+	} else if (r->error) {
+	    error = r->error;
+	    break;
+	} else {
+	    if (_span)
+		collect_points(r);
+	    if (!(_head = r->next))
+		_tail = &_head;
+	    --_nregions;
+	    free_region(r);
+	    pthread_cond_broadcast(&_cond);
+	}
+    }
+    pthread_mutex_unlock(&_lock);
+    return data;
+}
+
+void
+FromFile::Decompressor::collect_points(Region *r)
+{
+    // the region's output started at ubase; its start is a stream
+    // boundary, and the codec's points are relative to it
+    uint64_t ubase = _uoff - r->delivered - r->skip;
+    IndexPoint rp;
+    memset(&rp, 0, sizeof(rp));
+    rp.uoff = ubase;
+    rp.coff = r->coff;
+    for (int i = -1; i < r->points.size(); i++) {
+	IndexPoint &p = (i < 0 ? rp : r->points[i]);
+	if (i >= 0)
+	    p.uoff += ubase;
+	if (p.uoff >= _next_point) {
+	    _points.push_back(p);
+	    _next_point = p.uoff + _span;
+	} else
+	    free(p.window);
+    }
+    r->points.clear();
+}
+
+void
+FromFile::Decompressor::take_points(Vector<IndexPoint> &points)
+{
+    points.swap(_points);
+    _points.clear();
+}
+
+void
+FromFile::Decompressor::restart(const IndexPoint &p)
+{
+    pthread_mutex_lock(&_lock);
+    _restarting = true;
+    for (Region *r = _head; r; r = r->next)
+	r->cancelled = true;
+    pthread_cond_broadcast(&_cond);
+    while (_busy)
+	pthread_cond_wait(&_cond, &_lock);
+    while (Region *r = _head) {
+	_head = r->next;
+	free_region(r);
+    }
+    _tail = &_head;
+    _nregions = 0;
+
+    // points are only collected on a straight pass through the file
+    for (int i = 0; i < _points.size(); i++)
+	free(_points[i].window);
+    _points.clear();
+    _span = 0;
+
+    free(_start.window);
+    _start = p;
+    _start_pending = p.bits || p.window;
+    _split_pos = p.coff;
+    _skip = 0;
+    _cpos = p.coff;
+    _uoff = p.uoff;
+    _restarting = false;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_lock);
+}
+
+/** @class FromFile::Index
+ * @brief Sidecar index for random access into a trace.
+ *
+ * An index holds decompressor restart points, for compressed files, and
+ * record marks, which map the (uncompressed) file positions of some records
+ * to their timestamps.  It lives next to the trace, in FILENAME.idx by
+ * default, and is stamped with the trace's size and modification time so
+ * that stale indexes can be ignored.
+ *
+ * The file is little-endian: the magic "CLKFFIDX", a 4-byte version, the
+ * 4-byte span, the trace's 8-byte size and 8-byte mtime, then records
+ * tagged 'P' (point), 'M' (mark), and finally 'E'.  Indexes are built in
+ * FILENAME.tmp and renamed into place once complete. */
+class FromFile::Index { public:
+
+    enum { VERSION = 1 };
+
+    Index();
+    ~Index();
+
+    int create(const String &filename, const struct stat &st, uint32_t span,
+	       ErrorHandler *errh);
+    int load(const String &filename, const struct stat &st,
+	     ErrorHandler *errh);
+    void add_point(IndexPoint &p);
+    void add_mark(off_t pos, const Timestamp &ts, const Timestamp &max_before);
+    int finish(ErrorHandler *errh);
+
+    bool find_point(uint64_t uoff, IndexPoint &p) const;
+    bool find_mark(const Timestamp &ts, off_t &pos) const;
+    bool first_timestamp(Timestamp &ts) const;
+
+  private:
+
+    struct Point {
+	uint64_t uoff;
+	uint64_t coff;
+	int bits;
+	uint32_t window_len;
+	long window_pos;	// position of the window in the index file
+    };
+
+    struct Mark {
+	off_t pos;
+	Timestamp ts;
+	Timestamp max_before;	// latest timestamp of any earlier record
+    };
+
+    String _filename;
+    FILE *_f;
+    Vector<Point> _points;
+    Vector<Mark> _marks;
+
+    static void put(StringAccum &sa, uint64_t x, int n);
+    static uint64_t get(const unsigned char *s, int n);
+
+};
+
+FromFile::Index::Index()
+    : _f(0)
+{
+}
+
+FromFile::Index::~Index()
+{
+    if (_f)
+	fclose(_f);
+    if (_filename)
+	unlink((_filename + ".tmp").c_str());
+}
+
+void
+FromFile::Index::put(StringAccum &sa, uint64_t x, int n)
+{
+    for (int i = 0; i < n; ++i, x >>= 8)
+	sa << (char) (x & 255);
+}
+
+uint64_t
+FromFile::Index::get(const unsigned char *s, int n)
+{
+    uint64_t x = 0;
+    while (--n >= 0)
+	x = (x << 8) | s[n];
+    return x;
+}
+
+int
+FromFile::Index::create(const String &filename, const struct stat &st,
+			uint32_t span, ErrorHandler *errh)
+{
+    String tmp = filename + ".tmp";
+    if (!(_f = fopen(tmp.c_str(), "wb")))
+	return errh->error("%s: %s", tmp.c_str(), strerror(errno));
+    _filename = filename;
+    StringAccum sa;
+    sa << "CLKFFIDX";
+    put(sa, VERSION, 4);
+    put(sa, span, 4);
+    put(sa, st.st_size, 8);
+    put(sa, st.st_mtime, 8);
+    fwrite(sa.data(), 1, sa.length(), _f);
+    return 0;
+}
+
+void
+FromFile::Index::add_point(IndexPoint &p)
+{
+    StringAccum sa;
+    sa << 'P';
+    put(sa, p.uoff, 8);
+    put(sa, p.coff, 8);
+    put(sa, p.bits, 1);
+    put(sa, p.window ? p.window_len : 0, 4);
+    if (p.window)
+	sa.append(p.window, p.window_len);
+    fwrite(sa.data(), 1, sa.length(), _f);
+    free(p.window);
+    p.window = 0;
+}
+
+void
+FromFile::Index::add_mark(off_t pos, const Timestamp &ts,
+			  const Timestamp &max_before)
+{
+    StringAccum sa;
+    sa << 'M';
+    put(sa, pos, 8);
+    put(sa, ts.sec(), 8);
+    put(sa, ts.nsec(), 4);
+    put(sa, max_before.sec(), 8);
+    put(sa, max_before.nsec(), 4);
+    fwrite(sa.data(), 1, sa.length(), _f);
+}
+
+int
+FromFile::Index::finish(ErrorHandler *errh)
+{
+    String tmp = _filename + ".tmp";
+    fputc('E', _f);
+    bool ok = !ferror(_f);
+    ok = (fclose(_f) == 0) && ok;
+    _f = 0;
+    if (ok && rename(tmp.c_str(), _filename.c_str()) == 0) {
+	_filename = String();
+	return 0;
+    }
+    return errh->error("%s: %s", (ok ? _filename : tmp).c_str(),
+		       strerror(errno));
+}
+
+int
+FromFile::Index::load(const String &filename, const struct stat &st,
+		      ErrorHandler *errh)
+{
+    if (!(_f = fopen(filename.c_str(), "rb")))
+	return -errno;
+    unsigned char buf[40];
+    if (fread(buf, 1, 32, _f) != 32 || memcmp(buf, "CLKFFIDX", 8) != 0
+	|| get(buf + 8, 4) != VERSION) {
+	errh->warning("%s: not an index, ignoring it", filename.c_str());
+	return -EINVAL;
+    }
+    if ((off_t) get(buf + 16, 8) != st.st_size
+	|| (int64_t) get(buf + 24, 8) != (int64_t) st.st_mtime) {
+	errh->warning("%s: index is out of date, ignoring it", filename.c_str());
+	return -EINVAL;
+    }
+
+    int c;
+    while ((c = fgetc(_f)) == 'P' || c == 'M')
+	if (c == 'P') {
+	    Point p;
+	    if (fread(buf, 1, 21, _f) != 21)
+		break;
+	    p.uoff = get(buf, 8);
+	    p.coff = get(buf + 8, 8);
+	    p.bits = buf[16] & 7;
+	    p.window_len = get(buf + 17, 4);
+	    p.window_pos = ftell(_f);
+	    if (p.window_len > 32768
+		|| fseek(_f, p.window_len, SEEK_CUR) < 0)
+		break;
+	    _points.push_back(p);
+	} else {
+	    Mark m;
+	    if (fread(buf, 1, 32, _f) != 32)
+		break;
+	    m.pos = get(buf, 8);
+	    m.ts = Timestamp::make_nsec(get(buf + 8, 8), get(buf + 16, 4));
+	    m.max_before = Timestamp::make_nsec(get(buf + 20, 8), get(buf + 28, 4));
+	    _marks.push_back(m);
+	}
+    if (c != 'E') {
+	errh->warning("%s: index truncated, ignoring it", filename.c_str());
+	return -EINVAL;
+    }
+    return 0;
+}
+
+bool
+FromFile::Index::find_point(uint64_t uoff, IndexPoint &p) const
+{
+    // last point at or before uoff
+    int l = 0, r = _points.size();
+    while (l < r) {
+	int m = l + (r - l) / 2;
+	if (_points[m].uoff <= uoff)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    if (l == 0)
+	return false;
+    const Point &x = _points[l - 1];
+    p.uoff = x.uoff;
+    p.coff = x.coff;
+    p.bits = x.bits;
+    p.window_len = x.window_len;
+    p.window = 0;
+    if (x.window_len) {
+	p.window = reinterpret_cast<unsigned char *>(malloc(x.window_len));
+	if (!p.window || fseek(_f, x.window_pos, SEEK_SET) < 0
+	    || fread(p.window, 1, x.window_len, _f) != x.window_len) {
+	    free(p.window);
+	    return false;
+	}
+    }
+    return true;
+}
+
+bool
+FromFile::Index::find_mark(const Timestamp &ts, off_t &pos) const
+{
+    // last mark preceded only by records earlier than ts; max_before is
+    // nondecreasing
+    int l = 0, r = _marks.size();
+    while (l < r) {
+	int m = l + (r - l) / 2;
+	if (_marks[m].max_before < ts)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    if (l == 0)
+	return false;
+    pos = _marks[l - 1].pos;
+    return true;
+}
+
+bool
+FromFile::Index::first_timestamp(Timestamp &ts) const
+{
+    if (_marks.empty())
+	return false;
+    ts = _marks[0].ts;
+    return true;
+}
+
+
 FromFile::FromFile()
     : _fd(-1), _buffer(0), _data_packet(0),
 #ifdef ALLOW_MMAP
       _mmap(true),
 #endif
+      _readahead_depth(0), _direct(false), _readahead(0),
+      _decompress(true), _decompress_threads(0), _decompressor(0),
+      _index_build(false), _index_span(4194304), _index(0), _index_next(0),
       _filename(), _pipe(0), _landmark_pattern("%f"), _lineno(0)
 {
 }
@@ -52,8 +1716,21 @@ FromFile::configure_keywords(Vector<String> &conf, Element *e, ErrorHandler *err
 #endif
     if (Args(e, errh).bind(conf)
 	.read("MMAP", mmap)
+	.read("READAHEAD", _readahead_depth)
+	.read("DIRECT", _direct)
+	.read("DECOMPRESS", _decompress)
+	.read("DECOMPRESS_THREADS", _decompress_threads)
+	.read("INDEX", FilenameArg(), _index_filename)
+	.read("BUILD_INDEX", _index_build)
+	.read("INDEX_SPAN", _index_span)
 	.consume() < 0)
 	return -1;
+    if (_index_span < 65536)
+	_index_span = 65536;
+    if (_readahead_depth < 0)
+	_readahead_depth = 0;
+    if (_direct && !_readahead_depth)
+	_readahead_depth = 4;
 #ifdef ALLOW_MMAP
     _mmap = mmap;
 #else
@@ -170,10 +1847,64 @@ FromFile::read_buffer_mmap(ErrorHandler *errh)
 }
 #endif
 
+int
+FromFile::read_buffer_readahead(ErrorHandler *errh)
+{
+    off_t off;
+    int len;
+    _data_packet = _readahead->next(off, len);
+    if (len < 0)
+	return error(errh, strerror(-len));
+    else if (len == 0)
+	return 0;
+    assert(off == _file_offset);
+    _buffer = _data_packet->data();
+    _len = len;
+    return _len;
+}
+
+int
+FromFile::read_buffer_decompress(ErrorHandler *errh)
+{
+    size_t len;
+    const char *err;
+    unsigned char *data = _decompressor->next(len, err);
+    if (_index_build) {
+	Vector<IndexPoint> points;
+	_decompressor->take_points(points);
+	for (IndexPoint *p = points.begin(); p != points.end(); ++p)
+	    _index->add_point(*p);
+    }
+    if (err)
+	return error(errh, "%s", err);
+    else if (!data)
+	return 0;
+    _data_packet = Packet::make(data, len, Decompressor::free_destructor, 0);
+    if (!_data_packet) {
+	free(data);
+	return error(errh, strerror(ENOMEM));
+    }
+    _buffer = _data_packet->data();
+    _len = len;
+    return _len;
+}
+
 int
 FromFile::read_buffer(ErrorHandler *errh)
 {
-    if (_data_packet)
+    int result = fill_buffer(errh);
+    // an index under construction is complete once the whole file is read
+    if (result == 0 && _index_build)
+	(void) write_index(errh);
+    return result;
+}
+
+int
+FromFile::fill_buffer(ErrorHandler *errh)
+{
+    if (_data_packet && _readahead)
+	_readahead->release(_data_packet);
+    else if (_data_packet)
 	_data_packet->kill();
     _data_packet = 0;
 
@@ -185,6 +1916,11 @@ FromFile::read_buffer(ErrorHandler *errh)
     if (_fd < 0)
 	return _fd == -1 ? -EBADF : _len;
 
+    if (_decompressor)
+	return read_buffer_decompress(errh);
+    if (_readahead)
+	return read_buffer_readahead(errh);
+
 #ifdef ALLOW_MMAP
     if (_mmap) {
 	int result = read_buffer_mmap(errh);
@@ -242,6 +1978,13 @@ FromFile::read(void *vdata, uint32_t dlen, ErrorHandler *errh)
 int
 FromFile::read_line(String &result, ErrorHandler *errh, bool temporary)
 {
+    // a seek may have left _pos beyond the current buffer
+    while (_pos >= _len) {
+	int errcode = read_buffer(errh);
+	if (errcode <= 0)
+	    return errcode;
+    }
+
     // first, try to read a line from the current buffer
     const unsigned char *s = _buffer + _pos;
     const unsigned char *e = _buffer + _len;
@@ -315,8 +2058,36 @@ FromFile::peek_line(String &result, ErrorHandler *errh, bool temporary)
 int
 FromFile::seek(off_t want, ErrorHandler* errh)
 {
+    if (_index_build && want != file_pos()) {
+	warning(errh, "seeking, so not building index");
+	delete _index;
+	_index = 0;
+	_index_build = false;
+    }
+
     if (want >= _file_offset && want < (off_t) (_file_offset + _len)) {
-	_pos = want;
+	_pos = want - _file_offset;
+	return 0;
+    }
+
+    if (_decompressor) {
+	// restart decompression at the closest indexed point, or the start
+	// of the file, unless 'want' is reached sooner by reading forward
+	IndexPoint p;
+	if (!_index || !_index->find_point(want, p))
+	    memset(&p, 0, sizeof(p));
+	if (want < _file_offset || (off_t) p.uoff > (off_t) (_file_offset + _len)) {
+	    _decompressor->restart(p);
+	    _file_offset = p.uoff - _len;
+	    _pos = _len;
+	    if (read_buffer(errh) < 0)
+		return -1;
+	} else
+	    free(p.window);
+	while ((off_t) (_file_offset + _len) <= want && _len)
+	    if (read_buffer(errh) < 0)
+		return -1;
+	_pos = want - _file_offset;
 	return 0;
     }
 
@@ -328,6 +2099,16 @@ FromFile::seek(off_t want, ErrorHandler* errh)
     }
 #endif
 
+    if (_readahead) {
+	// restart read-ahead at an aligned offset; read_buffer() will
+	// advance _file_offset to 'start' and _pos to 'want - start'
+	off_t start = want & ~(off_t) (Readahead::ALIGN - 1);
+	_readahead->restart(start);
+	_file_offset = start - _len;
+	_pos = _len + (want - start);
+	return 0;
+    }
+
     if (_fd < 0)
         return _fd == -1 ? -EBADF : 0;
 
@@ -353,6 +2134,91 @@ FromFile::seek(off_t want, ErrorHandler* errh)
     return 0;
 }
 
+/** @brief Return the length of the file's data, or -1 if unknown.
+ *
+ * The length is unknown for pipes and for compressed files, whose
+ * decompressed length is only found by reading them. */
+off_t
+FromFile::file_size() const
+{
+    struct stat s;
+    if (_fd >= 0 && !_pipe && !_decompressor && fstat(_fd, &s) >= 0
+	&& S_ISREG(s.st_mode))
+	return s.st_size;
+    else
+	return -1;
+}
+
+/** @brief Seek to the latest indexed record that may be skipped for @a ts.
+ *
+ * Every record before the chosen position has a timestamp earlier than @a
+ * ts.  Returns 1 if the position changed, 0 if there was no better position
+ * (or no index), and a negative number on error. */
+int
+FromFile::seek_time(const Timestamp &ts, ErrorHandler *errh)
+{
+    off_t pos;
+    if (!has_index() || !_index->find_mark(ts, pos) || pos <= file_pos())
+	return 0;
+    return seek(pos, errh) < 0 ? -1 : 1;
+}
+
+/** @brief Return the first record's timestamp according to the index. */
+bool
+FromFile::index_first_timestamp(Timestamp &ts) const
+{
+    return has_index() && _index->first_timestamp(ts);
+}
+
+void
+FromFile::index_mark(off_t pos, const Timestamp &ts)
+{
+    if (!_index) {		// initialization failed
+	_index_build = false;
+	return;
+    }
+    _index->add_mark(pos, ts, _index_max_ts);
+    _index_next = pos + _index_span;
+}
+
+int
+FromFile::initialize_index(ErrorHandler *errh)
+{
+    struct stat st;
+    if (_fd == STDIN_FILENO || _pipe || fstat(_fd, &st) < 0
+	|| !S_ISREG(st.st_mode)) {
+	if (_index_build)
+	    return error(errh, "cannot index this file");
+	return 0;
+    }
+
+    String filename = (_index_filename ? _index_filename : _filename + ".idx");
+    _index = new Index;
+    int r;
+    if (_index_build) {
+	_index_next = 0;
+	_index_max_ts = Timestamp();
+	r = _index->create(filename, st, _index_span, errh);
+    } else if ((r = _index->load(filename, st, errh)) == -ENOENT
+	       && _index_filename)
+	errh->warning("%s: %s", filename.c_str(), strerror(ENOENT));
+    if (r < 0) {
+	delete _index;
+	_index = 0;
+    }
+    return _index_build && r < 0 ? -1 : 0;
+}
+
+int
+FromFile::write_index(ErrorHandler *errh)
+{
+    int r = _index->finish(errh ? errh : ErrorHandler::default_handler());
+    delete _index;
+    _index = 0;
+    _index_build = false;
+    return r;
+}
+
 int
 FromFile::set_data(const String& data, ErrorHandler* errh)
 {
@@ -389,6 +2255,23 @@ FromFile::initialize(ErrorHandler *errh, bool allow_nonexistent)
 	return e;
     }
 
+    // asynchronous read-ahead works only on regular files
+    if (_readahead_depth) {
+	struct stat statbuf;
+	if (fstat(_fd, &statbuf) >= 0 && S_ISREG(statbuf.st_mode)) {
+#ifdef O_DIRECT
+	    if (_direct)
+		(void) fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_DIRECT);
+#endif
+	    _readahead = new Readahead(_fd, _readahead_depth);
+	    if (_readahead->start(0, errh) < 0)
+		return -1;
+#ifdef ALLOW_MMAP
+	    _mmap = false;
+#endif
+	}
+    }
+
   retry_file:
 #ifdef ALLOW_MMAP
     _mmap_unit = 0;
@@ -404,19 +2287,50 @@ FromFile::initialize(ErrorHandler *errh, bool allow_nonexistent)
 	return -ENOENT;
     }
 
-    // check for a gziped or bzip2d dump
-    if (_fd == STDIN_FILENO || _pipe)
-	/* cannot handle gzip or bzip2 */;
-    else if (compressed_data(_buffer, _len)) {
+    // check for a compressed dump
+    if (_fd == STDIN_FILENO || _pipe || _decompressor)
+	/* cannot handle compressed data */;
+    else if (const CodecType *type = (_decompress ? Decompressor::find_type(_buffer, _len) : 0)) {
+	// decompress in-process; fall back to a pipe if that fails
+	int nthreads = _decompress_threads;
+	if (nthreads <= 0) {
+	    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	    nthreads = (ncpu > 9 ? 8 : ncpu > 1 ? ncpu - 1 : 1);
+	}
+	if (_readahead) {
+	    _readahead->release(_data_packet);
+	    delete _readahead;
+	    _readahead = 0;
+	} else if (_data_packet)
+	    _data_packet->kill();
+	_data_packet = 0;
+	_decompressor = new Decompressor(type, nthreads,
+					 _index_build ? _index_span : 0);
+	if (_decompressor->start(_fd, ErrorHandler::silent_handler()) >= 0)
+	    goto retry_file;
+	delete _decompressor;
+	_decompressor = 0;
+	_decompress = false;
+	(void) lseek(_fd, 0, SEEK_SET);
+	goto retry_file;
+    } else if (compressed_data(_buffer, _len)) {
+	// open the pipe first: it examines the read-ahead buffer
+	_pipe = open_uncompress_pipe(_filename, _buffer, _len, errh);
+	if (_readahead) {
+	    _readahead->release(_data_packet);
+	    _data_packet = 0;
+	    delete _readahead;
+	    _readahead = 0;
+	}
 	close(_fd);
 	_fd = -1;
-	if (!(_pipe = open_uncompress_pipe(_filename, _buffer, _len, errh)))
+	if (!_pipe)
 	    return -1;
 	_fd = fileno(_pipe);
 	goto retry_file;
     }
 
-    return 0;
+    return initialize_index(errh);
 }
 
 void
@@ -434,6 +2348,22 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
     _data_packet = o._data_packet;
     o._data_packet = 0;
 
+    delete _readahead;
+    _readahead = o._readahead;
+    o._readahead = 0;
+
+    delete _decompressor;
+    _decompressor = o._decompressor;
+    o._decompressor = 0;
+
+    delete _index;
+    _index = o._index;
+    o._index = 0;
+    _index_build = o._index_build;
+    o._index_build = false;
+    _index_next = o._index_next;
+    _index_max_ts = o._index_max_ts;
+
 #ifdef ALLOW_MMAP
     if (_mmap != o._mmap)
 	errh->warning("different MMAP states");
@@ -450,15 +2380,24 @@ FromFile::take_state(FromFile &o, ErrorHandler *errh)
 void
 FromFile::cleanup()
 {
+    if (_data_packet && _readahead)
+	_readahead->release(_data_packet);
+    else if (_data_packet)
+	_data_packet->kill();
+    _data_packet = 0;
+    delete _readahead;
+    _readahead = 0;
+    delete _decompressor;
+    _decompressor = 0;
+    delete _index;
+    _index = 0;
+    _index_build = false;
     if (_pipe)
 	pclose(_pipe);
     else if (_fd >= 0 && _fd != STDIN_FILENO)
 	close(_fd);
     _pipe = 0;
     _fd = -1;
-    if (_data_packet)
-	_data_packet->kill();
-    _data_packet = 0;
 }
 
 const uint8_t *
@@ -592,6 +2531,17 @@ FromFile::filepos_handler(Element* e, void* thunk)
     return String(fd->_file_offset + fd->_pos);
 }
 
+String
+FromFile::raw_filepos_handler(Element* e, void* thunk)
+{
+    FromFile* fd = reinterpret_cast<FromFile*>((uint8_t*)e + (intptr_t)thunk);
+    // for compressed files, report progress through the compressed file,
+    // so that raw_filepos and filesize are comparable
+    if (fd->_decompressor)
+	return String(fd->_decompressor->compressed_pos());
+    return String(fd->_file_offset + fd->_pos);
+}
+
 int
 FromFile::filepos_write_handler(const String& str, Element* e, void* thunk, ErrorHandler* errh)
 {
@@ -609,6 +2559,7 @@ FromFile::add_handlers(Element* e, bool filepos_writable) const
     e->add_read_handler("filename", filename_handler, (void *)offset);
     e->add_read_handler("filesize", filesize_handler, (void *)offset);
     e->add_read_handler("filepos", filepos_handler, (void *)offset);
+    e->add_read_handler("raw_filepos", raw_filepos_handler, (void *)offset);
     if (filepos_writable)
 	e->add_write_handler("filepos", filepos_write_handler, (void *)offset);
 }
@@ -424,9 +424,20 @@ CLICK_DECLS
 uint32_t click_random_seed = 152;
 #endif
 
+static bool click_random_fixed = false;
+
+void
+click_random_fix_seed(uint32_t seed)
+{
+    click_srandom(seed);
+    click_random_fixed = true;
+}
+
 void
 click_random_srandom()
 {
+    if (click_random_fixed)
+	return;
     static const int bufsiz = 64;
     union {
 	char c[bufsiz];
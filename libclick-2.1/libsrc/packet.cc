@@ -272,7 +272,13 @@ struct GlobalPacketPool {
     volatile uint32_t lock;
 };
 static GlobalPacketPool global_packet_pool;
-#else
+#  elif HAVE___THREAD_STORAGE_CLASS
+// Without multithreading support there is no global pool, but a driver may
+// still create packets on helper threads.  Give each thread its own pool so
+// that helpers never touch another thread's free lists; a helper thread
+// should call Packet::static_cleanup() before it exits.
+static __thread PacketPool global_packet_pool;
+#  else
 static PacketPool global_packet_pool;
 #  endif
 
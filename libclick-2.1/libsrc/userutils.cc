@@ -709,6 +709,12 @@ compressed_data(const unsigned char *buf, int len)
 	if (len >= 10 && memcmp(buf + 4, "1AY&SY", 6) == 0)
 	    return true;
     }
+    // check for xz signatures
+    if (len >= 6 && memcmp(buf, "\3757zXZ\0", 6) == 0)
+	return true;
+    // check for zstd signatures
+    if (len >= 4 && memcmp(buf, "\050\265\057\375", 4) == 0)
+	return true;
     // otherwise unknown
     return false;
 }
@@ -720,6 +726,10 @@ open_uncompress_pipe(const String &filename, const unsigned char *buf, int len,
     StringAccum cmd;
     if (buf[0] == 'B')
 	cmd << "bzcat";
+    else if (buf[0] == 0375)
+	cmd << "xzcat";
+    else if (buf[0] == 050)
+	cmd << "zstdcat";
     else if (access("/usr/bin/gzcat", X_OK) >= 0)
 	cmd << "/usr/bin/gzcat";
     else
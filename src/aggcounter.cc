@@ -25,8 +25,21 @@
 #include <click/router.hh>
 CLICK_DECLS
 
+// Worker threads count batches of (aggregate, amount) pairs.
+struct AggregateCounter::Batch {
+    enum { SIZE = 4096 };
+    uint32_t agg[SIZE];
+    uint32_t amount[SIZE];
+    int n;
+    Batch *next;
+    Batch()
+	: n(0), next(0) {
+    }
+};
+
 AggregateCounter::AggregateCounter()
-    : _root(0), _free(0), _call_nnz_h(0), _call_count_h(0)
+    : _call_nnz_h(0), _call_count_h(0), _nthreads(0), _batch(0),
+      _work_head(0), _work_tail(&_work_head), _nbusy(0), _stopping(false)
 {
 }
 
@@ -34,20 +47,40 @@ AggregateCounter::~AggregateCounter()
 {
 }
 
-AggregateCounter::Node *
-AggregateCounter::new_node_block()
+void *
+AggregateCounter::cast(const char *n)
+{
+    if (strcmp(n, "SummaryCounter") == 0)
+	return static_cast<SummaryCounter *>(this);
+    else
+	return Element::cast(n);
+}
+
+bool
+AggregateCounter::init_nodes(Vector<Node> &nodes)
 {
-    assert(!_free);
-    int block_size = 1024;
-    Node *block = new Node[block_size];
-    if (!block)
+    // node 0 is the root; node 1 pads so that child pairs start at even
+    // indexes
+    nodes.clear();
+    if (!nodes.reserve(1024))
+	return false;
+    nodes.resize(2);
+    nodes[0].aggregate = 0;
+    nodes[0].count = 0;
+    nodes[0].child = 0;
+    return true;
+}
+
+uint32_t
+AggregateCounter::new_node_pair(Vector<Node> &nodes)
+{
+    // returns 0 on failure
+    uint32_t n = nodes.size();
+    if (n == (uint32_t) nodes.capacity()
+	&& !nodes.reserve(n * 2))
 	return 0;
-    _blocks.push_back(block);
-    for (int i = 1; i < block_size - 1; i++)
-	block[i].child[0] = &block[i+1];
-    block[block_size - 1].child[0] = 0;
-    _free = &block[1];
-    return &block[0];
+    nodes.resize(n + 2);
+    return n;
 }
 
 int
@@ -57,6 +90,7 @@ AggregateCounter::configure(Vector<String> &conf, ErrorHandler *errh)
     bool ip_bytes = false;
     bool packet_count = true;
     bool extra_length = true;
+    int nthreads = 0;
     uint32_t freeze_nnz, stop_nnz;
     uint64_t freeze_count, stop_count;
     String call_nnz, call_count;
@@ -74,6 +108,7 @@ AggregateCounter::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("COUNT_STOP", stop_count)
 	.read("AGGREGATE_CALL", AnyArg(), call_nnz)
 	.read("COUNT_CALL", AnyArg(), call_count)
+	.read("THREADS", nthreads)
 	.read("BANNER", _output_banner).complete() < 0)
 	return -1;
 
@@ -110,6 +145,11 @@ AggregateCounter::configure(Vector<String> &conf, ErrorHandler *errh)
 	_call_count_h = new HandlerCall(call_count);
     }
 
+    if (nthreads > 0 && _call_nnz_h)
+	errh->warning("AGGREGATE keywords are not thread-safe, ignoring THREADS");
+    else
+	_nthreads = (nthreads > 0 ? nthreads : 0);
+
     return 0;
 }
 
@@ -126,22 +166,44 @@ AggregateCounter::initialize(ErrorHandler *errh)
 
     _frozen = false;
     _active = true;
+
+    // worker threads
+    if (_nthreads) {
+	pthread_mutex_init(&_lock, 0);
+	pthread_cond_init(&_work_cond, 0);
+	pthread_cond_init(&_done_cond, 0);
+	_shards.resize(_nthreads);
+	_threads.reserve(_nthreads);
+	for (int i = 0; i < _nthreads; i++) {
+	    _shards[i].owner = this;
+	    if (!init_nodes(_shards[i].nodes))
+		return errh->error("out of memory!");
+	    pthread_t t;
+	    if (int e = pthread_create(&t, 0, worker_thread, &_shards[i]))
+		return errh->error("pthread_create: %s", strerror(e));
+	    _threads.push_back(t);
+	}
+    }
     return 0;
 }
 
 void
 AggregateCounter::cleanup(CleanupStage)
 {
-    for (int i = 0; i < _blocks.size(); i++)
-	delete[] _blocks[i];
-    _blocks.clear();
+    if (_threads.size())
+	stop_threads();
+    delete _batch;
+    _batch = 0;
+    _shards.clear();
+    _nodes.clear();
     delete _call_nnz_h;
     delete _call_count_h;
     _call_nnz_h = _call_count_h = 0;
 }
 
 AggregateCounter::Node *
-AggregateCounter::make_peer(uint32_t a, Node *n, bool frozen)
+AggregateCounter::make_peer(Vector<Node> &nodes, uint32_t a, uint32_t ni,
+			    bool frozen)
 {
     /*
      * become a peer
@@ -152,13 +214,11 @@ AggregateCounter::make_peer(uint32_t a, Node *n, bool frozen)
     if (frozen)
 	return 0;
 
-    Node *down[2];
-    if (!(down[0] = new_node()))
+    uint32_t di = new_node_pair(nodes);
+    if (!di)
 	return 0;
-    if (!(down[1] = new_node())) {
-	free_node(down[0]);
-	return 0;
-    }
+    Node *n = &nodes[ni];
+    Node *down = &nodes[di];
 
     // swivel is first bit 'a' and 'old->input' differ
     int swivel = ffs_msb(a ^ n->aggregate);
@@ -167,44 +227,47 @@ AggregateCounter::make_peer(uint32_t a, Node *n, bool frozen)
     // mask masks off all bits before swivel
     uint32_t mask = (swivel == 1 ? 0 : (0xFFFFFFFFU << (33 - swivel)));
 
-    down[bitvalue]->aggregate = a;
-    down[bitvalue]->count = 0;
-    down[bitvalue]->child[0] = down[bitvalue]->child[1] = 0;
+    down[bitvalue].aggregate = a;
+    down[bitvalue].count = 0;
+    down[bitvalue].child = 0;
 
-    *down[1 - bitvalue] = *n;	/* copy orig node down one level */
+    down[1 - bitvalue] = *n;	/* copy orig node down one level */
 
-    n->aggregate = (down[0]->aggregate & mask);
-    if (down[0]->aggregate == n->aggregate) {
-	n->count = down[0]->count;
-	down[0]->count = 0;
+    n->aggregate = (down[0].aggregate & mask);
+    if (down[0].aggregate == n->aggregate) {
+	n->count = down[0].count;
+	down[0].count = 0;
     } else
 	n->count = 0;
-    n->child[0] = down[0];	/* point to children */
-    n->child[1] = down[1];
+    n->child = di;		/* point to children */
 
-    return (n->aggregate == a ? n : down[bitvalue]);
+    return (n->aggregate == a ? n : &down[bitvalue]);
 }
 
 AggregateCounter::Node *
-AggregateCounter::find_node(uint32_t a, bool frozen)
+AggregateCounter::find_node(Vector<Node> &nodes, uint32_t a, bool frozen)
 {
     // straight outta tcpdpriv
-    Node *n = _root;
+    Node *base = nodes.begin();
+    Node *n = base;
     while (n) {
 	if (n->aggregate == a)
 	    return (n->count || !frozen ? n : 0);
-	if (!n->child[0])
-	    n = make_peer(a, n, frozen);
+	if (!n->child)
+	    n = make_peer(nodes, a, n - base, frozen);
 	else {
 	    // swivel is the first bit in which the two children differ
-	    int swivel = ffs_msb(n->child[0]->aggregate ^ n->child[1]->aggregate);
+	    Node *c = base + n->child;
+	    int swivel = ffs_msb(c[0].aggregate ^ c[1].aggregate);
 	    if (ffs_msb(a ^ n->aggregate) < swivel) // input differs earlier
-		n = make_peer(a, n, frozen);
-	    else if (a & (1 << (32 - swivel)))
-		n = n->child[1];
-	    else
-		n = n->child[0];
+		n = make_peer(nodes, a, n - base, frozen);
+	    else {
+		n = c + ((a >> (32 - swivel)) & 1);
+		continue;
+	    }
 	}
+	// make_peer may have moved the nodes
+	base = nodes.begin();
     }
 
     if (!frozen)
@@ -213,38 +276,43 @@ AggregateCounter::find_node(uint32_t a, bool frozen)
 }
 
 inline bool
-AggregateCounter::update(Packet *p, bool frozen)
+AggregateCounter::update(uint32_t agg, uint32_t amount, bool frozen)
 {
-    if (!_active)
-	return false;
+    Node *n;
+    if (_nthreads) {
+	if (!frozen) {
+	    // let a worker find the node; a zero amount creates no count
+	    if (amount) {
+		if (!_batch)
+		    _batch = new Batch;
+		_batch->agg[_batch->n] = agg;
+		_batch->amount[_batch->n] = amount;
+		if (++_batch->n == Batch::SIZE)
+		    submit_batch();
+	    }
+	    goto counted;
+	}
+	// frozen updates depend on every earlier packet
+	sync();
+    }
 
-    // AGGREGATE_ANNO is already in host byte order!
-    uint32_t agg = AGGREGATE_ANNO(p);
-    Node *n = find_node(agg, frozen);
+    n = find_node(agg, frozen);
     if (!n)
 	return false;
 
-    uint32_t amount;
-    if (!_bytes)
-	amount = 1 + (_use_packet_count ? EXTRA_PACKETS_ANNO(p) : 0);
-    else {
-	amount = p->length() + (_use_extra_length ? EXTRA_LENGTH_ANNO(p) : 0);
-	if (_ip_bytes && p->has_network_header())
-	    amount -= p->network_header_offset();
-    }
-
     // update _num_nonzero; possibly call handler
     if (amount && !n->count) {
 	if (_num_nonzero >= _call_nnz) {
 	    _call_nnz = (uint32_t)(-1);
 	    _call_nnz_h->call_write();
 	    // handler may have changed our state; reupdate
-	    return update(p, frozen || _frozen);
+	    return _active && update(agg, amount, frozen || _frozen);
 	}
 	_num_nonzero++;
     }
 
     n->count += amount;
+ counted:
     _count += amount;
     if (_count >= _call_count) {
 	_call_count = (uint64_t)(-1);
@@ -253,6 +321,26 @@ AggregateCounter::update(Packet *p, bool frozen)
     return true;
 }
 
+inline bool
+AggregateCounter::update(Packet *p, bool frozen)
+{
+    if (!_active)
+	return false;
+
+    // AGGREGATE_ANNO is already in host byte order!
+    uint32_t agg = AGGREGATE_ANNO(p);
+    uint32_t amount;
+    if (!_bytes)
+	amount = 1 + (_use_packet_count ? EXTRA_PACKETS_ANNO(p) : 0);
+    else {
+	amount = p->length() + (_use_extra_length ? EXTRA_LENGTH_ANNO(p) : 0);
+	if (_ip_bytes && p->has_network_header())
+	    amount -= p->network_header_offset();
+    }
+
+    return update(agg, amount, frozen);
+}
+
 void
 AggregateCounter::push(int port, Packet *p)
 {
@@ -269,33 +357,36 @@ AggregateCounter::pull(int port)
     return p;
 }
 
-
-// CLEAR, REAGGREGATE
-
-void
-AggregateCounter::clear_node(Node *n)
+bool
+AggregateCounter::count_summary(uint32_t agg, uint32_t packets, uint32_t ip_len)
 {
-    if (n->child[0]) {
-	clear_node(n->child[0]);
-	clear_node(n->child[1]);
-    }
-    free_node(n);
+    // A summary record stands for a packet with EXTRA_PACKETS_ANNO
+    // 'packets - 1' and total IP length 'ip_len'.
+    uint32_t amount;
+    if (!_bytes)
+	amount = (_use_packet_count ? packets : 1);
+    else if (_use_extra_length && _ip_bytes && ip_len)
+	amount = ip_len;
+    else
+	return false;
+    if (_active)
+	update(agg, amount, _frozen);
+    return true;
 }
 
+
+// CLEAR, REAGGREGATE
+
 int
 AggregateCounter::clear(ErrorHandler *errh)
 {
-    if (_root)
-	clear_node(_root);
-
-    if (!(_root = new_node())) {
+    // discard the workers' counts too
+    sync();
+    if (!init_nodes(_nodes)) {
 	if (errh)
 	    errh->error("out of memory!");
 	return -1;
     }
-    _root->aggregate = 0;
-    _root->count = 0;
-    _root->child[0] = _root->child[1] = 0;
     _num_nonzero = 0;
     _count = 0;
     return 0;
@@ -303,72 +394,206 @@ AggregateCounter::clear(ErrorHandler *errh)
 
 
 void
-AggregateCounter::reaggregate_node(Node *n)
+AggregateCounter::reaggregate_node(const Vector<Node> &old_nodes, uint32_t ni)
 {
-    Node *l = n->child[0], *r = n->child[1];
-    uint32_t count = n->count;
-    free_node(n);
-
-    if ((n = find_node(count, false))) {
-	if (!n->count)
-	    _num_nonzero++;
-	n->count++;
-	_count++;
+    const Node &o = old_nodes[ni];
+    if (o.count) {
+	Node *n = find_node(o.count, false);
+	if (n) {
+	    if (!n->count)
+		_num_nonzero++;
+	    n->count++;
+	    _count++;
+	}
     }
 
-    if (l) {
-	reaggregate_node(l);
-	reaggregate_node(r);
+    if (o.child) {
+	reaggregate_node(old_nodes, o.child);
+	reaggregate_node(old_nodes, o.child + 1);
     }
 }
 
-void
-AggregateCounter::reaggregate_counts()
+int
+AggregateCounter::reaggregate_counts(ErrorHandler *errh)
 {
-    Node *old_root = _root;
-    _root = 0;
+    sync();
+    // new aggregates are old counts, so each count must fit in 32 bits
+    for (const Node *n = _nodes.begin(); n != _nodes.end(); ++n)
+	if (n->count > 0xFFFFFFFFU) {
+	    if (errh)
+		errh->error("count %llu too large to reaggregate", (unsigned long long) n->count);
+	    return -1;
+	}
+    Vector<Node> old_nodes;
+    old_nodes.swap(_nodes);
     clear();
-    reaggregate_node(old_root);
+    reaggregate_node(old_nodes, 0);
+    return 0;
+}
+
+
+// WORKER THREADS
+
+void
+AggregateCounter::merge_node(const Vector<Node> &shard_nodes, uint32_t ni)
+{
+    const Node &o = shard_nodes[ni];
+    if (o.count) {
+	if (Node *n = find_node(o.aggregate, false)) {
+	    if (!n->count)
+		_num_nonzero++;
+	    n->count += o.count;
+	}
+    }
+
+    if (o.child) {
+	merge_node(shard_nodes, o.child);
+	merge_node(shard_nodes, o.child + 1);
+    }
+}
+
+void
+AggregateCounter::submit_batch()
+{
+    if (Batch *b = _batch) {
+	_batch = 0;
+	pthread_mutex_lock(&_lock);
+	*_work_tail = b;
+	_work_tail = &b->next;
+	++_nbusy;
+	pthread_cond_signal(&_work_cond);
+	pthread_mutex_unlock(&_lock);
+    }
+}
+
+void
+AggregateCounter::sync()
+{
+    // Wait for the workers to count every submitted batch, then add their
+    // counters into ours.  (_count already includes their amounts.)
+    if (!_threads.size())
+	return;
+    submit_batch();
+    pthread_mutex_lock(&_lock);
+    while (_nbusy)
+	pthread_cond_wait(&_done_cond, &_lock);
+    pthread_mutex_unlock(&_lock);
+    for (int i = 0; i < _shards.size(); i++)
+	if (_shards[i].nodes.size() > 2 || _shards[i].nodes[0].count) {
+	    merge_node(_shards[i].nodes, 0);
+	    init_nodes(_shards[i].nodes);
+	}
+}
+
+void
+AggregateCounter::stop_threads()
+{
+    pthread_mutex_lock(&_lock);
+    _stopping = true;
+    pthread_cond_broadcast(&_work_cond);
+    pthread_mutex_unlock(&_lock);
+    for (int i = 0; i < _threads.size(); i++)
+	pthread_join(_threads[i], 0);
+    _threads.clear();
+    while (Batch *b = _work_head) {
+	_work_head = b->next;
+	delete b;
+    }
+    _work_tail = &_work_head;
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_work_cond);
+    pthread_cond_destroy(&_done_cond);
+    _nthreads = 0;
+}
+
+void *
+AggregateCounter::worker_thread(void *arg)
+{
+    Shard *shard = static_cast<Shard *>(arg);
+    AggregateCounter *ac = shard->owner;
+    pthread_mutex_lock(&ac->_lock);
+    while (1) {
+	while (!ac->_work_head && !ac->_stopping)
+	    pthread_cond_wait(&ac->_work_cond, &ac->_lock);
+	Batch *b = ac->_work_head;
+	if (!b || ac->_stopping)
+	    break;
+	if (!(ac->_work_head = b->next))
+	    ac->_work_tail = &ac->_work_head;
+	pthread_mutex_unlock(&ac->_lock);
+
+	for (int i = 0; i < b->n; i++)
+	    if (Node *n = find_node(shard->nodes, b->agg[i], false))
+		n->count += b->amount[i];
+	delete b;
+
+	pthread_mutex_lock(&ac->_lock);
+	if (--ac->_nbusy == 0)
+	    pthread_cond_broadcast(&ac->_done_cond);
+    }
+    pthread_mutex_unlock(&ac->_lock);
+    return 0;
 }
 
 
 // HANDLERS
 
+// Records are buffered as 32-bit words in host byte order. WR_BINARY
+// records are two words, aggregate then count; other records are an
+// aggregate followed by a 64-bit count, which is exactly a WR_BINARY64
+// file record.
+
+static inline uint64_t
+record_count(const uint32_t *r)
+{
+    uint64_t count;
+    memcpy(&count, r + 1, sizeof(count));
+    return count;
+}
+
 static void
 write_batch(FILE *f, AggregateCounter::WriteFormat format,
 	    uint32_t *buffer, int pos, double count, ErrorHandler *)
 {
-    if (format == AggregateCounter::WR_BINARY)
+    if (format == AggregateCounter::WR_BINARY
+	|| format == AggregateCounter::WR_BINARY64)
 	ignore_result(fwrite(buffer, sizeof(uint32_t), pos, f));
     else if (format == AggregateCounter::WR_TEXT_IP)
-	for (int i = 0; i < pos; i += 2)
-	    fprintf(f, "%d.%d.%d.%d %u\n", (buffer[i] >> 24) & 255, (buffer[i] >> 16) & 255, (buffer[i] >> 8) & 255, buffer[i] & 255, buffer[i+1]);
+	for (int i = 0; i < pos; i += 3)
+	    fprintf(f, "%d.%d.%d.%d %llu\n", (buffer[i] >> 24) & 255, (buffer[i] >> 16) & 255, (buffer[i] >> 8) & 255, buffer[i] & 255, (unsigned long long) record_count(buffer + i));
     else if (format == AggregateCounter::WR_TEXT_PDF)
-	for (int i = 0; i < pos; i += 2)
-	    fprintf(f, "%u %.12g\n", buffer[i], buffer[i+1] / count);
+	for (int i = 0; i < pos; i += 3)
+	    fprintf(f, "%u %.12g\n", buffer[i], record_count(buffer + i) / count);
     else if (format == AggregateCounter::WR_TEXT)
-	for (int i = 0; i < pos; i += 2)
-	    fprintf(f, "%u %u\n", buffer[i], buffer[i+1]);
+	for (int i = 0; i < pos; i += 3)
+	    fprintf(f, "%u %llu\n", buffer[i], (unsigned long long) record_count(buffer + i));
 }
 
 void
-AggregateCounter::write_nodes(Node *n, FILE *f, WriteFormat format,
+AggregateCounter::write_nodes(uint32_t ni, FILE *f, WriteFormat format,
 			      uint32_t *buffer, int &pos, int len,
 			      ErrorHandler *errh) const
 {
+    const Node *n = &_nodes[ni];
     if (n->count > 0) {
-	buffer[pos++] = n->aggregate;
-	buffer[pos++] = n->count;
-	if (pos == len) {
+	buffer[pos] = n->aggregate;
+	if (format == WR_BINARY) {
+	    buffer[pos + 1] = n->count;
+	    pos += 2;
+	} else {
+	    memcpy(&buffer[pos + 1], &n->count, sizeof(n->count));
+	    pos += 3;
+	}
+	if (pos + 3 > len) {
 	    write_batch(f, format, buffer, pos, _count, errh);
 	    pos = 0;
 	}
     }
 
-    if (n->child[0])
-	write_nodes(n->child[0], f, format, buffer, pos, len, errh);
-    if (n->child[1])
-	write_nodes(n->child[1], f, format, buffer, pos, len, errh);
+    if (n->child) {
+	write_nodes(n->child, f, format, buffer, pos, len, errh);
+	write_nodes(n->child + 1, f, format, buffer, pos, len, errh);
+    }
 }
 
 int
@@ -383,25 +608,31 @@ AggregateCounter::write_file(String where, WriteFormat format,
     if (!f)
 	return errh->error("%s: %s", where.c_str(), strerror(errno));
 
-    fprintf(f, "!IPAggregate 1.0\n");
+    // no count can exceed 32 bits unless the total does
+    if (format == WR_BINARY && _count > 0xFFFFFFFFU)
+	format = WR_BINARY64;
+
+    fprintf(f, "!IPAggregate %s\n", format == WR_BINARY64 ? "1.1" : "1.0");
     ignore_result(fwrite(_output_banner.data(), 1, _output_banner.length(), f));
     if (_output_banner.length() && _output_banner.back() != '\n')
 	fputc('\n', f);
     fprintf(f, "!num_nonzero %u\n", _num_nonzero);
-    if (format == WR_BINARY) {
+    if (format == WR_BINARY || format == WR_BINARY64) {
+	const char *wide = (format == WR_BINARY64 ? "64" : "");
 #if CLICK_BYTE_ORDER == CLICK_BIG_ENDIAN
-	fprintf(f, "!packed_be\n");
+	fprintf(f, "!packed%s_be\n", wide);
 #elif CLICK_BYTE_ORDER == CLICK_LITTLE_ENDIAN
-	fprintf(f, "!packed_le\n");
+	fprintf(f, "!packed%s_le\n", wide);
 #else
+	(void) wide;
 	format = WR_TEXT;
 #endif
     } else if (format == WR_TEXT_IP)
 	fprintf(f, "!ip\n");
 
-    uint32_t buf[1024];
+    uint32_t buf[1536];
     int pos = 0;
-    write_nodes(_root, f, format, buf, pos, 1024, errh);
+    write_nodes(0, f, format, buf, pos, 1536, errh);
     if (pos)
 	write_batch(f, format, buf, pos, _count, errh);
 
@@ -421,6 +652,7 @@ AggregateCounter::write_file_handler(const String &data, Element *e, void *thunk
     String fn;
     if (!FilenameArg().parse(cp_uncomment(data), fn))
 	return errh->error("argument should be filename");
+    ac->sync();
     int int_thunk = (intptr_t)thunk;
     return ac->write_file(fn, (WriteFormat)int_thunk, errh);
 }
@@ -450,6 +682,7 @@ AggregateCounter::read_handler(Element *e, void *thunk)
       case AC_COUNT:
 	return String(ac->_count);
       case AC_NAGG:
+	ac->sync();
 	return String(ac->_num_nonzero);
       default:
 	return "<error>";
@@ -481,8 +714,7 @@ AggregateCounter::write_handler(const String &data, Element *e, void *thunk, Err
 	ac->router()->please_stop_driver();
 	return 0;
       case AC_REAGGREGATE:
-	ac->reaggregate_counts();
-	return 0;
+	return ac->reaggregate_counts(errh);
       case AC_BANNER:
 	ac->_output_banner = data;
 	if (data && data.back() != '\n')
@@ -1,6 +1,8 @@
 #ifndef CLICK_AGGCOUNTER_HH
 #define CLICK_AGGCOUNTER_HH
 #include <click/element.hh>
+#include <pthread.h>
+#include "summarycounter.hh"
 CLICK_DECLS
 class HandlerCall;
 
@@ -92,6 +94,18 @@ the supplied value, once the total count has reached or exceeded I<N>.
 The three COUNT keywords are mutually exclusive. Supply at most one of
 them.
 
+=item THREADS
+
+Integer. If greater than zero, update counts on THREADS worker threads.
+AggregateCounter collects the aggregates and amounts of incoming packets into
+batches, and each worker adds batches into a private set of counters. The
+workers' counters are merged into the main counters whenever they are needed,
+for example by the C<nagg> or C<write_file> handlers, so results are identical
+to single-threaded counting. Frozen updates, including those on the second
+input, are applied by the main thread after a merge. THREADS is ignored when
+any AGGREGATE keyword is given, since those need a distinct-aggregate count
+after every packet. Defaults to 0.
+
 =item BANNER
 
 String. This banner is written to the head of any output file. It should
@@ -107,7 +121,10 @@ couple text lines, followed by a line containing 'C<!packed_le>' or
 'C<!packed_be>', followed by N 8-byte records. In each record, bytes 1-4 are
 the aggregate, and bytes 5-8 are the count. Both values are 32-bit integers.
 The byte order is indicated by the 'C<!packed>' line: 'C<!packed_le>' means
-little-endian, 'C<!packed_be>' means big-endian.
+little-endian, 'C<!packed_be>' means big-endian. If the total count does not
+fit in 32 bits, the file instead starts with 'C<!IPAggregate 1.1>', the
+marker line is 'C<!packed64_le>' or 'C<!packed64_be>', and each record is 12
+bytes: a 32-bit aggregate followed by a 64-bit count.
 
 =h write_text_file write-only
 
@@ -146,6 +163,8 @@ counts represent how many times each old count appeared. The old aggregate
 identifiers are thrown away. To put it another way, AggregateCounter creates a
 multiset containing all aggregate counts, then stores each count as an
 aggregate, with its number of occurrences in the multiset as its count.
+Since counts become 32-bit aggregate identifiers, the write fails, leaving
+the counters unchanged, if any count is 2^32 or more.
 
 =h banner read/write
 
@@ -168,6 +187,13 @@ Returns the number of aggregates that have been seen so far.
 The aggregate identifier is stored in host byte order. Thus, the aggregate ID
 corresponding to IP address 128.0.0.0 is 2147483648.
 
+FromIPSummaryDump's AGGREGATE_COUNTER keyword can hand summary records to an
+AggregateCounter directly, without creating packets. Those records are
+counted as if they had arrived on the first input, but are never emitted.
+AggregateCounter refuses such records if it counts bytes without
+EXTRA_LENGTH or IP_BYTES, and FromIPSummaryDump then creates packets as
+usual.
+
 Only available in user-level processes.
 
 =e
@@ -189,7 +215,7 @@ form.
 
 AggregateIP, AggregatePacketCounter, FromIPSummaryDump, FromDump */
 
-class AggregateCounter : public Element { public:
+class AggregateCounter : public Element, public SummaryCounter { public:
 
     AggregateCounter() CLICK_COLD;
     ~AggregateCounter() CLICK_COLD;
@@ -197,6 +223,7 @@ class AggregateCounter : public Element { public:
     const char *class_name() const	{ return "AggregateCounter"; }
     const char *port_count() const	{ return "1-2/1-2"; }
 
+    void *cast(const char *);
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
     int initialize(ErrorHandler *) CLICK_COLD;
     void cleanup(CleanupStage) CLICK_COLD;
@@ -206,18 +233,32 @@ class AggregateCounter : public Element { public:
     void push(int, Packet *);
     Packet *pull(int);
 
+    bool count_summary(uint32_t aggregate, uint32_t packets, uint32_t ip_len);
+
     bool empty() const			{ return _num_nonzero == 0; }
     int clear(ErrorHandler * = 0);
-    enum WriteFormat { WR_TEXT = 0, WR_BINARY = 1, WR_TEXT_IP = 2, WR_TEXT_PDF = 3 };
+    enum WriteFormat { WR_TEXT = 0, WR_BINARY = 1, WR_TEXT_IP = 2, WR_TEXT_PDF = 3,
+		       WR_BINARY64 = 4 };
     int write_file(String, WriteFormat, ErrorHandler *) const;
-    void reaggregate_counts();
+    int reaggregate_counts(ErrorHandler * = 0);
 
   private:
 
+    // Nodes live in one array and refer to each other by index. Children
+    // are allocated in adjacent pairs, so a node names only its left
+    // child; the right child follows it. Node 0 is the root, so a child
+    // index of 0 means no children. Nodes are never freed individually;
+    // clear() and reaggregate_counts() start a new array.
     struct Node {
+	uint64_t count;
 	uint32_t aggregate;
-	uint32_t count;
-	Node *child[2];
+	uint32_t child;
+    };
+
+    struct Batch;
+    struct Shard {
+	AggregateCounter *owner;
+	Vector<Node> nodes;
     };
 
     bool _bytes : 1;
@@ -227,9 +268,7 @@ class AggregateCounter : public Element { public:
     bool _frozen;
     bool _active;
 
-    Node *_root;
-    Node *_free;
-    Vector<Node *> _blocks;
+    Vector<Node> _nodes;
     uint32_t _num_nonzero;
     uint64_t _count;
 
@@ -240,39 +279,41 @@ class AggregateCounter : public Element { public:
 
     String _output_banner;
 
-    Node *new_node();
-    Node *new_node_block();
-    void free_node(Node *);
-
-    Node *make_peer(uint32_t, Node *, bool frozen);
-    Node *find_node(uint32_t, bool frozen = false);
-    void reaggregate_node(Node *);
-    void clear_node(Node *);
-
-    void write_nodes(Node *, FILE *, WriteFormat, uint32_t *, int &, int, ErrorHandler *) const;
+    int _nthreads;
+    Vector<pthread_t> _threads;
+    Vector<Shard> _shards;
+    pthread_mutex_t _lock;
+    pthread_cond_t _work_cond;
+    pthread_cond_t _done_cond;
+    Batch *_batch;		// batch being filled
+    Batch *_work_head;		// batches awaiting a worker (FIFO)
+    Batch **_work_tail;
+    int _nbusy;			// batches submitted but not yet counted
+    bool _stopping;
+
+    inline bool update(uint32_t agg, uint32_t amount, bool frozen);
+
+    static bool init_nodes(Vector<Node> &);
+    static uint32_t new_node_pair(Vector<Node> &);
+    static Node *make_peer(Vector<Node> &, uint32_t, uint32_t, bool frozen);
+    static Node *find_node(Vector<Node> &, uint32_t, bool frozen);
+    Node *find_node(uint32_t a, bool frozen = false) {
+	return find_node(_nodes, a, frozen);
+    }
+    void reaggregate_node(const Vector<Node> &, uint32_t);
+    void merge_node(const Vector<Node> &, uint32_t);
+
+    void submit_batch();
+    void sync();
+    void stop_threads();
+    static void *worker_thread(void *);
+
+    void write_nodes(uint32_t, FILE *, WriteFormat, uint32_t *, int &, int, ErrorHandler *) const;
     static int write_file_handler(const String &, Element *, void *, ErrorHandler *);
     static String read_handler(Element *, void *) CLICK_COLD;
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
 
 };
 
-inline AggregateCounter::Node *
-AggregateCounter::new_node()
-{
-    if (_free) {
-	Node *n = _free;
-	_free = n->child[0];
-	return n;
-    } else
-	return new_node_block();
-}
-
-inline void
-AggregateCounter::free_node(Node *n)
-{
-    n->child[0] = _free;
-    _free = n;
-}
-
 CLICK_ENDDECLS
 #endif
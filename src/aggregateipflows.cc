@@ -27,6 +27,9 @@
 #include <clicknet/icmp.h>
 #include <click/packet_anno.hh>
 #include <click/handlercall.hh>
+#if __SSE2__
+# include <emmintrin.h>
+#endif
 CLICK_DECLS
 
 #define SEC_OLDER(s1, s2)	((int)(s1 - s2) < 0)
@@ -72,8 +75,9 @@ flip_ports(uint32_t ports)
 // actual AggregateIPFlows operations
 
 AggregateIPFlows::AggregateIPFlows()
+    : _chunks(0), _chunks_alloc(0)
 #if CLICK_USERLEVEL
-    : _traceinfo_file(0), _packet_source(0), _filepos_h(0)
+    , _traceinfo_file(0), _packet_source(0), _filepos_h(0)
 #endif
 {
 }
@@ -100,7 +104,7 @@ AggregateIPFlows::configure(Vector<String> &conf, ErrorHandler *errh)
     _tcp_done_timeout = 30;
     _udp_timeout = 60;
     _fragment_timeout = 30;
-    _gc_interval = 20 * 60;
+    _gc_interval = 1;
     _fragments = 2;
     bool handle_icmp_errors = false;
     bool fragments_parsed;
@@ -135,6 +139,9 @@ AggregateIPFlows::initialize(ErrorHandler *errh)
     _next = 1;
     _active_sec = _gc_sec = 0;
     _timestamp_warning = false;
+    _flow_free = _flow_limit = _nflows = 0;
+    if (grow_flows() < 0)
+	return errh->error("out of memory!");
 
 #if CLICK_USERLEVEL
     if (_traceinfo_filename == "-")
@@ -166,6 +173,7 @@ AggregateIPFlows::cleanup(CleanupStage)
 {
     clean_map(_tcp_map);
     clean_map(_udp_map);
+    clean_flows();
 #if CLICK_USERLEVEL
     if (_traceinfo_file && _traceinfo_file != stdout) {
 	fprintf(_traceinfo_file, "</trace>\n");
@@ -175,20 +183,59 @@ AggregateIPFlows::cleanup(CleanupStage)
 #endif
 }
 
+// flow records
+
+uint32_t
+AggregateIPFlows::alloc_flow()
+{
+    if (uint32_t fi = _flow_free) {
+	_flow_free = flow(fi)->_expiry_next;
+	return fi;
+    }
+    if (!(_flow_limit & (FLOW_SLAB - 1))) {
+	FlowInfo *slab = new FlowInfo[FLOW_SLAB];
+	if (!slab)
+	    return 0;
+	_flow_slabs.push_back(slab);
+#if CLICK_USERLEVEL
+	if (stats()) {
+	    FlowStats *stat_slab = new FlowStats[FLOW_SLAB];
+	    if (!stat_slab)
+		return 0;
+	    _stat_slabs.push_back(stat_slab);
+	}
+#endif
+	if (!_flow_limit)	// index 0 means no flow
+	    _flow_limit = 1;
+    }
+    return _flow_limit++;
+}
+
 inline void
-AggregateIPFlows::delete_flowinfo(const HostPair &hp, FlowInfo *finfo, bool really_delete)
+AggregateIPFlows::free_flow(uint32_t fi)
+{
+    FlowInfo *finfo = flow(fi);
+    finfo->_aggregate = 0;
+    finfo->_expiry_next = _flow_free;
+    _flow_free = fi;
+}
+
+inline void
+AggregateIPFlows::trace_flow(uint32_t fi)
 {
 #if CLICK_USERLEVEL
     if (_traceinfo_file) {
-	StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
-	IPAddress src(sinfo->reverse() ? hp.b : hp.a);
-	int sport = (ntohl(sinfo->_ports) >> (sinfo->reverse() ? 0 : 16)) & 0xFFFF;
-	IPAddress dst(sinfo->reverse() ? hp.a : hp.b);
-	int dport = (ntohl(sinfo->_ports) >> (sinfo->reverse() ? 16 : 0)) & 0xFFFF;
-	Timestamp duration = sinfo->_last_timestamp - sinfo->_first_timestamp;
+	FlowInfo *finfo = flow(fi);
+	FlowStats *sinfo = flow_stats(fi);
+	const HostPair &hp = finfo->_hosts;
+	IPAddress src(finfo->reverse() ? hp.b : hp.a);
+	int sport = (ntohl(finfo->_ports) >> (finfo->reverse() ? 0 : 16)) & 0xFFFF;
+	IPAddress dst(finfo->reverse() ? hp.a : hp.b);
+	int dport = (ntohl(finfo->_ports) >> (finfo->reverse() ? 16 : 0)) & 0xFFFF;
+	Timestamp duration = finfo->_last_timestamp - sinfo->_first_timestamp;
 	fprintf(_traceinfo_file, "<flow aggregate='%u' src='%s' sport='%d' dst='%s' dport='%d' begin='" PRITIMESTAMP "' duration='" PRITIMESTAMP "'",
 
-		sinfo->_aggregate,
+		finfo->_aggregate,
 		src.unparse().c_str(), sport, dst.unparse().c_str(), dport,
 		sinfo->_first_timestamp.sec(), sinfo->_first_timestamp.subsec(),
 		duration.sec(), duration.subsec());
@@ -198,36 +245,232 @@ AggregateIPFlows::delete_flowinfo(const HostPair &hp, FlowInfo *finfo, bool real
   <stream dir='0' packets='%d' /><stream dir='1' packets='%d' />\n\
 </flow>\n",
 		sinfo->_packets[0], sinfo->_packets[1]);
-	if (really_delete)
-	    delete sinfo;
-    } else
+    }
+#else
+    (void) fi;
+#endif
+}
+
+
+// flow table
+
+static inline uint64_t
+flow_hash(const AggregateIPFlows::HostPair &hosts, uint32_t ports, bool udp)
+{
+    uint64_t h = ((uint64_t) hosts.a << 32 | hosts.b) * 0x9E3779B97F4A7C15ULL;
+    h ^= ((uint64_t) ports << 1 | udp) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+static inline uint8_t
+flow_tag(uint64_t hash)
+{
+    // never 0, which marks an empty slot
+    return (hash >> 57) | 0x80;
+}
+
+static inline uint32_t
+flow_probe_step(uint64_t hash)
+{
+    // odd, so probing visits every chunk
+    return (hash >> 40) | 1;
+}
+
+inline unsigned
+AggregateIPFlows::Chunk::match(uint8_t tag) const
+{
+#if __SSE2__
+    __m128i tags = _mm_load_si128(reinterpret_cast<const __m128i *>(_tags));
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag)));
+#else
+    unsigned m = 0;
+    for (int i = 0; i < CHUNK_SLOTS; ++i)
+	m |= (unsigned) (_tags[i] == tag) << i;
+#endif
+    return m & ((1U << CHUNK_SLOTS) - 1);
+}
+
+uint32_t
+AggregateIPFlows::lookup_flow(uint64_t hash, const HostPair &hosts, uint32_t ports, bool udp) const
+{
+    uint8_t tag = flow_tag(hash);
+    uint32_t step = flow_probe_step(hash);
+    uint32_t ci = hash & _chunk_mask;
+    for (uint32_t n = 0; n <= _chunk_mask; ++n, ci = (ci + step) & _chunk_mask) {
+	const Chunk &c = _chunks[ci];
+	for (unsigned m = c.match(tag); m; m &= m - 1) {
+	    uint32_t fi = c._slots[ffs_lsb(m) - 1];
+	    const FlowInfo *finfo = flow(fi);
+	    if (finfo->_ports == ports && finfo->_hosts == hosts
+		&& finfo->_udp == udp)
+		return fi;
+	}
+	if (!c._tags[CHUNK_SLOTS])
+	    break;
+    }
+    return 0;
+}
+
+void
+AggregateIPFlows::insert_flow(uint64_t hash, uint32_t fi)
+{
+    // caller ensures there is room
+    uint32_t step = flow_probe_step(hash);
+    uint32_t ci = hash & _chunk_mask;
+    while (1) {
+	Chunk &c = _chunks[ci];
+	if (unsigned m = c.match(0)) {
+	    int slot = ffs_lsb(m) - 1;
+	    c._tags[slot] = flow_tag(hash);
+	    c._slots[slot] = fi;
+	    ++_nflows;
+	    return;
+	}
+	if (c.overflow() != 255)	// saturated counts stay put
+	    ++c.overflow();
+	ci = (ci + step) & _chunk_mask;
+    }
+}
+
+void
+AggregateIPFlows::remove_flow(uint32_t fi)
+{
+    const FlowInfo *finfo = flow(fi);
+    uint64_t hash = flow_hash(finfo->_hosts, finfo->_ports, finfo->_udp);
+    uint8_t tag = flow_tag(hash);
+    uint32_t step = flow_probe_step(hash);
+    uint32_t ci = hash & _chunk_mask;
+    while (1) {
+	Chunk &c = _chunks[ci];
+	for (unsigned m = c.match(tag); m; m &= m - 1) {
+	    int slot = ffs_lsb(m) - 1;
+	    if (c._slots[slot] == fi) {
+		c._tags[slot] = 0;
+		--_nflows;
+		return;
+	    }
+	}
+	if (c.overflow() != 255)
+	    --c.overflow();
+	ci = (ci + step) & _chunk_mask;
+    }
+}
+
+int
+AggregateIPFlows::grow_flows()
+{
+    uint32_t nchunks = (_chunks ? 2 * (_chunk_mask + 1) : 16);
+    char *alloc = new char[nchunks * sizeof(Chunk) + 63];
+    if (!alloc)
+	return -1;
+    // align chunks to cache lines
+    Chunk *chunks = reinterpret_cast<Chunk *>((reinterpret_cast<uintptr_t>(alloc) + 63) & ~(uintptr_t) 63);
+    memset(chunks, 0, nchunks * sizeof(Chunk));
+
+    Chunk *old_chunks = _chunks;
+    char *old_alloc = _chunks_alloc;
+    uint32_t old_nchunks = (old_chunks ? _chunk_mask + 1 : 0);
+    _chunks = chunks;
+    _chunks_alloc = alloc;
+    _chunk_mask = nchunks - 1;
+    _nflows = 0;
+
+    for (uint32_t ci = 0; ci < old_nchunks; ++ci)
+	for (unsigned m = old_chunks[ci].match(0) ^ ((1U << CHUNK_SLOTS) - 1);
+	     m; m &= m - 1) {
+	    uint32_t fi = old_chunks[ci]._slots[ffs_lsb(m) - 1];
+	    const FlowInfo *finfo = flow(fi);
+	    insert_flow(flow_hash(finfo->_hosts, finfo->_ports, finfo->_udp), fi);
+	}
+    delete[] old_alloc;
+    return 0;
+}
+
+void
+AggregateIPFlows::clean_flows()
+{
+    for (int i = 0; i < NEXP; ++i) {
+	for (uint32_t fi = _expiry[i]._head; fi; fi = flow(fi)->_expiry_next)
+	    trace_flow(fi);
+	_expiry[i] = ExpiryList();
+    }
+    for (FlowInfo **it = _flow_slabs.begin(); it != _flow_slabs.end(); ++it)
+	delete[] *it;
+    _flow_slabs.clear();
+#if CLICK_USERLEVEL
+    for (FlowStats **it = _stat_slabs.begin(); it != _stat_slabs.end(); ++it)
+	delete[] *it;
+    _stat_slabs.clear();
 #endif
-	if (really_delete)
-	    delete finfo;
+    delete[] _chunks_alloc;
+    _chunks = 0;
+    _chunks_alloc = 0;
+    _flow_free = _flow_limit = _nflows = 0;
 }
 
 void
 AggregateIPFlows::clean_map(Map &table)
 {
-    // free completed flows and emit fragments
+    // free held fragments
     for (Map::iterator iter = table.begin(); iter.live(); iter++) {
 	HostPairInfo *hpinfo = &iter.value();
 	while (Packet *p = hpinfo->_fragment_head) {
 	    hpinfo->_fragment_head = p->next();
 	    p->kill();
 	}
-	while (FlowInfo *f = hpinfo->_flows) {
-	    hpinfo->_flows = f->_next;
-	    delete_flowinfo(iter.key(), f);
-	}
     }
+    table.clear();
+}
+
+
+// expiry
+
+inline void
+AggregateIPFlows::expiry_push_back(int which, uint32_t fi)
+{
+    ExpiryList &el = _expiry[which];
+    FlowInfo *finfo = flow(fi);
+    finfo->_expiry_prev = el._tail;
+    finfo->_expiry_next = 0;
+    if (el._tail)
+	flow(el._tail)->_expiry_next = fi;
+    else
+	el._head = fi;
+    el._tail = fi;
+}
+
+inline void
+AggregateIPFlows::expiry_remove(int which, uint32_t fi)
+{
+    ExpiryList &el = _expiry[which];
+    FlowInfo *finfo = flow(fi);
+    if (finfo->_expiry_prev)
+	flow(finfo->_expiry_prev)->_expiry_next = finfo->_expiry_next;
+    else
+	el._head = finfo->_expiry_next;
+    if (finfo->_expiry_next)
+	flow(finfo->_expiry_next)->_expiry_prev = finfo->_expiry_prev;
+    else
+	el._tail = finfo->_expiry_prev;
+}
+
+inline void
+AggregateIPFlows::touch_flow(uint32_t fi)
+{
+    // move to the back of the expiry list for its current timeout
+    FlowInfo *finfo = flow(fi);
+    expiry_remove(finfo->_expiry, fi);
+    finfo->_expiry = (finfo->_udp ? EXP_UDP : finfo->_flow_over == 3 ? EXP_TCP_DONE : EXP_TCP);
+    expiry_push_back(finfo->_expiry, fi);
 }
 
 #if CLICK_USERLEVEL
 void
-AggregateIPFlows::stat_new_flow_hook(const Packet *p, FlowInfo *finfo)
+AggregateIPFlows::stat_new_flow_hook(const Packet *p, uint32_t fi)
 {
-    StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
+    FlowStats *sinfo = flow_stats(fi);
     sinfo->_first_timestamp = p->timestamp_anno();
     sinfo->_filepos = 0;
     if (_filepos_h)
@@ -236,8 +479,10 @@ AggregateIPFlows::stat_new_flow_hook(const Packet *p, FlowInfo *finfo)
 #endif
 
 inline void
-AggregateIPFlows::packet_emit_hook(const Packet *p, const click_ip *iph, FlowInfo *finfo)
+AggregateIPFlows::packet_emit_hook(const Packet *p, const click_ip *iph, uint32_t fi)
 {
+    FlowInfo *finfo = flow(fi);
+
     // account for timestamp
     finfo->_last_timestamp = p->timestamp_anno();
 
@@ -255,51 +500,59 @@ AggregateIPFlows::packet_emit_hook(const Packet *p, const click_ip *iph, FlowInf
 	else if (p->tcp_header()->th_flags & TH_SYN)
 	    finfo->_flow_over = 0;
     }
+    touch_flow(fi);
 
 #if CLICK_USERLEVEL
     // count packets
-    if (stats() && PAINT_ANNO(p) < 2) {
-	StatFlowInfo *sinfo = static_cast<StatFlowInfo *>(finfo);
-	sinfo->_packets[PAINT_ANNO(p)]++;
-    }
+    if (stats() && PAINT_ANNO(p) < 2)
+	flow_stats(fi)->_packets[PAINT_ANNO(p)]++;
 #endif
 }
 
 void
-AggregateIPFlows::reap_map(Map &table, uint32_t timeout, uint32_t done_timeout)
+AggregateIPFlows::reap_fragments(Map &m)
 {
-    timeout = _active_sec - timeout;
-    done_timeout = _active_sec - done_timeout;
     int frag_timeout = _active_sec - _fragment_timeout;
+    bool udp = (&m == &_udp_map);
 
-    // free completed flows and emit fragments
-    for (Map::iterator iter = table.begin(); iter.live(); iter++) {
+    // emit old fragments; forget host pairs with no fragments left
+    for (Map::iterator iter = m.begin(); iter.live(); ) {
 	HostPairInfo *hpinfo = &iter.value();
 	Packet *head;
-	// fragments
 	while ((head = hpinfo->_fragment_head)
 	       && (head->timestamp_anno().sec() < frag_timeout
 		   || !IP_ISFRAG(good_ip_header(head))))
-	    emit_fragment_head(hpinfo);
+	    emit_fragment_head(hpinfo, udp);
+	if (hpinfo->_fragment_head)
+	    iter++;
+	else
+	    iter = m.erase(iter);
+    }
+}
+
+void
+AggregateIPFlows::reap_flows(int which, uint32_t timeout)
+{
+    Map &m = (which == EXP_UDP ? _udp_map : _tcp_map);
+    timeout = _active_sec - timeout;
 
+    // free expired flows; flows blocked by held fragments keep their place
+    // at the front, so they are retried first once the fragments drain
+    uint32_t fi = _expiry[which]._head;
+    // circular comparison
+    while (fi && SEC_OLDER(flow(fi)->_last_timestamp.sec(), timeout)) {
+	FlowInfo *finfo = flow(fi);
+	uint32_t next = finfo->_expiry_next;
 	// can't delete any flows if there are fragments
-	if (hpinfo->_fragment_head)
-	    continue;
-
-	// completed flows
-	FlowInfo **pprev = &hpinfo->_flows;
-	FlowInfo *f = *pprev;
-	while (f) {
-	    // circular comparison
-	    if (SEC_OLDER(f->_last_timestamp.sec(), (f->_flow_over == 3 ? done_timeout : timeout))) {
-		notify(f->_aggregate, AggregateListener::DELETE_AGG, 0);
-		*pprev = f->_next;
-		delete_flowinfo(iter.key(), f);
-	    } else
-		pprev = &f->_next;
-	    f = *pprev;
+	HostPairInfo *hpinfo = (m.size() ? m.get_pointer(finfo->_hosts) : 0);
+	if (!hpinfo || !hpinfo->_fragment_head) {
+	    expiry_remove(which, fi);
+	    notify(finfo->_aggregate, AggregateListener::DELETE_AGG, 0);
+	    trace_flow(fi);
+	    remove_flow(fi);
+	    free_flow(fi);
 	}
-	// XXX never free host pairs
+	fi = next;
     }
 }
 
@@ -307,8 +560,11 @@ void
 AggregateIPFlows::reap()
 {
     if (_gc_sec) {
-	reap_map(_tcp_map, _tcp_timeout, _tcp_done_timeout);
-	reap_map(_udp_map, _udp_timeout, _udp_timeout);
+	reap_fragments(_tcp_map);
+	reap_fragments(_udp_map);
+	reap_flows(EXP_TCP, _tcp_timeout);
+	reap_flows(EXP_TCP_DONE, _tcp_done_timeout);
+	reap_flows(EXP_UDP, _udp_timeout);
     }
     _gc_sec = _active_sec + _gc_interval;
 }
@@ -333,9 +589,9 @@ AggregateIPFlows::icmp_encapsulated_header(const Packet *p)
 }
 
 int
-AggregateIPFlows::relevant_timeout(const FlowInfo *f, const Map &m) const
+AggregateIPFlows::relevant_timeout(const FlowInfo *f) const
 {
-    if (&m == &_udp_map)
+    if (f->_udp)
 	return _udp_timeout;
     else if (f->_flow_over == 3)
 	return _tcp_done_timeout;
@@ -345,71 +601,100 @@ AggregateIPFlows::relevant_timeout(const FlowInfo *f, const Map &m) const
 
 // XXX timing when fragments are merged back in?
 
-AggregateIPFlows::FlowInfo *
-AggregateIPFlows::find_flow_info(Map &m, HostPairInfo *hpinfo, uint32_t ports, bool flipped, const Packet *p)
-{
-    FlowInfo **pprev = &hpinfo->_flows;
-    for (FlowInfo *finfo = *pprev; finfo; pprev = &finfo->_next, finfo = finfo->_next)
-	if (finfo->_ports == ports) {
-	    // if this flow is actually dead (but has not yet been garbage
-	    // collected), then kill it for consistent semantics
-	    int age = p->timestamp_anno().sec() - finfo->_last_timestamp.sec();
-	    // 4.Feb.2004 - Also start a new flow if the old flow closed off,
-	    // and we have a SYN.
-	    if ((age > (int) _smallest_timeout
-		 && age > relevant_timeout(finfo, m))
-		|| (finfo->_flow_over == 3
-		    && p->ip_header()->ip_p == IP_PROTO_TCP
-		    && (p->tcp_header()->th_flags & TH_SYN))) {
-		// old aggregate has died
-		notify(finfo->aggregate(), AggregateListener::DELETE_AGG, 0);
-		const click_ip *iph = good_ip_header(p);
-		HostPair hp(iph->ip_src.s_addr, iph->ip_dst.s_addr);
-		delete_flowinfo(hp, finfo, false);
-
-		// make a new aggregate
-		finfo->_aggregate = _next;
-		_next++;
-		finfo->_reverse = flipped;
-		finfo->_flow_over = 0;
+uint32_t
+AggregateIPFlows::find_flow_info(const HostPair &hosts, uint32_t ports, bool udp, bool flipped, const Packet *p)
+{
+    uint64_t hash = flow_hash(hosts, ports, udp);
+    if (uint32_t fi = lookup_flow(hash, hosts, ports, udp)) {
+	FlowInfo *finfo = flow(fi);
+	// if this flow is actually dead (but has not yet been garbage
+	// collected), then kill it for consistent semantics
+	int age = p->timestamp_anno().sec() - finfo->_last_timestamp.sec();
+	// 4.Feb.2004 - Also start a new flow if the old flow closed off,
+	// and we have a SYN.
+	if ((age > (int) _smallest_timeout
+	     && age > relevant_timeout(finfo))
+	    || (finfo->_flow_over == 3
+		&& p->ip_header()->ip_p == IP_PROTO_TCP
+		&& (p->tcp_header()->th_flags & TH_SYN))) {
+	    // old aggregate has died
+	    notify(finfo->aggregate(), AggregateListener::DELETE_AGG, 0);
+	    trace_flow(fi);
+
+	    // make a new aggregate
+	    finfo->_aggregate = _next;
+	    _next++;
+	    finfo->_reverse = flipped;
+	    finfo->_flow_over = 0;
+	    finfo->_last_timestamp = p->timestamp_anno();
+	    touch_flow(fi);
 #if CLICK_USERLEVEL
-		if (stats())
-		    stat_new_flow_hook(p, finfo);
+	    if (stats())
+		stat_new_flow_hook(p, fi);
 #endif
-		notify(finfo->aggregate(), AggregateListener::NEW_AGG, p);
-	    }
-
-	    // otherwise, move to the front of the list and return
-	    *pprev = finfo->_next;
-	    finfo->_next = hpinfo->_flows;
-	    hpinfo->_flows = finfo;
-	    return finfo;
+	    notify(finfo->aggregate(), AggregateListener::NEW_AGG, p);
 	}
+	return fi;
+    }
 
-    // make and install new FlowInfo pair
-    FlowInfo *finfo;
+    // make and install new flow
+    uint32_t capacity = (_chunk_mask + 1) * CHUNK_SLOTS;
+    if (_nflows >= capacity - 2 * (_chunk_mask + 1)
+	&& grow_flows() < 0
+	&& _nflows == capacity)
+	return 0;
+    uint32_t fi = alloc_flow();
+    if (!fi)
+	return 0;
+    FlowInfo *finfo = flow(fi);
+    finfo->_hosts = hosts;
+    finfo->_ports = ports;
+    finfo->_aggregate = _next;
+    // the packet might be held as a fragment, so set the timestamp now
+    finfo->_last_timestamp = p->timestamp_anno();
+    finfo->_flow_over = 0;
+    finfo->_reverse = flipped;
+    finfo->_udp = udp;
+    finfo->_expiry = (udp ? EXP_UDP : EXP_TCP);
+    expiry_push_back(finfo->_expiry, fi);
+    insert_flow(hash, fi);
 #if CLICK_USERLEVEL
     if (stats()) {
-	finfo = new StatFlowInfo(ports, hpinfo->_flows, _next);
-	stat_new_flow_hook(p, finfo);
-    } else
+	FlowStats *sinfo = flow_stats(fi);
+	sinfo->_packets[0] = sinfo->_packets[1] = 0;
+	stat_new_flow_hook(p, fi);
+    }
 #endif
-	finfo = new FlowInfo(ports, hpinfo->_flows, _next);
-
-    finfo->_reverse = flipped;
-    hpinfo->_flows = finfo;
     _next++;
     notify(finfo->aggregate(), AggregateListener::NEW_AGG, p);
-    return finfo;
+    return fi;
+}
+
+uint32_t
+AggregateIPFlows::fragment_flow(const Packet *p, bool udp)
+{
+    // look up the flow of a held first fragment
+    const click_ip *iph = good_ip_header(p);
+    HostPair hosts(iph->ip_src.s_addr, iph->ip_dst.s_addr);
+    const uint8_t *udp_ptr = reinterpret_cast<const uint8_t *>(iph) + (iph->ip_hl << 2);
+    uint32_t ports = *reinterpret_cast<const uint32_t *>(udp_ptr);
+    bool flipped = (hosts.a != iph->ip_src.s_addr);
+    if (hosts.a == hosts.b && ports_reverse_order(ports))
+	flipped = !flipped;
+    if (flipped)
+	ports = flip_ports(ports);
+    return lookup_flow(flow_hash(hosts, ports, udp), hosts, ports, udp);
 }
 
 void
-AggregateIPFlows::emit_fragment_head(HostPairInfo *hpinfo)
+AggregateIPFlows::emit_fragment_head(HostPairInfo *hpinfo, bool udp)
 {
     Packet *head = hpinfo->_fragment_head;
     hpinfo->_fragment_head = head->next();
 
     const click_ip *iph = good_ip_header(head);
+    // the first fragment has the port numbers
+    const Packet *first = (IP_FIRSTFRAG(iph) ? head : 0);
     // XXX multiple linear traversals of entire fragment list!
     // want a faster method that takes up little memory?
 
@@ -425,6 +710,8 @@ AggregateIPFlows::emit_fragment_head(HostPairInfo *hpinfo)
 		&& AGGREGATE_ANNO(p)) {
 		SET_AGGREGATE_ANNO(head, AGGREGATE_ANNO(p));
 		SET_PAINT_ANNO(head, PAINT_ANNO(p));
+		if (IP_FIRSTFRAG(good_ip_header(p)))
+		    first = p;
 		goto find_flowinfo;
 	    }
 	head->kill();
@@ -432,23 +719,31 @@ AggregateIPFlows::emit_fragment_head(HostPairInfo *hpinfo)
     }
 
   find_flowinfo:
-    // find the packet's FlowInfo
-    FlowInfo *finfo, **pprev = &hpinfo->_flows;
-    for (finfo = *pprev; finfo; pprev = &finfo->_next, finfo = *pprev)
-	if (finfo->_aggregate == AGGREGATE_ANNO(head)) {
-	    *pprev = finfo->_next;
-	    finfo->_next = hpinfo->_flows;
-	    hpinfo->_flows = finfo;
-	    break;
-	}
+    // find the packet's flow; remember fragmented datagrams' flows for
+    // their later fragments
+    uint32_t fi = 0;
+    if (first) {
+	fi = fragment_flow(first, udp);
+	// The flow might have been renumbered since the fragment arrived.
+	if (fi && flow(fi)->_aggregate != AGGREGATE_ANNO(head))
+	    fi = 0;
+	else if (fi && IP_ISFRAG(good_ip_header(first))
+		 && find(hpinfo->_flows.begin(), hpinfo->_flows.end(), fi) == hpinfo->_flows.end())
+	    hpinfo->_flows.push_back(fi);
+    } else
+	for (uint32_t *it = hpinfo->_flows.begin(); it != hpinfo->_flows.end(); ++it)
+	    if (flow(*it)->_aggregate == AGGREGATE_ANNO(head)) {
+		fi = *it;
+		break;
+	    }
 
-    assert(finfo);
-    packet_emit_hook(head, iph, finfo);
+    if (fi)
+	packet_emit_hook(head, iph, fi);
     output(0).push(head);
 }
 
 int
-AggregateIPFlows::handle_fragment(Packet *p, HostPairInfo *hpinfo)
+AggregateIPFlows::handle_fragment(Packet *p, HostPairInfo *hpinfo, bool udp)
 {
     if (hpinfo->_fragment_head)
 	hpinfo->_fragment_tail->set_next(p);
@@ -464,7 +759,7 @@ AggregateIPFlows::handle_fragment(Packet *p, HostPairInfo *hpinfo)
     while ((head = hpinfo->_fragment_head)
 	   && (head->timestamp_anno().sec() < frag_timeout
 	       || !IP_ISFRAG(good_ip_header(head))))
-	emit_fragment_head(hpinfo);
+	emit_fragment_head(hpinfo, udp);
 
     return ACT_NONE;
 }
@@ -497,15 +792,16 @@ AggregateIPFlows::handle_packet(Packet *p)
 	|| (iph->ip_src.s_addr == 0 && iph->ip_dst.s_addr == 0))
 	return ACT_DROP;
 
-    // find relevant HostPairInfo
-    Map &m = (iph->ip_p == IP_PROTO_TCP ? _tcp_map : _udp_map);
+    // find held fragments, if any
+    bool udp = (iph->ip_p == IP_PROTO_UDP);
+    Map &m = (udp ? _udp_map : _tcp_map);
     HostPair hosts(iph->ip_src.s_addr, iph->ip_dst.s_addr);
     if (hosts.a != iph->ip_src.s_addr)
 	paint ^= 1;
-    HostPairInfo *hpinfo = &m[hosts];
+    HostPairInfo *hpinfo = (m.size() ? m.get_pointer(hosts) : 0);
 
-    // find relevant FlowInfo, if any
-    FlowInfo *finfo;
+    // find relevant flow, if any
+    uint32_t fi;
     if (IP_FIRSTFRAG(iph)) {
 	const uint8_t *udp_ptr = reinterpret_cast<const uint8_t *>(iph) + (iph->ip_hl << 2);
 	if (udp_ptr + 4 > p->end_data())
@@ -520,11 +816,12 @@ AggregateIPFlows::handle_packet(Packet *p)
 	if (paint & 1)
 	    ports = flip_ports(ports);
 
-	finfo = find_flow_info(m, hpinfo, ports, paint & 1, p);
-	if (!finfo) {
+	fi = find_flow_info(hosts, ports, udp, paint & 1, p);
+	if (!fi) {
 	    click_chatter("out of memory!");
 	    return ACT_DROP;
 	}
+	FlowInfo *finfo = flow(fi);
 	if (finfo->reverse())
 	    paint ^= 1;
 
@@ -532,24 +829,27 @@ AggregateIPFlows::handle_packet(Packet *p)
 	SET_AGGREGATE_ANNO(p, finfo->aggregate());
 	SET_PAINT_ANNO(p, paint);
     } else {
-	finfo = 0;
+	fi = 0;
 	SET_AGGREGATE_ANNO(p, 0);
 	SET_PAINT_ANNO(p, paint);
     }
 
     // check for fragment
-    if ((_fragments && IP_ISFRAG(iph)) || hpinfo->_fragment_head)
-	return handle_fragment(p, hpinfo);
-    else if (!finfo)
+    if ((_fragments && IP_ISFRAG(iph)) || (hpinfo && hpinfo->_fragment_head)) {
+	if (!hpinfo)
+	    hpinfo = &m[hosts];
+	return handle_fragment(p, hpinfo, udp);
+    } else if (!fi)
 	return ACT_DROP;
 
     // packet emit hook
     _active_sec = p->timestamp_anno().sec();
-    packet_emit_hook(p, iph, finfo);
+    packet_emit_hook(p, iph, fi);
 
     return ACT_EMIT;
 }
 
+
 void
 AggregateIPFlows::push(int, Packet *p)
 {
@@ -95,7 +95,10 @@ The timeout for fragments, in seconds, Default is 30 seconds.
 
 =item REAP
 
-The garbage collection interval. Default is 20 minutes of packet time.
+The garbage collection interval. Each collection frees only the flows that
+have timed out, and the host pairs left without flows or fragments, so its
+cost is proportional to the number of expired flows. Default is 1 second of
+packet time.
 
 =item ICMP
 
@@ -177,41 +180,82 @@ class AggregateIPFlows : public Element, public AggregateNotifier { public:
 
   private:
 
+    // Flow records live in slabs of FLOW_SLAB records and are named by
+    // index; index 0 means no flow. Free records are chained through
+    // _expiry_next.
     struct FlowInfo {
+	HostPair _hosts;
 	uint32_t _ports;
 	uint32_t _aggregate;
 	Timestamp _last_timestamp;
 	unsigned _flow_over : 2;
 	bool _reverse : 1;
-	FlowInfo *_next;
-	// have 24 bytes; statistics would double
-	// + 8 + 8 = 16 bytes
-	FlowInfo(uint32_t ports, FlowInfo *next, uint32_t agg) : _ports(ports), _aggregate(agg), _flow_over(0), _next(next) { }
+	bool _udp : 1;
+	unsigned _expiry : 2;
+	uint32_t _expiry_prev;	// expiry list, least recently used first
+	uint32_t _expiry_next;
 	uint32_t aggregate() const { return _aggregate; }
 	bool reverse() const	{ return _reverse; }
     };
 
 #if CLICK_USERLEVEL
-    struct StatFlowInfo : public FlowInfo {
+    struct FlowStats {
 	Timestamp _first_timestamp;
 	uint32_t _filepos;
 	uint32_t _packets[2];
-	StatFlowInfo(uint32_t ports, FlowInfo *next, uint32_t agg) : FlowInfo(ports, next, agg) { _packets[0] = _packets[1] = 0; }
     };
 #endif
 
+    enum { FLOW_SLAB_SHIFT = 12, FLOW_SLAB = 1 << FLOW_SLAB_SHIFT };
+    Vector<FlowInfo *> _flow_slabs;
+#if CLICK_USERLEVEL
+    Vector<FlowStats *> _stat_slabs;
+#endif
+    uint32_t _flow_free;
+    uint32_t _flow_limit;
+
+    // The flow table is open addressed by the full flow key. Each chunk
+    // fills one cache line: CHUNK_SLOTS one-byte tags, which are compared
+    // in parallel, then the slots' flow indexes. A chunk's overflow count
+    // says how many flows probed past it, so lookups can stop at the
+    // first chunk nobody overflowed.
+    enum { CHUNK_SLOTS = 12 };
+    struct Chunk {
+	uint8_t _tags[16];	// CHUNK_SLOTS tags, overflow count, padding
+	uint32_t _slots[CHUNK_SLOTS];
+	inline unsigned match(uint8_t tag) const;
+	uint8_t &overflow()	{ return _tags[CHUNK_SLOTS]; }
+    };
+    Chunk *_chunks;
+    char *_chunks_alloc;
+    uint32_t _chunk_mask;
+    uint32_t _nflows;
+
+    // Host pairs with fragments waiting for their port numbers. The
+    // _flows list remembers the flows of fragments already emitted, for
+    // the datagrams' later fragments.
     struct HostPairInfo {
-	FlowInfo *_flows;
 	Packet *_fragment_head;
 	Packet *_fragment_tail;
-	HostPairInfo() : _flows(0), _fragment_head(0), _fragment_tail(0) { }
-	FlowInfo *find_force(uint32_t ports);
+	Vector<uint32_t> _flows;
+	HostPairInfo() : _fragment_head(0), _fragment_tail(0) { }
     };
 
     typedef HashTable<HostPair, HostPairInfo> Map;
     Map _tcp_map;
     Map _udp_map;
 
+    // Flows are kept on one of three expiry lists, one per timeout, in
+    // order of last use. Reaping frees expired flows from the fronts,
+    // leaving in place those whose host pair still holds fragments.
+    enum { EXP_TCP, EXP_TCP_DONE, EXP_UDP, NEXP };
+    struct ExpiryList {
+	uint32_t _head;
+	uint32_t _tail;
+	ExpiryList() : _head(0), _tail(0) { }
+    };
+    ExpiryList _expiry[NEXP];
+
     uint32_t _next;
     unsigned _active_sec;
     unsigned _gc_sec;
@@ -238,23 +282,43 @@ class AggregateIPFlows : public Element, public AggregateNotifier { public:
 
     static const click_ip *icmp_encapsulated_header(const Packet *);
 
+    FlowInfo *flow(uint32_t fi) const {
+	return &_flow_slabs[fi >> FLOW_SLAB_SHIFT][fi & (FLOW_SLAB - 1)];
+    }
+#if CLICK_USERLEVEL
+    FlowStats *flow_stats(uint32_t fi) const {
+	return &_stat_slabs[fi >> FLOW_SLAB_SHIFT][fi & (FLOW_SLAB - 1)];
+    }
+#endif
+    uint32_t alloc_flow();
+    inline void free_flow(uint32_t fi);
+    uint32_t lookup_flow(uint64_t hash, const HostPair &, uint32_t ports, bool udp) const;
+    void insert_flow(uint64_t hash, uint32_t fi);
+    void remove_flow(uint32_t fi);
+    int grow_flows();
+    void clean_flows();
     void clean_map(Map &);
-    void reap_map(Map &, uint32_t, uint32_t);
+
+    inline void expiry_push_back(int which, uint32_t fi);
+    inline void expiry_remove(int which, uint32_t fi);
+
+    void reap_fragments(Map &);
+    void reap_flows(int which, uint32_t timeout);
     void reap();
 
-    inline int relevant_timeout(const FlowInfo *, const Map &) const;
+    inline int relevant_timeout(const FlowInfo *) const;
 #if CLICK_USERLEVEL
-    void stat_new_flow_hook(const Packet *, FlowInfo *);
+    void stat_new_flow_hook(const Packet *, uint32_t fi);
 #endif
-    inline void packet_emit_hook(const Packet *, const click_ip *, FlowInfo *);
-    inline void delete_flowinfo(const HostPair &, FlowInfo *, bool really_delete = true);
-    void emit_fragment_head(HostPairInfo *hpinfo);
-    FlowInfo *find_flow_info(Map &, HostPairInfo *, uint32_t ports, bool flipped, const Packet *);
-
-    FlowInfo *uncommon_case(FlowInfo *finfo, const click_ip *iph);
+    inline void touch_flow(uint32_t fi);
+    inline void packet_emit_hook(const Packet *, const click_ip *, uint32_t fi);
+    inline void trace_flow(uint32_t fi);
+    void emit_fragment_head(HostPairInfo *hpinfo, bool udp);
+    uint32_t find_flow_info(const HostPair &, uint32_t ports, bool udp, bool flipped, const Packet *);
+    uint32_t fragment_flow(const Packet *, bool udp);
 
     enum { ACT_EMIT, ACT_DROP, ACT_NONE };
-    int handle_fragment(Packet *, HostPairInfo *);
+    int handle_fragment(Packet *, HostPairInfo *, bool udp);
     int handle_packet(Packet *);
 
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
@@ -14,6 +14,9 @@
 static inline uint32_t bswap_32(uint32_t u) {
     return ((u >> 24) | ((u & 0xff0000) >> 8) | ((u & 0xff00) << 8) | ((u & 0xff) << 24));
 }
+static inline uint64_t bswap_64(uint64_t u) {
+    return ((uint64_t) bswap_32(u) << 32) | bswap_32(u >> 32);
+}
 #endif
 
 
@@ -381,8 +384,8 @@ AggregateTree::sum_and_sum_sq(double *sum, double *sum_sq) const
 }
 
 
-static uint32_t *
-node_active_counts(AggregateTree::Node *n, uint32_t *vec)
+static uint64_t *
+node_active_counts(AggregateTree::Node *n, uint64_t *vec)
 {
     if (n->count)
 	*vec++ = n->count;
@@ -394,11 +397,11 @@ node_active_counts(AggregateTree::Node *n, uint32_t *vec)
 }
 
 void
-AggregateTree::active_counts(Vector<uint32_t> &vec) const
+AggregateTree::active_counts(Vector<uint64_t> &vec) const
 {
     vec.resize(_num_nonzero);
     if (_num_nonzero) {
-	uint32_t *end_vec = node_active_counts(_root, &vec[0]);
+	uint64_t *end_vec = node_active_counts(_root, &vec[0]);
 	assert((uint32_t)(end_vec - &vec[0]) == _num_nonzero);
 	(void) end_vec;
     }
@@ -406,7 +409,7 @@ AggregateTree::active_counts(Vector<uint32_t> &vec) const
 
 
 void
-AggregateTree::node_randomly_assign_counts(Node *n, Vector<uint32_t> &v)
+AggregateTree::node_randomly_assign_counts(Node *n, Vector<uint64_t> &v)
 {
     if (n->count) {
 	int which = random() % v.size();
@@ -423,10 +426,10 @@ AggregateTree::node_randomly_assign_counts(Node *n, Vector<uint32_t> &v)
 }
 
 void
-AggregateTree::randomly_assign_counts(const Vector<uint32_t> &vec)
+AggregateTree::randomly_assign_counts(const Vector<uint64_t> &vec)
 {
     assert((uint32_t) vec.size() == _num_nonzero);
-    Vector<uint32_t> v(vec);
+    Vector<uint64_t> v(vec);
     node_randomly_assign_counts(_root, v);
 }
 
@@ -461,7 +464,7 @@ void
 AggregateTree::node_sample(Node *n, uint32_t taking)
 {
     if (n->count) {
-	for (uint32_t i = n->count; i > 0; i--)
+	for (uint64_t i = n->count; i > 0; i--)
 	    if (((uint32_t)random()) >= taking)
 		n->count--;
 	if (!n->count)
@@ -525,7 +528,7 @@ AggregateTree::cut_larger(uint32_t largest)
 
 
 void
-AggregateTree::node_cut_aggregates(Node *n, uint32_t mask, uint32_t &value, uint32_t &count, uint32_t size_boundary, bool smallerp, bool hostsp)
+AggregateTree::node_cut_aggregates(Node *n, uint32_t mask, uint32_t &value, uint64_t &count, uint32_t size_boundary, bool smallerp, bool hostsp)
 {
     if ((n->aggregate & mask) != value) {
 	assert((n->aggregate & mask) > value);
@@ -545,7 +548,8 @@ AggregateTree::node_cut_aggregates(Node *n, uint32_t mask, uint32_t &value, uint
 void
 AggregateTree::cut_smaller_aggregates(int p, uint32_t smallest)
 {
-    uint32_t value = 0, count = 0;
+    uint32_t value = 0;
+    uint64_t count = 0;
     uint32_t mask = prefix_to_mask(p);
     node_cut_aggregates(_root, mask, value, count, smallest, true, false);
     if (count && count < smallest)
@@ -555,7 +559,8 @@ AggregateTree::cut_smaller_aggregates(int p, uint32_t smallest)
 void
 AggregateTree::cut_larger_aggregates(int p, uint32_t largest)
 {
-    uint32_t value = 0, count = 0;
+    uint32_t value = 0;
+    uint64_t count = 0;
     uint32_t mask = prefix_to_mask(p);
     node_cut_aggregates(_root, mask, value, count, largest, false, false);
     if (count && count >= largest)
@@ -565,7 +570,8 @@ AggregateTree::cut_larger_aggregates(int p, uint32_t largest)
 void
 AggregateTree::cut_smaller_host_aggregates(int p, uint32_t smallest)
 {
-    uint32_t value = 0, count = 0;
+    uint32_t value = 0;
+    uint64_t count = 0;
     uint32_t mask = prefix_to_mask(p);
     node_cut_aggregates(_root, mask, value, count, smallest, true, true);
     if (count && count < smallest)
@@ -575,7 +581,8 @@ AggregateTree::cut_smaller_host_aggregates(int p, uint32_t smallest)
 void
 AggregateTree::cut_larger_host_aggregates(int p, uint32_t largest)
 {
-    uint32_t value = 0, count = 0;
+    uint32_t value = 0;
+    uint64_t count = 0;
     uint32_t mask = prefix_to_mask(p);
     node_cut_aggregates(_root, mask, value, count, largest, false, true);
     if (count && count >= largest)
@@ -708,13 +715,13 @@ node_balance(AggregateTree::Node *n, AggregateTree::Node **last,
 	assert((n->aggregate & (~prefix_mask >> 1)) == 0);
 	if (*last && ((*last)->aggregate & prefix_mask) == (n->aggregate & prefix_mask)) {
 	    assert(n->aggregate & ~prefix_mask);
-	    fprintf(f, "%u %u %u\n", (n->aggregate & prefix_mask), (*last)->count, n->count);
+	    fprintf(f, "%u %llu %llu\n", (n->aggregate & prefix_mask), (unsigned long long) (*last)->count, (unsigned long long) n->count);
 	    *last = 0;
 	} else {
 	    if (*last)
-		fprintf(f, "%u %u 0\n", ((*last)->aggregate & prefix_mask), (*last)->count);
+		fprintf(f, "%u %llu 0\n", ((*last)->aggregate & prefix_mask), (unsigned long long) (*last)->count);
 	    if (n->aggregate & ~prefix_mask) {
-		fprintf(f, "%u 0 %u\n", (n->aggregate & prefix_mask), n->count);
+		fprintf(f, "%u 0 %llu\n", (n->aggregate & prefix_mask), (unsigned long long) n->count);
 		*last = 0;
 	    } else
 		*last = n;
@@ -735,7 +742,7 @@ AggregateTree::balance(int p, FILE *f) const
     uint32_t prefix_mask = prefix_to_mask(p);
     node_balance(_root, &last, prefix_mask, f);
     if (last)
-	fprintf(f, "%u %u 0\n", (last->aggregate & prefix_mask), last->count);
+	fprintf(f, "%u %llu 0\n", (last->aggregate & prefix_mask), (unsigned long long) last->count);
 }
 
 
@@ -1126,21 +1133,32 @@ AggregateTree::take_nonzero_sizes(const AggregateTree &other, uint32_t mask)
 //
 
 void
-AggregateTree::read_packed_file(FILE *f, int file_byte_order)
+AggregateTree::read_packed_file(FILE *f, int file_byte_order, bool wide)
 {
     uint32_t ubuf[BUFSIZ];
     _read_format = WR_BINARY;
-    if (file_byte_order == CLICK_BYTE_ORDER) {
+    bool swap = (file_byte_order != CLICK_BYTE_ORDER);
+    if (!wide) {
 	while (!feof(f) && !ferror(f)) {
 	    size_t howmany = fread(ubuf, 8, BUFSIZ / 2, f);
 	    for (size_t i = 0; i < howmany; i++)
-		add(ubuf[2*i], ubuf[2*i + 1]);
+		if (swap)
+		    add(bswap_32(ubuf[2*i]), bswap_32(ubuf[2*i + 1]));
+		else
+		    add(ubuf[2*i], ubuf[2*i + 1]);
 	}
     } else {
+	// 12-byte records: 32-bit aggregate, then 64-bit count
 	while (!feof(f) && !ferror(f)) {
-	    size_t howmany = fread(ubuf, 8, BUFSIZ / 2, f);
-	    for (size_t i = 0; i < howmany; i++)
-		add(bswap_32(ubuf[2*i]), bswap_32(ubuf[2*i + 1]));
+	    size_t howmany = fread(ubuf, 12, BUFSIZ / 3, f);
+	    for (size_t i = 0; i < howmany; i++) {
+		uint64_t count;
+		memcpy(&count, &ubuf[3*i + 1], sizeof(count));
+		if (swap)
+		    add(bswap_32(ubuf[3*i]), bswap_64(count));
+		else
+		    add(ubuf[3*i], count);
+	    }
 	}
     }
 }
@@ -1149,7 +1167,8 @@ int
 AggregateTree::read_file(FILE *f, ErrorHandler *errh)
 {
     char s[BUFSIZ];
-    uint32_t agg, value, b[4];
+    uint32_t agg, b[4];
+    unsigned long long value;
     _read_format = WR_ASCII;
     while (fgets(s, BUFSIZ, f)) {
 	if (strlen(s) == BUFSIZ - 1 && s[BUFSIZ - 2] != '\n')
@@ -1157,14 +1176,18 @@ AggregateTree::read_file(FILE *f, ErrorHandler *errh)
 	if (s[0] == '$' || s[0] == '!') {
 	    if (strcmp(s + 1, "packed\n") == 0) {
 		errh->warning("file marked '$packed'; change to refer to true byte order");
-		read_packed_file(f, CLICK_LITTLE_ENDIAN);
+		read_packed_file(f, CLICK_LITTLE_ENDIAN, false);
 	    } else if (strcmp(s + 1, "packed_le\n") == 0)
-		read_packed_file(f, CLICK_LITTLE_ENDIAN);
+		read_packed_file(f, CLICK_LITTLE_ENDIAN, false);
 	    else if (strcmp(s + 1, "packed_be\n") == 0)
-		read_packed_file(f, CLICK_BIG_ENDIAN);
-	} else if (sscanf(s, "%u %u", &agg, &value) == 2)
+		read_packed_file(f, CLICK_BIG_ENDIAN, false);
+	    else if (strcmp(s + 1, "packed64_le\n") == 0)
+		read_packed_file(f, CLICK_LITTLE_ENDIAN, true);
+	    else if (strcmp(s + 1, "packed64_be\n") == 0)
+		read_packed_file(f, CLICK_BIG_ENDIAN, true);
+	} else if (sscanf(s, "%u %llu", &agg, &value) == 2)
 	    add(agg, value);
-	else if (sscanf(s, "%u.%u.%u.%u %u", &b[0], &b[1], &b[2], &b[3], &value) == 5
+	else if (sscanf(s, "%u.%u.%u.%u %llu", &b[0], &b[1], &b[2], &b[3], &value) == 5
 		 && b[0] < 256 && b[1] < 256 && b[2] < 256 && b[3] < 256) {
 	    add((b[0]<<24) | (b[1]<<16) | (b[2]<<8) | b[3], value);
 	    _read_format = WR_ASCII_IP;
@@ -1175,18 +1198,31 @@ AggregateTree::read_file(FILE *f, ErrorHandler *errh)
     return 0;
 }
 
+// Records are buffered as 32-bit words in host byte order. WR_BINARY
+// records are two words, aggregate then count; other records are an
+// aggregate followed by a 64-bit count, which is exactly a WR_BINARY64
+// file record.
+
+static inline unsigned long long
+record_count(const uint32_t *r)
+{
+    uint64_t count;
+    memcpy(&count, r + 1, sizeof(count));
+    return count;
+}
+
 void
 AggregateTree::write_batch(FILE *f, WriteFormat format,
 			   uint32_t *buffer, int pos, ErrorHandler *)
 {
-    if (format == WR_BINARY)
+    if (format == WR_BINARY || format == WR_BINARY64)
 	fwrite(buffer, sizeof(uint32_t), pos, f);
     else if (format == WR_ASCII_IP)
-	for (int i = 0; i < pos; i += 2)
-	    fprintf(f, "%d.%d.%d.%d %u\n", (buffer[i] >> 24) & 255, (buffer[i] >> 16) & 255, (buffer[i] >> 8) & 255, buffer[i] & 255, buffer[i+1]);
+	for (int i = 0; i < pos; i += 3)
+	    fprintf(f, "%d.%d.%d.%d %llu\n", (buffer[i] >> 24) & 255, (buffer[i] >> 16) & 255, (buffer[i] >> 8) & 255, buffer[i] & 255, record_count(buffer + i));
     else
-	for (int i = 0; i < pos; i += 2)
-	    fprintf(f, "%u %u\n", buffer[i], buffer[i+1]);
+	for (int i = 0; i < pos; i += 3)
+	    fprintf(f, "%u %llu\n", buffer[i], record_count(buffer + i));
 }
 
 void
@@ -1195,9 +1231,15 @@ AggregateTree::write_nodes(Node *n, FILE *f, WriteFormat format,
 			   ErrorHandler *errh)
 {
     if (n->count > 0) {
-	buffer[pos++] = n->aggregate;
-	buffer[pos++] = n->count;
-	if (pos == len) {
+	buffer[pos] = n->aggregate;
+	if (format == WR_BINARY) {
+	    buffer[pos + 1] = n->count;
+	    pos += 2;
+	} else {
+	    memcpy(&buffer[pos + 1], &n->count, sizeof(n->count));
+	    pos += 3;
+	}
+	if (pos + 3 > len) {
 	    write_batch(f, format, buffer, pos, errh);
 	    pos = 0;
 	}
@@ -1213,31 +1255,49 @@ void
 AggregateTree::write_hex_nodes(Node *n, FILE *f, ErrorHandler *errh)
 {
     if (n->count > 0)
-	fprintf(f, "%08x %u\n", n->aggregate, n->count);
+	fprintf(f, "%08x %llu\n", n->aggregate, (unsigned long long) n->count);
     if (n->child[0])
 	write_hex_nodes(n->child[0], f, errh);
     if (n->child[1])
 	write_hex_nodes(n->child[1], f, errh);
 }
 
+static uint64_t
+node_max_count(AggregateTree::Node *n)
+{
+    uint64_t m = n->count;
+    if (n->child[0]) {
+	uint64_t m0 = node_max_count(n->child[0]);
+	uint64_t m1 = node_max_count(n->child[1]);
+	m = (m0 > m ? m0 : m);
+	m = (m1 > m ? m1 : m);
+    }
+    return m;
+}
+
 int
 AggregateTree::write_file(FILE *f, WriteFormat format, ErrorHandler *errh) const
 {
+    if (format == WR_BINARY && node_max_count(_root) > 0xFFFFFFFFU)
+	format = WR_BINARY64;
+
     fprintf(f, "!num_nonzero %u\n", _num_nonzero);
-    if (format == WR_BINARY) {
+    if (format == WR_BINARY || format == WR_BINARY64) {
+	const char *wide = (format == WR_BINARY64 ? "64" : "");
 #if CLICK_BYTE_ORDER == CLICK_BIG_ENDIAN
-	fprintf(f, "!packed_be\n");
+	fprintf(f, "!packed%s_be\n", wide);
 #elif CLICK_BYTE_ORDER == CLICK_LITTLE_ENDIAN
-	fprintf(f, "!packed_le\n");
+	fprintf(f, "!packed%s_le\n", wide);
 #else
+	(void) wide;
 	format = WR_ASCII;
 #endif
     } else if (format == WR_ASCII_IP)
 	fprintf(f, "!ip\n");
 
-    uint32_t buf[1024];
+    uint32_t buf[1536];
     int pos = 0;
-    write_nodes(_root, f, format, buf, pos, 1024, errh);
+    write_nodes(_root, f, format, buf, pos, 1536, errh);
     if (pos)
 	write_batch(f, format, buf, pos, errh);
 
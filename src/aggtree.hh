@@ -8,7 +8,8 @@ struct AggregateWTree_WNode;
 
 class AggregateTree { public:
 
-    enum WriteFormat { WR_UNKNOWN = -1, WR_ASCII = 0, WR_BINARY = 1, WR_ASCII_IP = 2 };
+    enum WriteFormat { WR_UNKNOWN = -1, WR_ASCII = 0, WR_BINARY = 1, WR_ASCII_IP = 2,
+		       WR_BINARY64 = 3 };
 
     AggregateTree();
     AggregateTree(const AggregateTree &);
@@ -21,7 +22,7 @@ class AggregateTree { public:
     uint32_t nnz() const			{ return _num_nonzero; }
     uint32_t nnz_match(uint32_t mask, uint32_t value) const;
 
-    inline void add(uint32_t aggregate, int32_t count = 1);
+    inline void add(uint32_t aggregate, int64_t count = 1);
     void zero_aggregate(int, uint32_t);
     void zero_masked_aggregate(uint32_t, uint32_t);
 
@@ -45,8 +46,8 @@ class AggregateTree { public:
 
     void haar_wavelet_energy_coeff(Vector<double> &) const;
 
-    void active_counts(Vector<uint32_t> &) const;
-    void randomly_assign_counts(const Vector<uint32_t> &);
+    void active_counts(Vector<uint64_t> &) const;
+    void randomly_assign_counts(const Vector<uint64_t> &);
 
     void sum_and_sum_sq(double *, double *) const;
 
@@ -73,7 +74,7 @@ class AggregateTree { public:
 
     struct Node {
 	uint32_t aggregate;
-	uint32_t count;
+	uint64_t count;
 	union {
 	    Node *child[2];
 	    AggregateWTree_WNode *wchild[2];
@@ -109,14 +110,14 @@ class AggregateTree { public:
     void node_sample(Node *, uint32_t);
     void node_cut_smaller(Node *, uint32_t);
     void node_cut_larger(Node *, uint32_t);
-    void node_cut_aggregates(Node *, uint32_t, uint32_t &, uint32_t &, uint32_t, bool smaller, bool hosts);
+    void node_cut_aggregates(Node *, uint32_t, uint32_t &, uint64_t &, uint32_t, bool smaller, bool hosts);
     void node_keep_common_hosts(Node *, const Node *[], int &, bool);
     void node_drop_common_hosts(Node *, const Node *[], int &);
     void node_drop_common_unequal_hosts(Node *, const Node *[], int &);
     void node_take_nonzero_sizes(Node *, const Node *[], int &, uint32_t);
-    void node_randomly_assign_counts(Node *, Vector<uint32_t> &);
+    void node_randomly_assign_counts(Node *, Vector<uint64_t> &);
 
-    void read_packed_file(FILE *, int file_byte_order);
+    void read_packed_file(FILE *, int file_byte_order, bool wide);
     static void write_batch(FILE *, WriteFormat, uint32_t *, int, ErrorHandler *);
     static void write_nodes(Node *, FILE *, WriteFormat, uint32_t *, int &, int, ErrorHandler *);
     static void write_hex_nodes(Node *, FILE *, ErrorHandler *);
@@ -144,13 +145,13 @@ AggregateTree::free_node(Node *n)
 }
 
 inline void
-AggregateTree::add(uint32_t aggregate, int32_t count)
+AggregateTree::add(uint32_t aggregate, int64_t count)
 {
     if (count == 0)
 	/* nada */;
     else if (Node *n = find_node(aggregate)) {
 	n->count += count;
-	if (n->count == (uint32_t)count)
+	if (n->count == (uint64_t)count)
 	    _num_nonzero++;
 	else if (n->count == 0)
 	    _num_nonzero--;
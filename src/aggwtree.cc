@@ -142,9 +142,9 @@ AggregateWTree::kill_all_nodes()
 // check to see tree is OK
 //
 
-static uint32_t NODE_OK_ERROR = (uint32_t) ErrorHandler::error_result;
+static uint64_t NODE_OK_ERROR = (uint64_t) ErrorHandler::error_result;
 
-uint32_t
+uint64_t
 AggregateWTree::node_ok(WNode *n, int last_swivel, uint32_t *nnz_ptr,
 			ErrorHandler *errh) const
 {
@@ -152,7 +152,7 @@ AggregateWTree::node_ok(WNode *n, int last_swivel, uint32_t *nnz_ptr,
 
     if (n->count && nnz_ptr)
 	(*nnz_ptr)++;
-    uint32_t local_count = node_local_count(n);
+    uint64_t local_count = node_local_count(n);
     if (n->depth != last_swivel)
 	errh->error("%x: bad depth %d <= %d", n->aggregate, n->depth, last_swivel);
 
@@ -184,11 +184,11 @@ AggregateWTree::node_ok(WNode *n, int last_swivel, uint32_t *nnz_ptr,
 	    return errh->error("%x: packets present in middle of tree", n->aggregate);
 
 	// check child counts
-	uint32_t left_count = node_ok(n->wchild[0], swivel, nnz_ptr, errh);
-	uint32_t right_count = node_ok(n->wchild[1], swivel, nnz_ptr, errh);
+	uint64_t left_count = node_ok(n->wchild[0], swivel, nnz_ptr, errh);
+	uint64_t right_count = node_ok(n->wchild[1], swivel, nnz_ptr, errh);
 	if (left_count + right_count + local_count != n->full_count
 	    && left_count != NODE_OK_ERROR && right_count != NODE_OK_ERROR)
-	    return errh->error("%x: bad full count: nominally %u, calculated %u", n->aggregate, n->full_count, left_count + right_count + local_count);
+	    return errh->error("%x: bad full count: nominally %llu, calculated %llu", n->aggregate, (unsigned long long) n->full_count, (unsigned long long) (left_count + right_count + local_count));
 
 	return left_count + right_count + local_count;
 
@@ -196,7 +196,7 @@ AggregateWTree::node_ok(WNode *n, int last_swivel, uint32_t *nnz_ptr,
 	return errh->error("%x: only one live child", n->aggregate);
 
     else if (local_count != n->full_count)
-	return errh->error("%x: bad full count for leaf: nominally %u, calculated %u", n->aggregate, n->full_count, local_count);
+	return errh->error("%x: bad full count for leaf: nominally %llu, calculated %llu", n->aggregate, (unsigned long long) n->full_count, (unsigned long long) local_count);
 
     else
 	return local_count;
@@ -268,10 +268,10 @@ AggregateWTree::make_peer(uint32_t a, WNode *n)
 }
 
 void
-AggregateWTree::finish_add(WNode *n, int32_t delta, WNode *stack[], int pos)
+AggregateWTree::finish_add(WNode *n, int64_t delta, WNode *stack[], int pos)
 {
     assert(pos > 0 && stack[pos - 1] == n);
-    uint32_t old_count = n->count;
+    uint64_t old_count = n->count;
     n->count += delta;
     int32_t nnz_delta = (n->count != 0) - (old_count != 0);
     _num_nonzero += nnz_delta;
@@ -284,7 +284,7 @@ AggregateWTree::finish_add(WNode *n, int32_t delta, WNode *stack[], int pos)
 }
 
 void
-AggregateWTree::add(uint32_t a, int32_t delta)
+AggregateWTree::add(uint32_t a, int64_t delta)
 {
     WNode *stack[32];
     int pos = 0;
@@ -341,7 +341,7 @@ AggregateWTree::adjust_num_nonzero(int32_t delta, WNode *stack[], int pos)
 }
 
 void
-AggregateWTree::free_subtree_x(WNode *n, uint32_t &nnz, uint32_t &count)
+AggregateWTree::free_subtree_x(WNode *n, uint32_t &nnz, uint64_t &count)
 {
     if (n->count)
 	nnz++;
@@ -358,7 +358,8 @@ AggregateWTree::collapse_subtree(WNode *n, WNode *stack[], int pos)
 {
     assert(pos > 0 && stack[pos - 1] == n);
     if (n->wchild[0]) {
-	uint32_t nnz = (n->count != 0), count = 0;
+	uint32_t nnz = (n->count != 0);
+	uint64_t count = 0;
 	free_subtree_x(n->wchild[0], nnz, count);
 	free_subtree_x(n->wchild[1], nnz, count);
 	n->wchild[0] = n->wchild[1] = 0;
@@ -380,6 +381,13 @@ AggregateWTree::delete_subtree(WNode *n, WNode *stack[], int pos)
 // SAMPLING
 //
 
+static inline uint64_t
+random64()
+{
+    // random() returns 31 bits
+    return ((uint64_t) random() << 62) ^ ((uint64_t) random() << 31) ^ (uint64_t) random();
+}
+
 AggregateWTree::WNode *
 AggregateWTree::pick_random_active_node(WNode *stack[], int *store_pos) const
 {
@@ -389,11 +397,11 @@ AggregateWTree::pick_random_active_node(WNode *stack[], int *store_pos) const
 
     int pos = 0;
     WNode *n = _root;
-    uint32_t v = ((uint32_t)random()) % (_root->full_count);
+    uint64_t v = random64() % _root->full_count;
 
     while (n) {
-	uint32_t left_count = node_full_count(n->wchild[0]);
-	uint32_t self_count = node_local_count(n);
+	uint64_t left_count = node_full_count(n->wchild[0]);
+	uint64_t self_count = node_local_count(n);
 	assert(v < left_count + self_count + node_full_count(n->wchild[1]));
 	stack[pos++] = n;
 	if (v < left_count)
@@ -437,12 +445,26 @@ AggregateWTree::cull_addresses_by_packets(uint32_t max_nnz)
 }
 
 void
-AggregateWTree::cull_packets(uint32_t max_np)
+AggregateWTree::cull_packets(uint64_t max_np)
 {
     WNode *stack[32];
     int pos;
     assert(_count_type == COUNT_PACKETS);
-    for (uint32_t np = _root->full_count; np > max_np; np--) {
+    uint64_t np = _root->full_count;
+    if (np > max_np && max_np < np - max_np) {
+	// fewer packets to keep than to drop: move the kept ones to a new tree
+	AggregateWTree kept(_count_type | (_topheavy ? 0 : LEAF));
+	for (uint64_t i = 0; i < max_np; i++) {
+	    WNode *n = pick_random_active_node(stack, &pos);
+	    kept.add(n->aggregate, 1);
+	    finish_add(n, -1, stack, pos);
+	}
+	AggregateTree::WriteFormat read_format = _read_format;
+	*this = kept;
+	_read_format = read_format;
+	return;
+    }
+    for (; np > max_np; np--) {
 	WNode *n = pick_random_active_node(stack, &pos);
 	finish_add(n, -1, stack, pos);
     }
@@ -846,21 +868,30 @@ AggregateWTree::fake_by_dirichlet(uint32_t nnz)
 //
 
 void
-AggregateWTree::read_packed_file(FILE *f, int file_byte_order)
+AggregateWTree::read_packed_file(FILE *f, int file_byte_order, bool wide)
 {
     uint32_t ubuf[BUFSIZ];
     _read_format = AggregateTree::WR_BINARY;
-    if (file_byte_order == CLICK_BYTE_ORDER) {
+    bool swap = (file_byte_order != CLICK_BYTE_ORDER);
+    if (!wide) {
 	while (!feof(f) && !ferror(f)) {
 	    size_t howmany = fread(ubuf, 8, BUFSIZ / 2, f);
 	    for (size_t i = 0; i < howmany; i++)
-		add(ubuf[2*i], ubuf[2*i + 1]);
+		if (swap)
+		    add(bswap_32(ubuf[2*i]), bswap_32(ubuf[2*i + 1]));
+		else
+		    add(ubuf[2*i], ubuf[2*i + 1]);
 	}
     } else {
 	while (!feof(f) && !ferror(f)) {
-	    size_t howmany = fread(ubuf, 8, BUFSIZ / 2, f);
-	    for (size_t i = 0; i < howmany; i++)
-		add(bswap_32(ubuf[2*i]), bswap_32(ubuf[2*i + 1]));
+	    size_t howmany = fread(ubuf, 12, BUFSIZ / 3, f);
+	    for (size_t i = 0; i < howmany; i++) {
+		uint64_t count;
+		memcpy(&count, &ubuf[3*i + 1], sizeof(count));
+		if (swap)
+		    count = ((uint64_t) bswap_32(count) << 32) | bswap_32(count >> 32);
+		add(swap ? bswap_32(ubuf[3*i]) : ubuf[3*i], count);
+	    }
 	}
     }
 }
@@ -869,21 +900,26 @@ int
 AggregateWTree::read_file(FILE *f, ErrorHandler *errh)
 {
     char s[BUFSIZ];
-    uint32_t agg, value, b[4];
+    uint32_t agg, b[4];
+    unsigned long long value;
     _read_format = AggregateTree::WR_ASCII;
     while (fgets(s, BUFSIZ, f)) {
 	if (strlen(s) == BUFSIZ - 1 && s[BUFSIZ - 2] != '\n')
 	    return errh->error("line too long");
 	if (s[0] == '$' || s[0] == '!') {
 	    if (strcmp(s + 1, "packed\n") == 0)
-		read_packed_file(f, CLICK_BYTE_ORDER);
+		read_packed_file(f, CLICK_BYTE_ORDER, false);
 	    else if (strcmp(s + 1, "packed_le\n") == 0)
-		read_packed_file(f, CLICK_LITTLE_ENDIAN);
+		read_packed_file(f, CLICK_LITTLE_ENDIAN, false);
 	    else if (strcmp(s + 1, "packed_be\n") == 0)
-		read_packed_file(f, CLICK_BIG_ENDIAN);
-	} else if (sscanf(s, "%u %u", &agg, &value) == 2)
+		read_packed_file(f, CLICK_BIG_ENDIAN, false);
+	    else if (strcmp(s + 1, "packed64_le\n") == 0)
+		read_packed_file(f, CLICK_LITTLE_ENDIAN, true);
+	    else if (strcmp(s + 1, "packed64_be\n") == 0)
+		read_packed_file(f, CLICK_BIG_ENDIAN, true);
+	} else if (sscanf(s, "%u %llu", &agg, &value) == 2)
 	    add(agg, value);
-	else if (sscanf(s, "%u.%u.%u.%u %u", &b[0], &b[1], &b[2], &b[3], &value) == 5
+	else if (sscanf(s, "%u.%u.%u.%u %llu", &b[0], &b[1], &b[2], &b[3], &value) == 5
 		 && b[0] < 256 && b[1] < 256 && b[2] < 256 && b[3] < 256) {
 	    add((b[0]<<24) | (b[1]<<16) | (b[2]<<8) | b[3], value);
 	    _read_format = AggregateTree::WR_ASCII_IP;
@@ -894,24 +930,42 @@ AggregateWTree::read_file(FILE *f, ErrorHandler *errh)
     return 0;
 }
 
+static uint64_t
+node_max_count(WNode *n)
+{
+    uint64_t m = n->count;
+    if (n->wchild[0]) {
+	uint64_t m0 = node_max_count(n->wchild[0]);
+	uint64_t m1 = node_max_count(n->wchild[1]);
+	m = (m0 > m ? m0 : m);
+	m = (m1 > m ? m1 : m);
+    }
+    return m;
+}
+
 int
 AggregateWTree::write_file(FILE *f, AggregateTree::WriteFormat format, ErrorHandler *errh) const
 {
+    if (format == AggregateTree::WR_BINARY && node_max_count(_root) > 0xFFFFFFFFU)
+	format = AggregateTree::WR_BINARY64;
+
     fprintf(f, "!num_nonzero %u\n", _num_nonzero);
-    if (format == AggregateTree::WR_BINARY) {
+    if (format == AggregateTree::WR_BINARY || format == AggregateTree::WR_BINARY64) {
+	const char *wide = (format == AggregateTree::WR_BINARY64 ? "64" : "");
 #if CLICK_BYTE_ORDER == CLICK_BIG_ENDIAN
-	fprintf(f, "!packed_be\n");
+	fprintf(f, "!packed%s_be\n", wide);
 #elif CLICK_BYTE_ORDER == CLICK_LITTLE_ENDIAN
-	fprintf(f, "!packed_le\n");
+	fprintf(f, "!packed%s_le\n", wide);
 #else
+	(void) wide;
 	format = AggregateTree::WR_ASCII;
 #endif
     } else if (format == AggregateTree::WR_ASCII_IP)
 	fprintf(f, "!ip\n");
 
-    uint32_t buf[1024];
+    uint32_t buf[1536];
     int pos = 0;
-    AggregateTree::write_nodes(_root, f, format, buf, pos, 1024, errh);
+    AggregateTree::write_nodes(_root, f, format, buf, pos, 1536, errh);
     if (pos)
 	AggregateTree::write_batch(f, format, buf, pos, errh);
 
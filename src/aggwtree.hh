@@ -3,7 +3,7 @@
 #include "aggtree.hh"
 
 struct AggregateWTree_WNode : public AggregateTree::Node {
-    uint32_t full_count;
+    uint64_t full_count;
     int depth;
 };
 
@@ -27,11 +27,11 @@ class AggregateWTree { public:
     uint32_t num_nonzero() const		{ return _num_nonzero; }
     uint32_t nnz() const			{ return _num_nonzero; }
 
-    void add(uint32_t aggregate, int32_t count = 1);
+    void add(uint32_t aggregate, int64_t count = 1);
 
     void cull_addresses(uint32_t nnz);
     void cull_addresses_by_packets(uint32_t nnz);
-    void cull_packets(uint32_t np);
+    void cull_packets(uint64_t np);
 
     void cut_smaller_prefix(int p, uint32_t size);
 
@@ -76,23 +76,23 @@ class AggregateWTree { public:
     void set_count_type(int);
 
     WNode *make_peer(uint32_t, WNode *);
-    void finish_add(WNode *, int32_t, WNode *stack[], int);
-    void free_subtree_x(WNode *, uint32_t &, uint32_t &);
+    void finish_add(WNode *, int64_t, WNode *stack[], int);
+    void free_subtree_x(WNode *, uint32_t &, uint64_t &);
     void collapse_subtree(WNode *, WNode *stack[], int);
     void delete_subtree(WNode *, WNode *stack[], int);
     void adjust_num_nonzero(int32_t, WNode *stack[], int);
 
-    uint32_t node_ok(WNode *, int, uint32_t *, ErrorHandler *) const;
+    uint64_t node_ok(WNode *, int, uint32_t *, ErrorHandler *) const;
     WNode *pick_random_active_node(WNode *stack[], int *) const;
 
-    inline uint32_t node_local_count(WNode *) const;
-    static inline uint32_t node_full_count(WNode *);
+    inline uint64_t node_local_count(WNode *) const;
+    static inline uint64_t node_full_count(WNode *);
 
     void node_prefixize(WNode *, int, WNode *stack[], int);
 
     void node_fake_dirichlet(WNode *, WNode *stack[], int, uint32_t);
 
-    void read_packed_file(FILE *, int file_byte_order);
+    void read_packed_file(FILE *, int file_byte_order, bool wide);
 
     friend class AggregateTree;
 
@@ -116,13 +116,13 @@ AggregateWTree::free_node(WNode *n)
     _free = n;
 }
 
-inline uint32_t
+inline uint64_t
 AggregateWTree::node_local_count(WNode *n) const
 {
     return (_count_type == COUNT_ADDRS ? n->count != 0 : n->count);
 }
 
-inline uint32_t
+inline uint64_t
 AggregateWTree::node_full_count(WNode *n)
 {
     return (n ? n->full_count : 0);
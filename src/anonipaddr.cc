@@ -69,11 +69,13 @@ AnonymizeIPAddr::configure(Vector<String> &conf, ErrorHandler *errh)
     _preserve_class = 0;
     String preserve_8;
     bool seed_ignored;
+    _defer = false;
 
     if (Args(conf, this, errh)
 	.read("CLASS", _preserve_class)
 	.read("PRESERVE_8", AnyArg(), preserve_8)
 	.read("SEED", seed_ignored)
+	.read("DEFER", _defer)
 	.complete() < 0)
 	return -1;
 
@@ -130,6 +132,8 @@ AnonymizeIPAddr::initialize(ErrorHandler *errh)
 	    return errh->error("out of memory!");
     }
 
+    memset(_cache, 0, sizeof(_cache));
+
     // prepare special nodes for 0.0.0.0 and 255.255.255.255
     memset(&_special_nodes[0], 0, sizeof(_special_nodes));
     _special_nodes[0].input = _special_nodes[0].output = 0;
@@ -227,19 +231,10 @@ AnonymizeIPAddr::find_node(uint32_t a)
     return 0;
 }
 
-inline uint32_t
-AnonymizeIPAddr::anonymize_addr(uint32_t a)
+inline click_ip *
+AnonymizeIPAddr::embedded_header(const Packet *p)
 {
-    if (Node *n = find_node(ntohl(a)))
-	return htonl(n->output);
-    else
-	return 0;
-}
-
-void
-AnonymizeIPAddr::handle_icmp(WritablePacket *q)
-{
-    click_icmp *icmph = q->icmp_header();
+    click_icmp *icmph = const_cast<click_icmp *>(p->icmp_header());
     if (icmph->icmp_type == ICMP_UNREACH || icmph->icmp_type == ICMP_TIMXCEED
 	|| icmph->icmp_type == ICMP_PARAMPROB
 	|| icmph->icmp_type == ICMP_SOURCEQUENCH
@@ -247,50 +242,77 @@ AnonymizeIPAddr::handle_icmp(WritablePacket *q)
 	// check length of embedded IP header
 	click_ip *embedded_iph = reinterpret_cast<click_ip *>(icmph + 1);
 	unsigned hlen = embedded_iph->ip_hl << 2;
-	if (q->transport_length() < (int)(sizeof(click_icmp) + hlen + 8)
-	    || hlen < sizeof(click_ip))
-	    return;
+	if (p->transport_length() >= (int)(sizeof(click_icmp) + hlen + 8)
+	    && hlen >= sizeof(click_ip))
+	    return embedded_iph;
+    }
+    return 0;
+}
 
-	uint32_t src = embedded_iph->ip_src.s_addr, dst = embedded_iph->ip_dst.s_addr;
+void
+AnonymizeIPAddr::rewrite(click_ip *iph, uint16_t *sum_ptr, uint32_t src, uint32_t dst)
+{
+    uint32_t old_src = iph->ip_src.s_addr, old_dst = iph->ip_dst.s_addr;
 
-	// incrementally update IP checksum according to RFC1624:
-	// new_sum = ~(~old_sum + ~old_halfword + new_halfword)
-	uint32_t icmp_sum = (~icmph->icmp_cksum & 0xFFFF)
-	    + (~src & 0xFFFF) + (~src >> 16) + (~dst & 0xFFFF) + (~dst >> 16);
+    // incrementally update checksum according to RFC1624:
+    // new_sum = ~(~old_sum + ~old_halfword + new_halfword)
+    uint32_t sum = (~*sum_ptr & 0xFFFF)
+	+ (~old_src & 0xFFFF) + (~old_src >> 16)
+	+ (~old_dst & 0xFFFF) + (~old_dst >> 16);
 
-	embedded_iph->ip_src.s_addr = src = anonymize_addr(src);
-	embedded_iph->ip_dst.s_addr = dst = anonymize_addr(dst);
+    iph->ip_src.s_addr = src;
+    iph->ip_dst.s_addr = dst;
 
-	icmp_sum += (src & 0xFFFF) + (src >> 16) + (dst & 0xFFFF) + (dst >> 16);
-	icmp_sum = (icmp_sum & 0xFFFF) + (icmp_sum >> 16);
-	icmph->icmp_cksum = ~(icmp_sum + (icmp_sum >> 16));
+    sum += (src & 0xFFFF) + (src >> 16) + (dst & 0xFFFF) + (dst >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    *sum_ptr = ~(sum + (sum >> 16));
+}
 
+void
+AnonymizeIPAddr::handle_icmp(WritablePacket *q)
+{
+    if (click_ip *embedded_iph = embedded_header(q)) {
+	uint32_t src = anonymize_addr(embedded_iph->ip_src.s_addr);
+	uint32_t dst = anonymize_addr(embedded_iph->ip_dst.s_addr);
+	rewrite(embedded_iph, &q->icmp_header()->icmp_cksum, src, dst);
 	// XXX ICMP-in-ICMP?
     }
 }
 
-Packet *
-AnonymizeIPAddr::simple_action(Packet *p)
+/** @brief Copy @a p's IP header into @a buf, replacing its addresses with
+ * @a addr as returned by map_header().
+ *
+ * Returns the header length.  @a buf must have room for MAX_HEADER bytes.
+ * The rest of the packet, which can_overlay() guarantees contains no
+ * addresses, may be used unchanged. */
+unsigned
+AnonymizeIPAddr::overlay_header(const Packet *p, const uint32_t addr[2],
+				unsigned char *buf)
 {
-    const click_ip *in_iph = p->ip_header();
-    if (!p->has_network_header() || in_iph->ip_v != 4) {
-	checked_output_push(1, p);
-	return 0;
-    } else if (WritablePacket *q = p->uniqueify()) {
-	click_ip *iph = q->ip_header();
-	uint32_t src = iph->ip_src.s_addr, dst = iph->ip_dst.s_addr;
-
-	// incrementally update IP checksum according to RFC1624:
-	// new_sum = ~(~old_sum + ~old_halfword + new_halfword)
-	uint32_t sum = (~iph->ip_sum & 0xFFFF)
-	    + (~src & 0xFFFF) + (~src >> 16) + (~dst & 0xFFFF) + (~dst >> 16);
-
-	iph->ip_src.s_addr = src = anonymize_addr(src);
-	iph->ip_dst.s_addr = dst = anonymize_addr(dst);
+    unsigned hlen = p->ip_header()->ip_hl << 2;
+    if (hlen > (unsigned) p->network_length())
+	hlen = p->network_length();
+    if (hlen > MAX_HEADER)
+	hlen = MAX_HEADER;
+    if (hlen < sizeof(click_ip))
+	hlen = sizeof(click_ip);
+    memcpy(buf, p->network_header(), hlen);
+    click_ip *iph = reinterpret_cast<click_ip *>(buf);
+    rewrite(iph, &iph->ip_sum, addr[0], addr[1]);
+    return hlen;
+}
 
-	sum += (src & 0xFFFF) + (src >> 16) + (dst & 0xFFFF) + (dst >> 16);
-	sum = (sum & 0xFFFF) + (sum >> 16);
-	iph->ip_sum = ~(sum + (sum >> 16));
+/** @brief Anonymize @a p in place, copying its data if it is shared.
+ *
+ * @a p must have an IPv4 network header.  Returns 0 if out of memory. */
+WritablePacket *
+AnonymizeIPAddr::anonymize_packet(Packet *p)
+{
+    if (WritablePacket *q = p->uniqueify()) {
+	click_ip *iph = q->ip_header();
+	uint32_t src = anonymize_addr(iph->ip_src.s_addr);
+	uint32_t dst = anonymize_addr(iph->ip_dst.s_addr);
+	rewrite(iph, &iph->ip_sum, src, dst);
 
 	// check encapsulated headers for ICMP
 	if (iph->ip_p == IP_PROTO_ICMP)
@@ -301,6 +323,38 @@ AnonymizeIPAddr::simple_action(Packet *p)
 	return 0;
 }
 
+Packet *
+AnonymizeIPAddr::simple_action(Packet *p)
+{
+    const click_ip *in_iph = p->ip_header();
+    if (!p->has_network_header() || in_iph->ip_v != 4) {
+	checked_output_push(1, p);
+	return 0;
+    } else if (_defer) {
+	// create mappings in packet order, so output elements applying them
+	// later produce the same anonymization as DEFER false
+	(void) anonymize_addr(in_iph->ip_src.s_addr);
+	(void) anonymize_addr(in_iph->ip_dst.s_addr);
+	if (in_iph->ip_p == IP_PROTO_ICMP)
+	    if (const click_ip *embedded_iph = embedded_header(p)) {
+		(void) anonymize_addr(embedded_iph->ip_src.s_addr);
+		(void) anonymize_addr(embedded_iph->ip_dst.s_addr);
+	    }
+	return p;
+    } else
+	return anonymize_packet(p);
+}
+
+void
+AnonymizeIPAddr::push_batch(int port, PacketBatch &batch)
+{
+    PacketBatch out;
+    while (Packet *p = batch.pop_front())
+	if ((p = AnonymizeIPAddr::simple_action(p)))
+	    out.append(p);
+    output(port).push_batch(out);
+}
+
 int
 AnonymizeIPAddr::llrpc(unsigned command, void *data)
 {
@@ -2,6 +2,7 @@
 #ifndef CLICK_ANONIPADDR_HH
 #define CLICK_ANONIPADDR_HH
 #include <click/element.hh>
+#include <clicknet/ip.h>
 CLICK_DECLS
 
 /*
@@ -46,6 +47,15 @@ preserves classes A, B, C, and D. The CLASS flag works by preserving leading
 one bits; higher CLASSes, up to 32, preserve more one bits. Default CLASS is 0
 E<lparen>no preservation).
 
+=item DEFER
+
+Boolean. If true, AnonymizeIPAddr computes address mappings for passing
+packets, but leaves the packets themselves unchanged. Output elements that
+name this element in their ANONYMIZE keyword, such as ToIPSummaryDump and
+ToDump, then apply the mappings as they write, so packets whose data is
+shared, such as packets read from trace files, need not be copied. Packets
+that reach any other element keep their original addresses. Default is false.
+
 =item PRESERVE_8
 
 Space-separated list of integers. Preserve the listed 8-bit prefixes. For
@@ -104,9 +114,20 @@ class AnonymizeIPAddr : public Element { public:
     void cleanup(CleanupStage) CLICK_COLD;
 
     Packet *simple_action(Packet *);
+    void push_batch(int port, PacketBatch &);
 
     int llrpc(unsigned, void *);
 
+    inline uint32_t anonymize_addr(uint32_t);
+
+    static inline bool can_overlay(const Packet *);
+    inline void map_header(const Packet *, uint32_t addr[2]);
+    static unsigned overlay_header(const Packet *, const uint32_t addr[2],
+				   unsigned char *buf);
+    WritablePacket *anonymize_packet(Packet *);
+
+    enum { MAX_HEADER = 60 };
+
   private:
 
     struct Node {
@@ -115,6 +136,16 @@ class AnonymizeIPAddr : public Element { public:
 	Node *child[2];
     };
 
+    // Recently mapped addresses, in network byte order.  An address's
+    // mapping never changes once made, so entries are never invalidated;
+    // the zeroed table correctly maps 0.0.0.0 to itself.
+    enum { CACHE_SIZE = 4096 };
+    struct CacheEntry {
+	uint32_t input;
+	uint32_t output;
+    };
+    CacheEntry _cache[CACHE_SIZE];
+
     Node *_root;
     Node *_free;
     Vector<Node *> _blocks;
@@ -122,6 +153,7 @@ class AnonymizeIPAddr : public Element { public:
 
     int _preserve_class;
     Vector<uint32_t> _preserve_8;
+    bool _defer;
 
     Node *new_node();
     Node *new_node_block();
@@ -130,8 +162,9 @@ class AnonymizeIPAddr : public Element { public:
     uint32_t make_output(uint32_t, int) const;
     Node *make_peer(uint32_t, Node *);
     Node *find_node(uint32_t);
-    inline uint32_t anonymize_addr(uint32_t);
 
+    static inline click_ip *embedded_header(const Packet *);
+    static void rewrite(click_ip *iph, uint16_t *sum, uint32_t src, uint32_t dst);
     void handle_icmp(WritablePacket *);
 
 };
@@ -154,5 +187,41 @@ AnonymizeIPAddr::free_node(Node *n)
     _free = n;
 }
 
+inline uint32_t
+AnonymizeIPAddr::anonymize_addr(uint32_t a)
+{
+    CacheEntry &c = _cache[((a ^ (a >> 16)) * 0x9E3779B1U) >> 20];
+    if (c.input == a)
+	return c.output;
+    else if (Node *n = find_node(ntohl(a))) {
+	c.input = a;
+	return c.output = htonl(n->output);
+    } else
+	return 0;
+}
+
+/** @brief Return true iff @a p can be anonymized by overlay_header().
+ *
+ * The addresses of ICMP packets and truncated IP headers are rewritten in
+ * several places, so those packets must be copied with anonymize_packet(). */
+inline bool
+AnonymizeIPAddr::can_overlay(const Packet *p)
+{
+    const click_ip *iph = p->ip_header();
+    return p->has_network_header() && p->network_header() >= p->data()
+	&& p->network_length() >= (int) sizeof(click_ip)
+	&& iph->ip_v == 4 && iph->ip_p != IP_PROTO_ICMP;
+}
+
+/** @brief Store the anonymized source and destination addresses of @a p,
+ * which must satisfy can_overlay(), in @a addr. */
+inline void
+AnonymizeIPAddr::map_header(const Packet *p, uint32_t addr[2])
+{
+    const click_ip *iph = p->ip_header();
+    addr[0] = anonymize_addr(iph->ip_src.s_addr);
+    addr[1] = anonymize_addr(iph->ip_dst.s_addr);
+}
+
 CLICK_ENDDECLS
 #endif
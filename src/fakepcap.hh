@@ -10,6 +10,14 @@ CLICK_DECLS
 #define FAKE_PCAP_VERSION_MAJOR		2
 #define FAKE_PCAP_VERSION_MINOR		4
 
+/* pcapng block types */
+#define FAKE_PCAPNG_SHB			0x0A0D0D0A	/* section header */
+#define FAKE_PCAPNG_IDB			0x00000001	/* interface description */
+#define FAKE_PCAPNG_SPB			0x00000003	/* simple packet */
+#define FAKE_PCAPNG_EPB			0x00000006	/* enhanced packet */
+#define FAKE_PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+#define FAKE_PCAPNG_VERSION_MAJOR	1
+
 /* Canonical (pcap file) data link types (may differ from host versions) */
 #define FAKE_DLT_NONE			(-1)	/* Unknown */
 #define FAKE_DLT_NULL			0	/* Null encapsulation */
@@ -22,8 +22,8 @@ Reads packets from a file in ERF format, produced by the University of
 Waikato's DAG tools. Pushes them out the output, and optionally stops the
 driver when there are no more packets.
 
-FromDAGDump also transparently reads gzip- and bzip2-compressed files, if you
-have zcat(1) and bzcat(1) installed.
+FromDAGDump also transparently reads gzip-, bzip2-, xz-, and zstd-compressed
+files.
 
 Keyword arguments are:
 
@@ -146,6 +146,12 @@ cannot be determined (because the file was compressed, for example).
 
 Returns FromDAGDump's position in the (uncompressed) file, in bytes.
 
+=h raw_filepos read-only
+
+Returns FromDAGDump's position in the file as stored, in bytes. For compressed
+files, this is the position in the compressed file, comparable with
+C<filesize>.
+
 =h extend_interval write-only
 
 Text is a time interval. If END_TIME or one of its cousins was specified, then
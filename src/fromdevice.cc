@@ -50,24 +50,34 @@
 # include <net/if.h>
 # include <features.h>
 # include <linux/if_packet.h>
+# include <linux/filter.h>
 # include <net/ethernet.h>
 #endif
+#if FROMDEVICE_ALLOW_LINUX_RING
+# include <sys/mman.h>
+#endif
 
 CLICK_DECLS
 
 FromDevice::FromDevice()
     :
-#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP
+#if FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_LINUX_RING
       _task(this),
 #endif
 #if FROMDEVICE_ALLOW_PCAP
       _pcap(0), _pcap_complaints(0),
 #endif
-      _datalink(-1), _count(0), _promisc(0), _snaplen(0)
+      _datalink(-1), _count(0), _promisc(0), _snaplen(0), _have_filter(false)
 {
 #if FROMDEVICE_ALLOW_LINUX || FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
     _fd = -1;
 #endif
+#if FROMDEVICE_ALLOW_LINUX
+    _linux_drops = 0;
+#endif
+#if FROMDEVICE_ALLOW_LINUX_RING
+    _ring = 0;
+#endif
 }
 
 FromDevice::~FromDevice()
@@ -84,7 +94,8 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     _headroom += (4 - (_headroom + 2) % 4) % 4; // default 4/2 alignment
     _force_ip = false;
     _burst = 1;
-    String bpf_filter, capture, encap_type;
+    uint32_t ring_size = 32 << 20;
+    String bpf_filter, filter, capture, encap_type;
     bool has_encap;
     if (Args(conf, this, errh)
 	.read_mp("DEVNAME", _ifname)
@@ -95,12 +106,14 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("METHOD", WordArg(), capture)
 	.read("CAPTURE", WordArg(), capture) // deprecated
 	.read("BPF_FILTER", bpf_filter)
+	.read("FILTER", filter)
 	.read("PROTOCOL", _protocol)
 	.read("OUTBOUND", outbound)
 	.read("HEADROOM", _headroom)
 	.read("ENCAP", WordArg(), encap_type).read_status(has_encap)
 	.read("BURST", _burst)
 	.read("TIMESTAMP", timestamp)
+	.read("RING_SIZE", ring_size)
 	.complete() < 0)
 	return -1;
     if (_snaplen > 65535 || _snaplen < 14)
@@ -109,8 +122,25 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
 	return errh->error("HEADROOM out of range");
     if (_burst <= 0)
 	return errh->error("BURST out of range");
+#if FROMDEVICE_ALLOW_LINUX_RING
+    if (ring_size < 2 * ring_block_size)
+	return errh->error("RING_SIZE too small");
+#endif
     _protocol = htons(_protocol);
 
+    if (filter && bpf_filter)
+	return errh->error("FILTER and BPF_FILTER are mutually exclusive");
+    if (filter) {
+	Vector<String> pattern;
+	pattern.push_back("0 " + filter);
+	int before = errh->nerrors();
+	PrefixErrorHandler ferrh(errh, "FILTER: ");
+	IPFilter::parse_program(_filter, pattern, 1, this, &ferrh);
+	if (errh->nerrors() != before)
+	    return -1;
+	_have_filter = true;
+    }
+
 #if FROMDEVICE_ALLOW_PCAP
     _bpf_filter = bpf_filter;
     if (has_encap) {
@@ -136,6 +166,10 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     else if (capture == "LINUX")
 	_method = method_linux;
 #endif
+#if FROMDEVICE_ALLOW_LINUX_RING
+    else if (capture == "LINUX_RING")
+	_method = method_linux_ring;
+#endif
 #if FROMDEVICE_ALLOW_PCAP
     else if (capture == "PCAP")
 	_method = method_pcap;
@@ -154,6 +188,9 @@ FromDevice::configure(Vector<String> &conf, ErrorHandler *errh)
     _promisc = promisc;
     _outbound = outbound;
     _timestamp = timestamp;
+#if FROMDEVICE_ALLOW_LINUX_RING
+    _ring_size = ring_size;
+#endif
     return 0;
 }
 
@@ -227,8 +264,101 @@ FromDevice::set_promiscuous(int fd, String ifname, bool promisc)
 
     return was_promisc;
 }
+
+void
+FromDevice::attach_filter(ErrorHandler *errh)
+{
+    // METHOD LINUX learns packet lengths from recvfrom(), so accepted
+    // packets must stay whole; the ring records lengths separately.
+    uint32_t accept = (_method == method_linux_ring ? _snaplen : 0xFFFFFFFFU);
+    Vector<IPFilter::BPFInsn> bpf;
+    if (!IPFilter::compile_bpf(_filter, _snaplen, accept,
+			       _force_ip && noutputs() == 1, bpf)) {
+	errh->warning("%s: cannot run FILTER in the kernel", _ifname.c_str());
+	return;
+    }
+    struct sock_fprog fprog;
+    fprog.len = bpf.size();
+    fprog.filter = reinterpret_cast<struct sock_filter *>(bpf.begin());
+    if (setsockopt(_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+	errh->warning("%s: SO_ATTACH_FILTER: %s", _ifname.c_str(), strerror(errno));
+}
 #endif /* FROMDEVICE_ALLOW_LINUX */
 
+#if FROMDEVICE_ALLOW_LINUX_RING
+int
+FromDevice::open_ring(ErrorHandler *errh)
+{
+    int version = TPACKET_V3;
+    if (setsockopt(_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+	return errh->error("%s: PACKET_VERSION: %s", _ifname.c_str(), strerror(errno));
+
+    // TPACKET_V3 packs variable-length frames into blocks; the frame
+    // fields only need to be consistent
+    _ring_nblocks = _ring_size / ring_block_size;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ring_block_size;
+    req.tp_block_nr = _ring_nblocks;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (ring_block_size / req.tp_frame_size) * _ring_nblocks;
+    req.tp_retire_blk_tov = 10;	// msec before a partly full block is retired
+    if (setsockopt(_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+	return errh->error("%s: PACKET_RX_RING: %s", _ifname.c_str(), strerror(errno));
+
+    size_t size = (size_t) ring_block_size * _ring_nblocks;
+    void *ring = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (ring == MAP_FAILED)
+	return errh->error("%s: mmap: %s", _ifname.c_str(), strerror(errno));
+    _ring = reinterpret_cast<unsigned char *>(ring);
+    _ring_block = 0;
+    return 0;
+}
+
+int
+FromDevice::ring_dispatch()
+{
+    // Copy the packets out of the next ring block, if the kernel has
+    // retired it, return the block to the kernel, and push the packets.
+    tpacket_block_desc *bd = reinterpret_cast<tpacket_block_desc *>(_ring + (size_t) _ring_block * ring_block_size);
+    if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+	return 0;
+
+    PacketBatch batch;
+    const unsigned char *ph = reinterpret_cast<unsigned char *>(bd) + bd->hdr.bh1.offset_to_first_pkt;
+    for (uint32_t i = 0; i < bd->hdr.bh1.num_pkts; ++i) {
+	const tpacket3_hdr *h = reinterpret_cast<const tpacket3_hdr *>(ph);
+	const sockaddr_ll *sa = reinterpret_cast<const sockaddr_ll *>(ph + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+	if ((sa->sll_pkttype != PACKET_OUTGOING || _outbound)
+	    && (_protocol == 0 || _protocol == sa->sll_protocol)) {
+	    uint32_t caplen = h->tp_snaplen;
+	    if (caplen > (uint32_t) _snaplen)
+		caplen = _snaplen;
+	    if (WritablePacket *p = Packet::make(_headroom, ph + h->tp_mac, caplen, 0)) {
+		SET_EXTRA_LENGTH_ANNO(p, h->tp_len - caplen);
+		p->set_packet_type_anno((Packet::PacketType) sa->sll_pkttype);
+		if (_timestamp)
+		    p->timestamp_anno() = Timestamp::make_nsec(h->tp_sec, h->tp_nsec);
+		p->set_mac_header(p->data());
+		if (!_force_ip || fake_pcap_force_ip(p, _datalink))
+		    batch.append(p);
+		else
+		    checked_output_push(1, p);
+	    }
+	}
+	ph += h->tp_next_offset;
+    }
+
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    if (++_ring_block == _ring_nblocks)
+	_ring_block = 0;
+
+    int n = batch.count();
+    output(0).push_batch(batch);
+    return n;
+}
+#endif /* FROMDEVICE_ALLOW_LINUX_RING */
+
 #if FROMDEVICE_ALLOW_PCAP
 const char*
 FromDevice::fetch_pcap_error(pcap_t* pcap, const char *ebuf)
@@ -315,6 +445,8 @@ FromDevice::initialize(ErrorHandler *errh)
 	    _datalink = FAKE_DLT_EN10MB;
 	    _method = method_netmap;
 	    _netmap.initialize_rings_rx(_timestamp);
+	    if (_have_filter)
+		errh->warning("%s: cannot run FILTER in the kernel", _ifname.c_str());
 	}
     }
 #endif
@@ -374,10 +506,20 @@ FromDevice::initialize(ErrorHandler *errh)
 	// linux pcap-0.4-16) want to have a filter installed before they
 	// will pick up any packets.
 
-	// compile the BPF filter
+	// compile the BPF filter, or translate FILTER
 	struct bpf_program fcode;
-	if (pcap_compile(_pcap, &fcode, _bpf_filter.mutable_c_str(), 0, netmask) < 0)
-	    return errh->error("%s: %s", ifname, fetch_pcap_error(_pcap, 0));
+	Vector<IPFilter::BPFInsn> bpf;
+	if (_have_filter && pcap_datalink(_pcap) == FAKE_DLT_EN10MB
+	    && IPFilter::compile_bpf(_filter, _snaplen, _snaplen,
+				     _force_ip && noutputs() == 1, bpf)) {
+	    fcode.bf_len = bpf.size();
+	    fcode.bf_insns = reinterpret_cast<struct bpf_insn *>(bpf.begin());
+	} else {
+	    if (_have_filter)
+		errh->warning("%s: cannot run FILTER in the kernel", ifname);
+	    if (pcap_compile(_pcap, &fcode, _bpf_filter.mutable_c_str(), 0, netmask) < 0)
+		return errh->error("%s: %s", ifname, fetch_pcap_error(_pcap, 0));
+	}
 	if (pcap_setfilter(_pcap, &fcode) < 0)
 	    return errh->error("%s: %s", ifname, fetch_pcap_error(_pcap, 0));
 
@@ -390,7 +532,8 @@ FromDevice::initialize(ErrorHandler *errh)
 #endif
 
 #if FROMDEVICE_ALLOW_LINUX
-    if (_method == method_default || _method == method_linux) {
+    if (_method == method_default || _method == method_linux
+	|| _method == method_linux_ring) {
 	_fd = open_packet_socket(_ifname, errh);
 	if (_fd < 0)
 	    return -1;
@@ -404,12 +547,20 @@ FromDevice::initialize(ErrorHandler *errh)
 	    _was_promisc = promisc_ok;
 
 	_datalink = FAKE_DLT_EN10MB;
-	_method = method_linux;
+	if (_method != method_linux_ring)
+	    _method = method_linux;
+# if FROMDEVICE_ALLOW_LINUX_RING
+	else if (open_ring(errh) < 0)
+	    return -1;
+# endif
+	if (_have_filter)
+	    attach_filter(errh);
     }
 #endif
 
-#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
-    if (_method == method_pcap || _method == method_netmap)
+#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_LINUX_RING
+    if (_method == method_pcap || _method == method_netmap
+	|| _method == method_linux_ring)
 	ScheduleInfo::initialize_task(this, &_task, false, errh);
 #endif
 #if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_LINUX || FROMDEVICE_ALLOW_NETMAP
@@ -433,8 +584,13 @@ FromDevice::cleanup(CleanupStage stage)
     if (_fd >= 0 && _method == method_netmap)
 	_netmap.close(_fd);
 #endif
+#if FROMDEVICE_ALLOW_LINUX_RING
+    if (_ring)
+	munmap(_ring, (size_t) ring_block_size * _ring_nblocks);
+    _ring = 0;
+#endif
 #if FROMDEVICE_ALLOW_LINUX
-    if (_fd >= 0 && _method == method_linux) {
+    if (_fd >= 0 && (_method == method_linux || _method == method_linux_ring)) {
 	if (_was_promisc >= 0)
 	    set_promiscuous(_fd, _ifname, _was_promisc);
 	close(_fd);
@@ -528,6 +684,16 @@ FromDevice::selected(int, int)
 	    ErrorHandler::default_handler()->error("%p{element}: %s", this, pcap_geterr(_pcap));
     }
 #endif
+#if FROMDEVICE_ALLOW_LINUX_RING
+    if (_method == method_linux_ring) {
+	// Process at most one ring block.
+	int r = ring_dispatch();
+	if (r > 0) {
+	    _count += r;
+	    _task.reschedule();
+	}
+    }
+#endif
 #if FROMDEVICE_ALLOW_LINUX
     int nlinux = 0;
     while (_method == method_linux && nlinux < _burst) {
@@ -561,7 +727,7 @@ FromDevice::selected(int, int)
 #endif
 }
 
-#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP
+#if FROMDEVICE_ALLOW_PCAP || FROMDEVICE_ALLOW_NETMAP || FROMDEVICE_ALLOW_LINUX_RING
 bool
 FromDevice::run_task(Task *)
 {
@@ -583,6 +749,10 @@ FromDevice::run_task(Task *)
 	if (r < 0 && ++_pcap_complaints < 5)
 	    ErrorHandler::default_handler()->error("%p{element}: %s", this, pcap_geterr(_pcap));
     }
+# endif
+# if FROMDEVICE_ALLOW_LINUX_RING
+    if (_method == method_linux_ring)
+	r = ring_dispatch();
 # endif
     if (r > 0) {
 	_count += r;
@@ -605,11 +775,14 @@ FromDevice::kernel_drops(bool& known, int& max_drops) const
     }
 #endif
 #if FROMDEVICE_ALLOW_LINUX && defined(PACKET_STATISTICS)
-    if (_method == method_linux) {
+    if (_method == method_linux || _method == method_linux_ring) {
+	// reading PACKET_STATISTICS resets the kernel's counters
         struct tpacket_stats stats;
         socklen_t statsize = sizeof(stats);
-        if (getsockopt(_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &statsize) >= 0)
-            known = true, max_drops = stats.tp_drops;
+        if (getsockopt(_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &statsize) >= 0) {
+	    _linux_drops += stats.tp_drops;
+            known = true, max_drops = _linux_drops;
+	}
     }
 #endif
 }
@@ -652,5 +825,5 @@ FromDevice::add_handlers()
 }
 
 CLICK_ENDDECLS
-ELEMENT_REQUIRES(userlevel FakePcap KernelFilter NetmapInfo)
+ELEMENT_REQUIRES(userlevel FakePcap KernelFilter NetmapInfo IPFilter)
 EXPORT_ELEMENT(FromDevice)
@@ -86,6 +86,7 @@ FromDump::configure(Vector<String> &conf, ErrorHandler *errh)
     bool per_node = false;
 #endif
     _packet_filepos = 0;
+    _burst = 1;
 
     if (_ff.configure_keywords(conf, this, errh) < 0)
 	return -1;
@@ -94,6 +95,7 @@ FromDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read_p("TIMING", timing)
 	.read("STOP", stop)
 	.read("ACTIVE", active)
+	.read("BURST", _burst)
 	.read("SAMPLE", FixedPointArg(SAMPLING_SHIFT), _sampling_prob)
 	.read("FORCE_IP", force_ip)
 	.read("START", first_time)
@@ -153,6 +155,8 @@ FromDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _have_any_times = false;
     _timing = timing;
     _force_ip = force_ip;
+    if (_burst == 0 || _timing)
+	_burst = 1;
 
 #if CLICK_NS
     if (per_node) {
@@ -212,6 +216,11 @@ FromDump::initialize(ErrorHandler *errh)
 	ScheduleInfo::initialize_task(this, &_task, _active, errh);
     _timer.initialize(this);
 
+    // sample with a private generator: with TimeSortedSched PARALLEL, this
+    // element runs on its own thread
+    if (_sampling_prob < (1 << SAMPLING_SHIFT))
+	_sampling_state = click_random() | ((uint64_t) click_random() << 31);
+
     // skip if hotswapping
     if (hotswap_element())
 	return 0;
@@ -226,27 +235,35 @@ FromDump::initialize(ErrorHandler *errh)
     if (!fh)
 	return _ff.error(errh, "not a tcpdump file (too short)");
 
-    if (fh->magic == FAKE_PCAP_MAGIC || fh->magic == FAKE_PCAP_MAGIC_NANO || fh->magic == FAKE_MODIFIED_PCAP_MAGIC)
-	_swapped = false;
-    else {
-	swap_file_header(fh, &swapped_fh);
-	_swapped = true;
-	fh = &swapped_fh;
+    Timestamp first_ts;
+    bool use_index = _have_first_time && _ff.index_first_timestamp(first_ts);
+    _pcapng = (fh->magic == FAKE_PCAPNG_SHB);
+    if (_pcapng) {
+	if (initialize_pcapng(reinterpret_cast<const uint32_t *>(fh), use_index || _packet_filepos != 0, errh) < 0)
+	    return -1;
+    } else {
+	if (fh->magic == FAKE_PCAP_MAGIC || fh->magic == FAKE_PCAP_MAGIC_NANO || fh->magic == FAKE_MODIFIED_PCAP_MAGIC)
+	    _swapped = false;
+	else {
+	    swap_file_header(fh, &swapped_fh);
+	    _swapped = true;
+	    fh = &swapped_fh;
+	}
+	if (fh->magic != FAKE_PCAP_MAGIC && fh->magic != FAKE_PCAP_MAGIC_NANO && fh->magic != FAKE_MODIFIED_PCAP_MAGIC)
+	    return _ff.error(errh, "not a tcpdump file (bad magic number)");
+	// compensate for extra crap appended to packet headers
+	if (fh->magic == FAKE_PCAP_MAGIC || fh->magic == FAKE_PCAP_MAGIC_NANO)
+	    _extra_pkthdr_crap = 0;
+	else
+	    _extra_pkthdr_crap = sizeof(fake_modified_pcap_pkthdr) - sizeof(fake_pcap_pkthdr);
+	_have_nanosecond_timestamps = fh->magic == FAKE_PCAP_MAGIC_NANO;
+
+	if (fh->version_major != FAKE_PCAP_VERSION_MAJOR)
+	    return _ff.error(errh, "unknown major version %d", fh->version_major);
+	_minor_version = fh->version_minor;
+	// map possible host link types to global link types
+	_linktype = fake_pcap_canonical_dlt(fh->linktype, true);
     }
-    if (fh->magic != FAKE_PCAP_MAGIC && fh->magic != FAKE_PCAP_MAGIC_NANO && fh->magic != FAKE_MODIFIED_PCAP_MAGIC)
-	return _ff.error(errh, "not a tcpdump file (bad magic number)");
-    // compensate for extra crap appended to packet headers
-    if (fh->magic == FAKE_PCAP_MAGIC || fh->magic == FAKE_PCAP_MAGIC_NANO)
-	_extra_pkthdr_crap = 0;
-    else
-	_extra_pkthdr_crap = sizeof(fake_modified_pcap_pkthdr) - sizeof(fake_pcap_pkthdr);
-    _have_nanosecond_timestamps = fh->magic == FAKE_PCAP_MAGIC_NANO;
-
-    if (fh->version_major != FAKE_PCAP_VERSION_MAJOR)
-	return _ff.error(errh, "unknown major version %d", fh->version_major);
-    _minor_version = fh->version_minor;
-    // map possible host link types to global link types
-    _linktype = fake_pcap_canonical_dlt(fh->linktype, true);
 
     // if forcing IP packets, check datalink type to ensure we understand it
     if (_force_ip) {
@@ -261,8 +278,103 @@ FromDump::initialize(ErrorHandler *errh)
 	int result = _ff.seek(_packet_filepos, errh);
 	_packet_filepos = 0;
 	return result;
-    } else
+    } else if (use_index) {
+	// use the index to skip packets before START
+	prepare_times(first_ts);
+	return _ff.seek_time(_first_time, errh) < 0 ? -1 : 0;
+    } else if (_have_first_time && !_pcapng && !_ff.building_index())
+	return seek_start(errh);
+    else
+	return 0;
+}
+
+int
+FromDump::record_length(const unsigned char *data, Timestamp &ts) const
+{
+    // return the length of a plausible packet record at 'data', or 0
+    fake_pcap_pkthdr ph;
+    memcpy(&ph, data, sizeof(ph));
+    if (_swapped)
+	swap_packet_header(&ph, &ph);
+    uint32_t len = ph.len, caplen = ph.caplen;
+    if (_minor_version < 3 || (_minor_version == 3 && caplen > len))
+	len = ph.caplen, caplen = ph.len;
+    uint32_t subsec_limit = (_have_nanosecond_timestamps ? 1000000000 : 1000000);
+    if (caplen > 65535 || caplen > len || len > 262144
+	|| (uint32_t) ph.ts.tv.tv_usec >= subsec_limit)
 	return 0;
+    ts = fake_bpf_timeval_union::make_timestamp(&ph.ts, _have_nanosecond_timestamps);
+    return sizeof(ph) + _extra_pkthdr_crap + caplen;
+}
+
+bool
+FromDump::resync(const unsigned char *buf, size_t n, bool at_eof,
+		 size_t &pos, Timestamp &ts) const
+{
+    // find the first offset in 'buf' that starts a chain of plausible,
+    // time-ordered records; the chain must be RESYNC_RECORDS long, or run
+    // to the end of the buffer
+    for (pos = 0; pos + sizeof(fake_pcap_pkthdr) <= n; ++pos) {
+	size_t o = pos;
+	int k;
+	Timestamp prev, t;
+	for (k = 0; k < RESYNC_RECORDS && o + sizeof(fake_pcap_pkthdr) <= n; ++k) {
+	    int rlen = record_length(buf + o, t);
+	    if (!rlen || (k && (t < prev || t - prev > Timestamp(3600))))
+		break;
+	    if (!k)
+		ts = t;
+	    prev = t;
+	    o += rlen;
+	}
+	if (k == RESYNC_RECORDS
+	    || (o + sizeof(fake_pcap_pkthdr) > n && (at_eof ? o == n : k >= 2)))
+	    return true;
+    }
+    return false;
+}
+
+int
+FromDump::seek_start(ErrorHandler *errh)
+{
+    // Find the first packet at or after START by binary search over the
+    // file, assuming packets are in timestamp order.  Only works for
+    // uncompressed regular files.
+    off_t size = _ff.file_size();
+    off_t lo = _ff.file_pos();
+    if (size < 0 || size - lo < 2 * PROBE_SIZE)
+	return 0;
+
+    unsigned char *buf = new unsigned char[PROBE_SIZE];
+    Timestamp ts;
+    size_t pos;
+    int n = _ff.read(buf, PROBE_SIZE, errh);
+    if (n < (int) sizeof(fake_pcap_pkthdr) || !record_length(buf, ts)) {
+	delete[] buf;
+	return _ff.seek(lo, errh);
+    }
+    if (!_have_any_times)
+	prepare_times(ts);
+
+    // invariant: lo is a record with timestamp before START
+    off_t hi = size;
+    while (ts < _first_time && hi - lo > PROBE_SIZE) {
+	off_t mid = lo + (hi - lo) / 2;
+	if (_ff.seek(mid, errh) < 0) {
+	    delete[] buf;
+	    return -1;
+	}
+	n = _ff.read(buf, PROBE_SIZE, errh);
+	Timestamp mid_ts;
+	if (resync(buf, n, mid + n >= size, pos, mid_ts)
+	    && mid + (off_t) pos < hi && mid_ts < _first_time)
+	    lo = mid + pos;
+	else
+	    hi = mid;
+    }
+
+    delete[] buf;
+    return _ff.seek(lo, errh);
 }
 
 void
@@ -276,6 +388,8 @@ FromDump::take_state(Element *e, ErrorHandler *errh)
     o->_packet = 0;
 
     _swapped = o->_swapped;
+    _pcapng = o->_pcapng;
+    _interfaces.swap(o->_interfaces);
     _extra_pkthdr_crap = o->_extra_pkthdr_crap;
     _minor_version = o->_minor_version;
 
@@ -324,15 +438,241 @@ FromDump::prepare_times(const Timestamp &ts)
     _have_any_times = true;
 }
 
+inline Timestamp
+FromDump::PcapngInterface::make_timestamp(uint64_t t) const
+{
+    Timestamp ts;
+    if (binary_tsresol) {
+	uint64_t frac = t & ((uint64_t(1) << tsresol) - 1);
+	uint32_t nsec;
+	if (tsresol <= 34)
+	    nsec = (frac * 1000000000) >> tsresol;
+	else
+	    nsec = ((frac >> (tsresol - 34)) * 1000000000) >> 34;
+	ts = Timestamp::make_nsec(t >> tsresol, nsec);
+    } else if (tsunits == 1000000 && tsdivisor == 1)
+	ts = Timestamp::make_usec(t / 1000000, t % 1000000);
+    else {
+	t /= tsdivisor;
+	ts = Timestamp::make_nsec(t / tsunits, (t % tsunits) * (1000000000 / tsunits));
+    }
+    if (tsoffset)
+	ts += Timestamp(tsoffset, 0);
+    return ts;
+}
+
+int
+FromDump::read_pcapng_section(const uint32_t *shb, ErrorHandler *errh)
+{
+    // 'shb' holds the first 24 bytes of a section header block, which set
+    // the byte order of the rest of the section
+    uint32_t len = shb[1];
+    uint16_t major;
+    memcpy(&major, &shb[3], sizeof(major));
+    if (shb[2] == FAKE_PCAPNG_BYTE_ORDER_MAGIC)
+	_swapped = false;
+    else if (shb[2] == SWAPLONG(FAKE_PCAPNG_BYTE_ORDER_MAGIC)) {
+	_swapped = true;
+	len = SWAPLONG(len);
+	major = SWAPSHORT(major);
+    } else
+	return _ff.error(errh, "not a pcapng file (bad byte-order magic)");
+    if (major != FAKE_PCAPNG_VERSION_MAJOR)
+	return _ff.error(errh, "unknown pcapng major version %d", major);
+    if (len < 28 || (len & 3))
+	return _ff.error(errh, "bad pcapng section header");
+    // interface IDs are local to a section
+    _interfaces.clear();
+    _ff.shift_pos(len - 24);
+    return 0;
+}
+
+int
+FromDump::read_pcapng_interface(uint32_t len, ErrorHandler *errh)
+{
+    if (len < 20)
+	return _ff.error(errh, "bad pcapng interface description");
+    String body = _ff.get_string(len - 12, errh);
+    if (body.length() != (int) (len - 12))
+	return -1;
+    _ff.shift_pos(4);		// trailing block length
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(body.data());
+    const uint8_t *end = data + body.length();
+    PcapngInterface iface;
+    uint16_t linktype;
+    memcpy(&linktype, data, sizeof(linktype));
+    memcpy(&iface.snaplen, data + 4, sizeof(iface.snaplen));
+    if (_swapped) {
+	linktype = SWAPSHORT(linktype);
+	iface.snaplen = SWAPLONG(iface.snaplen);
+    }
+    iface.linktype = fake_pcap_canonical_dlt(linktype, true);
+    iface.binary_tsresol = false;
+    iface.tsresol = 6;
+    iface.tsoffset = 0;
+
+    // options: if_tsresol (9) and if_tsoffset (14) matter
+    for (const uint8_t *o = data + 8; o + 4 <= end; ) {
+	uint16_t code, olen;
+	memcpy(&code, o, sizeof(code));
+	memcpy(&olen, o + 2, sizeof(olen));
+	if (_swapped) {
+	    code = SWAPSHORT(code);
+	    olen = SWAPSHORT(olen);
+	}
+	if (code == 0 || o + 4 + olen > end)
+	    break;
+	if (code == 9 && olen >= 1) {
+	    iface.binary_tsresol = (o[4] & 0x80) != 0;
+	    iface.tsresol = o[4] & 0x7F;
+	} else if (code == 14 && olen >= 8) {
+	    uint32_t x[2];
+	    memcpy(x, o + 4, sizeof(x));
+	    if (_swapped)
+		iface.tsoffset = ((uint64_t) SWAPLONG(x[0]) << 32) | SWAPLONG(x[1]);
+	    else
+		memcpy(&iface.tsoffset, x, sizeof(x));
+	}
+	o += 4 + ((olen + 3) & ~3);
+    }
+
+    iface.tsunits = 1;
+    iface.tsdivisor = 1;
+    if (!iface.binary_tsresol) {
+	if (iface.tsresol > 19)
+	    return _ff.error(errh, "unsupported pcapng timestamp resolution 10^-%d", iface.tsresol);
+	for (int i = 0; i < iface.tsresol; ++i)
+	    if (i < 9)
+		iface.tsunits *= 10;
+	    else
+		iface.tsdivisor *= 10;
+    }
+
+    if (iface.linktype == FAKE_DLT_RAW)
+	_force_ip = true;
+    _interfaces.push_back(iface);
+    return 0;
+}
+
+int
+FromDump::read_pcapng_block(uint32_t &type, uint32_t &len, ErrorHandler *errh)
+{
+    // Read a block header. Consume the whole block and return 0 unless it
+    // is a packet block, in which case return 1. Return -1 at EOF or error.
+    uint32_t swapped_bh[2];
+    const uint32_t *bh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(8, swapped_bh, errh));
+    if (!bh)
+	return -1;
+    type = bh[0];
+    if (type == FAKE_PCAPNG_SHB) {
+	// a new section, perhaps with a different byte order
+	uint32_t shb[6];
+	memcpy(shb, bh, 8);
+	const uint8_t *rest = _ff.get_unaligned(16, &shb[2], errh);
+	if (!rest)
+	    return -1;
+	else if (rest != reinterpret_cast<uint8_t *>(&shb[2]))
+	    memcpy(&shb[2], rest, 16);
+	return read_pcapng_section(shb, errh);
+    }
+
+    len = bh[1];
+    if (_swapped) {
+	type = SWAPLONG(type);
+	len = SWAPLONG(len);
+    }
+    if (len < 12 || (len & 3))
+	return _ff.error(errh, "bad pcapng block length");
+    else if (type == FAKE_PCAPNG_EPB || type == FAKE_PCAPNG_SPB)
+	return 1;
+    else if (type == FAKE_PCAPNG_IDB)
+	return read_pcapng_interface(len, errh);
+    else {
+	_ff.shift_pos(len - 8);
+	return 0;
+    }
+}
+
+int
+FromDump::initialize_pcapng(const uint32_t *shb, bool seeking, ErrorHandler *errh)
+{
+    if (read_pcapng_section(shb, errh) < 0)
+	return -1;
+    _extra_pkthdr_crap = 0;
+
+    // Read blocks through the first interface description. If we're about
+    // to seek, read all blocks up to the first packet, so that the seek
+    // doesn't skip other interfaces, then back up to that packet.
+    uint32_t type, len;
+    off_t pos;
+    int r;
+    do {
+	pos = _ff.file_pos();
+	r = read_pcapng_block(type, len, errh);
+    } while (r == 0 && (seeking || type != FAKE_PCAPNG_IDB));
+    if (_interfaces.empty())
+	return _ff.error(errh, "no pcapng interface description before first packet");
+    _linktype = _interfaces[0].linktype;
+    return r > 0 ? _ff.seek(pos, errh) : 0;
+}
+
+inline bool
+FromDump::finish_packet(Timestamp ts, uint32_t caplen, uint32_t len,
+			uint32_t skiplen, ErrorHandler *errh)
+{
+    // skiplen bytes follow the packet data in the record
+    Packet *p;
+  check_times:
+    if (!_have_any_times)
+	prepare_times(ts);
+    if (_have_first_time) {
+	if (ts < _first_time) {
+	    _ff.shift_pos(caplen + skiplen);
+	    return true;
+	} else
+	    _have_first_time = false;
+    }
+    if (_have_last_time && ts >= _last_time) {
+	_have_last_time = false;
+	(void) _end_h->call_write(errh);
+	if (!_active) {
+	    _ff.shift_pos(caplen + skiplen);
+	    return false;
+	}
+	// retry _last_time in case someone changed it
+	goto check_times;
+    }
+
+    // checking sampling probability
+    if (_sampling_prob < (1 << SAMPLING_SHIFT)
+	&& (click_random_r(_sampling_state) & ((1<<SAMPLING_SHIFT)-1)) >= _sampling_prob) {
+	_ff.shift_pos(caplen + skiplen);
+	return true;
+    }
+
+    // create packet
+    p = _ff.get_packet(caplen, ts.sec(), ts.subsec(), errh);
+    if (!p)
+	return false;
+    SET_EXTRA_LENGTH_ANNO(p, len - caplen);
+    _ff.shift_pos(skiplen);
+
+    p->set_mac_header(p->data());
+    _packet = p;
+    return true;
+}
+
 bool
 FromDump::read_packet(ErrorHandler *errh)
 {
     fake_pcap_pkthdr swapped_ph;
     const fake_pcap_pkthdr *ph;
     Timestamp ts = Timestamp::uninitialized_t();
-    int len, caplen, skiplen = 0;
-    Packet *p;
+    uint32_t len, caplen, skiplen = 0;
     assert(!_packet);
+    if (_pcapng)
+	return read_pcapng_packet(errh);
 
     // record file position
     _packet_filepos = _ff.file_pos();
@@ -371,45 +711,72 @@ FromDump::read_packet(ErrorHandler *errh)
     _ff.shift_pos(_extra_pkthdr_crap);
 
     // check times
-  check_times:
     ts = fake_bpf_timeval_union::make_timestamp(&ph->ts, _have_nanosecond_timestamps);
-    if (!_have_any_times)
-	prepare_times(ts);
-    if (_have_first_time) {
-	if (ts < _first_time) {
-	    _ff.shift_pos(caplen + skiplen);
-	    return true;
-	} else
-	    _have_first_time = false;
-    }
-    if (_have_last_time && ts >= _last_time) {
-	_have_last_time = false;
-	(void) _end_h->call_write(errh);
-	if (!_active) {
-	    _ff.shift_pos(caplen + skiplen);
-	    return false;
-	}
-	// retry _last_time in case someone changed it
-	goto check_times;
-    }
+    _ff.index_record(_packet_filepos, ts);
+    return finish_packet(ts, caplen, len, skiplen, errh);
+}
 
-    // checking sampling probability
-    if (_sampling_prob < (1 << SAMPLING_SHIFT)
-	&& (click_random() & ((1<<SAMPLING_SHIFT)-1)) >= _sampling_prob) {
-	_ff.shift_pos(caplen + skiplen);
-	return true;
+bool
+FromDump::read_pcapng_packet(ErrorHandler *errh)
+{
+    uint32_t type, len, ifindex = 0, caplen, origlen, hdrlen;
+    Timestamp ts;
+
+    // record file position
+    _packet_filepos = _ff.file_pos();
+
+    // non-packet blocks count as records that yield no packet
+    int r = read_pcapng_block(type, len, errh);
+    if (r <= 0)
+	return r == 0;
+
+    if (type == FAKE_PCAPNG_EPB) {
+	uint32_t swapped_eh[5];
+	const uint32_t *eh;
+	hdrlen = 28;
+	if (len < hdrlen + 4
+	    || !(eh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(20, swapped_eh, errh))))
+	    goto bad_block;
+	ifindex = eh[0];
+	uint32_t ts_high = eh[1], ts_low = eh[2];
+	caplen = eh[3];
+	origlen = eh[4];
+	if (_swapped) {
+	    ifindex = SWAPLONG(ifindex);
+	    ts_high = SWAPLONG(ts_high);
+	    ts_low = SWAPLONG(ts_low);
+	    caplen = SWAPLONG(caplen);
+	    origlen = SWAPLONG(origlen);
+	}
+	if (ifindex >= (uint32_t) _interfaces.size())
+	    goto bad_block;
+	ts = _interfaces[ifindex].make_timestamp(((uint64_t) ts_high << 32) | ts_low);
+	_ff.index_record(_packet_filepos, ts);
+    } else {
+	// simple packet blocks come from interface 0 and have no timestamp
+	uint32_t swapped_sh;
+	const uint32_t *sh;
+	hdrlen = 12;
+	if (len < hdrlen + 4 || _interfaces.empty()
+	    || !(sh = reinterpret_cast<const uint32_t *>(_ff.get_aligned(4, &swapped_sh, errh))))
+	    goto bad_block;
+	origlen = (_swapped ? SWAPLONG(*sh) : *sh);
+	caplen = len - hdrlen - 4;
+	if (origlen < caplen)
+	    caplen = origlen;
+	if (_interfaces[0].snaplen && _interfaces[0].snaplen < caplen)
+	    caplen = _interfaces[0].snaplen;
     }
 
-    // create packet
-    p = _ff.get_packet(caplen, ts.sec(), ts.subsec(), errh);
-    if (!p)
-	return false;
-    SET_EXTRA_LENGTH_ANNO(p, len - caplen);
-    _ff.shift_pos(skiplen);
+    if (caplen > len - hdrlen - 4)
+	goto bad_block;
+    _linktype = _interfaces[ifindex].linktype;
+    return finish_packet(ts, caplen, origlen < caplen ? caplen : origlen,
+			 len - hdrlen - caplen, errh);
 
-    p->set_mac_header(p->data());
-    _packet = p;
-    return true;
+  bad_block:
+    _ff.error(errh, "bad pcapng packet block; giving up");
+    return false;
 }
 
 bool
@@ -449,30 +816,44 @@ FromDump::run_task(Task *)
     if (!_active)
 	return false;
 
+    PacketBatch batch;
+    bool more = true, waiting = false;
     int retry_count = 0;
-  again:
-    if (!_packet && !read_packet(0)) {
-	if (_end_h)
-	    _end_h->call_write(ErrorHandler::default_handler());
-	return false;
-    }
-    if (_packet && _timing && !check_timing(_packet))
-	return false;
-    if (_packet && _force_ip && !fake_pcap_force_ip(_packet, _linktype)) {
-	checked_output_push(1, _packet);
-	_packet = 0;
+    while (batch.count() < _burst) {
+	bool had_last_time = _have_last_time;
+	if (!_packet && !read_packet(0)) {
+	    more = false;
+	    break;
+	}
+	if (_packet && _timing && !check_timing(_packet)) {
+	    waiting = true;
+	    break;
+	}
+	if (_packet && _force_ip && !fake_pcap_force_ip(_packet, _linktype)) {
+	    checked_output_push(1, _packet);
+	    _packet = 0;
+	}
+	if (_packet) {
+	    batch.append(_packet);
+	    _packet = 0;
+	} else if (++retry_count >= 16)
+	    break;
+	// END_CALL may have stopped the driver; don't read past its packet
+	if (had_last_time && !_have_last_time)
+	    break;
     }
-    if (!_packet && ++retry_count < 16)
-	goto again;
 
-    _task.fast_reschedule();
-    if (_packet) {
-	output(0).push(_packet);
-	_count++;
-	_packet = 0;
-	return true;
-    } else
-	return false;
+    unsigned n = batch.count();
+    if (n) {
+	_count += n;
+	output(0).push_batch(batch);
+    }
+    if (!more) {
+	if (_end_h)
+	    _end_h->call_write(ErrorHandler::default_handler());
+    } else if (!waiting)
+	_task.fast_reschedule();
+    return n != 0;
 }
 
 Packet *
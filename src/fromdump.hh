@@ -12,7 +12,7 @@ class HandlerCall;
 /*
 =c
 
-FromDump(FILENAME [, I<keywords> STOP, TIMING, SAMPLE, FORCE_IP, START, START_AFTER, END, END_AFTER, INTERVAL, END_CALL, FILEPOS, MMAP])
+FromDump(FILENAME [, I<keywords> STOP, TIMING, SAMPLE, FORCE_IP, START, START_AFTER, END, END_AFTER, INTERVAL, END_CALL, FILEPOS, MMAP, INDEX, BUILD_INDEX])
 
 =s traces
 
@@ -24,8 +24,15 @@ Reads packets from a file produced by `tcpdump -w FILENAME' or ToDump and
 emits them from the output, optionally stopping the driver when there are no
 more packets.
 
-FromDump also transparently reads gzip- and bzip2-compressed tcpdump files, if
-you have zcat(1) and bzcat(1) installed.
+FromDump also transparently reads gzip-, bzip2-, xz-, and zstd-compressed
+tcpdump files. See DECOMPRESS, below.
+
+FromDump also reads pcapng files, such as those written by Wireshark and
+`tcpdump --pcapng'. A pcapng file may describe several interfaces, each with
+its own link type and timestamp resolution; FromDump applies the right ones to
+each packet, so the C<encap> handler and FORCE_IP follow the link type of the
+packet most recently read. Packets from simple packet blocks, which carry no
+timestamp, get timestamp zero.
 
 Keyword arguments are:
 
@@ -59,12 +66,17 @@ pushed out on output 1; otherwise, they are dropped.) Default is false.
 =item START
 
 Absolute time in seconds since the epoch. FromDump will output packets with
-timestamps after that time.
+timestamps after that time. If the file has an index (see INDEX), FromDump
+jumps close to that time rather than reading every earlier packet.
+Otherwise, for uncompressed tcpdump files (but not pcapng files), FromDump
+finds the first such packet by binary search, which assumes that the file's
+packets are in timestamp order.
 
 =item START_AFTER
 
 Argument is relative time in seconds (or supply a suffix like `min', `h').
-FromDump will skip the first I<T> seconds in the log.
+FromDump will skip the first I<T> seconds in the log. Uses the index, if
+any, like START.
 
 =item END
 
@@ -94,6 +106,15 @@ are mutually exclusive.
 Boolean. If false, then FromDump will not emit packets (until the `C<active>'
 handler is written). Default is true.
 
+=item BURST
+
+Unsigned integer. In push context, FromDump reads up to BURST packets at a
+time and pushes them downstream as one batch. Elements that process batches
+pass the burst on without a per-packet call; others receive the packets one
+at a time. Handlers called while a batch is being processed, such as a
+downstream element's request to stop the driver, take effect only after the
+whole batch has been pushed. Ignored when TIMING is true. Default is 1.
+
 =item FILEPOS
 
 File offset. If supplied, then FromDump will start emitting packets from
@@ -108,6 +129,49 @@ This can result in slightly better performance on some machines. FromDump's
 regular file discipline is pretty optimized, so the difference is often small
 in practice. Default is true on most operating systems, but false on Linux.
 
+=item READAHEAD
+
+Integer. If nonzero, read the file asynchronously, keeping this many
+one-megabyte reads in flight. Uses io_uring where available, and a reader
+thread otherwise. Ignored for compressed files. Default is 0.
+
+=item DIRECT
+
+Boolean. If true, open the file with O_DIRECT, bypassing the page cache.
+Implies READAHEAD 4 unless READAHEAD is set. Default is false.
+
+=item DECOMPRESS
+
+Boolean. If true, then gzip-, bzip2-, xz-, and zstd-compressed files are
+decompressed in-process when the corresponding library was available at
+build time; otherwise they are piped through zcat(1) and friends. Default is
+true.
+
+=item DECOMPRESS_THREADS
+
+Integer. Number of decompression threads. Files made of independent blocks
+(BGZF, pbzip2, multi-frame zstd, multi-block xz) are decompressed in
+parallel. Default is one less than the number of CPUs, at most 8.
+
+=item INDEX
+
+Filename. The file's index, which lets FromDump jump to a START time or a
+FILEPOS without reading, or decompressing, everything before it. Default is
+FILENAME with `C<.idx>' appended. FromDump uses the index if it exists and
+matches the file's current size and modification time.
+
+=item BUILD_INDEX
+
+Boolean. If true, then FromDump writes an index for the file while reading
+it. The index is written once the whole file has been read. Default is false.
+
+=item INDEX_SPAN
+
+Integer. When building an index, record an entry about every INDEX_SPAN
+bytes of (uncompressed) file. Smaller spans make jumps faster and the index
+larger: each entry inside a gzip member stores 32KB of decompressor state.
+Default is 4194304 (4MB).
+
 =back
 
 You can supply at most one of START and START_AFTER, and at most one of END,
@@ -157,11 +221,20 @@ Returns the filename supplied to FromDump.
 =h filesize read-only
 
 Returns the length of the FromDump file, in bytes, or "-" if that length
-cannot be determined (because the file was compressed, for example).
+cannot be determined (because the file is a pipe, for example). For
+compressed files, this is the compressed length.
 
 =h filepos read/write
 
 Returns or sets FromDump's position in the (uncompressed) file, in bytes.
+Moving backward in a compressed file restarts decompression from the closest
+indexed point, or the start of the file.
+
+=h raw_filepos read-only
+
+Returns FromDump's position in the file as stored on disk, in bytes, for
+comparison with C<filesize>. When FromDump decompresses a file in-process,
+this is the position in the compressed file; otherwise it equals C<filepos>.
 
 =h packet_filepos read-only
 
@@ -213,6 +286,7 @@ class FromDump : public Element { public:
   private:
 
     enum { BUFFER_SIZE = 32768, SAMPLING_SHIFT = 28 };
+    enum { PROBE_SIZE = 262144, RESYNC_RECORDS = 4 };
 
     FromFile _ff;
 
@@ -228,9 +302,12 @@ class FromDump : public Element { public:
     bool _last_time_relative : 1;
     bool _last_time_interval : 1;
     bool _have_nanosecond_timestamps : 1;
+    bool _pcapng : 1;
     bool _active;
     unsigned _extra_pkthdr_crap;
     unsigned _sampling_prob;
+    uint64_t _sampling_state;
+    unsigned _burst;
     int _minor_version;
     int _linktype;
 
@@ -252,7 +329,30 @@ class FromDump : public Element { public:
     Timestamp _timing_offset;
     off_t _packet_filepos;
 
+    struct PcapngInterface {
+	int linktype;
+	uint32_t snaplen;
+	bool binary_tsresol;	// units are 2^-tsresol seconds if true,
+	uint8_t tsresol;	// 10^-tsresol seconds otherwise
+	uint32_t tsunits;	// decimal units per second, at most 10^9
+	uint64_t tsdivisor;	// 10^(tsresol - 9) for finer decimal units
+	int64_t tsoffset;
+	inline Timestamp make_timestamp(uint64_t t) const;
+    };
+    Vector<PcapngInterface> _interfaces;
+
     bool read_packet(ErrorHandler *);
+    bool read_pcapng_packet(ErrorHandler *);
+    int read_pcapng_block(uint32_t &type, uint32_t &len, ErrorHandler *);
+    int read_pcapng_section(const uint32_t *shb, ErrorHandler *);
+    int read_pcapng_interface(uint32_t len, ErrorHandler *);
+    int initialize_pcapng(const uint32_t *shb, bool seeking, ErrorHandler *);
+    bool finish_packet(Timestamp ts, uint32_t caplen, uint32_t len,
+		       uint32_t skiplen, ErrorHandler *);
+    int record_length(const unsigned char *data, Timestamp &ts) const;
+    bool resync(const unsigned char *buf, size_t n, bool at_eof,
+		size_t &pos, Timestamp &ts) const;
+    int seek_start(ErrorHandler *errh);
 
     void prepare_times(const Timestamp &);
     bool check_timing(Packet *p);
@@ -20,6 +20,8 @@
 #include <click/config.h>
 
 #include "fromipsumdump.hh"
+#include "summarycounter.hh"
+#include "timerange.hh"
 #include <click/args.hh>
 #include <click/router.hh>
 #include <click/standard/scheduleinfo.hh>
@@ -33,10 +35,14 @@
 #include <click/packet_anno.hh>
 #include <click/nameinfo.hh>
 #include <click/userutils.hh>
+#include <click/integers.hh>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if __SSE2__
+# include <emmintrin.h>
+#endif
 CLICK_DECLS
 
 #ifdef i386
@@ -49,7 +55,9 @@ CLICK_DECLS
 #define GET1(p)		((p)[0])
 
 FromIPSummaryDump::FromIPSummaryDump()
-    : _work_packet(0), _task(this), _timer(this)
+    : _time_field(-1), _work_packet(0), _task(this), _timer(this),
+      _summary_counter(0), _summary_time_range(0), _summary_nfields(0),
+      _column_record_size(0), _column_row(0), _column_nrows(0)
 {
     _ff.set_landmark_pattern("%f:%l");
 }
@@ -67,14 +75,69 @@ FromIPSummaryDump::cast(const char *n)
 	return Element::cast(n);
 }
 
+// Fields that set only their own values, so that FromIPSummaryDump may
+// leave them unset when NEEDED_FIELDS does not include them.  Fields in one
+// group read each other's values.  Network-level (1) and TCP-level (2)
+// fields also create headers; a skipped binary field still creates its
+// header, while a text field, whose value might not parse, is never skipped.
+enum {
+    G_TIME = 1 << 0, G_COUNT = 1 << 1, G_PAINT = 1 << 2, G_AGGREGATE = 1 << 3,
+    G_IP_SRC = 1 << 4, G_IP_DST = 1 << 5, G_IP_TOS = 1 << 6, G_IP_TTL = 1 << 7,
+    G_IP_ID = 1 << 8, G_IP_SUM = 1 << 9, G_TCP_SEQ = 1 << 10,
+    G_TCP_ACK = 1 << 11, G_TCP_WINDOW = 1 << 12, G_TCP_URP = 1 << 13
+};
+
+static const struct {
+    const char *name;
+    uint32_t group;
+    int level;
+} optional_fields[] = {
+    { "timestamp", G_TIME, 0 }, { "ntimestamp", G_TIME, 0 },
+    { "ts_sec", G_TIME, 0 }, { "ts_usec", G_TIME, 0 },
+    { "ts_usec1", G_TIME, 0 }, { "first_timestamp", G_TIME, 0 },
+    { "first_ntimestamp", G_TIME, 0 }, { "count", G_COUNT, 0 },
+    { "link", G_PAINT, 0 }, { "paint", G_PAINT, 0 },
+    { "direction", G_PAINT, 0 }, { "aggregate", G_AGGREGATE, 0 },
+    { "ip_src", G_IP_SRC, 1 }, { "ip_dst", G_IP_DST, 1 },
+    { "ip_tos", G_IP_TOS, 1 }, { "ip_dscp", G_IP_TOS, 1 },
+    { "ip_ecn", G_IP_TOS, 1 }, { "ip_ttl", G_IP_TTL, 1 },
+    { "ip_id", G_IP_ID, 1 }, { "ip_sum", G_IP_SUM, 1 },
+    { "tcp_seq", G_TCP_SEQ, 2 }, { "tcp_ack", G_TCP_ACK, 2 },
+    { "tcp_window", G_TCP_WINDOW, 2 }, { "tcp_urp", G_TCP_URP, 2 }
+};
+
+static uint32_t
+optional_field_group(const char *name, int &level)
+{
+    for (size_t i = 0; i < sizeof(optional_fields) / sizeof(optional_fields[0]); ++i)
+	if (strcmp(name, optional_fields[i].name) == 0) {
+	    level = optional_fields[i].level;
+	    return optional_fields[i].group;
+	}
+    return 0;
+}
+
+static inline uint32_t
+get_value(const uint8_t *data, int width)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < width; ++i)
+	v = (v << 8) | data[i];
+    return v;
+}
+
 int
 FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 {
     bool stop = false, active = true, zero = true, checksum = false, multipacket = false, timing = false, allow_nonexistent = false;
     uint8_t default_proto = IP_PROTO_TCP;
+    Timestamp start, end;
     _sampling_prob = (1 << SAMPLING_SHIFT);
-    String default_contents, default_flowid, data;
+    String default_contents, default_flowid, data, needed_fields, filter;
+    String summary_field = "ip_dst";
 
+    if (_ff.configure_keywords(conf, this, errh) < 0)
+	return -1;
     if (Args(conf, this, errh)
 	.read_p("FILENAME", FilenameArg(), _ff.filename())
 	.read("STOP", stop)
@@ -85,16 +148,26 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("SAMPLE", FixedPointArg(SAMPLING_SHIFT), _sampling_prob)
 	.read("PROTO", default_proto)
 	.read("MULTIPACKET", multipacket)
+	.read("START", start)
+	.read("END", end)
 	.read("DEFAULT_CONTENTS", AnyArg(), default_contents)
 	.read("DEFAULT_FIELDS", AnyArg(), default_contents)
 	.read("DEFAULT_FLOWID", AnyArg(), default_flowid)
 	.read("CONTENTS", AnyArg(), default_contents)
 	.read("FIELDS", AnyArg(), default_contents)
 	.read("FLOWID", AnyArg(), default_flowid)
+	.read("NEEDED_FIELDS", AnyArg(), needed_fields)
+	.read("FILTER", filter)
 	.read("ALLOW_NONEXISTENT", allow_nonexistent)
         .read("DATA", data)
+	.read("AGGREGATE_COUNTER", ElementCastArg("SummaryCounter"), _summary_counter)
+	.read("AGGREGATE_FIELD", WordArg(), summary_field)
+	.read("TIME_RANGE", ElementCastArg("TimeRange"), _summary_time_range)
 	.complete() < 0)
 	return -1;
+    if (summary_field != "ip_src" && summary_field != "ip_dst")
+	return errh->error("AGGREGATE_FIELD must be %<ip_src%> or %<ip_dst%>");
+    _summary_aggregate = IPSummaryDump::FieldReader::find(summary_field);
     if (_sampling_prob > (1 << SAMPLING_SHIFT)) {
 	errh->warning("SAMPLE probability reduced to 1");
 	_sampling_prob = (1 << SAMPLING_SHIFT);
@@ -110,7 +183,26 @@ FromIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _allow_nonexistent = allow_nonexistent;
     _have_timing = false;
     _multipacket = multipacket;
-    _have_flowid = _have_aggregate = _binary = false;
+    _start = start;
+    _have_start = (bool) start;
+    _end = end;
+    _have_end = (bool) end;
+    _have_records = false;
+    _index_ok = true;
+    _have_flowid = _have_aggregate = _binary = _columnar = false;
+    _time_nsec = false;
+
+    _needed_groups = 0;
+    _have_needed = (bool) needed_fields;
+    Vector<String> words;
+    cp_spacevec(cp_unquote(needed_fields), words);
+    for (String *w = words.begin(); w != words.end(); ++w) {
+	const IPSummaryDump::FieldReader *f = IPSummaryDump::FieldReader::find(*w);
+	int level;
+	_needed_groups |= optional_field_group(f ? f->name : w->c_str(), level);
+    }
+    parse_filter(filter);
+
     if (default_contents)
 	bang_data(default_contents, errh);
     if (default_flowid)
@@ -159,6 +251,10 @@ FromIPSummaryDump::initialize(ErrorHandler *errh)
 	_notifier.initialize(Notifier::EMPTY_NOTIFIER, router());
     _timer.initialize(this);
     _format_complaint = false;
+    // sample with a private generator: with TimeSortedSched PARALLEL, this
+    // element runs on its own thread
+    if (_sampling_prob < (1 << SAMPLING_SHIFT))
+	_sampling_state = click_random() | ((uint64_t) click_random() << 31);
     if (output_is_push(0))
 	ScheduleInfo::initialize_task(this, &_task, _active, errh);
 
@@ -229,6 +325,7 @@ FromIPSummaryDump::bang_data(const String &line, ErrorHandler *errh)
 
     _fields.clear();
     _field_order.clear();
+    _spans.clear();
     for (int i = 0; i < words.size(); i++) {
 	String word = cp_unquote(words[i]);
 	if (i == 0 && (word == "!data" || word == "!contents"))
@@ -244,12 +341,74 @@ FromIPSummaryDump::bang_data(const String &line, ErrorHandler *errh)
 	_fields.push_back(f);
 	_field_order.push_back(_fields.size() - 1);
     }
+    _spans.resize(2 * _fields.size());
 
     if (_fields.size() == 0)
 	_ff.error(errh, "no contents specified");
 
     click_qsort(_field_order.begin(), _fields.size(), sizeof(int),
 		sort_fields_compare, this);
+
+    set_field_use();
+    set_filter_fields();
+    check_summary_fields();
+    if (_columnar)
+	set_column_widths();
+}
+
+void
+FromIPSummaryDump::check_summary_fields()
+{
+    // Fields that may accompany a directly counted record: they cannot
+    // change its aggregate, its count, or, when ip_len is at least 40, its
+    // length.
+    static const char * const simple_fields[] = {
+	"first_timestamp", "first_ntimestamp", "link", "paint", "direction",
+	"aggregate", "wire_len", "ip_src", "ip_dst", "ip_tos", "ip_ttl",
+	"ip_id", "ip_proto", "sport", "dport", "tcp_seq", "tcp_ack",
+	"tcp_flags", "tcp_window", "udp_len"
+    };
+
+    _summary_nfields = 0;
+    for (int s = 0; s < NS; ++s)
+	_summary_field[s] = -1;
+    if (!_summary_counter || _timing || _multipacket
+	|| _sampling_prob < (1 << SAMPLING_SHIFT))
+	return;
+
+    int nfields = 0;
+    for (int i = 0; i < _fields.size(); ++i) {
+	const IPSummaryDump::FieldReader *f = _fields[i];
+	int s;
+	if (f == _summary_aggregate)
+	    s = S_AGGREGATE;
+	else if (strcmp(f->name, "timestamp") == 0
+		 || strcmp(f->name, "ntimestamp") == 0)
+	    s = S_TIMESTAMP;
+	else if (strcmp(f->name, "ip_len") == 0)
+	    s = S_IP_LEN;
+	else if (strcmp(f->name, "count") == 0)
+	    s = S_COUNT;
+	else {
+	    if (f != &IPSummaryDump::null_reader) {
+		const char * const *sf = simple_fields;
+		const char * const *sfend = sf + sizeof(simple_fields) / sizeof(simple_fields[0]);
+		while (sf != sfend && strcmp(f->name, *sf) != 0)
+		    ++sf;
+		if (sf == sfend)
+		    return;
+	    }
+	    continue;
+	}
+	// a repeated field overrides earlier copies; give up
+	if (_summary_field[s] >= 0)
+	    return;
+	_summary_field[s] = i;
+	nfields = i + 1;
+    }
+
+    if (_summary_field[S_AGGREGATE] >= 0)
+	_summary_nfields = nfields;
 }
 
 void
@@ -325,6 +484,281 @@ FromIPSummaryDump::bang_binary(const String &line, ErrorHandler *errh)
     _ff.set_lineno(1);
 }
 
+void
+FromIPSummaryDump::bang_columnar(const String &line, ErrorHandler *errh)
+{
+    bang_binary(line, errh);
+    _columnar = true;
+    _ff.set_landmark_pattern("%f:block %l");
+    // index entries would point into the middle of row groups
+    _index_ok = false;
+    set_column_widths();
+    if (!_column_width.size() && _fields.size())
+	_ff.error(errh, "variable-length field in columnar dump");
+}
+
+void
+FromIPSummaryDump::set_column_widths()
+{
+    _column_width.clear();
+    _column_record_size = 0;
+    for (int i = 0; i < _fields.size(); i++) {
+	int w = IPSummaryDump::fixed_binary_size(_fields[i]->type);
+	if (w < 0) {
+	    _column_width.clear();
+	    return;
+	}
+	_column_width.push_back(w);
+	_column_record_size += w;
+    }
+}
+
+void
+FromIPSummaryDump::set_field_use()
+{
+    _field_use.clear();
+    for (int i = 0; i < _fields.size(); i++)
+	_field_use.push_back(_fields[i]->inject ? USE_INJECT : 0);
+    if (!_have_needed)
+	return;
+
+    // timestamps and counts also drive this element
+    uint32_t needed = _needed_groups;
+    if (_timing || _multipacket || _have_start || _have_end
+	|| _ff.building_index())
+	needed |= G_TIME;
+    if (_multipacket)
+	needed |= G_COUNT;
+
+    for (int i = 0; i < _fields.size(); i++) {
+	int level;
+	uint32_t group = optional_field_group(_fields[i]->name, level);
+	if (_fields[i]->inject && group && !(needed & group))
+	    _field_use[i] = (level == 1 ? USE_IP_HEADER : (level == 2 ? USE_TCP_HEADER : 0));
+    }
+}
+
+void
+FromIPSummaryDump::parse_filter(const String &text)
+{
+    Vector<String> words;
+    cp_spacevec(text, words);
+
+    // only conjunctions can be checked term by term
+    for (String *w = words.begin(); w != words.end(); ++w)
+	if (*w == "or" || *w == "not"
+	    || w->find_left('|') >= 0 || w->find_left('!') >= 0
+	    || w->find_left('(') >= 0 || w->find_left(')') >= 0
+	    || w->find_left('?') >= 0)
+	    return;
+
+    const String *w = words.begin();
+    while (w < words.end()) {
+	const String *e = w;
+	while (e != words.end() && *e != "and" && *e != "&&")
+	    ++e;
+	parse_filter_term(w, e);
+	w = e + 1;
+    }
+}
+
+void
+FromIPSummaryDump::parse_filter_term(const String *w, const String *end)
+{
+    FilterTerm t;
+    t.natoms = 0;
+
+    // a protocol may precede another test, as in 'tcp port 80'
+    int proto = -1;
+    if (w != end && *w == "ip")
+	++w;
+    if (w != end && (*w == "tcp" || *w == "udp" || *w == "icmp")) {
+	proto = (*w == "tcp" ? IP_PROTO_TCP : (*w == "udp" ? IP_PROTO_UDP : IP_PROTO_ICMP));
+	++w;
+    } else if (end - w >= 2 && *w == "proto") {
+	int32_t p;
+	if (NameInfo::query_int(NameInfo::T_IP_PROTO, this, w[1], &p)
+	    && p >= 0 && p < 256)
+	    proto = p;
+	w += 2;
+    }
+    if (proto >= 0) {
+	FilterAtom a = { "ip_proto", 1, 0xFF, (uint32_t) proto, -1 };
+	t.atom[t.natoms++] = a;
+	_filter.push_back(t);
+	t.natoms = 0;
+    }
+
+    if (w == end)
+	return;
+    int dir = 0;
+    if (*w == "src" || *w == "dst") {
+	dir = (*w == "src" ? 1 : 2);
+	++w;
+    }
+    String kind = "host";
+    if (w != end && (*w == "host" || *w == "net" || *w == "port")) {
+	kind = *w;
+	++w;
+    }
+    if (end - w != 1)
+	return;
+
+    if (kind == "port") {
+	uint16_t port;
+	if (!IPPortArg(proto > 0 ? proto : IP_PROTO_TCP).parse(*w, port, this))
+	    return;
+	if (dir != 2) {
+	    FilterAtom a = { "sport", 2, 0xFFFF, port, -1 };
+	    t.atom[t.natoms++] = a;
+	}
+	if (dir != 1) {
+	    FilterAtom a = { "dport", 2, 0xFFFF, port, -1 };
+	    t.atom[t.natoms++] = a;
+	}
+    } else {
+	IPAddress addr, mask;
+	if (!IPPrefixArg(true).parse(*w, addr, mask, this)
+	    || (kind == "host" && mask.addr() != 0xFFFFFFFFU))
+	    return;
+	uint32_t m = ntohl(mask.addr()), v = ntohl(addr.addr()) & m;
+	if (dir != 2) {
+	    FilterAtom a = { "ip_src", 4, m, v, -1 };
+	    t.atom[t.natoms++] = a;
+	}
+	if (dir != 1) {
+	    FilterAtom a = { "ip_dst", 4, m, v, -1 };
+	    t.atom[t.natoms++] = a;
+	}
+    }
+    _filter.push_back(t);
+}
+
+void
+FromIPSummaryDump::set_filter_fields()
+{
+    _field_offset.clear();
+    _time_field = -1;
+    for (int i = 0, offset = 0; i < _fields.size(); i++) {
+	_field_offset.push_back(offset);
+	int w = IPSummaryDump::fixed_binary_size(_fields[i]->type);
+	if (offset >= 0 && w >= 0)
+	    offset += w;
+	else
+	    offset = -1;
+	if (_time_field < 0 && _field_offset[i] >= 0
+	    && (strcmp(_fields[i]->name, "timestamp") == 0
+		|| strcmp(_fields[i]->name, "ntimestamp") == 0)) {
+	    _time_field = i;
+	    _time_nsec = (_fields[i]->name[0] == 'n');
+	}
+    }
+    if (_time_field >= 0 && _have_end)
+	_field_use[_time_field] |= USE_FILTER;
+
+    for (FilterTerm *t = _filter.begin(); t != _filter.end(); ++t)
+	for (int a = 0; a < t->natoms; a++) {
+	    FilterAtom &x = t->atom[a];
+	    x.field = -1;
+	    for (int i = 0; i < _fields.size() && x.field < 0; i++)
+		if (strcmp(_fields[i]->name, x.name) == 0 && _field_offset[i] >= 0)
+		    x.field = i;
+	    if (x.field >= 0)
+		_field_use[x.field] |= USE_FILTER;
+	}
+}
+
+inline Timestamp
+FromIPSummaryDump::binary_timestamp(const uint8_t *data) const
+{
+    if (_time_nsec)
+	return Timestamp::make_nsec(GET4(data), GET4(data + 4));
+    else
+	return Timestamp::make_usec(GET4(data), GET4(data + 4));
+}
+
+bool
+FromIPSummaryDump::filter_record(const uint8_t *data, const uint8_t *end) const
+{
+    if (_have_end && _time_field >= 0) {
+	const uint8_t *t = data + _field_offset[_time_field];
+	if (t + 8 <= end && binary_timestamp(t) >= _end)
+	    return false;
+    }
+    // a term whose fields are missing might match
+    for (const FilterTerm *t = _filter.begin(); t != _filter.end(); ++t) {
+	int a;
+	for (a = 0; a < t->natoms; a++) {
+	    const FilterAtom &x = t->atom[a];
+	    if (x.field < 0)
+		break;
+	    const uint8_t *v = data + _field_offset[x.field];
+	    if (v + x.width > end
+		|| (get_value(v, x.width) & x.mask) == x.value)
+		break;
+	}
+	if (a == t->natoms)
+	    return false;
+    }
+    return true;
+}
+
+bool
+FromIPSummaryDump::filter_group() const
+{
+    if (_time_field >= 0) {
+	if (_have_start && binary_timestamp(_column_group.max(_time_field)) < _start)
+	    return false;
+	if (_have_end && binary_timestamp(_column_group.min(_time_field)) >= _end)
+	    return false;
+    }
+    // matching values of an atom lie between its value and value | ~mask
+    for (const FilterTerm *t = _filter.begin(); t != _filter.end(); ++t) {
+	int a;
+	for (a = 0; a < t->natoms; a++) {
+	    const FilterAtom &x = t->atom[a];
+	    if (x.field < 0)
+		break;
+	    uint32_t wmask = (x.width == 4 ? 0xFFFFFFFFU : (1U << (8 * x.width)) - 1);
+	    uint32_t lo = get_value(_column_group.min(x.field), x.width);
+	    uint32_t hi = get_value(_column_group.max(x.field), x.width);
+	    if (hi >= x.value && lo <= (x.value | (~x.mask & wmask)))
+		break;
+	}
+	if (a == t->natoms)
+	    return false;
+    }
+    return true;
+}
+
+void
+FromIPSummaryDump::read_column_group(const String &block, ErrorHandler *errh)
+{
+    int nrows = -1;
+    if (_column_width.size())
+	nrows = _column_group.parse(reinterpret_cast<const uint8_t *>(block.data()), block.length(), _column_width);
+    if (nrows < 0) {
+	_ff.error(errh, "bad columnar row group");
+	return;
+    } else if (nrows == 0)	// footer
+	return;
+
+    // skip groups that end before START, or that cannot match FILTER
+    if (!filter_group())
+	return;
+
+    // decode only the columns whose fields will be used
+    _column_rows.resize(nrows * _column_record_size);
+    for (int c = 0, offset = 0; c < _column_width.size(); offset += _column_width[c], c++)
+	if ((_field_use[c] & (USE_INJECT | USE_FILTER))
+	    && !_column_group.decode(c, _column_rows.begin(), _column_record_size, offset)) {
+	    _ff.error(errh, "bad columnar row group");
+	    return;
+	}
+    _column_row = 0;
+    _column_nrows = nrows;
+}
+
 static void
 set_checksums(WritablePacket *q, click_ip *iph)
 {
@@ -352,6 +786,107 @@ set_checksums(WritablePacket *q, click_ip *iph)
     }
 }
 
+// Fields end at whitespace, but double-quoted sections may contain it.
+static inline bool
+field_space(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static const char *
+field_end(const char *s, const char *end)
+{
+#if __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i quote = _mm_set1_epi8('\"');
+#endif
+    while (s < end) {
+#if __SSE2__
+	// skip 16 bytes at a time while none is a space, control character,
+	// quote, or (since the comparison is signed) non-ASCII byte
+	if (s + 16 <= end) {
+	    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+	    __m128i plain = _mm_andnot_si128(_mm_cmpeq_epi8(x, quote),
+					     _mm_cmpgt_epi8(x, space));
+	    unsigned m = ~_mm_movemask_epi8(plain) & 0xFFFF;
+	    if (!m) {
+		s += 16;
+		continue;
+	    }
+	    s += ffs_lsb(m) - 1;
+	}
+#endif
+	if (field_space(*s))
+	    break;
+	else if (*s == '\"')
+	    s = cp_skip_double_quote(s, end);
+	else
+	    ++s;
+    }
+    return s;
+}
+
+void
+FromIPSummaryDump::split_fields(const char *data, const char *end, int nfields)
+{
+    const char **span = _spans.begin();
+    for (int i = 0; i < nfields; ++i, span += 2) {
+	span[0] = data;
+	span[1] = data = field_end(data, end);
+	while (data < end && field_space(*data))
+	    ++data;
+    }
+}
+
+inline bool
+FromIPSummaryDump::parse_field(IPSummaryDump::PacketOdesc &d, int fi) const
+{
+    const char *b = _spans[2 * fi], *e = _spans[2 * fi + 1];
+    if (b == e || (e == b + 1 && *b == '-'))
+	return false;
+    // the String refers to the line's own data; nothing is copied
+    const IPSummaryDump::FieldReader *f = _fields[fi];
+    d.clear_values();
+    return f->ina(d, String::make_stable(b, e), f);
+}
+
+bool
+FromIPSummaryDump::count_summary(const String &line, off_t line_pos)
+{
+    split_fields(line.begin(), line.end(), _summary_nfields);
+
+    // parse the fields the counter needs as the packet path would
+    IPSummaryDump::PacketOdesc d(this, 0, _default_proto, 0, _minor_version);
+    if (!parse_field(d, _summary_field[S_AGGREGATE]))
+	return false;
+    uint32_t aggregate = ntohl(d.v);
+
+    Timestamp ts;
+    if (_summary_field[S_TIMESTAMP] >= 0
+	&& parse_field(d, _summary_field[S_TIMESTAMP]))
+	ts = Timestamp::make_nsec(d.u32[0], d.u32[1]);
+
+    // synthesized packets have at least 40 bytes of headers; shorter
+    // lengths are left to the packet path
+    uint32_t ip_len = 0;
+    if (_summary_field[S_IP_LEN] >= 0
+	&& parse_field(d, _summary_field[S_IP_LEN]) && d.v >= 40)
+	ip_len = d.v;
+
+    uint32_t packets = 1;
+    if (_summary_field[S_COUNT] >= 0
+	&& parse_field(d, _summary_field[S_COUNT]) && d.v)
+	packets = d.v;
+
+    if (!_summary_counter->count_summary(aggregate, packets, ip_len))
+	return false;
+    if (_summary_time_range)
+	_summary_time_range->add(ts);
+    if (_index_ok)
+	_ff.index_record(line_pos, ts);
+    return true;
+}
+
 Packet *
 FromIPSummaryDump::read_packet(ErrorHandler *errh)
 {
@@ -360,14 +895,25 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
     String line;
     const char *data;
     const char *end;
+    off_t line_pos;
+    int nsummary = 0;
 
+  retry:
     while (1) {
-	if ((binary = _binary)) {
+	line_pos = _ff.file_pos();
+	if (_column_row < _column_nrows) {
+	    line = String::make_stable(reinterpret_cast<const char *>(_column_rows.begin()) + _column_row * _column_record_size, _column_record_size);
+	    ++_column_row;
+	    binary = true;
+	} else if ((binary = _binary)) {
 	    int result = read_binary(line, errh);
 	    if (result <= 0)
 		goto eof;
-	    else
-		binary = (result == 1);
+	    binary = (result == 1);
+	    if (binary && _columnar) {
+		read_column_group(line, errh);
+		continue;
+	    }
 	} else if (_ff.read_line(line, errh, true) <= 0) {
 	  eof:
 	    _ff.cleanup();
@@ -379,12 +925,26 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 
 	if (data == end)
 	    /* do nothing */;
-	else if (binary || (data[0] != '!' && data[0] != '#'))
+	else if (binary || (data[0] != '!' && data[0] != '#')) {
 	    /* real packet */
+	    // the headers are known by the first packet; if possible, use
+	    // the index to skip packets before START
+	    if (!_have_records && _have_start && _ff.seek_time(_start, errh) > 0) {
+		_have_records = true;
+		continue;
+	    }
+	    _have_records = true;
+	    if (binary && (_filter.size() || _have_end)
+		&& !filter_record((const uint8_t *) data, (const uint8_t *) end))
+		continue;
 	    break;
+	}
 
 	// parse bang lines
 	if (data[0] == '!') {
+	    // indexed positions after a format change would lose it
+	    if (_have_records)
+		_index_ok = false;
 	    if (data + 6 <= end && memcmp(data, "!data", 5) == 0 && isspace((unsigned char) data[5]))
 		bang_data(line, errh);
 	    else if (data + 8 <= end && memcmp(data, "!flowid", 7) == 0 && isspace((unsigned char) data[7]))
@@ -395,11 +955,22 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 		bang_aggregate(line, errh);
 	    else if (data + 8 <= end && memcmp(data, "!binary", 7) == 0 && isspace((unsigned char) data[7]))
 		bang_binary(line, errh);
+	    else if (data + 10 <= end && memcmp(data, "!columnar", 9) == 0 && isspace((unsigned char) data[9]))
+		bang_columnar(line, errh);
 	    else if (data + 10 <= end && memcmp(data, "!contents", 9) == 0 && isspace((unsigned char) data[9]))
 		bang_data(line, errh);
 	}
     }
 
+    // count simple records without making packets; return now and then
+    // so other tasks can run
+    if (_summary_nfields && !binary && !_have_start
+	&& count_summary(line, line_pos)) {
+	if (++nsummary < 64)
+	    goto retry;
+	return 0;
+    }
+
     // read packet data
     WritablePacket *q = Packet::make(16, (const unsigned char *) 0, 0, 1000);
     if (!q) {
@@ -469,6 +1040,15 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	    const IPSummaryDump::FieldReader *f = _fields[*fip];
 	    if (!args[*fip] || !f->inject)
 		continue;
+	    if (!(_field_use[*fip] & USE_INJECT)) {
+		if (_field_use[*fip] & USE_TCP_HEADER) {
+		    if (d.make_ip(IP_PROTO_TCP))
+			(void) d.make_transp();
+		} else if (_field_use[*fip] & USE_IP_HEADER)
+		    (void) d.make_ip(0);
+		nfields++;
+		continue;
+	    }
 	    d.clear_values();
 	    if (f->inb(d, args[*fip], (const uint8_t *) end, f)) {
 		f->inject(d, f);
@@ -477,33 +1057,28 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
 	}
 
     } else {
-	Vector<String> args;
-	while (args.size() < _fields.size()) {
-	    const char *original_data = data;
-	    while (data < end)
-		if (isspace((unsigned char) *data))
-		    break;
-		else if (*data == '\"')
-		    data = cp_skip_double_quote(data, end);
-		else
-		    ++data;
-	    args.push_back(line.substring(original_data, data));
-	    while (data < end && isspace((unsigned char) *data))
-		++data;
-	}
+	split_fields(data, end, _fields.size());
+	bool skipped = false;
 
 	for (int *fip = _field_order.begin();
 	     fip != _field_order.end() && d.p;
 	     ++fip) {
 	    const IPSummaryDump::FieldReader *f = _fields[*fip];
-	    if (!args[*fip] || args[*fip].equals("-", 1) || !f->inject)
+	    // whether a text field creates headers depends on its value
+	    if (!f->inject)
 		continue;
-	    d.clear_values();
-	    if (f->ina(d, args[*fip], f)) {
+	    else if (!(_field_use[*fip] & (USE_INJECT | USE_IP_HEADER | USE_TCP_HEADER)))
+		skipped = true;
+	    else if (parse_field(d, *fip)) {
 		f->inject(d, f);
 		nfields++;
 	    }
 	}
+
+	// a line is well-formed if any field parses, even a skipped one
+	for (int fi = 0; !nfields && skipped && fi < _fields.size(); ++fi)
+	    if (_fields[fi]->inject && parse_field(d, fi))
+		nfields++;
     }
 
     if (!nfields) {	// bad format
@@ -573,6 +1148,22 @@ FromIPSummaryDump::read_packet(ErrorHandler *errh)
     if (d.p && d.want_len > d.p->length())
 	SET_EXTRA_LENGTH_ANNO(d.p, d.want_len - d.p->length());
 
+    if (d.p) {
+	if (_index_ok)
+	    _ff.index_record(line_pos, d.p->timestamp_anno());
+	if (_have_start) {
+	    if (d.p->timestamp_anno() < _start) {
+		d.p->kill();
+		goto retry;
+	    }
+	    _have_start = false;
+	}
+	if (_have_end && d.p->timestamp_anno() >= _end) {
+	    d.p->kill();
+	    goto retry;
+	}
+    }
+
     return d.p;
 }
 
@@ -705,7 +1296,7 @@ FromIPSummaryDump::run_task(Task *)
 	    p = handle_multipacket(p);
 	// check sampling probability
 	if (_sampling_prob >= (1 << SAMPLING_SHIFT)
-	    || (click_random() & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
+	    || (click_random_r(_sampling_state) & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
 	    break;
 	if (p)
 	    p->kill();
@@ -738,7 +1329,7 @@ FromIPSummaryDump::pull(int)
 	    p = handle_multipacket(p);
 	// check sampling probability
 	if (_sampling_prob >= (1 << SAMPLING_SHIFT)
-	    || (click_random() & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
+	    || (click_random_r(_sampling_state) & ((1 << SAMPLING_SHIFT) - 1)) < _sampling_prob)
 	    break;
 	if (p)
 	    p->kill();
@@ -807,6 +1398,6 @@ FromIPSummaryDump::add_handlers()
 	add_task_handlers(&_task);
 }
 
-ELEMENT_REQUIRES(userlevel IPSummaryDumpInfo)
+ELEMENT_REQUIRES(userlevel IPSummaryDumpInfo IPSummaryDump_Columns)
 EXPORT_ELEMENT(FromIPSummaryDump)
 CLICK_ENDDECLS
@@ -7,13 +7,15 @@
 #include <click/notifier.hh>
 #include <click/ipflowid.hh>
 #include <click/fromfile.hh>
-#include "ipsumdumpinfo.hh"
+#include "ipsumdumpcolumns.hh"
 CLICK_DECLS
+class SummaryCounter;
+class TimeRange;
 
 /*
 =c
 
-FromIPSummaryDump(FILENAME [, I<keywords> STOP, TIMING, ACTIVE, ZERO, CHECKSUM, PROTO, MULTIPACKET, SAMPLE, FIELDS, FLOWID, DATA])
+FromIPSummaryDump(FILENAME [, I<keywords> STOP, TIMING, ACTIVE, ZERO, CHECKSUM, PROTO, MULTIPACKET, SAMPLE, START, END, FIELDS, FLOWID, NEEDED_FIELDS, FILTER, DATA])
 
 =s traces
 
@@ -25,8 +27,8 @@ Reads IP packet descriptors from a file produced by ToIPSummaryDump, then
 creates packets containing info from the descriptors and pushes them out the
 output. Optionally stops the driver when there are no more packets.
 
-The file may be compressed with gzip(1) or bzip2(1); FromIPSummaryDump will
-run zcat(1) or bzcat(1) to uncompress it.
+The file may be compressed with gzip(1), bzip2(1), xz(1), or zstd(1); see
+DECOMPRESS, below.
 
 FromIPSummaryDump reads from the file named FILENAME unless FILENAME is a
 single dash 'C<->', in which case it reads from the standard input. It will
@@ -87,6 +89,22 @@ C<sampling_prob> handler to find out the actual probability. If MULTIPACKET is
 true, then the sampling probability applies separately to the multiple packets
 generated per record.
 
+=item START
+
+Absolute time in seconds since the epoch. FromIPSummaryDump skips records
+with timestamps before that time, up to the first record at or after it.
+(For multipacket records, the timestamp is that of the last packet.) If the
+file has an index (see INDEX), FromIPSummaryDump jumps close to that time
+rather than reading every earlier record. In columnar dumps, row groups that
+end before START are skipped without being decoded.
+
+=item END
+
+Absolute time in seconds since the epoch. FromIPSummaryDump skips records
+with timestamps at or after that time. Records need not be sorted, so the
+rest of the file is still read. In columnar dumps, row groups that begin at
+or after END are skipped without being decoded.
+
 =item FIELDS
 
 String, containing a space-separated list of field names (see
@@ -100,6 +118,28 @@ destination address, destination port, and, optionally, protocol). Defines the
 IP addresses and ports used by default. Any flow information in the input file
 will override this setting.
 
+=item NEEDED_FIELDS
+
+String, containing a space-separated list of field names: the fields that
+downstream elements will examine. FromIPSummaryDump may then leave other
+fields, such as addresses, TTLs, sequence numbers, and annotations, unset on
+its packets, which saves parsing them (and, in columnar dumps, decoding
+them). Fields that give packets their shape, such as protocols, lengths, and
+ports, are always set. Default is to set every field.
+
+=item FILTER
+
+String, an IPFilter expression. FromIPSummaryDump skips binary and columnar
+records that cannot match the expression by examining only the relevant
+record bytes, without making packets for them. It checks terms joined by
+`C<and>' that test protocols (C<tcp>, C<udp>, C<icmp>, C<ip proto P>),
+addresses (C<host A>, C<net N/L>, optionally with C<src> or C<dst>), and
+ports (C<port P>, C<src port P>, C<dst port P>); other terms, and
+expressions containing C<or> or C<not>, are not checked. Records that might
+match are emitted, so FILTER complements IPFilter rather than replacing it.
+In columnar dumps, row groups whose minimum and maximum values rule out a
+match are skipped without being decoded. Text dumps are not filtered.
+
 =item ALLOW_NONEXISTENT
 
 Boolean.  If true, allow nonexistent and empty files: FromIPSummaryDump will
@@ -111,6 +151,74 @@ Defaults to false.
 String. If set, FromIPSummaryDump reads from the DATA string, rather than
 from a file.
 
+=item AGGREGATE_COUNTER
+
+Element, such as an AggregateCounter. If set, then FromIPSummaryDump hands
+simple text records to this element directly, without creating packets for
+them. Each record is counted with the aggregate given by its AGGREGATE_FIELD
+field, the packet count given by its C<count> field, and the length given by
+its C<ip_len> field; records counted this way are not emitted. A record is
+handled normally, as a packet, if its aggregate field is missing or the
+counter cannot use it (for instance, because it counts bytes and the record
+has no C<ip_len>). Use this keyword only when FromIPSummaryDump's packets
+would reach the counter unchanged, except for aggregation on AGGREGATE_FIELD.
+Direct counting is used only for text dumps whose fields are all addresses,
+ports, lengths, timestamps, counts, and similar simple header fields, and
+only when TIMING, MULTIPACKET, SAMPLE, and START are unset.
+
+=item AGGREGATE_FIELD
+
+Field name, C<ip_src> or C<ip_dst>. The field whose address, in host byte
+order, is the aggregate for AGGREGATE_COUNTER. Default is C<ip_dst>.
+
+=item TIME_RANGE
+
+Element, a TimeRange. If set, then the timestamps of records counted by
+AGGREGATE_COUNTER are added to this element's range.
+
+=item READAHEAD
+
+Integer. If nonzero, read the file asynchronously, keeping this many
+one-megabyte reads in flight. Uses io_uring where available, and a reader
+thread otherwise. Ignored for compressed files. Default is 0.
+
+=item DIRECT
+
+Boolean. If true, open the file with O_DIRECT, bypassing the page cache.
+Implies READAHEAD 4 unless READAHEAD is set. Default is false.
+
+=item DECOMPRESS
+
+Boolean. If true, then gzip-, bzip2-, xz-, and zstd-compressed files are
+decompressed in-process when the corresponding library was available at
+build time; otherwise they are piped through zcat(1) and friends. Default is
+true.
+
+=item DECOMPRESS_THREADS
+
+Integer. Number of decompression threads. Files made of independent blocks
+(BGZF, pbzip2, multi-frame zstd, multi-block xz) are decompressed in
+parallel. Default is one less than the number of CPUs, at most 8.
+
+=item INDEX
+
+Filename. The file's index, which lets FromIPSummaryDump jump to a START
+time without reading, or decompressing, everything before it. Default is
+FILENAME with `C<.idx>' appended. The index is used if it exists and matches
+the file's current size and modification time.
+
+=item BUILD_INDEX
+
+Boolean. If true, then FromIPSummaryDump writes an index for the file while
+reading it. The index is written once the whole file has been read. Records
+that follow a format change in the middle of the file, such as a second
+`C<!data>' line, are not indexed. Default is false.
+
+=item INDEX_SPAN
+
+Integer. When building an index, record an entry about every INDEX_SPAN
+bytes of (uncompressed) file. Default is 4194304 (4MB).
+
 =back
 
 Only available in user-level processes.
@@ -145,7 +253,13 @@ length cannot be determined.
 
 =h filepos read-only
 
-Returns FromIPSummaryDump's position in the file, in bytes.
+Returns FromIPSummaryDump's position in the (uncompressed) file, in bytes.
+
+=h raw_filepos read-only
+
+Returns FromIPSummaryDump's position in the file as stored, in bytes. For
+compressed files, this is the position in the compressed file, comparable
+with C<filesize>.
 
 =h stop write-only
 
@@ -176,13 +290,35 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
   private:
 
     enum { SAMPLING_SHIFT = 28 };
+    enum { S_AGGREGATE, S_TIMESTAMP, S_IP_LEN, S_COUNT, NS };
+    enum { USE_INJECT = 1, USE_FILTER = 2, USE_IP_HEADER = 4,
+	   USE_TCP_HEADER = 8 };
+
+    struct FilterAtom {
+	const char *name;	// field name
+	int width;		// field's binary size
+	uint32_t mask;
+	uint32_t value;
+	int field;		// field index, or -1 if not in the dump
+    };
+    struct FilterTerm {		// matches if any atom matches
+	FilterAtom atom[2];
+	int natoms;
+    };
 
     FromFile _ff;
 
     Vector<const IPSummaryDump::FieldReader *> _fields;
     Vector<int> _field_order;
+    Vector<const char *> _spans;	// start and end of each field in a line
+    Vector<uint8_t> _field_use;	// USE_ flags for each field
+    Vector<int> _field_offset;	// offset in binary records, or -1
+    int _time_field;		// timestamp field index, or -1
+    uint32_t _needed_groups;	// optional field groups in NEEDED_FIELDS
+    Vector<FilterTerm> _filter;
     uint16_t _default_proto;
     uint32_t _sampling_prob;
+    uint64_t _sampling_state;
     IPFlowID _flowid;
     uint32_t _aggregate;
 
@@ -198,6 +334,15 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     bool _timing : 1;
     bool _have_timing : 1;
     bool _allow_nonexistent : 1;
+    bool _have_start : 1;
+    bool _have_records : 1;
+    bool _index_ok : 1;
+    bool _columnar : 1;
+    bool _have_end : 1;
+    bool _have_needed : 1;
+    bool _time_nsec : 1;
+    Timestamp _start;
+    Timestamp _end;
     Packet *_work_packet;
     uint32_t _multipacket_length;
     Timestamp _multipacket_timestamp_delta;
@@ -211,6 +356,19 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     int _minor_version;
     IPFlowID _given_flowid;
 
+    SummaryCounter *_summary_counter;
+    TimeRange *_summary_time_range;
+    const IPSummaryDump::FieldReader *_summary_aggregate;
+    int _summary_field[NS];	// field index of each S_ value, or -1
+    int _summary_nfields;	// 0 if records cannot be counted directly
+
+    IPSummaryDump::ColumnGroup _column_group;
+    Vector<int> _column_width;	// empty if some field has no fixed size
+    Vector<uint8_t> _column_rows;	// decoded records of the current group
+    int _column_record_size;
+    int _column_row;		// next record in _column_rows
+    int _column_nrows;
+
     int read_binary(String &, ErrorHandler *);
 
     static int sort_fields_compare(const void *, const void *, void *);
@@ -219,6 +377,20 @@ class FromIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     void bang_flowid(const String &, ErrorHandler *);
     void bang_aggregate(const String &, ErrorHandler *);
     void bang_binary(const String &, ErrorHandler *);
+    void bang_columnar(const String &, ErrorHandler *);
+    void set_column_widths();
+    void set_field_use();
+    void parse_filter(const String &);
+    void parse_filter_term(const String *, const String *);
+    void set_filter_fields();
+    inline Timestamp binary_timestamp(const uint8_t *) const;
+    bool filter_record(const uint8_t *, const uint8_t *) const;
+    bool filter_group() const;
+    void read_column_group(const String &, ErrorHandler *);
+    void check_summary_fields();
+    void split_fields(const char *, const char *, int);
+    inline bool parse_field(IPSummaryDump::PacketOdesc &, int) const;
+    bool count_summary(const String &, off_t);
     void check_defaults();
     bool check_timing(Packet *p);
     Packet *read_packet(ErrorHandler *);
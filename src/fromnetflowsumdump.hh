@@ -24,8 +24,8 @@ summary format described below, then creates packets containing info from the
 descriptors and pushes them out the output. Optionally stops the driver when
 there are no more packets.
 
-FILE may be compressed with gzip(1) or bzip2(1); FromNetFlowSummaryDump will
-run zcat(1) or bzcat(1) to uncompress it.
+FILE may be compressed with gzip(1), bzip2(1), xz(1), or zstd(1);
+FromNetFlowSummaryDump will uncompress it.
 
 Keyword arguments are:
 
@@ -124,6 +124,12 @@ length cannot be determined.
 
 Returns FromNetFlowSummaryDump's position in the file, in bytes.
 
+=h raw_filepos read-only
+
+Returns FromNetFlowSummaryDump's position in the file as stored, in bytes. For
+compressed files, this is the position in the compressed file, comparable
+with C<filesize>.
+
 =a
 
 FromDump, FromIPSummaryDump */
@@ -23,8 +23,8 @@ Reads IP packets from a file in a format used for NLANR traces: either FR,
 FR+, or TSH. Pushes them out the output, and optionally stops the driver when
 there are no more packets.
 
-FromNLANRDump also transparently reads gzip- and bzip2-compressed files, if
-you have zcat(1) and bzcat(1) installed.
+FromNLANRDump also transparently reads gzip-, bzip2-, xz-, and
+zstd-compressed files.
 
 Keyword arguments are:
 
@@ -146,6 +146,12 @@ cannot be determined (because the file was compressed, for example).
 
 Returns FromNLANRDump's position in the (uncompressed) file, in bytes.
 
+=h raw_filepos read-only
+
+Returns FromNLANRDump's position in the file as stored, in bytes. For compressed
+files, this is the position in the compressed file, comparable with
+C<filesize>.
+
 =h packet_filepos read-only
 
 Returns the (uncompressed) file position of the last packet emitted, in bytes.
@@ -26,8 +26,8 @@ Reads textual TCP/IP packet descriptors from an ASCII tcpdump(1) output file,
 then creates packets resembling those descriptors and pushes them out the
 output. Optionally stops the driver when there are no more packets.
 
-The file may be compressed with gzip(1) or bzip2(1); FromTcpdump will
-run zcat(1) or bzcat(1) to uncompress it.
+The file may be compressed with gzip(1), bzip2(1), xz(1), or zstd(1);
+FromTcpdump will uncompress it.
 
 FromTcpdump reads from the file named FILENAME unless FILENAME is a
 single dash `C<->', in which case it reads from the standard input. It will
@@ -104,6 +104,12 @@ length cannot be determined.
 
 Returns FromTcpdump's position in the file, in bytes.
 
+=h raw_filepos read-only
+
+Returns FromTcpdump's position in the file as stored, in bytes. For compressed
+files, this is the position in the compressed file, comparable with
+C<filesize>.
+
 =h stop write-only
 
 When written, sets `active' to false and stops the driver.
@@ -57,6 +57,7 @@
 #define BINARY_OPT		317
 #define START_TIME_OPT		318
 #define QUIET_OPT		319
+#define THREADS_OPT		320
 
 // data sources
 #define INTERFACE_OPT		400
@@ -121,6 +122,7 @@ static const Clp_Option options[] = {
     { "random-seed", 0, RANDOM_SEED_OPT, Clp_ValUnsigned, 0 },
     { "promiscuous", 0, PROMISCUOUS_OPT, 0, Clp_Negate },
     { "quiet", 'q', QUIET_OPT, 0, Clp_Negate },
+    { "threads", 0, THREADS_OPT, Clp_ValUnsigned, Clp_Negate },
 
     { "output", 'o', OUTPUT_OPT, Clp_ValString, 0 },
     { "config", 0, CONFIG_OPT, 0, 0 },
@@ -234,6 +236,7 @@ Other options:\n\
                              representing multiple packets (NetFlow only).\n\
       --collate              Collate packets from data sources by timestamp.\n\
       --random-seed SEED     Set random seed to SEED (default is random).\n\
+      --threads N            Count labels on N worker threads.\n\
   -q, --quiet                Do not print progress bar.\n\
       --config               Output Click configuration and exit.\n\
   -V, --verbose              Report errors verbosely.\n\
@@ -300,6 +303,7 @@ struct Options {
     String filename;
     String ipsumdump_format;
     String dag_encap;
+    String summary_field;
     String time_config;
     Timestamp split_time;
     int nfiles;
@@ -320,11 +324,10 @@ add_source(StringAccum &sa, int num, int action, const Options &opt)
 	   << ", SNIFFER true, SNAPLEN " << opt.snaplen << ", FORCE_IP true";
 	if (opt.promisc)
 	    sa << ", PROMISC true";
-#if FROMDEVICE_PCAP
+	// the kernel drops most packets the filter rejects; the IPFilter
+	// downstream drops the rest
 	if (opt.filter)
-	    sa << ", BPF_FILTER " << cp_quote(opt.filter);
-	result |= Options::FILTERED;
-#endif
+	    sa << ", FILTER " << cp_quote(opt.filter);
 	sa << ");\n";
 	return result;
 
@@ -389,6 +392,9 @@ add_source(StringAccum &sa, int num, int action, const Options &opt)
 	    sa << ", MULTIPACKET true";
 	if (opt.ipsumdump_format)
 	    sa << ", CONTENTS " << opt.ipsumdump_format;
+	if (opt.summary_field)
+	    sa << ", AGGREGATE_COUNTER ac, AGGREGATE_FIELD " << opt.summary_field
+	       << ", TIME_RANGE tr";
 	sa << ");\n";
 	return result;
 
@@ -421,6 +427,7 @@ main(int argc, char *argv[])
     uint32_t aggctr_limit_nnz = 0;
     uint32_t aggctr_limit_count = 0;
     uint32_t aggctr_limit_bytes = 0;
+    unsigned nthreads = 0;
     bool config = false;
     bool verbose = false;
     //bool collate;
@@ -529,13 +536,17 @@ main(int argc, char *argv[])
 
 	  case RANDOM_SEED_OPT:
 	    do_seed = false;
-	    srandom(clp->val.u);
+	    click_random_fix_seed(clp->val.u);
 	    break;
 
 	  case QUIET_OPT:
 	    quiet = !clp->negated;
 	    break;
 
+	  case THREADS_OPT:
+	    nthreads = (clp->negated ? 0 : clp->val.u);
+	    break;
+
 	  case TIME_OFFSET_OPT:
 	    time_offset = *((const Timestamp *)&clp->val);
 	    break;
@@ -731,6 +742,15 @@ particular purpose.\n");
 	options.mirror = true;
     }
 
+    // Summary dump records can go straight to the aggregate counter when
+    // nothing between the source and the counter would change them.
+    if (action == READ_IPSUMDUMP_OPT
+	&& (agg == "ip src" || agg == "ip dst")
+	&& !options.mirror && !options.filter && !options.do_sample
+	&& !options.anonymize && !options.multipacket && !options.time_config
+	&& !write_dump && !aggctr_limit_nnz && multi_output < 0)
+	options.summary_field = "ip_" + agg.substring(3);
+
     // source elements
     Vector<uint32_t> source_flags;
     uint32_t all_source_flags = ~0U, any_source_flags = 0;
@@ -825,6 +845,8 @@ particular purpose.\n");
 	output_calls.push_back("ac.aggregate_call '" + String(aggctr_limit_nnz) + " trigger.run'");
     } else if (aggctr_limit_nnz)
 	sa << ", AGGREGATE_STOP " << aggctr_limit_nnz;
+    else if (nthreads)
+	sa << ", THREADS " << nthreads;
     sa << ")\n";
 
     // remains
@@ -843,7 +865,7 @@ particular purpose.\n");
     if (!quiet) {
 	sa << "progress :: ProgressBar(";
 	for (int i = 0; i < files.size(); i++)
-	    sa << "src" << i << ".filepos ";
+	    sa << "src" << i << ".raw_filepos ";
 	sa.pop_back();
 	sa << ", ";
 	for (int i = 0; i < files.size(); i++)
@@ -148,14 +148,14 @@ static const Clp_Option options[] = {
   { "cut-larger-label-aggregates", 0, CUT_LARGER_ADDR_AGG_ACT, CLP_TWO_UINTS_TYPE, 0 },
   { "cut-larger-address-aggregates", 0, CUT_LARGER_ADDR_AGG_ACT, CLP_TWO_UINTS_TYPE, 0 },
 
-  { "cull", 0, CULL_PACKETS_ACT, Clp_ValUnsigned, 0 },
+  { "cull", 0, CULL_PACKETS_ACT, Clp_ValUnsignedLong, 0 },
   { "cull-labels", 0, CULL_ADDRS_ACT, Clp_ValUnsigned, 0 },
   { "cull-labels-by-packets", 0, CULL_ADDRS_BY_PACKETS_ACT, Clp_ValUnsigned, 0 },
   { "cull-addresses", 0, CULL_ADDRS_ACT, Clp_ValUnsigned, 0 },
   { "cull-addresses-by-packets", 0, CULL_ADDRS_BY_PACKETS_ACT, Clp_ValUnsigned, 0 },
   { "cull-addrs", 0, CULL_ADDRS_ACT, Clp_ValUnsigned, 0 },
   { "cull-addrs-by-packets", 0, CULL_ADDRS_BY_PACKETS_ACT, Clp_ValUnsigned, 0 },
-  { "cull-packets", 0, CULL_PACKETS_ACT, Clp_ValUnsigned, 0 },
+  { "cull-packets", 0, CULL_PACKETS_ACT, Clp_ValUnsignedLong, 0 },
 
   { "haar-wavelet-energy", 0, HAAR_WAVELET_ENERGY_ACT, 0, 0 },
 
@@ -302,8 +302,16 @@ write_vector(const Vector<uint32_t> &v, FILE *f)
     write_vector((v.size() ? &v[0] : 0), v.size(), f);
 }
 
+static void
+write_vector(const Vector<uint64_t> &v, FILE *f)
+{
+    for (int i = 0; i < v.size(); i++)
+	fprintf(f, (i ? " %llu" : "%llu"), (unsigned long long) v[i]);
+    fprintf(f, "\n");
+}
+
 static Vector<int> actions;
-static Vector<uint32_t> extras;
+static Vector<uint64_t> extras;
 static Vector<uint32_t> extras2;
 static Vector<String> str_extras;
 static FILE *out;
@@ -312,7 +320,7 @@ static Vector<String> files;
 static int files_pos = 0;
 
 static void
-add_action(int action, uint32_t extra = 0, uint32_t extra2 = 0, const String &extra_s = String())
+add_action(int action, uint64_t extra = 0, uint32_t extra2 = 0, const String &extra_s = String())
 {
     if (actions.size() && actions.back() >= FIRST_END_ACT)
 	die_usage("can't add another action after that");
@@ -323,19 +331,17 @@ add_action(int action, uint32_t extra = 0, uint32_t extra2 = 0, const String &ex
 }
 
 static int
-uint32_compar(const void *ap, const void *bp)
+uint64_compar(const void *ap, const void *bp)
 {
-    uint32_t a = *(reinterpret_cast<const uint32_t *>(ap));
-    uint32_t b = *(reinterpret_cast<const uint32_t *>(bp));
-    return a - b;
+    uint64_t a = *(reinterpret_cast<const uint64_t *>(ap));
+    uint64_t b = *(reinterpret_cast<const uint64_t *>(bp));
+    return (a < b ? -1 : a > b);
 }
 
 static int
-uint32_rev_compar(const void *ap, const void *bp)
+uint64_rev_compar(const void *ap, const void *bp)
 {
-    uint32_t a = *(reinterpret_cast<const uint32_t *>(ap));
-    uint32_t b = *(reinterpret_cast<const uint32_t *>(bp));
-    return b - a;
+    return uint64_compar(bp, ap);
 }
 
 static int
@@ -480,7 +486,7 @@ more_files()
 }
 
 static double
-correlation_coefficient(const Vector<uint32_t> &a, const Vector<uint32_t> &b)
+correlation_coefficient(const Vector<uint64_t> &a, const Vector<uint64_t> &b)
 {
     assert(a.size() == b.size());
     double a_sum = 0, b_sum = 0, a2_sum = 0, b2_sum = 0, ab_sum = 0;
@@ -586,7 +592,7 @@ process_tree_actions(AggregateTree &tree, ErrorHandler *errh)
 
 	  case CULL_PACKETS_ACT: {
 	      AggregateWTree wtree(tree, AggregateWTree::COUNT_PACKETS);
-	      wtree.cull_packets(action_extra);
+	      wtree.cull_packets(extras[j]);
 	      //wtree.ok();
 	      tree = wtree;
 	      break;
@@ -778,10 +784,10 @@ process_actions(AggregateTree &tree, ErrorHandler *errh)
 
       case SIZES_ACT:
       case SORTED_SIZES_ACT: {
-	  Vector<uint32_t> sizes;
+	  Vector<uint64_t> sizes;
 	  tree.active_counts(sizes);
 	  if (action == SORTED_SIZES_ACT && sizes.size())
-	      qsort(&sizes[0], sizes.size(), sizeof(uint32_t), uint32_rev_compar);
+	      qsort(&sizes[0], sizes.size(), sizeof(uint64_t), uint64_rev_compar);
 	  write_vector(sizes, out);
 	  break;
       }
@@ -793,21 +799,21 @@ process_actions(AggregateTree &tree, ErrorHandler *errh)
 	      agg_tree.posterize();
 	  agg_tree.prefixize(action_extra);
 	  tree.take_nonzero_sizes(agg_tree, prefix_to_mask(action_extra));
-	  Vector<uint32_t> sizes;
+	  Vector<uint64_t> sizes;
 	  tree.active_counts(sizes);
 	  write_vector(sizes, out);
 	  break;
       }
 
       case CORR_SIZE_AGG_ADDR_ACT: {
-	  Vector<uint32_t> sizes;
+	  Vector<uint64_t> sizes;
 	  tree.active_counts(sizes);
 
 	  AggregateTree agg_tree(tree);
 	  agg_tree.posterize();
 	  agg_tree.prefixize(action_extra);
 	  tree.take_nonzero_sizes(agg_tree, prefix_to_mask(action_extra));
-	  Vector<uint32_t> agg_addrs;
+	  Vector<uint64_t> agg_addrs;
 	  tree.active_counts(agg_addrs);
 
 	  fprintf(out, "%.20g\n", correlation_coefficient(sizes, agg_addrs));
@@ -816,22 +822,22 @@ process_actions(AggregateTree &tree, ErrorHandler *errh)
       }
 
       case SIZE_COUNTS_ACT: {
-	  Vector<uint32_t> sizes;
+	  Vector<uint64_t> sizes;
 	  tree.active_counts(sizes);
 	  if (sizes.size())
-	      qsort(&sizes[0], sizes.size(), sizeof(uint32_t), uint32_compar);
+	      qsort(&sizes[0], sizes.size(), sizeof(uint64_t), uint64_compar);
 	  uint32_t count = 0;
-	  uint32_t size = 0;
+	  uint64_t size = 0;
 	  for (int i = 0; i < sizes.size(); i++) {
 	      if (sizes[i] != size && count) {
-		  fprintf(out, "%u %u\n", size, count);
+		  fprintf(out, "%llu %u\n", (unsigned long long) size, count);
 		  count = 0;
 	      }
 	      size = sizes[i];
 	      count++;
 	  }
 	  if (count)
-	      fprintf(out, "%u %u\n", size, count);
+	      fprintf(out, "%llu %u\n", (unsigned long long) size, count);
 	  break;
       }
 
@@ -1042,10 +1048,13 @@ particular purpose.\n");
 	  case CUT_LARGER_ACT:
 	  case CULL_ADDRS_ACT:
 	  case CULL_ADDRS_BY_PACKETS_ACT:
-	  case CULL_PACKETS_ACT:
 	    add_action(opt, clp->val.u);
 	    break;
 
+	  case CULL_PACKETS_ACT:
+	    add_action(opt, clp->val.ul);
+	    break;
+
 	  case FAKE_BY_DISCRIM_ACT:
 	    if (!clp->have_val)
 		clp->val.d = 1;	// random
@@ -1189,7 +1198,7 @@ particular purpose.\n");
 	  if (tree1.nnz() != tree2.nnz())
 	      errh->fatal("'--assign-counts' trees have different -N (%u vs. %u)", tree1.nnz(), tree2.nnz());
 
-	  Vector<uint32_t> sizes;
+	  Vector<uint64_t> sizes;
 	  tree1.active_counts(sizes);
 	  tree2.randomly_assign_counts(sizes);
 	  tree2.write_file(out, output_format, errh);
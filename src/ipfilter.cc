@@ -29,6 +29,12 @@
 #include <click/integers.hh>
 #include <click/etheraddress.hh>
 #include <click/nameinfo.hh>
+#if IPFILTER_NATIVE
+# include <sys/mman.h>
+#endif
+#if IPFILTER_SIMD
+# include <immintrin.h>
+#endif
 CLICK_DECLS
 
 static const StaticNameDB::Entry type_entries[] = {
@@ -163,6 +169,7 @@ IPFilter::static_cleanup()
 
 
 IPFilter::IPFilter()
+    : _simd(false)
 {
 }
 
@@ -1298,6 +1305,25 @@ IPFilter::configure(Vector<String> &conf, ErrorHandler *errh)
     parse_program(zprog, conf, noutputs(), this, errh);
     if (!errh->nerrors()) {
 	_zprog = zprog;
+	// The CLICK_IPFILTER_MATCH environment variable picks a slower
+	// matcher, for testing: "simd" skips native code; "interpret"
+	// skips native code and SIMD; and "bpf" judges Ethernet frames with
+	// the classic BPF program FromDevice would give the kernel.
+	const char *how = getenv("CLICK_IPFILTER_MATCH");
+	bool bpf = how && strcmp(how, "bpf") == 0;
+	bool interpret = bpf || (how && strcmp(how, "interpret") == 0);
+	if (bpf && (noutputs() != 1
+		    || !compile_bpf(_zprog, 0xFFFF, 1, false, _bpf)))
+	    errh->warning("cannot compile BPF, using the interpreter");
+	if (!interpret && !(how && strcmp(how, "simd") == 0))
+	    _native.compile(_zprog);
+#if IPFILTER_SIMD
+	// Native code beats lockstep evaluation, so use SIMD only without it.
+	_simd = !_native && !interpret && _zprog.output_everything() < 0
+	    && __builtin_cpu_supports("avx2");
+#else
+	(void) interpret;
+#endif
 	return 0;
     } else
 	return -1;
@@ -1317,6 +1343,583 @@ IPFilter::add_handlers()
 }
 
 
+//
+// NATIVE CODE
+//
+
+#if IPFILTER_NATIVE
+namespace {
+
+/* Translates a compressed program into x86-64 code.  The code follows the
+   System V calling convention: %rdi, %rsi, and %rdx point at the MAC header
+   (minus 2), network header, and transport header, and %eax returns the
+   output port.  Each test loads its packet word into %eax, masks it, and
+   compares it against its values, either in order or, for sorted values,
+   with a balanced tree of comparisons. */
+class X86Compiler { public:
+
+    X86Compiler(const IPFilter::IPFilterProgram &zprog);
+
+    const char *data() const		{ return _sa.data(); }
+    int length() const			{ return _sa.length(); }
+
+  private:
+
+    struct fixup {
+	int pos;		// position of rel32 field
+	bool output;		// target is an output port, not a test
+	int32_t target;		// port or test position in program
+    };
+
+    const uint32_t *_prog;
+    StringAccum _sa;
+    Vector<int> _test_pos;	// indexed by program position
+    Vector<fixup> _fixups;
+
+    void append32(uint32_t x) {
+	char *c = _sa.extend(4);
+	c[0] = x; c[1] = x >> 8; c[2] = x >> 16; c[3] = x >> 24;
+    }
+    void patch32(int pos, uint32_t x) {
+	char *c = _sa.data() + pos;
+	c[0] = x; c[1] = x >> 8; c[2] = x >> 16; c[3] = x >> 24;
+    }
+    // Emit a jump to 'jump', a program jump relative to test 'pc', with
+    // condition code 'cc' (-1 means unconditional).
+    void jump(int cc, int pc, int32_t jump);
+    void compare(uint32_t value) {
+	_sa << (char) 0x3D;	// cmp $value, %eax
+	append32(value);
+    }
+    void search(const uint32_t *v, int lo, int hi, int pc, int32_t yes,
+		int32_t no);
+
+};
+
+enum { cc_b = 0x82, cc_e = 0x84, cc_a = 0x87 };
+
+void
+X86Compiler::jump(int cc, int pc, int32_t jump)
+{
+    if (cc < 0)
+	_sa << (char) 0xE9;
+    else
+	_sa << (char) 0x0F << (char) cc;
+    fixup f;
+    f.pos = _sa.length();
+    f.output = jump <= 0;
+    f.target = (jump <= 0 ? -jump : pc + jump);
+    _fixups.push_back(f);
+    append32(0);
+}
+
+void
+X86Compiler::search(const uint32_t *v, int lo, int hi, int pc,
+		    int32_t yes, int32_t no)
+{
+    if (hi - lo <= 3) {
+	for (int i = lo; i < hi; ++i) {
+	    compare(v[i]);
+	    jump(cc_e, pc, yes);
+	}
+	jump(-1, pc, no);
+    } else {
+	int mid = lo + (hi - lo) / 2;
+	compare(v[mid]);
+	jump(cc_e, pc, yes);
+	_sa << (char) 0x0F << (char) cc_a;
+	int right = _sa.length();
+	append32(0);
+	search(v, lo, mid, pc, yes, no);
+	patch32(right, _sa.length() - (right + 4));
+	search(v, mid + 1, hi, pc, yes, no);
+    }
+}
+
+X86Compiler::X86Compiler(const IPFilter::IPFilterProgram &zprog)
+    : _prog(zprog.begin()), _test_pos(zprog.end() - zprog.begin(), -1)
+{
+    int size = zprog.end() - zprog.begin();
+    for (int pc = 0; pc < size; ) {
+	const uint32_t *pr = _prog + pc;
+	_test_pos[pc] = _sa.length();
+
+	// mov disp32(%base), %eax
+	int off = (int16_t) pr[0], base;
+	if (off >= IPFilter::offset_transp)
+	    off -= IPFilter::offset_transp, base = 2; // %rdx
+	else if (off >= IPFilter::offset_net)
+	    off -= IPFilter::offset_net, base = 6; // %rsi
+	else
+	    base = 7;		// %rdi
+	_sa << (char) 0x8B << (char) (0x80 | base);
+	append32(off);
+	if (pr[3] != 0xFFFFFFFFU) {
+	    _sa << (char) 0x25;	// and $mask, %eax
+	    append32(pr[3]);
+	}
+
+	int nval = pr[0] >> 17, next = pc + 4 + nval;
+	if (IPFilter::PERFORM_BINARY_SEARCH
+	    && nval >= IPFilter::MIN_BINARY_SEARCH)
+	    search(pr + 4, 0, nval, pc, pr[2], pr[1]);
+	else {
+	    for (int i = 0; i < nval; ++i) {
+		compare(pr[4 + i]);
+		jump(cc_e, pc, pr[2]);
+	    }
+	    // fall through to the next test if possible
+	    if ((int32_t) pr[1] <= 0 || pc + (int32_t) pr[1] != next)
+		jump(-1, pc, pr[1]);
+	}
+	pc = next;
+    }
+
+    // output stubs: mov $port, %eax; ret
+    Vector<int32_t> stub_port;
+    Vector<int> stub_pos;
+    for (fixup *f = _fixups.begin(); f != _fixups.end(); ++f) {
+	int dest;
+	if (f->output) {
+	    int i = 0;
+	    while (i < stub_port.size() && stub_port[i] != f->target)
+		++i;
+	    if (i == stub_port.size()) {
+		stub_port.push_back(f->target);
+		stub_pos.push_back(_sa.length());
+		_sa << (char) 0xB8;
+		append32(f->target);
+		_sa << (char) 0xC3;
+	    }
+	    dest = stub_pos[i];
+	} else
+	    dest = _test_pos[f->target];
+	patch32(f->pos, dest - (f->pos + 4));
+    }
+}
+
+}
+#endif
+
+bool
+IPFilter::NativeProgram::compile(const IPFilterProgram &zprog)
+{
+    clear();
+#if IPFILTER_NATIVE
+    if (zprog.output_everything() >= 0 || zprog.begin() == zprog.end())
+	return false;
+    X86Compiler x(zprog);
+    if (!x.length())
+	return false;
+    void *code = mmap(0, x.length(), PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+	return false;
+    memcpy(code, x.data(), x.length());
+    if (mprotect(code, x.length(), PROT_READ | PROT_EXEC) != 0) {
+	munmap(code, x.length());
+	return false;
+    }
+    _code = reinterpret_cast<code_type>(code);
+    _size = x.length();
+    return true;
+#else
+    (void) zprog;
+    return false;
+#endif
+}
+
+void
+IPFilter::NativeProgram::clear()
+{
+#if IPFILTER_NATIVE
+    if (_code)
+	munmap(reinterpret_cast<void *>(_code), _size);
+#endif
+    _code = 0;
+    _size = 0;
+}
+
+
+//
+// CLASSIC BPF
+//
+
+namespace {
+
+enum {
+    bpf_ld = 0x00, bpf_ldx = 0x01, bpf_st = 0x02, bpf_alu = 0x04,
+    bpf_jmp = 0x05, bpf_ret = 0x06, bpf_misc = 0x07,
+    bpf_w = 0x00, bpf_h = 0x08, bpf_b = 0x10,
+    bpf_abs = 0x20, bpf_ind = 0x40, bpf_mem = 0x60, bpf_len = 0x80,
+    bpf_msh = 0xA0,
+    bpf_sub = 0x10, bpf_and = 0x50, bpf_rsh = 0x70,
+    bpf_ja = 0x00, bpf_jeq = 0x10, bpf_jgt = 0x20, bpf_jge = 0x30,
+    bpf_x = 0x08, bpf_txa = 0x80,
+    bpf_maxinsns = 4096
+};
+
+enum { ether_len = 14, ip_min_len = 20 };
+
+/* Translates a compressed program into classic BPF over Ethernet frames.
+   The prologue saves the captured length in M[0], checks that the frame
+   holds IPv4 with a sane header length, leaves that header length in X,
+   and checks that the frame was captured far enough for every test.  Each
+   test then loads its packet word into A, masks it, and compares it
+   against its values, either in order or with a balanced tree of
+   comparisons.  Jumps name labels; assemble() resolves them, routing
+   conditional jumps longer than 255 instructions through 'ja'. */
+class BPFCompiler { public:
+
+    BPFCompiler(const IPFilter::IPFilterProgram &zprog, uint32_t snaplen,
+		uint32_t accept, bool drop_non_ip);
+
+    bool assemble(Vector<IPFilter::BPFInsn> &bpf) const;
+
+  private:
+
+    struct insn {
+	uint16_t code;
+	uint32_t k;
+	int jt;			// labels; -1 means the next instruction
+	int jf;
+    };
+
+    Vector<insn> _insns;
+    Vector<int> _label_pos;	// indexed by label
+    bool _ok;
+
+    int new_label() {
+	_label_pos.push_back(-1);
+	return _label_pos.size() - 1;
+    }
+    void place(int label) {
+	_label_pos[label] = _insns.size();
+    }
+    void emit(uint16_t code, uint32_t k) {
+	insn i = { code, k, -1, -1 };
+	_insns.push_back(i);
+    }
+    void branch(uint16_t code, uint32_t k, int jt, int jf) {
+	insn i = { (uint16_t) (bpf_jmp | code), k, jt, jf };
+	_insns.push_back(i);
+    }
+    void search(const uint32_t *v, int lo, int hi, int yes, int no);
+
+};
+
+BPFCompiler::BPFCompiler(const IPFilter::IPFilterProgram &zprog,
+			 uint32_t snaplen, uint32_t accept, bool drop_non_ip)
+    : _ok(true)
+{
+    const uint32_t *prog = zprog.begin();
+    int size = zprog.end() - zprog.begin();
+    int accept_label = new_label(), reject_label = new_label(),
+	non_ip = new_label(), l;
+
+    // how much of the frame the tests read
+    int need = ether_len + ip_min_len, transp_need = 0;
+    Vector<int> test_label(size, -1);
+    for (int pc = 0; pc < size; pc += 4 + (prog[pc] >> 17)) {
+	int off = (int16_t) prog[pc];
+	if (off >= IPFilter::offset_transp) {
+	    if (off - IPFilter::offset_transp + 4 > transp_need)
+		transp_need = off - IPFilter::offset_transp + 4;
+	} else if (off >= IPFilter::offset_net) {
+	    if (ether_len + off - IPFilter::offset_net + 4 > need)
+		need = ether_len + off - IPFilter::offset_net + 4;
+	} else if (off + 2 > need)
+	    need = off + 2;
+	test_label[pc] = new_label();
+    }
+
+    // M[0] = captured length
+    emit(bpf_ld | bpf_w | bpf_len, 0);
+    l = new_label();
+    branch(bpf_jgt, snaplen, -1, l);
+    emit(bpf_ld, snaplen);
+    place(l);
+    emit(bpf_st, 0);
+    branch(bpf_jge, ether_len + ip_min_len, -1, accept_label);
+
+    // IPv4 with a header length of at least 20; X = header length
+    emit(bpf_ld | bpf_h | bpf_abs, 12);
+    branch(bpf_jeq, 0x0800, -1, non_ip);
+    emit(bpf_ld | bpf_b | bpf_abs, ether_len);
+    emit(bpf_alu | bpf_and, 0xF0);
+    branch(bpf_jeq, 0x40, -1, accept_label);
+    emit(bpf_ldx | bpf_b | bpf_msh, ether_len);
+    emit(bpf_misc | bpf_txa, 0);
+    branch(bpf_jge, ip_min_len, -1, accept_label);
+
+    // leave packets captured too short for the tests to user space
+    emit(bpf_ld | bpf_mem, 0);
+    if (need > ether_len + ip_min_len)
+	branch(bpf_jge, need, -1, accept_label);
+    branch(bpf_jge | bpf_x, 0, -1, accept_label);
+    emit(bpf_alu | bpf_sub | bpf_x, 0);
+    branch(bpf_jge, ether_len + transp_need, -1, accept_label);
+
+    if (zprog.output_everything() >= 0)
+	branch(bpf_ja, 0, zprog.output_everything() == 0 ? accept_label : reject_label, -1);
+    Vector<uint32_t> values;
+    for (int pc = 0; pc < size; ) {
+	const uint32_t *pr = prog + pc;
+	place(test_label[pc]);
+
+	int off = (int16_t) pr[0];
+	uint32_t mask = ntohl(pr[3]);
+	if (off >= IPFilter::offset_transp)
+	    emit(bpf_ld | bpf_w | bpf_ind, ether_len + off - IPFilter::offset_transp);
+	else if (off >= IPFilter::offset_net)
+	    emit(bpf_ld | bpf_w | bpf_abs, ether_len + off - IPFilter::offset_net);
+	else if (off >= 2)
+	    emit(bpf_ld | bpf_w | bpf_abs, off - 2);
+	else {
+	    // the word starts before the frame; the mask must skip those bytes
+	    int shift = 8 * (2 - off);
+	    if (shift >= 32 || (mask >> (32 - shift)) != 0)
+		_ok = false;
+	    emit(bpf_ld | bpf_w | bpf_abs, 0);
+	    emit(bpf_alu | bpf_rsh, shift);
+	}
+	if (mask != 0xFFFFFFFFU)
+	    emit(bpf_alu | bpf_and, mask);
+
+	int nval = pr[0] >> 17, next = pc + 4 + nval, target[2];
+	for (int i = 0; i < 2; ++i) {
+	    int32_t jump = pr[1 + i];
+	    if (jump > 0)
+		target[i] = test_label[pc + jump];
+	    else
+		target[i] = (jump == 0 ? accept_label : reject_label);
+	}
+	values.clear();
+	for (int i = 0; i < nval; ++i)
+	    values.push_back(ntohl(pr[4 + i]));
+	click_qsort(values.begin(), values.size());
+	search(values.begin(), 0, nval, target[1], target[0]);
+	pc = next;
+    }
+
+    place(non_ip);
+    if (drop_non_ip) {
+	// A still holds the ethertype
+	branch(bpf_jeq, 0x86DD, accept_label, -1);
+	branch(bpf_jeq, 0x8100, accept_label, reject_label);
+    } else
+	branch(bpf_ja, 0, accept_label, -1);
+    place(accept_label);
+    emit(bpf_ret, accept);
+    place(reject_label);
+    emit(bpf_ret, 0);
+}
+
+void
+BPFCompiler::search(const uint32_t *v, int lo, int hi, int yes, int no)
+{
+    if (hi - lo <= 3) {
+	for (int i = lo; i < hi - 1; ++i)
+	    branch(bpf_jeq, v[i], yes, -1);
+	if (lo < hi)
+	    branch(bpf_jeq, v[hi - 1], yes, no);
+	else
+	    branch(bpf_ja, 0, no, -1);
+    } else {
+	int mid = lo + (hi - lo) / 2, right = new_label();
+	branch(bpf_jeq, v[mid], yes, -1);
+	branch(bpf_jgt, v[mid], right, -1);
+	search(v, lo, mid, yes, no);
+	place(right);
+	search(v, mid + 1, hi, yes, no);
+    }
+}
+
+bool
+BPFCompiler::assemble(Vector<IPFilter::BPFInsn> &bpf) const
+{
+    if (!_ok)
+	return false;
+
+    // Lay out the program, marking conditional jumps that need a 'ja'
+    // trampoline, until no jump is too long.  Every jump goes forward.
+    int n = _insns.size();
+    Vector<int> pos(n + 1, 0);
+    Vector<int> far(n, 0);	// bit 0: jt needs 'ja', bit 1: jf does
+    bool changed;
+    do {
+	changed = false;
+	for (int i = 0, p = 0; i <= n; ++i) {
+	    pos[i] = p;
+	    if (i < n)
+		p += 1 + (far[i] & 1) + (far[i] >> 1);
+	}
+	for (int i = 0; i < n; ++i) {
+	    const insn &in = _insns[i];
+	    if ((in.code & 0x07) != bpf_jmp || (in.code & 0xF0) == bpf_ja)
+		continue;
+	    for (int b = 0; b < 2; ++b) {
+		int label = (b ? in.jf : in.jt);
+		if (label >= 0 && !(far[i] & (1 << b))
+		    && pos[_label_pos[label]] - (pos[i] + 1) > 255) {
+		    far[i] |= 1 << b;
+		    changed = true;
+		}
+	    }
+	}
+    } while (changed);
+    if (pos[n] > bpf_maxinsns)
+	return false;
+
+    bpf.clear();
+    for (int i = 0; i < n; ++i) {
+	const insn &in = _insns[i];
+	IPFilter::BPFInsn x;
+	x.code = in.code;
+	x.jt = x.jf = 0;
+	x.k = in.k;
+	if ((in.code & 0x07) != bpf_jmp) {
+	    bpf.push_back(x);
+	    continue;
+	} else if ((in.code & 0xF0) == bpf_ja) {
+	    x.k = pos[_label_pos[in.jt]] - (pos[i] + 1);
+	    bpf.push_back(x);
+	    continue;
+	}
+	int dest[2];
+	for (int b = 0; b < 2; ++b) {
+	    int label = (b ? in.jf : in.jt);
+	    dest[b] = (label >= 0 ? pos[_label_pos[label]] : pos[i + 1]);
+	}
+	int tramp = pos[i] + 1;
+	x.jt = (far[i] & 1 ? 0 : dest[0] - (pos[i] + 1));
+	x.jf = (far[i] & 2 ? far[i] & 1 : dest[1] - (pos[i] + 1));
+	bpf.push_back(x);
+	for (int b = 0; b < 2; ++b)
+	    if (far[i] & (1 << b)) {
+		IPFilter::BPFInsn ja = { bpf_jmp | bpf_ja, 0, 0, 0 };
+		ja.k = dest[b] - (tramp + 1);
+		bpf.push_back(ja);
+		++tramp;
+	    }
+    }
+    return true;
+}
+
+}
+
+bool
+IPFilter::compile_bpf(const IPFilterProgram &zprog, uint32_t snaplen,
+		      uint32_t accept, bool drop_non_ip, Vector<BPFInsn> &bpf)
+{
+    BPFCompiler c(zprog, snaplen, accept, drop_non_ip);
+    return c.assemble(bpf);
+}
+
+namespace {
+
+/* Runs a classic BPF program from compile_bpf() over a 'len'-byte frame,
+   like the kernel does, and returns its result.  Out-of-bounds loads and
+   instructions compile_bpf() never emits return 0. */
+uint32_t
+run_bpf(const IPFilter::BPFInsn *insn, int ninsn,
+	const unsigned char *data, uint32_t len)
+{
+    uint32_t a = 0, x = 0, mem[16], k;
+    for (int pc = 0; pc < ninsn; ++pc) {
+	const IPFilter::BPFInsn &in = insn[pc];
+	switch (in.code) {
+	case bpf_ret:
+	    return in.k;
+	case bpf_ld:
+	    a = in.k;
+	    break;
+	case bpf_ld | bpf_w | bpf_len:
+	    a = len;
+	    break;
+	case bpf_ld | bpf_mem:
+	    a = mem[in.k & 15];
+	    break;
+	case bpf_st:
+	    mem[in.k & 15] = a;
+	    break;
+	case bpf_ld | bpf_w | bpf_abs:
+	case bpf_ld | bpf_w | bpf_ind:
+	    k = in.k + (in.code & bpf_ind ? x : 0);
+	    if (k < in.k || k > len || len - k < 4)
+		return 0;
+	    a = (data[k] << 24) | (data[k + 1] << 16) | (data[k + 2] << 8) | data[k + 3];
+	    break;
+	case bpf_ld | bpf_h | bpf_abs:
+	    if (in.k > len || len - in.k < 2)
+		return 0;
+	    a = (data[in.k] << 8) | data[in.k + 1];
+	    break;
+	case bpf_ld | bpf_b | bpf_abs:
+	    if (in.k >= len)
+		return 0;
+	    a = data[in.k];
+	    break;
+	case bpf_ldx | bpf_b | bpf_msh:
+	    if (in.k >= len)
+		return 0;
+	    x = (data[in.k] & 15) << 2;
+	    break;
+	case bpf_misc | bpf_txa:
+	    a = x;
+	    break;
+	case bpf_alu | bpf_and:
+	    a &= in.k;
+	    break;
+	case bpf_alu | bpf_rsh:
+	    a >>= in.k;
+	    break;
+	case bpf_alu | bpf_sub | bpf_x:
+	    a -= x;
+	    break;
+	case bpf_jmp | bpf_ja:
+	    pc += in.k;
+	    break;
+	case bpf_jmp | bpf_jeq:
+	    pc += (a == in.k ? in.jt : in.jf);
+	    break;
+	case bpf_jmp | bpf_jgt:
+	    pc += (a > in.k ? in.jt : in.jf);
+	    break;
+	case bpf_jmp | bpf_jge:
+	    pc += (a >= in.k ? in.jt : in.jf);
+	    break;
+	case bpf_jmp | bpf_jge | bpf_x:
+	    pc += (a >= x ? in.jt : in.jf);
+	    break;
+	default:
+	    return 0;
+	}
+    }
+    return 0;
+}
+
+}
+
+int
+IPFilter::bpf_match(const Packet *p) const
+{
+    // BPF judges Ethernet frames; leave anything else to the interpreter
+    int port = match(_zprog, p);
+    if (p->has_mac_header() && p->network_header() - p->mac_header() == 14) {
+	uint32_t len = p->end_data() - p->mac_header();
+	if (run_bpf(_bpf.begin(), _bpf.size(), p->mac_header(), len)) {
+	    port = 0;
+	} else {
+	    if (port == 0)
+		click_chatter("%p{element}: BPF rejects a frame IPFilter accepts", this);
+	    port = noutputs();
+	}
+    }
+    return port;
+}
+
+
 //
 // RUNNING
 //
@@ -1389,7 +1992,137 @@ IPFilter::length_checked_match(const IPFilterProgram &zprog, const Packet *p,
 void
 IPFilter::push(int, Packet *p)
 {
-    checked_output_push(match(_zprog, p), p);
+    checked_output_push(match(p), p);
+}
+
+#if IPFILTER_SIMD
+namespace {
+
+enum { lane_done = 0x7FFFFFFF };
+
+/* Runs a compressed program on 8 packets at once.  Every lane carries its
+   own program counter.  Jumps only go forward, so each round evaluates the
+   lowest program counter for every lane that has reached it, and no test
+   runs twice.  'base' holds each lane's MAC header (minus 2), network
+   header, and transport header pointers, in that order, 8 at a time.
+   Lanes at and after 'nlanes' are ignored. */
+__attribute__((target("avx2"))) void
+match_lanes(const uint32_t *prog, const unsigned char *const *base,
+	    int nlanes, int *port)
+{
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i pc = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(nlanes), lanes),
+				     _mm256_set1_epi32(lane_done));
+    __m256i result = _mm256_setzero_si256();
+
+    while (1) {
+	__m256i x = _mm256_min_epi32(pc, _mm256_permute2x128_si256(pc, pc, 1));
+	x = _mm256_min_epi32(x, _mm256_shuffle_epi32(x, 0x4E));
+	x = _mm256_min_epi32(x, _mm256_shuffle_epi32(x, 0xB1));
+	int m = _mm256_cvtsi256_si32(x);
+	if (m == lane_done)
+	    break;
+
+	const uint32_t *pr = prog + m;
+	int off = (int16_t) pr[0], r;
+	if (off >= IPFilter::offset_transp)
+	    r = 2, off -= IPFilter::offset_transp;
+	else if (off >= IPFilter::offset_net)
+	    r = 1, off -= IPFilter::offset_net;
+	else
+	    r = 0;
+	const unsigned char *const *br = base + 8 * r;
+	__m256i w = _mm256_setr_epi32(*(const int *) (br[0] + off), *(const int *) (br[1] + off),
+				      *(const int *) (br[2] + off), *(const int *) (br[3] + off),
+				      *(const int *) (br[4] + off), *(const int *) (br[5] + off),
+				      *(const int *) (br[6] + off), *(const int *) (br[7] + off));
+	w = _mm256_and_si256(w, _mm256_set1_epi32(pr[3]));
+
+	int nval = pr[0] >> 17;
+	__m256i match = _mm256_cmpeq_epi32(w, _mm256_set1_epi32(pr[4]));
+	for (int i = 1; i < nval; ++i)
+	    match = _mm256_or_si256(match, _mm256_cmpeq_epi32(w, _mm256_set1_epi32(pr[4 + i])));
+
+	int32_t no = pr[1], yes = pr[2];
+	__m256i target = _mm256_blendv_epi8(_mm256_set1_epi32(no <= 0 ? (int) lane_done : m + no),
+					    _mm256_set1_epi32(yes <= 0 ? (int) lane_done : m + yes),
+					    match);
+	__m256i out = _mm256_blendv_epi8(_mm256_set1_epi32(-no),
+					 _mm256_set1_epi32(-yes), match);
+	__m256i here = _mm256_cmpeq_epi32(pc, x);
+	pc = _mm256_blendv_epi8(pc, target, here);
+	result = _mm256_blendv_epi8(result, out, here);
+    }
+    _mm256_storeu_si256((__m256i *) port, result);
+}
+
+}
+#endif
+
+void
+IPFilter::match_batch(Packet **p, int n, int *port) const
+{
+#if IPFILTER_SIMD
+    if (_simd) {
+	const unsigned char *base[24];
+	int lane[8], nlanes = 0;
+	for (int i = 0; i < n; ++i) {
+	    int packet_length = p[i]->network_length(),
+		network_header_length = p[i]->network_header_length();
+	    if (packet_length > network_header_length)
+		packet_length += offset_transp - network_header_length;
+	    else
+		packet_length += offset_net;
+	    if (packet_length < (int) _zprog.safe_length())
+		port[i] = length_checked_match(_zprog, p[i], packet_length);
+	    else {
+		base[nlanes] = p[i]->mac_header() - 2;
+		base[nlanes + 8] = p[i]->network_header();
+		base[nlanes + 16] = p[i]->transport_header();
+		lane[nlanes] = i;
+		++nlanes;
+	    }
+	}
+	if (nlanes) {
+	    // unused lanes repeat lane 0, so their loads stay in bounds
+	    for (int l = nlanes; l < 8; ++l)
+		for (int r = 0; r < 24; r += 8)
+		    base[l + r] = base[r];
+	    int lane_port[8];
+	    match_lanes(_zprog.begin(), base, nlanes, lane_port);
+	    for (int l = 0; l < nlanes; ++l)
+		port[lane[l]] = lane_port[l];
+	}
+	return;
+    }
+#endif
+    for (int i = 0; i < n; ++i)
+	port[i] = match(p[i]);
+}
+
+void
+IPFilter::push_batch(int, PacketBatch &batch)
+{
+    // Forward runs of packets bound for the same output, which keeps the
+    // packets' relative order on every output.
+    PacketBatch run;
+    int run_port = -1;
+    Packet *p[8];
+    int port[8];
+    while (!batch.empty()) {
+	int n = 0;
+	while (n < 8 && (p[n] = batch.pop_front()))
+	    ++n;
+	match_batch(p, n, port);
+	for (int i = 0; i < n; ++i) {
+	    if (port[i] != run_port) {
+		checked_output_push_batch(run_port, run);
+		run_port = port[i];
+	    }
+	    run.append(p[i]);
+	}
+    }
+    checked_output_push_batch(run_port, run);
 }
 
 CLICK_ENDDECLS
@@ -4,6 +4,24 @@
 #include <click/element.hh>
 CLICK_DECLS
 
+// Compile filter programs to native code where we know how.
+#ifndef IPFILTER_NATIVE
+# if CLICK_USERLEVEL && ALLOW_MMAP && defined(__x86_64__)
+#  define IPFILTER_NATIVE 1
+# else
+#  define IPFILTER_NATIVE 0
+# endif
+#endif
+
+// Match bursts of packets with AVX2 where the compiler can target it.
+#ifndef IPFILTER_SIMD
+# if CLICK_USERLEVEL && defined(__x86_64__) && defined(__GNUC__)
+#  define IPFILTER_SIMD 1
+# else
+#  define IPFILTER_SIMD 0
+# endif
+#endif
+
 /*
 =c
 
@@ -102,6 +120,20 @@ is using to classify packets. At each step in the program, four bytes
 of packet data are ANDed with a mask and compared against four bytes of
 classifier pattern.
 
+=n
+
+On x86-64 user-level drivers, IPFilter translates its program into native
+machine code, which tests packets long enough to satisfy every step without
+interpretation.  Shorter packets, and other platforms, use the interpreter.
+If native code is unavailable but the CPU supports AVX2, IPFilter instead
+evaluates packet batches eight at a time with vector instructions.
+Setting the CLICK_IPFILTER_MATCH environment variable to C<simd> skips native
+code, and setting it to C<interpret> skips both native code and vector
+instructions; this is useful for testing.  Setting it to C<bpf> passes
+Ethernet frames by the classic BPF program that FromDevice's FILTER would
+give the kernel, and reports frames that this program rejects but IPFilter
+accepts.
+
 =a
 
 IPClassifier, Classifier, CheckIPHeader, MarkIPHeader, CheckIPHeader2,
@@ -126,6 +158,7 @@ class IPFilter : public Element { public:
     void add_handlers() CLICK_COLD;
 
     void push(int port, Packet *);
+    void push_batch(int port, PacketBatch &);
 
     typedef Classification::Wordwise::CompressedProgram IPFilterProgram;
     static void parse_program(IPFilterProgram &zprog,
@@ -133,6 +166,57 @@ class IPFilter : public Element { public:
 			      const Element *context, ErrorHandler *errh);
     static inline int match(const IPFilterProgram &zprog, const Packet *p);
 
+    // A program translated to machine code.  Calling it returns the output
+    // port for a packet at least zprog.safe_length() bytes long, given its
+    // MAC header minus 2, network header, and transport header.
+    class NativeProgram { public:
+
+	NativeProgram()			: _code(0), _size(0) { }
+	~NativeProgram()		{ clear(); }
+
+	bool compile(const IPFilterProgram &zprog);
+	void clear();
+
+	operator bool() const		{ return _code != 0; }
+	inline int operator()(const unsigned char *mac_data,
+			      const unsigned char *neth_data,
+			      const unsigned char *transph_data) const {
+	    return _code(mac_data, neth_data, transph_data);
+	}
+
+      private:
+
+	typedef int (*code_type)(const unsigned char *,
+				 const unsigned char *,
+				 const unsigned char *);
+	code_type _code;
+	size_t _size;
+
+	NativeProgram(const NativeProgram &);
+	NativeProgram &operator=(const NativeProgram &);
+
+    };
+
+    // A classic BPF instruction, laid out like struct sock_filter and
+    // struct bpf_insn.
+    struct BPFInsn {
+	uint16_t code;
+	uint8_t jt;
+	uint8_t jf;
+	uint32_t k;
+    };
+
+    // Translate a program whose output 0 accepts packets into classic BPF
+    // for Ethernet frames.  The BPF program returns 'accept' for frames the
+    // program sends to output 0, and 0 for other IPv4 frames.  It cannot
+    // judge other frames, or IPv4 frames shorter than the program needs
+    // within the first 'snaplen' bytes, and accepts them, except that if
+    // 'drop_non_ip' is true, it rejects frames FORCE_IP would not treat as
+    // IP.  Returns false if the program is too large for BPF.
+    static bool compile_bpf(const IPFilterProgram &zprog, uint32_t snaplen,
+			    uint32_t accept, bool drop_non_ip,
+			    Vector<BPFInsn> &bpf);
+
     enum {
 	TYPE_NONE	= 0,		// data types
 	TYPE_TYPE	= 1,
@@ -253,6 +337,13 @@ class IPFilter : public Element { public:
   protected:
 
     IPFilterProgram _zprog;
+    NativeProgram _native;
+    bool _simd;
+    Vector<BPFInsn> _bpf;	// for CLICK_IPFILTER_MATCH=bpf only
+
+    inline int match(const Packet *p) const;
+    void match_batch(Packet **p, int n, int *port) const;
+    int bpf_match(const Packet *p) const;
 
   private:
 
@@ -378,5 +469,22 @@ IPFilter::match(const IPFilterProgram &zprog, const Packet *p)
     }
 }
 
+inline int
+IPFilter::match(const Packet *p) const
+{
+    if (!_native)
+	return _bpf.size() ? bpf_match(p) : match(_zprog, p);
+    int packet_length = p->network_length(),
+	network_header_length = p->network_header_length();
+    if (packet_length > network_header_length)
+	packet_length += offset_transp - network_header_length;
+    else
+	packet_length += offset_net;
+    if (packet_length < (int) _zprog.safe_length())
+	return length_checked_match(_zprog, p, packet_length);
+    return _native(p->mac_header() - 2, p->network_header(),
+		   p->transport_header());
+}
+
 CLICK_ENDDECLS
 #endif
@@ -69,6 +69,18 @@
 #define NO_PAYLOAD_OPT		323
 #define SKIP_PACKETS_OPT	324
 #define WRITE_TCPDUMP_NANO_OPT  325
+#define THREADS_OPT		326
+#define OUTPUT_BUFFER_OPT	327
+#define READAHEAD_OPT		328
+#define DIRECT_IO_OPT		329
+#define DECOMPRESS_THREADS_OPT	330
+#define BUILD_INDEX_OPT		331
+#define START_TIME_OPT		332
+#define TIME_OFFSET_OPT		333
+#define CAPTURE_METHOD_OPT	334
+#define COLUMNAR_OPT		335
+#define PARALLEL_COLLATE_OPT	336
+#define ROW_GROUP_OPT		337
 
 // sources
 #define INTERFACE_OPT		400
@@ -134,6 +146,7 @@ static const char* const field_names[] = {
 #define WIRE_LEN_OPT		1036
 
 #define CLP_TIMESTAMP_TYPE	(Clp_ValFirstUser)
+#define CLP_SIZE_TYPE		(Clp_ValFirstUser + 1)
 
 static const Clp_Option options[] = {
 
@@ -157,22 +170,34 @@ static const Clp_Option options[] = {
     { "filter", 'f', FILTER_OPT, Clp_ValString, 0 },
     { "anonymize", 'A', ANONYMIZE_OPT, 0, Clp_Negate },
     { "binary", 'b', BINARY_OPT, 0, Clp_Negate },
+    { "columnar", 0, COLUMNAR_OPT, 0, Clp_Negate },
+    { "row-group", 0, ROW_GROUP_OPT, Clp_ValUnsigned, 0 },
     { "map-prefix", 0, MAP_PREFIX_OPT, Clp_ValString, 0 },
     { "map-address", 0, MAP_PREFIX_OPT, Clp_ValString, 0 },
     { "mmap", 0, MMAP_OPT, 0, Clp_Negate },
+    { "readahead", 0, READAHEAD_OPT, Clp_ValUnsigned, Clp_Negate },
+    { "direct-io", 0, DIRECT_IO_OPT, 0, Clp_Negate },
+    { "decompress-threads", 0, DECOMPRESS_THREADS_OPT, Clp_ValUnsigned, 0 },
+    { "build-index", 0, BUILD_INDEX_OPT, 0, 0 },
     { "headers", 0, HEADER_OPT, 0, Clp_Negate },
     { "multipacket", 0, MULTIPACKET_OPT, 0, Clp_Negate },
     { "sample", 0, SAMPLE_OPT, Clp_ValDouble, Clp_Negate },
     { "collate", 0, COLLATE_OPT, 0, Clp_Negate },
+    { "parallel-collate", 0, PARALLEL_COLLATE_OPT, 0, Clp_Negate },
     { "random-seed", 0, RANDOM_SEED_OPT, Clp_ValUnsigned, 0 },
     { "promiscuous", 0, PROMISCUOUS_OPT, 0, Clp_Negate },
+    { "capture-method", 0, CAPTURE_METHOD_OPT, Clp_ValString, 0 },
     { "record-counts", 0, WRITE_DROPS_OPT, Clp_ValString, 0 },
     { "quiet", 'q', QUIET_OPT, 0, Clp_Negate },
     { "bad-packets", 0, BAD_PACKETS_OPT, 0, Clp_Negate },
     { "interval", 0, INTERVAL_OPT, CLP_TIMESTAMP_TYPE, 0 },
+    { "start-time", 0, START_TIME_OPT, CLP_TIMESTAMP_TYPE, 0 },
+    { "time-offset", 0, TIME_OFFSET_OPT, CLP_TIMESTAMP_TYPE, 0 },
     { "skip-packets", 0, SKIP_PACKETS_OPT, Clp_ValUnsigned, Clp_Negate },
     { "limit-packets", 0, LIMIT_PACKETS_OPT, Clp_ValUnsigned, Clp_Negate },
     { "no-payload", 0, NO_PAYLOAD_OPT, 0, 0 },
+    { "threads", 0, THREADS_OPT, Clp_ValUnsigned, Clp_Negate },
+    { "output-buffer", 0, OUTPUT_BUFFER_OPT, CLP_SIZE_TYPE, Clp_Negate },
 
     { "output", 'o', OUTPUT_OPT, Clp_ValString, 0 },
     { "config", 0, CONFIG_OPT, 0, 0 },
@@ -325,26 +350,43 @@ Source options (give exactly one):\n\
 Other options:\n\
   -o, --output FILE          Write summary dump to FILE (default stdout).\n\
   -b, --binary               Create binary output file.\n\
+      --columnar             Create columnar binary output file.\n\
+      --row-group N          Columnar row groups hold N packets (default 65536).\n\
+      --output-buffer SIZE   Write summary in SIZE-byte chunks, bypassing\n\
+                             stdio (default 1M; 0 for stdio).\n\
   -w, --write-tcpdump FILE   Also dump packets to FILE in tcpdump(1) format.\n\
       --no-tcpdump-nano      --write-tcpdump uses microsecond precision.\n\
       --no-payload           Drop payloads from tcpdump output.\n\
   -f, --filter FILTER        Apply tcpdump(1) filter FILTER to data.\n\
   -A, --anonymize            Anonymize IP addresses (preserves prefix & class).\n\
       --no-promiscuous       Do not put interfaces into promiscuous mode.\n\
+      --capture-method M     Read interfaces with capture method M (PCAP,\n\
+                             LINUX, or LINUX_RING).\n\
       --bad-packets          Print %<!bad%> messages for bad headers.\n\
       --sample PROB          Sample packets with PROB probability.\n\
       --multipacket          Produce multiple entries for a flow identifier\n\
                              representing multiple packets (NetFlow only).\n");
     merrh.message("\
       --collate              Collate packets from data sources by timestamp.\n\
+      --parallel-collate     Collate, reading each data source on its own\n\
+                             thread.\n\
+      --start-time TIME      Ignore packets with timestamps before TIME.\n\
+      --time-offset TIME     Ignore first TIME in input.\n\
       --interval TIME        Stop after TIME has elapsed in trace time.\n\
       --skip-packets N       Skip the first N packets.\n\
       --limit-packets N      Stop after processing N packets.\n\
       --map-address ADDRS    When done, print to stderr the anonymized IP\n\
                              addresses and/or prefixes corresponding to ADDRS.\n\
       --record-counts TIME   Record packet counts every TIME seconds in output.\n\
+      --threads N            Format summaries on N worker threads.\n\
       --random-seed SEED     Set random seed to SEED (default is random).\n\
       --no-mmap              Don%,t memory-map input files.\n\
+      --readahead N          Keep N asynchronous 1MB reads in flight.\n\
+      --direct-io            Read input files with O_DIRECT (implies\n\
+                             --readahead).\n\
+      --decompress-threads N Decompress input files with N threads.\n\
+      --build-index          Write an index for each input file, FILE.idx,\n\
+                             for fast seeking by time.\n\
       --no-headers           Don%,t print summary dump headers.\n\
   -q, --quiet                Don%,t print progress bar.\n\
       --config               Output Click configuration and exit.\n\
@@ -413,6 +455,29 @@ parse_timestamp(Clp_Parser *clp, const char *arg, int complain, void *)
 	return 0;
 }
 
+static int
+parse_size(Clp_Parser *clp, const char *arg, int complain, void *)
+{
+    char *end;
+    unsigned long v = strtoul(arg, &end, 0);
+    if (end != arg) {
+	if (*end == 'k' || *end == 'K')
+	    v <<= 10, ++end;
+	else if (*end == 'm' || *end == 'M')
+	    v <<= 20, ++end;
+	if (*end == 'b' || *end == 'B')
+	    ++end;
+	if (*end == 0 && v < 0x80000000UL) {
+	    clp->val.u = v;
+	    return 1;
+	}
+    }
+    if (complain)
+	return Clp_OptionError(clp, "'%O' expects a size, not '%s'", arg);
+    else
+	return 0;
+}
+
 
 
 struct Options {
@@ -424,13 +489,23 @@ struct Options {
     bool bad_packets;
     bool force_ip;
     int mmap;
+    int readahead;
+    bool direct_io;
+    int decompress_threads;
+    bool build_index;
+    bool parallel;
     int snaplen;
     String filter;
+    String needed_fields;
     String filename;
     String ipsumdump_format;
     String dag_encap;
+    String capture_method;
+    Timestamp start_time;
+    Timestamp time_offset;
+    int nfiles;
 
-    enum { SAMPLED = 1, FILTERED = 2 };
+    enum { SAMPLED = 1, FILTERED = 2, TIMED = 4 };
 };
 
 static uint32_t
@@ -447,16 +522,20 @@ add_source(StringAccum &sa, int num, int action, const Options &opt)
 	   << ", SNIFFER true, SNAPLEN " << opt.snaplen << force_ip;
 	if (opt.promisc)
 	    sa << ", PROMISC true";
-#if FROMDEVICE_PCAP
+	if (opt.capture_method)
+	    sa << ", METHOD " << opt.capture_method;
+	// the kernel drops most packets the filter rejects; the IPFilter
+	// downstream drops the rest
 	if (opt.filter)
-	    sa << ", BPF_FILTER " << cp_quote(opt.filter);
-	result |= Options::FILTERED;
-#endif
+	    sa << ", FILTER " << cp_quote(opt.filter);
 	sa << ");\n";
 	return result;
 
       case READ_DUMP_OPT:
 	sa << "FromDump(" << cp_quote(opt.filename);
+	// with one source, pushing bursts cannot reorder the output
+	if (opt.nfiles == 1)
+	    sa << ", BURST 32";
 	goto dump_common;
 
       case READ_NLANR_DUMP_OPT:
@@ -474,13 +553,34 @@ add_source(StringAccum &sa, int num, int action, const Options &opt)
 	goto dump_common;
 
       dump_common:
-	sa << force_ip << ", STOP true";
+	sa << force_ip;
+	// parallel sources run on TimeSortedSched's threads and cannot stop
+	// the driver; TimeSortedSched stops it instead
+	if (!opt.parallel)
+	    sa << ", STOP true";
 	if (opt.do_sample)
 	    sa << ", SAMPLE " << opt.sample;
+	// sources can skip to the start time quickly, but only one source
+	// knows when the whole trace starts
+	if ((opt.start_time || opt.time_offset) && opt.nfiles == 1) {
+	    if (opt.start_time)
+		sa << ", START " << opt.start_time;
+	    else
+		sa << ", START_AFTER " << opt.time_offset;
+	    result |= Options::TIMED;
+	}
 	if (opt.mmap >= 0)
 	    sa << ", MMAP " << opt.mmap;
+	if (opt.readahead > 0)
+	    sa << ", READAHEAD " << opt.readahead;
+	if (opt.direct_io)
+	    sa << ", DIRECT true";
+	if (opt.decompress_threads > 0)
+	    sa << ", DECOMPRESS_THREADS " << opt.decompress_threads;
+	if (opt.build_index)
+	    sa << ", BUILD_INDEX true";
 	sa << ");\n";
-	return Options::SAMPLED;
+	return result | Options::SAMPLED;
 
       case READ_ASCII_TCPDUMP_OPT:
 	sa << "FromTcpdump(" << cp_quote(opt.filename) << ", STOP true";
@@ -498,16 +598,34 @@ add_source(StringAccum &sa, int num, int action, const Options &opt)
 	return 0;
 
       case READ_IPSUMDUMP_OPT:
-	sa << "FromIPSummaryDump(" << cp_quote(opt.filename)
-	   << ", STOP true, ZERO true";
+	sa << "FromIPSummaryDump(" << cp_quote(opt.filename) << ", ZERO true";
+	if (!opt.parallel)
+	    sa << ", STOP true";
 	if (opt.do_sample)
 	    sa << ", SAMPLE " << opt.sample;
 	if (opt.multipacket)
 	    sa << ", MULTIPACKET true";
 	if (opt.ipsumdump_format)
 	    sa << ", CONTENTS " << opt.ipsumdump_format;
+	// the IPFilter that follows still checks every packet
+	if (opt.filter)
+	    sa << ", FILTER " << cp_quote(opt.filter);
+	if (opt.needed_fields)
+	    sa << ", NEEDED_FIELDS " << cp_quote(opt.needed_fields);
+	if (opt.start_time && opt.nfiles == 1) {
+	    sa << ", START " << opt.start_time;
+	    result |= Options::TIMED;
+	}
+	if (opt.readahead > 0)
+	    sa << ", READAHEAD " << opt.readahead;
+	if (opt.direct_io)
+	    sa << ", DIRECT true";
+	if (opt.decompress_threads > 0)
+	    sa << ", DECOMPRESS_THREADS " << opt.decompress_threads;
+	if (opt.build_index)
+	    sa << ", BUILD_INDEX true";
 	sa << ");\n";
-	return Options::SAMPLED;
+	return result | Options::SAMPLED;
 
       default:
 	assert(0);
@@ -523,6 +641,7 @@ main(int argc, char *argv[])
 	(argc, argv, sizeof(options) / sizeof(options[0]), options);
     program_name = Clp_ProgramName(clp);
     Clp_AddType(clp, CLP_TIMESTAMP_TYPE, 0, parse_timestamp, 0);
+    Clp_AddType(clp, CLP_SIZE_TYPE, 0, parse_size, 0);
 
     click_static_initialize();
     ErrorHandler *errh = ErrorHandler::default_handler();
@@ -537,10 +656,13 @@ main(int argc, char *argv[])
     int action = 0;
     bool do_seed = true;
     bool collate = false;
+    bool parallel_collate = false;
     bool quiet = false;
     bool quiet_explicit = false;
     bool bad_packets = false;
     bool binary = false;
+    bool columnar = false;
+    unsigned row_group = 0;
     bool header = true;
     bool write_dump_payload = true;
     bool write_dump_nano = true;
@@ -548,11 +670,15 @@ main(int argc, char *argv[])
     const char *record_drops = 0;
     unsigned skip_packets = 0;
     unsigned limit_packets = 0;
+    unsigned nthreads = 0;
+    int output_buffer = -1;
     Timestamp interval;
 
     Options options;
     options.anonymize = options.multipacket = options.do_sample =
-	options.force_ip = false;
+	options.force_ip = options.direct_io = options.build_index =
+	options.parallel = false;
+    options.readahead = options.decompress_threads = 0;
     options.promisc = true;
     options.mmap = options.snaplen = -1;
 
@@ -637,6 +763,10 @@ main(int argc, char *argv[])
 	    record_drops = clp->vstr;
 	    break;
 
+	  case CAPTURE_METHOD_OPT:
+	    options.capture_method = String(clp->vstr).upper();
+	    break;
+
 	  case SKIP_PACKETS_OPT:
 	    skip_packets = (clp->negated ? 0 : clp->val.u);
 	    break;
@@ -649,6 +779,22 @@ main(int argc, char *argv[])
 	    binary = !clp->negated;
 	    break;
 
+	  case COLUMNAR_OPT:
+	    columnar = !clp->negated;
+	    break;
+
+	  case ROW_GROUP_OPT:
+	    row_group = clp->val.u;
+	    break;
+
+	  case THREADS_OPT:
+	    nthreads = (clp->negated ? 0 : clp->val.u);
+	    break;
+
+	  case OUTPUT_BUFFER_OPT:
+	    output_buffer = (clp->negated ? 0 : clp->val.u);
+	    break;
+
 	  case MAP_PREFIX_OPT: {
 	      String arg(clp->vstr);
 	      char *data = arg.mutable_data();
@@ -687,9 +833,15 @@ main(int argc, char *argv[])
 	    collate = !clp->negated;
 	    break;
 
+	  case PARALLEL_COLLATE_OPT:
+	    parallel_collate = !clp->negated;
+	    if (parallel_collate)
+		collate = true;
+	    break;
+
 	  case RANDOM_SEED_OPT:
 	    do_seed = false;
-	    srandom(clp->val.u);
+	    click_random_fix_seed(clp->val.u);
 	    break;
 
 	  case QUIET_OPT:
@@ -705,10 +857,34 @@ main(int argc, char *argv[])
 	    interval = *reinterpret_cast<Timestamp *>(&clp->val);
 	    break;
 
+	  case START_TIME_OPT:
+	    options.start_time = *reinterpret_cast<Timestamp *>(&clp->val);
+	    break;
+
+	  case TIME_OFFSET_OPT:
+	    options.time_offset = *reinterpret_cast<Timestamp *>(&clp->val);
+	    break;
+
 	  case MMAP_OPT:
 	    options.mmap = !clp->negated;
 	    break;
 
+	  case READAHEAD_OPT:
+	    options.readahead = (clp->negated ? 0 : clp->val.u);
+	    break;
+
+	  case DIRECT_IO_OPT:
+	    options.direct_io = !clp->negated;
+	    break;
+
+	  case DECOMPRESS_THREADS_OPT:
+	    options.decompress_threads = clp->val.u;
+	    break;
+
+	  case BUILD_INDEX_OPT:
+	    options.build_index = true;
+	    break;
+
 	  case HEADER_OPT:
 	    header = !clp->negated;
 	    break;
@@ -786,12 +962,37 @@ particular purpose.\n");
 	else if (collate)
 	    p_errh->fatal("%<--collate%> may not be used with %<--interface%>");
     }
+    if (parallel_collate && action != READ_DUMP_OPT && action != READ_IPSUMDUMP_OPT)
+	p_errh->fatal("%<--parallel-collate%> requires tcpdump or summary dump files");
+    if (options.build_index
+	&& (action == INTERFACE_OPT || action == READ_ASCII_TCPDUMP_OPT
+	    || action == READ_NETFLOW_SUMMARY_OPT))
+	p_errh->fatal("%<--build-index%> requires a tcpdump, NLANR, DAG, or summary dump file");
     if (options.snaplen < 0)
 	options.snaplen = (write_dump ? 2000 : 68);
+    if (output_buffer < 0)	// live captures keep stdio's buffering
+	output_buffer = (action == INTERFACE_OPT ? 0 : 1 << 20);
     if (collate && files.size() < 2)
 	collate = false;
+    options.parallel = collate && parallel_collate;
     if (files.size() == 0)
 	files.push_back("-");
+    if (options.start_time && options.time_offset)
+	p_errh->fatal("specify at most one of %<--start-time%> and %<--time-offset%>");
+    options.nfiles = files.size();
+
+    // summary dump readers can skip fields that nothing downstream reads;
+    // filters and tcpdump output may read any field, and anonymization
+    // maps every address it sees, in order, and rewrites checksums
+    if (action == READ_IPSUMDUMP_OPT && log_contents.size()
+	&& !options.filter && !write_dump && !options.anonymize) {
+	StringAccum fsa;
+	for (int i = 0; i < log_contents.size(); i++)
+	    fsa << field_names[log_contents[i]] << ' ';
+	if (options.start_time || options.time_offset || interval || collate)
+	    fsa << "timestamp";
+	options.needed_fields = fsa.take_string().trim_space();
+    }
 
     // source elements
     Vector<uint32_t> source_flags;
@@ -804,7 +1005,10 @@ particular purpose.\n");
 
     // collate source streams
     if (collate) {
-	sa << "collate :: { tss :: TimeSortedSched(STOP true) -> Unqueue -> output;";
+	sa << "collate :: { tss :: TimeSortedSched(STOP true";
+	if (options.parallel)
+	    sa << ", PARALLEL true";
+	sa << ") -> Unqueue(BURST 32) -> output;";
 	for (int i = 0; i < files.size(); i++)
 	    sa << " input [" << i << "] -> [" << i << "] tss;";
 	sa << " };\n\n";
@@ -832,7 +1036,17 @@ particular purpose.\n");
     if (options.do_sample && !(any_source_flags & Options::SAMPLED))
 	sa << "  -> samp0 :: RandomSample(" << options.sample << ")\n";
     if (options.anonymize)
-	sa << "  -> anon :: AnonymizeIPAddr(CLASS 4, SEED false)\n";
+	// the output elements apply the addresses, so that packets read
+	// from files are not copied
+	sa << "  -> anon :: AnonymizeIPAddr(CLASS 4, SEED false, DEFER true)\n";
+    if ((options.start_time || options.time_offset)
+	&& !(any_source_flags & Options::TIMED)) {
+	sa << "  -> TimeFilter(";
+	if (options.start_time)
+	    sa << "START " << options.start_time << ")\n";
+	else
+	    sa << "START_AFTER " << options.time_offset << ")\n";
+    }
     if (action != INTERFACE_OPT && interval) {
 	sa << "  -> TimeFilter(INTERVAL " << interval << ", END_CALL manager.goto stop)\n";
 	if (files.size() > 1 && !collate) {
@@ -863,13 +1077,17 @@ particular purpose.\n");
 	for (int i = 0; i < files.size(); i++)
 	    sa << " src" << i;
 	sa << ", NANO " << write_dump_nano
-           << ", SNAPLEN " << options.snaplen << ")\n";
+           << ", SNAPLEN " << options.snaplen;
+	if (options.anonymize)
+	    sa << ", ANONYMIZE anon";
+	sa << ")\n";
     }
 
     // elements to dump summary log
     if (log_contents.size() == 0) {
 	if (!write_dump) {
-	    errh->warning("no dump content options, so I%,m not creating a summary dump");
+	    if (!options.build_index)
+		errh->warning("no dump content options, so I%,m not creating a summary dump");
 	    sa << "  -> Discard;\n";
 	}
 	output = "";		// we're not using the normal output file
@@ -879,6 +1097,10 @@ particular purpose.\n");
 	    sa << ' ' << cp_quote(field_names[log_contents[i]]);
 	if (binary)
 	    sa << ", BINARY true";
+	if (columnar)
+	    sa << ", COLUMNAR true";
+	if (columnar && row_group)
+	    sa << ", ROW_GROUP " << row_group;
 	if (action == READ_DUMP_OPT)
 	    sa << ", CAREFUL_TRUNC false";
 	sa << ", VERBOSE true, BAD_PACKETS " << bad_packets << ", BANNER ";
@@ -890,6 +1112,12 @@ particular purpose.\n");
 	sa << cp_quote(banner.take_string());
 	if (!header)
 	    sa << ", HEADER false";
+	if (nthreads)
+	    sa << ", THREADS " << nthreads;
+	if (output_buffer)
+	    sa << ", BUFFER " << output_buffer;
+	if (options.anonymize)
+	    sa << ", ANONYMIZE anon";
 	sa << ");\n";
 	script_sa << "Script(TYPE SIGNAL HUP, write to_dump.flush);\n";
     }
@@ -903,7 +1131,7 @@ particular purpose.\n");
     if (!quiet) {
 	sa << "progress :: ProgressBar(";
 	for (int i = 0; i < files.size(); i++)
-	    sa << "src" << i << ".filepos ";
+	    sa << "src" << i << ".raw_filepos ";
 	sa.pop_back();
 	sa << ", ";
 	for (int i = 0; i < files.size(); i++)
@@ -924,7 +1152,7 @@ particular purpose.\n");
     sa << "manager :: DriverManager(";
     int stop_driver_count = 1;
     if (action != INTERFACE_OPT)
-	stop_driver_count += files.size() + (collate ? 1 : 0);
+	stop_driver_count += (options.parallel ? 0 : files.size()) + (collate ? 1 : 0);
     else {
 	if (interval)
 	    sa << ", wait " << interval;
@@ -128,7 +128,7 @@ static void anno_outa(const PacketDesc& d, const FieldWriter *f)
     switch (f->user_data) {
       case T_TIMESTAMP:
       case T_FIRST_TIMESTAMP:
-	*d.sa << Timestamp::make_nsec(d.u32[0], d.u32[1]);
+	append_timestamp(*d.sa, Timestamp::make_nsec(d.u32[0], d.u32[1]));
 	break;
       case T_DIRECTION:
 	if (d.v == 0)
@@ -136,16 +136,45 @@ static void anno_outa(const PacketDesc& d, const FieldWriter *f)
 	else if (d.v == 1)
 	    *d.sa << '<';
 	else
-	    *d.sa << d.v;
+	    append_decimal(*d.sa, d.v);
 	break;
     }
 }
 
+// Parse at most 9 fraction digits as nanoseconds.
+static bool parse_frac(const char *s, const char *end, uint32_t &nsec)
+{
+    uint32_t v = 0;
+    int n = 0;
+    for (; s != end; ++s, ++n)
+	if (*s >= '0' && *s <= '9')
+	    v = v * 10 + *s - '0';
+	else
+	    return false;
+    for (; n < 9; ++n)
+	v *= 10;
+    nsec = v;
+    return true;
+}
+
 static bool anno_ina(PacketOdesc& d, const String &s, const FieldReader *f)
 {
     switch (f->user_data) {
     case T_TIMESTAMP:
     case T_FIRST_TIMESTAMP: {
+	// plain "SEC.FRAC" timestamps skip cp_time
+	const char *dot = s.begin();
+	while (dot != s.end() && *dot != '.')
+	    ++dot;
+	if (parse_decimal(s.begin(), dot, d.u32[0])) {
+	    uint32_t nsec = 0;
+	    if (dot == s.end()
+		|| (dot + 1 != s.end() && s.end() - dot <= 10
+		    && parse_frac(dot + 1, s.end(), nsec))) {
+		d.u32[1] = nsec;
+		return true;
+	    }
+	}
 	Timestamp ts;
 	if (cp_time(s, &ts)) {
 	    d.u32[0] = ts.sec();
@@ -217,13 +217,13 @@ static void ip_outa(const PacketDesc& d, const FieldWriter *f)
     switch (f->user_data) {
       case T_IP_SRC:
       case T_IP_DST:
-	*d.sa << IPAddress(d.v);
+	append_ip(*d.sa, d.v);
 	break;
       case T_IP_FRAG:
 	*d.sa << (char) d.v;
 	break;
       case T_IP_FRAGOFF:
-	*d.sa << ((d.v & IP_OFFMASK) << 3);
+	append_decimal(*d.sa, (d.v & IP_OFFMASK) << 3);
 	if (d.v & IP_MF)
 	    *d.sa << '+';
 	if (d.v & IP_DF)
@@ -234,7 +234,7 @@ static void ip_outa(const PacketDesc& d, const FieldWriter *f)
 	  case IP_PROTO_TCP:	*d.sa << 'T'; break;
 	  case IP_PROTO_UDP:	*d.sa << 'U'; break;
 	  case IP_PROTO_ICMP:	*d.sa << 'I'; break;
-	  default:		*d.sa << d.v; break;
+	  default:		append_decimal(*d.sa, d.v); break;
 	}
 	break;
     case T_IP_ECN:
@@ -293,7 +293,8 @@ void unparse_tcp_opt(StringAccum& sa, const uint8_t* opt, int opt_len, int mask)
 		goto bad_opt;
 	    if (!(mask & DO_TCPOPT_MSS))
 		goto unknown;
-	    sa << sep << "mss" << ((opt[2] << 8) | opt[3]);
+	    sa << sep << "mss";
+	    append_decimal(sa, (opt[2] << 8) | opt[3]);
 	    opt += TCPOLEN_MAXSEG;
 	    sep = ";";
 	    break;
@@ -302,7 +303,8 @@ void unparse_tcp_opt(StringAccum& sa, const uint8_t* opt, int opt_len, int mask)
 		goto bad_opt;
 	    if (!(mask & DO_TCPOPT_WSCALE))
 		goto unknown;
-	    sa << sep << "wscale" << (int)(opt[2]);
+	    sa << sep << "wscale";
+	    append_decimal(sa, opt[2]);
 	    opt += TCPOLEN_WSCALE;
 	    sep = ";";
 	    break;
@@ -324,7 +326,10 @@ void unparse_tcp_opt(StringAccum& sa, const uint8_t* opt, int opt_len, int mask)
 	      for (opt += 2; opt < end_sack; opt += 8) {
 		  uint32_t buf[2];
 		  memcpy(&buf[0], opt, 8);
-		  sa << sep << "sack" << ntohl(buf[0]) << '-' << ntohl(buf[1]);
+		  sa << sep << "sack";
+		  append_decimal(sa, ntohl(buf[0]));
+		  sa << '-';
+		  append_decimal(sa, ntohl(buf[1]));
 		  sep = ";";
 	      }
 	      break;
@@ -336,7 +341,10 @@ void unparse_tcp_opt(StringAccum& sa, const uint8_t* opt, int opt_len, int mask)
 		  goto unknown;
 	      uint32_t buf[2];
 	      memcpy(&buf[0], opt + 2, 8);
-	      sa << sep << "ts" << ntohl(buf[0]) << ':' << ntohl(buf[1]);
+	      sa << sep << "ts";
+	      append_decimal(sa, ntohl(buf[0]));
+	      sa << ':';
+	      append_decimal(sa, ntohl(buf[1]));
 	      opt += TCPOLEN_TIMESTAMP;
 	      sep = ";";
 	      break;
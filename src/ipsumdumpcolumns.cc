@@ -0,0 +1,439 @@
+// -*- mode: c++; c-basic-offset: 4 -*-
+/*
+ * ipsumdumpcolumns.{cc,hh} -- columnar binary IP summary dumps
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, subject to the conditions
+ * listed in the Click LICENSE file. These conditions include: you must
+ * preserve this copyright notice, and you cannot mention the copyright
+ * holders in advertising related to the Software without their permission.
+ * The Software is provided WITHOUT ANY WARRANTY, EXPRESS OR IMPLIED. This
+ * notice is a summary of the Click LICENSE file; the license in that file is
+ * legally binding.
+ */
+
+#include <click/config.h>
+#include "ipsumdumpcolumns.hh"
+CLICK_DECLS
+
+namespace IPSummaryDump {
+
+int fixed_binary_size(int type)
+{
+    switch (type) {
+    case B_0:
+    case B_1:
+    case B_2:
+    case B_4:
+    case B_6PTR:
+    case B_8:
+    case B_16:
+	return type;
+    case B_4NET:
+	return 4;
+    default:
+	return -1;
+    }
+}
+
+static inline uint64_t get_value(const uint8_t *s, int w)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < w; ++i)
+	v = (v << 8) | s[i];
+    return v;
+}
+
+static inline void put_value(uint8_t *s, uint64_t v, int w)
+{
+    for (int i = w - 1; i >= 0; --i, v >>= 8)
+	s[i] = v;
+}
+
+static inline void put4(StringAccum &sa, uint32_t v)
+{
+    uint8_t *s = reinterpret_cast<uint8_t *>(sa.extend(4));
+    put_value(s, v, 4);
+}
+
+static inline int bit_width(uint64_t v)
+{
+    int n = 0;
+    for (; v; v >>= 1)
+	++n;
+    return n;
+}
+
+// Packed values are limited so that a 64-bit accumulator always has room
+// for one more value plus a partial byte.
+enum { MAX_PACKED_BITS = 56 };
+
+static void put_packed(StringAccum &sa, const uint64_t *v, int n, uint64_t base, int bits)
+{
+    uint8_t *out = reinterpret_cast<uint8_t *>(sa.extend((n * bits + 7) / 8));
+    uint64_t acc = 0;
+    int nacc = 0;
+    for (int i = 0; i < n; ++i) {
+	acc |= (v[i] - base) << nacc;
+	for (nacc += bits; nacc >= 8; nacc -= 8, acc >>= 8)
+	    *out++ = acc;
+    }
+    if (nacc)
+	*out = acc;
+}
+
+static inline void put_varint(StringAccum &sa, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+	sa << (char) (v | 0x80);
+    sa << (char) v;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+ColumnWriter::ColumnWriter(const Vector<int> &width, int group_rows)
+    : _width(width), _record_size(0), _group_rows(group_rows), _nrows(0),
+      _ngroups(0)
+{
+    for (int c = 0; c < _width.size(); ++c) {
+	_offset.push_back(_record_size);
+	_record_size += _width[c];
+    }
+    _rows.reserve(_record_size * _group_rows);
+}
+
+// Collect the distinct values of _values into _dict, giving up if there are
+// too many for a dictionary to pay off.  Return the number of values, or 0.
+int ColumnWriter::dictionary(int w, uint64_t &bits)
+{
+    int n = _values.size();
+    int limit = n / (w > 2 ? 4 : 16);
+    if (limit > 65536)
+	limit = 65536;
+    int nslots = 16;
+    while (nslots < 2 * limit)
+	nslots *= 2;
+    int shift = 64 - bit_width(nslots - 1);
+
+    _dict.clear();
+    _dict_slot.assign(nslots, -1);
+    for (int i = 0; i < n; ++i) {
+	uint64_t v = _values[i];
+	int s = (v * 0x9E3779B97F4A7C15ULL) >> shift;
+	while (_dict_slot[s] >= 0 && _dict[_dict_slot[s]] != v)
+	    s = (s + 1) & (nslots - 1);
+	if (_dict_slot[s] < 0) {
+	    if (_dict.size() == limit)
+		return 0;
+	    _dict_slot[s] = _dict.size();
+	    _dict.push_back(v);
+	}
+    }
+    bits = bit_width(_dict.size() - 1);
+    return _dict.size();
+}
+
+void ColumnWriter::write_column(StringAccum &sa, int c)
+{
+    int w = _width[c], n = _nrows;
+    const uint8_t *rows = reinterpret_cast<const uint8_t *>(_rows.data()) + _offset[c];
+    int start = sa.length();
+    sa.extend(4);
+
+    if (w == 0 || w > 8) {
+	// no statistics or encodings for wide fields
+	sa << (char) COL_RAW;
+	int mini = 0, maxi = 0;
+	for (int i = 1; i < n; ++i) {
+	    if (memcmp(rows + i * _record_size, rows + mini * _record_size, w) < 0)
+		mini = i;
+	    if (memcmp(rows + i * _record_size, rows + maxi * _record_size, w) > 0)
+		maxi = i;
+	}
+	sa.append(rows + mini * _record_size, w);
+	sa.append(rows + maxi * _record_size, w);
+	for (int i = 0; i < n; ++i)
+	    sa.append(rows + i * _record_size, w);
+	goto done;
+    }
+
+    {
+	_values.resize(n);
+	uint64_t min = ~(uint64_t) 0, max = 0;
+	for (int i = 0; i < n; ++i) {
+	    uint64_t v = get_value(rows + i * _record_size, w);
+	    _values[i] = v;
+	    if (v < min)
+		min = v;
+	    if (v > max)
+		max = v;
+	}
+
+	// pick the smallest encoding
+	int encoding = COL_RAW;
+	size_t best = (size_t) n * w;
+	int bits = bit_width(max - min);
+	if (bits <= MAX_PACKED_BITS && 1 + ((size_t) n * bits + 7) / 8 < best) {
+	    encoding = COL_PACKED;
+	    best = 1 + ((size_t) n * bits + 7) / 8;
+	}
+	uint64_t dict_bits = 0;
+	if (bits > 8) {
+	    if (int nd = dictionary(w, dict_bits)) {
+		size_t size = 5 + (size_t) nd * w + ((size_t) n * dict_bits + 7) / 8;
+		if (size < best)
+		    encoding = COL_DICT, best = size;
+	    }
+	}
+	StringAccum delta;
+	if (w == 8 && n > 1) {
+	    // sec/subsec timestamps
+	    uint32_t subsec_max = 0;
+	    for (int i = 0; i < n; ++i)
+		if ((uint32_t) _values[i] > subsec_max)
+		    subsec_max = _values[i];
+	    uint32_t per_sec = (subsec_max < 1000000 ? 1000000 : 1000000000);
+	    if (subsec_max < per_sec) {
+		put4(delta, per_sec);
+		int64_t last = 0, last_delta = 0;
+		for (int i = 0; i < n; ++i) {
+		    int64_t t = (int64_t) (_values[i] >> 32) * per_sec + (uint32_t) _values[i];
+		    if (i == 0)
+			put_varint(delta, t);
+		    else if (i == 1)
+			put_varint(delta, zigzag(t - last));
+		    else
+			put_varint(delta, zigzag((t - last) - last_delta));
+		    if (i)
+			last_delta = t - last;
+		    last = t;
+		}
+		if ((size_t) delta.length() < best)
+		    encoding = COL_DELTA, best = delta.length();
+	    }
+	}
+
+	sa << (char) encoding;
+	uint8_t *mm = reinterpret_cast<uint8_t *>(sa.extend(2 * w));
+	put_value(mm, min, w);
+	put_value(mm + w, max, w);
+	switch (encoding) {
+	case COL_RAW:
+	    for (int i = 0; i < n; ++i)
+		sa.append(rows + i * _record_size, w);
+	    break;
+	case COL_PACKED:
+	    sa << (char) bits;
+	    put_packed(sa, _values.begin(), n, min, bits);
+	    break;
+	case COL_DICT: {
+	    put4(sa, _dict.size());
+	    sa << (char) dict_bits;
+	    uint8_t *d = reinterpret_cast<uint8_t *>(sa.extend(_dict.size() * w));
+	    for (int i = 0; i < _dict.size(); ++i)
+		put_value(d + i * w, _dict[i], w);
+	    // replace values by their dictionary indexes
+	    int nslots = _dict_slot.size();
+	    int shift = 64 - bit_width(nslots - 1);
+	    for (int i = 0; i < n; ++i) {
+		uint64_t v = _values[i];
+		int s = (v * 0x9E3779B97F4A7C15ULL) >> shift;
+		while (_dict[_dict_slot[s]] != v)
+		    s = (s + 1) & (nslots - 1);
+		_values[i] = _dict_slot[s];
+	    }
+	    put_packed(sa, _values.begin(), n, 0, dict_bits);
+	    break;
+	}
+	case COL_DELTA:
+	    sa.append(delta.data(), delta.length());
+	    break;
+	}
+
+	// footer entry statistics
+	mm = reinterpret_cast<uint8_t *>(_footer.extend(2 * w));
+	put_value(mm, min, w);
+	put_value(mm + w, max, w);
+    }
+
+  done:
+    uint8_t *s = reinterpret_cast<uint8_t *>(sa.data() + start);
+    put_value(s, sa.length() - start - 4, 4);
+    if (w == 0 || w > 8)
+	_footer.append(sa.data() + start + 5, 2 * w);
+}
+
+void ColumnWriter::write_group(StringAccum &sa, uint64_t offset)
+{
+    if (!_nrows)
+	return;
+    put4(_footer, offset >> 32);
+    put4(_footer, offset);
+    put4(_footer, _nrows);
+
+    int start = sa.length();
+    sa.extend(4);
+    put4(sa, _nrows);
+    for (int c = 0; c < _width.size(); ++c)
+	write_column(sa, c);
+    put_value(reinterpret_cast<uint8_t *>(sa.data() + start), sa.length() - start, 4);
+
+    ++_ngroups;
+    _nrows = 0;
+    _rows.clear();
+}
+
+void ColumnWriter::write_footer(StringAccum &sa) const
+{
+    uint32_t len = 16 + _footer.length();
+    put4(sa, len);
+    put4(sa, 0);
+    put4(sa, _ngroups);
+    sa.append(_footer.data(), _footer.length());
+    put4(sa, len);
+}
+
+
+int ColumnGroup::parse(const uint8_t *data, int len, const Vector<int> &width)
+{
+    const uint8_t *end = data + len;
+    if (len < 4)
+	return -1;
+    _nrows = get_value(data, 4);
+    if (_nrows == 0)
+	return 0;
+    if (_nrows < 0 || _nrows > MAX_GROUP_ROWS)
+	return -1;
+    data += 4;
+
+    _col.resize(width.size());
+    for (int c = 0; c < width.size(); ++c) {
+	Column &col = _col[c];
+	int w = col.width = width[c];
+	if (end - data < 4)
+	    return -1;
+	uint32_t clen = get_value(data, 4);
+	data += 4;
+	if (clen > (uint32_t) (end - data) || clen < (uint32_t) (1 + 2 * w))
+	    return -1;
+	col.encoding = data[0];
+	col.min = data + 1;
+	col.max = data + 1 + w;
+	col.data = data + 1 + 2 * w;
+	col.end = data + clen;
+	data += clen;
+    }
+    return _nrows;
+}
+
+static bool get_packed(const uint8_t *s, const uint8_t *end, int n, int bits,
+		       uint64_t *v)
+{
+    if (bits > MAX_PACKED_BITS || (size_t) (end - s) < ((size_t) n * bits + 7) / 8)
+	return false;
+    uint64_t mask = ((uint64_t) 1 << bits) - 1, acc = 0;
+    int nacc = 0;
+    for (int i = 0; i < n; ++i) {
+	for (; nacc < bits; nacc += 8)
+	    acc |= (uint64_t) *s++ << nacc;
+	v[i] = acc & mask;
+	acc >>= bits;
+	nacc -= bits;
+    }
+    return true;
+}
+
+static inline bool get_varint(const uint8_t *&s, const uint8_t *end, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; s != end && shift < 64; shift += 7) {
+	uint8_t x = *s++;
+	v |= (uint64_t) (x & 0x7F) << shift;
+	if (!(x & 0x80))
+	    return true;
+    }
+    return false;
+}
+
+bool ColumnGroup::decode(int c, uint8_t *rows, int record_size, int offset) const
+{
+    const Column &col = _col[c];
+    const uint8_t *s = col.data;
+    int w = col.width, n = _nrows;
+    rows += offset;
+
+    if (col.encoding == COL_RAW) {
+	if (col.end - s != (ptrdiff_t) n * w)
+	    return false;
+	for (int i = 0; i < n; ++i, s += w)
+	    memcpy(rows + i * record_size, s, w);
+	return true;
+    }
+    if (w == 0 || w > 8)
+	return false;
+
+    Vector<uint64_t> v(n, 0);
+    switch (col.encoding) {
+    case COL_PACKED: {
+	if (s == col.end || !get_packed(s + 1, col.end, n, s[0], v.begin()))
+	    return false;
+	uint64_t min = get_value(col.min, w);
+	for (int i = 0; i < n; ++i)
+	    put_value(rows + i * record_size, v[i] + min, w);
+	return true;
+    }
+    case COL_DICT: {
+	if (col.end - s < 5)
+	    return false;
+	uint32_t nd = get_value(s, 4);
+	int bits = s[4];
+	s += 5;
+	if ((size_t) (col.end - s) < (size_t) nd * w
+	    || !get_packed(s + nd * w, col.end, n, bits, v.begin()))
+	    return false;
+	for (int i = 0; i < n; ++i) {
+	    if (v[i] >= nd)
+		return false;
+	    memcpy(rows + i * record_size, s + v[i] * w, w);
+	}
+	return true;
+    }
+    case COL_DELTA: {
+	if (w != 8 || col.end - s < 4)
+	    return false;
+	uint32_t per_sec = get_value(s, 4);
+	if (!per_sec)
+	    return false;
+	s += 4;
+	uint64_t t = 0, x;
+	int64_t delta = 0;
+	for (int i = 0; i < n; ++i) {
+	    if (!get_varint(s, col.end, x))
+		return false;
+	    if (i == 0)
+		t = x;
+	    else {
+		int64_t dd = (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+		delta = (i == 1 ? dd : delta + dd);
+		t += delta;
+	    }
+	    uint8_t *r = rows + i * record_size;
+	    put_value(r, t / per_sec, 4);
+	    put_value(r + 4, t % per_sec, 4);
+	}
+	return true;
+    }
+    default:
+	return false;
+    }
+}
+
+}
+
+ELEMENT_REQUIRES(userlevel IPSummaryDump)
+ELEMENT_PROVIDES(IPSummaryDump_Columns)
+CLICK_ENDDECLS
@@ -0,0 +1,124 @@
+// -*- mode: c++; c-basic-offset: 4 -*-
+#ifndef CLICK_IPSUMDUMPCOLUMNS_HH
+#define CLICK_IPSUMDUMPCOLUMNS_HH
+#include <click/straccum.hh>
+#include <click/vector.hh>
+#include "ipsumdumpinfo.hh"
+CLICK_DECLS
+
+namespace IPSummaryDump {
+
+/* Columnar binary dumps.
+
+   After a '!columnar' line, a dump consists of blocks.  Each block starts
+   with a 4-byte length that counts the length word itself.  As in '!binary'
+   dumps, a length with the high bit set introduces a metadata line.  Other
+   blocks are row groups, which hold up to ROW_GROUP packet records (65536
+   by default, at most MAX_GROUP_ROWS), and the footer, which ends the dump:
+
+     row group:     [length] [nrows > 0] column...
+     column:        [column length] [encoding] [min] [max] data...
+     footer:        [length] [0] [ngroups] entry... [length]
+     footer entry:  [offset:8] [nrows] ([min] [max]) for each column
+
+   All numbers are big-endian.  The columns follow the '!data' field order.
+   A column holds one field's binary representation for every record in the
+   group; its column length counts the bytes that follow the column length
+   word.  MIN and MAX are the field's smallest and largest values in the
+   group, compared as unsigned big-endian numbers, and are as wide as the
+   field.  Footer offsets are relative to the start of the dump.  Only fields
+   with fixed-size binary representations can be stored in columns. */
+
+enum {
+    COL_RAW = 0,		// values, one after another
+    COL_PACKED = 1,		// [bits] (value - min), bit-packed LSB first
+    COL_DICT = 2,		// [ndict] [bits] dictionary, packed indices
+    COL_DELTA = 3		// [subsec_per_sec] varint delta-of-deltas of
+				// (sec * subsec_per_sec + subsec)
+};
+
+enum { MAX_GROUP_ROWS = 1 << 20 };
+
+// Return the size of a field's binary representation, or -1 if the field
+// has variable size or no binary representation.
+int fixed_binary_size(int type);
+
+class ColumnWriter { public:
+
+    ColumnWriter(const Vector<int> &width, int group_rows);
+
+    int record_size() const		{ return _record_size; }
+    int nrows() const			{ return _nrows; }
+    bool full() const			{ return _nrows >= _group_rows; }
+
+    // Add a binary packet record (without its length word).
+    inline void add(const char *record);
+
+    // Append the buffered records to 'sa' as a row group, which will start
+    // at file offset 'offset', and start a new group.
+    void write_group(StringAccum &sa, uint64_t offset);
+    void write_footer(StringAccum &sa) const;
+
+  private:
+
+    Vector<int> _width;
+    Vector<int> _offset;
+    int _record_size;
+    int _group_rows;
+    int _nrows;
+    StringAccum _rows;		// buffered records, row by row
+    StringAccum _footer;	// footer entries
+    uint32_t _ngroups;
+
+    Vector<uint64_t> _values;
+    Vector<uint64_t> _dict;
+    Vector<int> _dict_slot;
+
+    void write_column(StringAccum &sa, int c);
+    int dictionary(int w, uint64_t &bits);
+
+};
+
+class ColumnGroup { public:
+
+    ColumnGroup()			: _nrows(0) { }
+
+    // Parse row group 'data' (without its length word).  Return the number
+    // of rows, 0 for the footer, or -1 if the block is malformed.
+    int parse(const uint8_t *data, int len, const Vector<int> &width);
+
+    int nrows() const			{ return _nrows; }
+    const uint8_t *min(int c) const	{ return _col[c].min; }
+    const uint8_t *max(int c) const	{ return _col[c].max; }
+
+    // Write column c's values into records of size 'record_size' starting
+    // at 'rows', each at offset 'offset'.  Return false if the column is
+    // malformed.
+    bool decode(int c, uint8_t *rows, int record_size, int offset) const;
+
+  private:
+
+    struct Column {
+	int encoding;
+	int width;
+	const uint8_t *min;
+	const uint8_t *max;
+	const uint8_t *data;
+	const uint8_t *end;
+    };
+
+    Vector<Column> _col;
+    int _nrows;
+
+};
+
+inline void ColumnWriter::add(const char *record)
+{
+    _rows.append(record, _record_size);
+    ++_nrows;
+}
+
+}
+
+CLICK_ENDDECLS
+#endif
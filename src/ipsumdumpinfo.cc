@@ -224,24 +224,84 @@ bool hard_field_missing(const PacketDesc &d, int proto, int l)
 #endif
 #define PUT1(p, d)	((p)[0] = (d))
 
+const char decimal_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+const uint32_t decimal_powers[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000
+};
+
+#if HAVE_INT64_TYPES
+char *unparse_decimal(char *s, uint64_t v)
+{
+    if (v <= 0xFFFFFFFFU)
+	return unparse_decimal(s, (uint32_t) v);
+    // split into 8-digit groups so the digit loops stay 32-bit
+    uint64_t hi = v / 100000000;
+    uint32_t lo = v - hi * 100000000;
+    if (hi <= 0xFFFFFFFFU)
+	s = unparse_decimal(s, (uint32_t) hi);
+    else {
+	uint32_t top = hi / 100000000;
+	s = unparse_decimal(s, top);
+	s = unparse_digits(s, hi - (uint64_t) top * 100000000, 8);
+    }
+    return unparse_digits(s, lo, 8);
+}
+#endif
+
+char *unparse_timestamp(char *s, const Timestamp &ts)
+{
+    uint32_t sec, subsec;
+    if (!ts.is_negative())
+	sec = ts.sec(), subsec = ts.subsec();
+    else {
+	*s++ = '-';
+	if (ts.subsec() == 0)
+	    sec = -ts.sec(), subsec = 0;
+	else
+	    sec = -ts.sec() - 1, subsec = Timestamp::subsec_per_sec - ts.subsec();
+    }
+    s = unparse_decimal(s, sec);
+    *s++ = '.';
+#if TIMESTAMP_NANOSEC
+    uint32_t usec = subsec / Timestamp::nsec_per_usec;
+    if (usec * Timestamp::nsec_per_usec == subsec)
+	return unparse_digits(s, usec, 6);
+    else
+	return unparse_digits(s, subsec, 9);
+#else
+    return unparse_digits(s, subsec, 6);
+#endif
+}
+
 void num_outa(const PacketDesc& d, const FieldWriter *f)
 {
     if (f->type == B_8) {
 #if HAVE_INT64_TYPES
 	uint64_t v = ((uint64_t) d.u32[1] << 32) | d.u32[0];
-	*d.sa << v;
+	if (char *x = d.sa->reserve(20))
+	    d.sa->adjust_length(unparse_decimal(x, v) - x);
 #else
 	// XXX silently truncate large numbers
-	*d.sa << d.u32[0];
+	append_decimal(*d.sa, d.u32[0]);
 #endif
     } else
-	*d.sa << d.v;
+	append_decimal(*d.sa, d.v);
 }
 
 bool num_ina(PacketOdesc& d, const String &s, const FieldReader *f)
 {
+    // plain decimal numbers are by far the most common
+    if (parse_decimal(s.begin(), s.end(), d.u32[0]))
+	d.u32[1] = 0;
 #if HAVE_INT64_TYPES
-    if (f->type == B_8) {
+    else if (f->type == B_8) {
 	uint64_t v;
 	if (!IntArg().parse(s, v))
 	    return false;
@@ -252,7 +312,7 @@ bool num_ina(PacketOdesc& d, const String &s, const FieldReader *f)
 #else
     // XXX die on large numbers
 #endif
-    if (!IntArg().parse(s, d.v))
+    else if (!IntArg().parse(s, d.v))
 	return false;
     if ((f->type == B_1 && d.v > 255) || (f->type == B_2 && d.v > 65535))
 	return false;
@@ -281,7 +341,10 @@ void outb(const PacketDesc& d, bool, const FieldWriter *f)
       }
       case B_6PTR: {
 	  char* c = d.sa->extend(6);
-	  memcpy(c, d.vptr[0], 6);
+	  if (d.vptr[0])
+	      memcpy(c, d.vptr[0], 6);
+	  else
+	      memset(c, 0, 6);
 	  break;
       }
       case B_8: {
@@ -4,6 +4,7 @@
 #include <click/string.hh>
 #include <click/straccum.hh>
 #include <click/packet.hh>
+#include <click/integers.hh>
 CLICK_DECLS
 class Element;
 class IPFlowID;
@@ -171,6 +172,7 @@ void num_outa(const PacketDesc&, const FieldWriter *);
 void outb(const PacketDesc&, bool ok, const FieldWriter *);
 
 bool num_ina(PacketOdesc&, const String &, const FieldReader *);
+inline bool parse_decimal(const char *s, const char *end, uint32_t &result);
 const uint8_t *inb(PacketOdesc&, const uint8_t*, const uint8_t*, const FieldReader *);
 
 enum { MISSING_IP = 0,
@@ -250,6 +252,100 @@ inline bool field_missing(const PacketDesc &d, int proto, int l)
     return (d.bad_sa ? hard_field_missing(d, proto, l) : false);
 }
 
+/* Parse [s, end) as a plain decimal number: at most 9 digits, no sign, and
+   no leading zeros (which IntArg reads as octal). Other strings return
+   false; callers fall back to IntArg for them. */
+inline bool parse_decimal(const char *s, const char *end, uint32_t &result)
+{
+    if (s == end || end - s > 9 || (*s == '0' && end - s > 1))
+	return false;
+    uint32_t v = 0;
+    for (; s != end; ++s)
+	if (*s >= '0' && *s <= '9')
+	    v = v * 10 + *s - '0';
+	else
+	    return false;
+    result = v;
+    return true;
+}
+
+/* Formatters for ASCII summaries.  Each unparse_* function writes to a
+   buffer with room for the longest result (10 bytes for a 32-bit number,
+   20 for a 64-bit number, 16 for an IP address, 33 for a timestamp) and
+   returns the new end.  Output is byte-for-byte what StringAccum's
+   operator<< would produce; the append_* wrappers reserve space once. */
+extern const char decimal_digit_pairs[];
+extern const uint32_t decimal_powers[];
+
+inline int decimal_length(uint32_t v)
+{
+    // ffs_msb numbers the MSB 1; 1233/4096 approximates log10(2)
+    int n = ((33 - ffs_msb(v | 1)) * 1233) >> 12;
+    return n + ((v | 1) >= decimal_powers[n]);
+}
+
+// Write the last 'n' digits of 'v', padding with zeros if needed.
+inline char *unparse_digits(char *s, uint32_t v, int n)
+{
+    char *e = s + n;
+    for (; n >= 2; n -= 2, v /= 100)
+	memcpy(s + n - 2, &decimal_digit_pairs[2 * (v % 100)], 2);
+    if (n)
+	*s = '0' + v % 10;
+    return e;
+}
+
+inline char *unparse_decimal(char *s, uint32_t v)
+{
+    return unparse_digits(s, v, decimal_length(v));
+}
+
+#if HAVE_INT64_TYPES
+char *unparse_decimal(char *s, uint64_t v);
+#endif
+
+// Write IP address 'a', in network byte order, as a dotted quad.
+inline char *unparse_ip(char *s, uint32_t a)
+{
+    const uint8_t *x = reinterpret_cast<const uint8_t *>(&a);
+    for (int i = 0; i < 4; ++i) {
+	uint32_t v = x[i];
+	if (v >= 100) {
+	    uint32_t h = (v * 41) >> 12;	// v / 100 for v < 256
+	    *s++ = '0' + h;
+	    v -= h * 100;
+	    memcpy(s, &decimal_digit_pairs[2 * v], 2);
+	    s += 2;
+	} else if (v >= 10) {
+	    memcpy(s, &decimal_digit_pairs[2 * v], 2);
+	    s += 2;
+	} else
+	    *s++ = '0' + v;
+	*s++ = '.';
+    }
+    return s - 1;
+}
+
+char *unparse_timestamp(char *s, const Timestamp &ts);
+
+inline void append_decimal(StringAccum &sa, uint32_t v)
+{
+    if (char *x = sa.reserve(10))
+	sa.adjust_length(unparse_decimal(x, v) - x);
+}
+
+inline void append_ip(StringAccum &sa, uint32_t a)
+{
+    if (char *x = sa.reserve(16))
+	sa.adjust_length(unparse_ip(x, a) - x);
+}
+
+inline void append_timestamp(StringAccum &sa, const Timestamp &ts)
+{
+    if (char *x = sa.reserve(33))
+	sa.adjust_length(unparse_timestamp(x, ts) - x);
+}
+
 }
 
 class IPSummaryDumpInfo { public:
@@ -73,7 +73,7 @@ Only available in user-level processes.
 This ProgressBar shows how far into the file FromDump has gotten:
 
   fd :: FromDump(~/largedump.gz) -> ...
-  ProgressBar(fd.filepos, fd.filesize);
+  ProgressBar(fd.raw_filepos, fd.filesize);
 
 Here are some example progress bars. The first form occurs when the file size
 is known; the second, when it is not known.
@@ -73,6 +73,24 @@ RandomSample::push(int, Packet *p)
     }
 }
 
+void
+RandomSample::push_batch(int, PacketBatch &batch)
+{
+    if (!_active) {
+	output(0).push_batch(batch);
+	return;
+    }
+    PacketBatch out;
+    while (Packet *p = batch.pop_front())
+	if ((click_random() & SAMPLING_MASK) < _sampling_prob)
+	    out.append(p);
+	else {
+	    checked_output_push(1, p);
+	    _drops++;
+	}
+    output(0).push_batch(out);
+}
+
 Packet *
 RandomSample::pull(int)
 {
@@ -77,6 +77,7 @@ class RandomSample : public Element { public:
 
     void push(int port, Packet *);
     Packet *pull(int port);
+    void push_batch(int port, PacketBatch &);
 
   private:
 
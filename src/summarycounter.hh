@@ -0,0 +1,24 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_SUMMARYCOUNTER_HH
+#define CLICK_SUMMARYCOUNTER_HH
+CLICK_DECLS
+
+/* SummaryCounter is implemented by elements, such as AggregateCounter, that
+   can count a summary dump record without a packet. FromIPSummaryDump's
+   AGGREGATE_COUNTER keyword finds one with cast("SummaryCounter"). */
+
+class SummaryCounter { public:
+
+    SummaryCounter()			{ }
+    virtual ~SummaryCounter()		{ }
+
+    // Count a record representing 'packets' packets with aggregate
+    // 'aggregate' and IP length 'ip_len'. 'ip_len' is 0 if the record's
+    // length is unknown. Returns false if the record could not be counted
+    // this way; the caller should then synthesize a packet instead.
+    virtual bool count_summary(uint32_t aggregate, uint32_t packets, uint32_t ip_len) = 0;
+
+};
+
+CLICK_ENDDECLS
+#endif
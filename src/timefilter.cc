@@ -152,6 +152,15 @@ TimeFilter::simple_action(Packet *p)
     }
 }
 
+void
+TimeFilter::push_batch(int port, PacketBatch &batch)
+{
+    PacketBatch out;
+    while (Packet *p = batch.pop_front())
+	if ((p = TimeFilter::simple_action(p)))
+	    out.append(p);
+    output(port).push_batch(out);
+}
 
 String
 TimeFilter::read_handler(Element *e, void *)
@@ -112,6 +112,7 @@ class TimeFilter : public Element { public:
     void add_handlers() CLICK_COLD;
 
     Packet *simple_action(Packet *);
+    void push_batch(int port, PacketBatch &);
 
   private:
 
@@ -45,15 +45,7 @@ TimeRange::configure(Vector<String> &conf, ErrorHandler *errh)
 Packet *
 TimeRange::simple_action(Packet *p)
 {
-    const Timestamp& tv = p->timestamp_anno();
-    if (!_first)
-	_first = _last = tv;
-    else if (_simple)
-	_last = tv;
-    else if (_last < tv)
-	_last = tv;
-    else if (tv < _first)
-	_first = tv;
+    add(p->timestamp_anno());
     return p;
 }
 
@@ -65,6 +65,7 @@ class TimeRange : public Element { public:
     int configure(Vector<String> &, ErrorHandler *) CLICK_COLD;
     void add_handlers() CLICK_COLD;
 
+    inline void add(const Timestamp &);
     Packet *simple_action(Packet *);
 
   private:
@@ -82,5 +83,22 @@ class TimeRange : public Element { public:
 
 };
 
+/** @brief Extend the range to include @a ts.
+ *
+ * FromIPSummaryDump's TIME_RANGE keyword calls this for summary records it
+ * counts without creating packets. */
+inline void
+TimeRange::add(const Timestamp &ts)
+{
+    if (!_first)
+	_first = _last = ts;
+    else if (_simple)
+	_last = ts;
+    else if (_last < ts)
+	_last = ts;
+    else if (ts < _first)
+	_first = ts;
+}
+
 CLICK_ENDDECLS
 #endif
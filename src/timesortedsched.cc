@@ -27,7 +27,9 @@
 CLICK_DECLS
 
 TimeSortedSched::TimeSortedSched()
-    : _pkt(0), _npkt(0), _input(0), _nready(0),
+    : _pkt(0), _npkt(0), _leaf(0), _tree(0), _second(-1), _rebuild(true),
+      _winner_changed(false), _input(0), _nready(0), _ring(0),
+      _parallel(false), _threads_started(false),
       _notifier(Notifier::SEARCH_CONTINUE_WAKE), _buffer(1),
       _well_ordered(true)
 {
@@ -49,30 +51,46 @@ TimeSortedSched::cast(const char *n)
 int
 TimeSortedSched::configure(Vector<String> &conf, ErrorHandler *errh)
 {
-    _notifier.initialize(Notifier::EMPTY_NOTIFIER, router());
     _stop = false;
     if (Args(conf, this, errh)
 	.read("STOP", _stop)
 	.read("BUFFER", _buffer)
+	.read("PARALLEL", _parallel)
 	.complete() < 0)
 	return -1;
     if (_buffer <= 0)
 	return errh->error("BUFFER must be at least 1");
+    // With PARALLEL, upstream notifiers change on input threads, so they
+    // must not wake us directly; our signal tracks the merged view instead.
+    if (_parallel)
+	_notifier = Notifier(Notifier::SEARCH_STOP);
+    _notifier.initialize(Notifier::EMPTY_NOTIFIER, router());
     return 0;
 }
 
 int
 TimeSortedSched::initialize(ErrorHandler *errh)
 {
-    _pkt = new packet_s[ninputs() * _buffer];
+    _pkt = new Packet *[ninputs() * _buffer];
     _input = new input_s[ninputs()];
-    if (!_pkt || !_input)
+    _leaf = new leaf_s[ninputs() + 1];
+    _tree = new int[ninputs() + 1];
+    if (!_pkt || !_input || !_leaf || !_tree)
+	return errh->error("out of memory!");
+    if (_parallel && ninputs() && !(_ring = new ring_s[ninputs()]))
 	return errh->error("out of memory!");
     for (int i = 0; i < ninputs(); i++) {
-	_input[i].signal = Notifier::upstream_empty_signal(this, i, &_notifier);
+	if (_parallel)
+	    _input[i].signal = Notifier::upstream_empty_signal(this, i);
+	else
+	    _input[i].signal = Notifier::upstream_empty_signal(this, i, &_notifier);
 	_input[i].space = _buffer;
 	_input[i].ready = i;
+	_input[i].ring = 0;
     }
+    for (int i = 0; i <= ninputs(); i++)
+	_leaf[i].live = false;
+    _tree[0] = 0;
     _nready = ninputs();
     return 0;
 }
@@ -80,26 +98,219 @@ TimeSortedSched::initialize(ErrorHandler *errh)
 void
 TimeSortedSched::cleanup(CleanupStage)
 {
-    for (int i = 0; i < _npkt; ++i)
-	_pkt[i].p->kill();
+    if (_ring)
+	stop_threads();
+    if (_input && _pkt)
+	for (int i = 0; i < ninputs(); ++i)
+	    for (int j = 0; j < _buffer - _input[i].space; ++j)
+		_pkt[i * _buffer + j]->kill();
     delete[] _pkt;
     delete[] _input;
+    delete[] _leaf;
+    delete[] _tree;
+    delete[] _ring;
+}
+
+inline bool
+TimeSortedSched::leaf_less(int a, int b) const
+{
+    const leaf_s &la = _leaf[a], &lb = _leaf[b];
+    if (!la.live || !lb.live)
+	return la.live;
+    return la.ts < lb.ts || (la.ts == lb.ts && a < b);
+}
+
+int
+TimeSortedSched::rebuild_match(int n)
+{
+    if (n >= ninputs())
+	return n - ninputs();
+    int a = rebuild_match(2 * n), b = rebuild_match(2 * n + 1);
+    if (leaf_less(b, a))
+	click_swap(a, b);
+    _tree[n] = b;
+    return a;
+}
+
+void
+TimeSortedSched::rebuild_tree()
+{
+    int k = ninputs();
+    _tree[0] = rebuild_match(1);
+    _second = k;
+    for (int n = (_tree[0] + k) >> 1; n >= 1; n >>= 1)
+	if (leaf_less(_tree[n], _second))
+	    _second = _tree[n];
+}
+
+void
+TimeSortedSched::replay_winner()
+{
+    // Only the winner's leaf changed, so only its matches need replaying.
+    // If it stays the winner, the best loser it meets is the runner-up.
+    int k = ninputs(), c = _tree[0], second = k;
+    for (int n = (c + k) >> 1; n >= 1; n >>= 1) {
+	int l = _tree[n];
+	if (leaf_less(l, c)) {
+	    _tree[n] = c;
+	    c = l;
+	    second = -1;
+	} else if (second >= 0 && leaf_less(l, second))
+	    second = l;
+    }
+    _tree[0] = c;
+    _second = second;
+}
+
+void
+TimeSortedSched::start_threads()
+{
+    _threads_started = true;
+    for (int i = 0; i < ninputs(); ++i) {
+	ring_s &r = _ring[i];
+	r.head = r.tail = 0;
+	r.reader_waiting = r.writer_waiting = r.stop = false;
+	r.active = true;
+	r.running = false;
+	r.tss = this;
+	r.input = i;
+	// An input that is already inactive is pulled directly.
+	if (!_input[i].signal)
+	    continue;
+	pthread_mutex_init(&r.lock, 0);
+	pthread_cond_init(&r.cond, 0);
+	if (pthread_create(&r.thread, 0, input_thread, &r) == 0) {
+	    r.running = true;
+	    _input[i].ring = &r;
+	} else {
+	    // Fall back to pulling this input directly.
+	    click_chatter("%p{element}: cannot create thread for input %d", this, i);
+	    pthread_cond_destroy(&r.cond);
+	    pthread_mutex_destroy(&r.lock);
+	}
+    }
+}
+
+void
+TimeSortedSched::stop_threads()
+{
+    for (int i = 0; i < ninputs(); ++i) {
+	ring_s &r = _ring[i];
+	if (!r.running)
+	    continue;
+	pthread_mutex_lock(&r.lock);
+	__atomic_store_n(&r.stop, true, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&r.cond);
+	pthread_mutex_unlock(&r.lock);
+	pthread_join(r.thread, 0);
+	for (unsigned x = r.head; x != r.tail; ++x)
+	    if (Packet *p = r.entry[x % RING_SIZE].p)
+		p->kill();
+	pthread_cond_destroy(&r.cond);
+	pthread_mutex_destroy(&r.lock);
+	r.running = false;
+	_input[i].ring = 0;
+    }
+}
+
+/* Input threads pull packets into their rings exactly as the sequential
+   merge would pull them, recording each result, including null results,
+   together with the upstream signal that followed it.  The merge replays
+   these results in place of pulling, so it makes the same decisions, and
+   produces the same output, as a sequential merge.  A thread stops after a
+   null result with an inactive signal, since the merge will never pull that
+   input again. */
+
+void *
+TimeSortedSched::input_thread(void *user_data)
+{
+    ring_s &r = *static_cast<ring_s *>(user_data);
+    const Element::Port &port = r.tss->input(r.input);
+    const NotifierSignal &signal = r.tss->_input[r.input].signal;
+    while (1) {
+	unsigned tail = r.tail;
+	if (tail - __atomic_load_n(&r.head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+	    pthread_mutex_lock(&r.lock);
+	    __atomic_store_n(&r.writer_waiting, true, __ATOMIC_SEQ_CST);
+	    while (tail - __atomic_load_n(&r.head, __ATOMIC_SEQ_CST) == RING_SIZE
+		   && !__atomic_load_n(&r.stop, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&r.cond, &r.lock);
+	    __atomic_store_n(&r.writer_waiting, false, __ATOMIC_RELAXED);
+	    pthread_mutex_unlock(&r.lock);
+	}
+	if (__atomic_load_n(&r.stop, __ATOMIC_ACQUIRE))
+	    break;
+
+	ring_entry &e = r.entry[tail % RING_SIZE];
+	e.p = port.pull();
+	// Readers return clones of their file buffers, and packet reference
+	// counts are not atomic.  Copy shared packets here, so that only this
+	// thread touches the buffers' counts and the merger gets packets it
+	// owns outright.
+	if (e.p && e.p->shared())
+	    e.p = e.p->uniqueify();
+	e.active = signal;
+	bool done = !e.p && !e.active;
+	__atomic_store_n(&r.tail, tail + 1, __ATOMIC_SEQ_CST);
+	// wake a waiting merger only once the ring is half full, so the
+	// threads trade places once per batch rather than once per packet
+	if (__atomic_load_n(&r.reader_waiting, __ATOMIC_SEQ_CST)
+	    && (done || tail + 1 - __atomic_load_n(&r.head, __ATOMIC_ACQUIRE) >= WAKE_BATCH)) {
+	    pthread_mutex_lock(&r.lock);
+	    pthread_cond_signal(&r.cond);
+	    pthread_mutex_unlock(&r.lock);
+	}
+	if (done)
+	    break;
+    }
+    Packet::static_cleanup();
+    return 0;
+}
+
+Packet *
+TimeSortedSched::ring_pull(ring_s &r)
+{
+    unsigned head = r.head;
+    if (head == __atomic_load_n(&r.tail, __ATOMIC_ACQUIRE)) {
+	pthread_mutex_lock(&r.lock);
+	__atomic_store_n(&r.reader_waiting, true, __ATOMIC_SEQ_CST);
+	while (head == __atomic_load_n(&r.tail, __ATOMIC_SEQ_CST))
+	    pthread_cond_wait(&r.cond, &r.lock);
+	__atomic_store_n(&r.reader_waiting, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&r.lock);
+    }
+    ring_entry &e = r.entry[head % RING_SIZE];
+    Packet *p = e.p;
+    r.active = e.active;
+    __atomic_store_n(&r.head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r.writer_waiting, __ATOMIC_SEQ_CST)
+	&& __atomic_load_n(&r.tail, __ATOMIC_ACQUIRE) - (head + 1) <= RING_SIZE - WAKE_BATCH) {
+	pthread_mutex_lock(&r.lock);
+	pthread_cond_signal(&r.cond);
+	pthread_mutex_unlock(&r.lock);
+    }
+    return p;
 }
 
 Packet*
 TimeSortedSched::pull(int)
 {
+    if (_ring && !_threads_started)
+	start_threads();
+
     bool signals_on = false;
     // first maybe fill in buffer
     for (int rpos = _nready - 1; rpos >= 0; --rpos) {
 	int i = _input[rpos].ready;
 	input_s &is = _input[i];
-	if (is.signal) {
+	if (is.ring ? is.ring->active : (bool) is.signal) {
 	    signals_on = true;
-	    while ((_pkt[_npkt].p = input(i).pull())) {
-		_pkt[_npkt].input = i;
+	    Packet **buf = _pkt + i * _buffer;
+	    int n0 = _buffer - is.space, n = n0;
+	    while ((buf[n] = (is.ring ? ring_pull(*is.ring) : input(i).pull()))) {
+		++n;
+		push_heap(buf, buf + n, heap_less());
 		++_npkt;
-		push_heap(_pkt, _pkt + _npkt, heap_less());
 		--is.space;
 		if (!is.space) {
 		    _input[rpos].ready = _input[_nready - 1].ready;
@@ -107,26 +318,50 @@ TimeSortedSched::pull(int)
 		    break;
 		}
 	    }
+	    if (n != n0) {
+		_leaf[i].ts = buf[0]->timestamp_anno();
+		_leaf[i].live = true;
+		if (i == _tree[0])
+		    _winner_changed = true;
+		else
+		    _rebuild = true;
+	    }
 	}
     }
 
+    // then update the tournament tree; skip the replay if the winner
+    // still beats the runner-up
+    if (_rebuild)
+	rebuild_tree();
+    else if (_winner_changed && (_second < 0 || !leaf_less(_tree[0], _second)))
+	replay_winner();
+    _rebuild = _winner_changed = false;
+
     // then maybe emit a packet
     _notifier.set_active(_npkt > 0 || signals_on);
     if (_npkt > 0) {
-	Packet *p = _pkt[0].p;
+	int i = _tree[0];
+	input_s &is = _input[i];
+	Packet **buf = _pkt + i * _buffer;
+	int n = _buffer - is.space;
+	Packet *p = buf[0];
 	if (p->timestamp_anno()) {
 	    if (_last_emission && p->timestamp_anno() < _last_emission)
 		_well_ordered = false;
 	    _last_emission = p->timestamp_anno();
 	}
-	input_s &is = _input[_pkt[0].input];
 	++is.space;
 	if (is.space == 1) {
-	    _input[_nready].ready = _pkt[0].input;
+	    _input[_nready].ready = i;
 	    ++_nready;
 	}
-	pop_heap(_pkt, _pkt + _npkt, heap_less());
+	pop_heap(buf, buf + n, heap_less());
 	--_npkt;
+	if (n > 1)
+	    _leaf[i].ts = buf[0]->timestamp_anno();
+	else
+	    _leaf[i].live = false;
+	_winner_changed = true;
 	return p;
     } else {
 	if (_stop && !signals_on)
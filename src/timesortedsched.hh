@@ -3,12 +3,13 @@
 #define CLICK_TIMESORTEDSCHED_HH
 #include <click/element.hh>
 #include <click/notifier.hh>
+#include <pthread.h>
 CLICK_DECLS
 
 /*
 =c
 
-TimeSortedSched(I<keywords> STOP, BUFFER)
+TimeSortedSched(I<keywords> STOP, BUFFER, PARALLEL)
 
 =s timestamps
 
@@ -47,6 +48,19 @@ Integer. Up to BUFFER packets per input are buffered within
 TimeSortedSched. Default BUFFER is 1. Higher BUFFER values let TimeSortedSched
 cope with minor reordering in its input streams.
 
+=item PARALLEL
+
+Boolean. If true, then each input is pulled on its own thread, which keeps a
+bounded queue of packets ahead of the merge.  Decoding the inputs then
+proceeds in parallel, but the output, including C<well_ordered>, is exactly
+the same as without PARALLEL.  Every element upstream of an input runs on
+that input's thread, so those elements must be pull-only and must not use
+tasks or timers or stop the driver; for instance, FromDump or
+FromIPSummaryDump with STOP and TIMING false.  Packets that share data with
+other packets, such as FromDump's clones of its file buffer, are copied on
+the input thread, since packet reference counts are not thread-safe.
+Default is false.
+
 =back
 
 =n
@@ -54,6 +68,10 @@ cope with minor reordering in its input streams.
 TimeSortedSched is a notifier signal, active iff any of the upstream notifiers
 are active.
 
+Packets with equal timestamps from different inputs are emitted in input port
+order.  TimeSortedSched merges with a tournament tree over its inputs, so
+each packet costs about log2(I<n>) timestamp comparisons for I<n> inputs.
+
 =e
 
 This example merges multiple tcpdump(1) files into a single, time-sorted
@@ -97,33 +115,77 @@ class TimeSortedSched : public Element { public:
 
   private:
 
-    struct packet_s {
-	Packet *p;
-	int input;		// for space, consider using annotation?
-    };
     struct heap_less {
-	inline bool operator()(packet_s &a, packet_s &b) {
-	    return a.p->timestamp_anno() < b.p->timestamp_anno();
+	inline bool operator()(Packet *a, Packet *b) {
+	    return a->timestamp_anno() < b->timestamp_anno();
 	}
     };
+    // Tournament tree leaf: the earliest packet buffered from one input.
+    struct leaf_s {
+	Timestamp ts;
+	bool live;		// false if the input has no buffered packets
+    };
+    enum { RING_SIZE = 512, WAKE_BATCH = 32 };
+    struct ring_entry {
+	Packet *p;
+	bool active;		// upstream signal after the pull
+    };
+    struct ring_s {
+	ring_entry entry[RING_SIZE];
+	unsigned head;		// next entry to merge; written by merger
+	unsigned tail;		// next entry to fill; written by input thread
+	bool reader_waiting;
+	bool writer_waiting;
+	bool stop;
+	bool active;		// merger's view of the upstream signal
+	bool running;
+	TimeSortedSched *tss;
+	int input;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+    };
     struct input_s {
 	NotifierSignal signal;
 	int space;
 	int ready;
+	ring_s *ring;		// if nonnull, input is pulled on ring's thread
     };
 
-    packet_s *_pkt;
+    Packet **_pkt;		// per-input heaps of BUFFER packets each
     int _npkt;
 
+    // _tree[0] is the winning input; _tree[1..ninputs()-1] hold the losers
+    // of each match, with input i's leaf at position ninputs() + i.
+    leaf_s *_leaf;		// ninputs() + 1 leaves; the last is never live
+    int *_tree;
+    int _second;		// best loser on the winner's path, or -1
+    bool _rebuild;		// some leaf other than the winner changed
+    bool _winner_changed;
+
     input_s *_input;
     int _nready;
 
+    ring_s *_ring;
+    bool _parallel;
+    bool _threads_started;
+
     Notifier _notifier;
     int _buffer;
     Timestamp _last_emission;
     bool _stop;
     bool _well_ordered;
 
+    inline bool leaf_less(int a, int b) const;
+    int rebuild_match(int n);
+    void rebuild_tree();
+    void replay_winner();
+
+    void start_threads();
+    void stop_threads();
+    static void *input_thread(void *user_data);
+    static Packet *ring_pull(ring_s &r);
+
 };
 
 CLICK_ENDDECLS
@@ -31,6 +31,7 @@
 #include <click/standard/scheduleinfo.hh>
 #include <click/packet_anno.hh>
 #include "fakepcap.hh"
+#include "anonipaddr.hh"
 #include <click/userutils.hh>
 #if HAVE_PCAP
 extern "C" {
@@ -40,7 +41,7 @@ extern "C" {
 CLICK_DECLS
 
 ToDump::ToDump()
-    : _fp(0), _count(0), _task(this), _use_encap_from(0)
+    : _fp(0), _count(0), _task(this), _use_encap_from(0), _anon(0)
 {
 }
 
@@ -72,6 +73,7 @@ ToDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("EXTRA_LENGTH", _extra_length)
 	.read("UNBUFFERED", _unbuffered)
         .read("NANO", _nano)
+	.read("ANONYMIZE", ElementCastArg("AnonymizeIPAddr"), _anon)
 #if CLICK_NS
 	.read("PER_NODE", per_node)
 #endif
@@ -229,7 +231,7 @@ ToDump::write_packet(Packet *p)
 
     // XXX writing to pipe?
     if (fwrite(&ph, sizeof(ph), 1, _fp) == 0
-	|| (to_write > 0 && fwrite(p->data(), 1, to_write, _fp) == 0)) {
+	|| (to_write > 0 && !write_data(p, to_write))) {
 	if (errno != EAGAIN) {
 	    _active = false;
 	    click_chatter("ToDump(%s): %s", _filename.c_str(), strerror(errno));
@@ -238,6 +240,39 @@ ToDump::write_packet(Packet *p)
 	_count++;
 }
 
+bool
+ToDump::write_data(Packet *p, unsigned to_write)
+{
+    if (!_anon)
+	return fwrite(p->data(), 1, to_write, _fp) != 0;
+    else if (!AnonymizeIPAddr::can_overlay(p)) {
+	// rare packets that must be anonymized in full
+	Packet *q = p->clone();
+	if (q && (q = _anon->anonymize_packet(q))) {
+	    bool ok = fwrite(q->data(), 1, to_write, _fp) != 0;
+	    q->kill();
+	    return ok;
+	}
+	return false;
+    }
+
+    // write the data surrounding the IP header from the packet, and the
+    // header from an anonymized copy
+    uint32_t addr[2];
+    unsigned char hbuf[AnonymizeIPAddr::MAX_HEADER];
+    _anon->map_header(p, addr);
+    unsigned hlen = AnonymizeIPAddr::overlay_header(p, addr, hbuf);
+    const unsigned char *pieces[3] = { p->data(), hbuf, p->network_header() + hlen };
+    unsigned lens[3] = { (unsigned) p->network_header_offset(), hlen, ~0U };
+    for (int i = 0; i < 3 && to_write > 0; i++) {
+	unsigned l = (lens[i] < to_write ? lens[i] : to_write);
+	if (l && fwrite(pieces[i], 1, l, _fp) == 0)
+	    return false;
+	to_write -= l;
+    }
+    return true;
+}
+
 void
 ToDump::push(int, Packet *p)
 {
@@ -246,6 +281,15 @@ ToDump::push(int, Packet *p)
     checked_output_push(0, p);
 }
 
+void
+ToDump::push_batch(int, PacketBatch &batch)
+{
+    if (_active)
+	for (Packet *p = batch.front(); p; p = p->next())
+	    write_packet(p);
+    checked_output_push_batch(0, batch);
+}
+
 Packet *
 ToDump::pull(int)
 {
@@ -305,5 +349,5 @@ ToDump::add_handlers()
 }
 
 CLICK_ENDDECLS
-ELEMENT_REQUIRES(userlevel|ns FakePcap)
+ELEMENT_REQUIRES(userlevel|ns FakePcap AnonymizeIPAddr)
 EXPORT_ELEMENT(ToDump)
@@ -7,6 +7,7 @@
 #include <click/notifier.hh>
 #include <stdio.h>
 CLICK_DECLS
+class AnonymizeIPAddr;
 
 /*
 =c
@@ -71,6 +72,14 @@ false.
 Boolean. Set to true to write nanosecond-precision timestamps. Default depends
 on the version of tcpdump/pcap on the machine.
 
+=item ANONYMIZE
+
+Name of an AnonymizeIPAddr element, normally configured with DEFER true.
+ToDump writes packets as that element would have anonymized them, but without
+modifying or copying the packets themselves: rewritten IP headers are written
+from a private copy. (ICMP packets, whose payloads may contain addresses, are
+still copied.) Packets are emitted on ToDump's output, if any, unchanged.
+
 =back
 
 This element is only available at user level.
@@ -114,6 +123,7 @@ class ToDump : public Element { public:
     void take_state(Element *, ErrorHandler *);
 
     void push(int, Packet *);
+    void push_batch(int, PacketBatch &);
     Packet *pull(int);
     bool run_task(Task *);
 
@@ -138,10 +148,12 @@ class ToDump : public Element { public:
     Task _task;
     NotifierSignal _signal;
     Element **_use_encap_from;
+    AnonymizeIPAddr *_anon;
 
     static String read_handler(Element *, void *) CLICK_COLD;
     static int write_handler(const String &, Element *, void *, ErrorHandler *) CLICK_COLD;
     void write_packet(Packet *);
+    bool write_data(Packet *, unsigned);
 
 };
 
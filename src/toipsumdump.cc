@@ -19,6 +19,7 @@
 
 #include <click/config.h>
 #include "toipsumdump.hh"
+#include "anonipaddr.hh"
 #include <click/standard/scheduleinfo.hh>
 #include <click/args.hh>
 #include <click/error.hh>
@@ -27,16 +28,40 @@
 #include <clicknet/udp.h>
 #include <clicknet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <time.h>
 CLICK_DECLS
 
+struct ToIPSummaryDump::Batch {
+    Packet *p[BATCH_SIZE];
+    uint32_t anon[BATCH_SIZE][2];
+    bool overlay[BATCH_SIZE];
+    int n;
+    bool done;
+    uint32_t count;
+    StringAccum sa;
+    Batch *next_work;
+    Batch *next_out;
+    Batch()
+	: n(0), done(false), count(0), next_work(0), next_out(0) {
+    }
+};
+
 ToIPSummaryDump::ToIPSummaryDump()
-    : _f(0), _task(this)
+    : _f(0), _fd(-1), _buffer_size(0), _pending_bytes(0),
+      _write_error(false), _task(this), _anon(0), _nthreads(0), _batch(0),
+      _work_head(0), _work_tail(&_work_head),
+      _out_head(0), _out_tail(&_out_head), _nout(0), _stopping(false),
+      _columns(0), _columnar_pos(0)
 {
 }
 
 ToIPSummaryDump::~ToIPSummaryDump()
 {
+    delete _columns;
 }
 
 int
@@ -48,8 +73,12 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     bool careful_trunc = true;
     bool multipacket = false;
     bool binary = false;
+    bool columnar = false;
+    uint32_t row_group = 65536;
     bool header = true;
     bool extra_length = true;
+    int nthreads = 0;
+    uint32_t buffer_size = 0;
 
     if (Args(conf, this, errh)
 	.read_mp("FILENAME", FilenameArg(), _filename)
@@ -64,10 +93,22 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	.read("CAREFUL_TRUNC", careful_trunc)
 	.read("EXTRA_LENGTH", extra_length)
 	.read("BINARY", binary)
+	.read("COLUMNAR", columnar)
+	.read("ROW_GROUP", row_group)
+	.read("THREADS", nthreads)
+	.read("BUFFER", buffer_size)
+	.read("ANONYMIZE", ElementCastArg("AnonymizeIPAddr"), _anon)
 	.complete() < 0)
 	return -1;
 
+    if (columnar) {
+	binary = true;
+	if (row_group == 0 || row_group > IPSummaryDump::MAX_GROUP_ROWS)
+	    errh->error("ROW_GROUP out of range");
+    }
+
     Vector<String> v;
+    Vector<int> column_width;
     cp_spacevec(save, v);
     _binary_size = 4;
     for (int i = 0; i < v.size(); i++) {
@@ -94,6 +135,9 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
 	if ((s < 0 || !f->outb) && binary)
 	    errh->error("cannot use field %s with BINARY", word.c_str());
 	_binary_size += s;
+	if (columnar && (s = IPSummaryDump::fixed_binary_size(f->type)) < 0)
+	    errh->error("cannot use variable-length field %s with COLUMNAR", word.c_str());
+	column_width.push_back(s);
 
 	// remove _multipacket if packet count specified
 	if (strcmp(f->name, "count") == 0)
@@ -102,6 +146,14 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     if (_fields.size() == 0)
 	errh->error("no contents specified");
 
+    // fields that consult shared NameInfo databases aren't thread-safe
+    for (int i = 0; i < _fields.size() && nthreads > 0; i++)
+	if (strcmp(_fields[i]->name, "icmp_type_name") == 0
+	    || strcmp(_fields[i]->name, "icmp_code_name") == 0) {
+	    errh->warning("field %s is not thread-safe, ignoring THREADS", _fields[i]->name);
+	    nthreads = 0;
+	}
+
     _verbose = verbose;
     _bad_packets = bad_packets;
     _careful_trunc = careful_trunc;
@@ -109,15 +161,205 @@ ToIPSummaryDump::configure(Vector<String> &conf, ErrorHandler *errh)
     _binary = binary;
     _header = header;
     _extra_length = extra_length;
+    _nthreads = (nthreads > 0 ? nthreads : 0);
+    _buffer_size = buffer_size;
+    compile_kernel();
+    if (columnar && !errh->nerrors())
+	_columns = new IPSummaryDump::ColumnWriter(column_width, row_group);
 
     return errh->nerrors() ? -1 : 0;
 }
 
+void
+ToIPSummaryDump::compile_kernel()
+{
+    static const struct {
+	const char *name;
+	uint8_t op;
+	uint8_t binary_size;
+    } kernel_fields[] = {
+	{ "timestamp", K_TIMESTAMP, 8 }, { "ip_src", K_IP_SRC, 4 },
+	{ "ip_dst", K_IP_DST, 4 }, { "sport", K_SPORT, 2 },
+	{ "dport", K_DPORT, 2 }, { "ip_proto", K_IP_PROTO, 1 },
+	{ "ip_len", K_IP_LEN, 4 }, { "ip_id", K_IP_ID, 2 },
+	{ "ip_ttl", K_IP_TTL, 1 }, { "ip_tos", K_IP_TOS, 1 },
+	{ "count", K_COUNT, 4 }
+    };
+    const int nkernel_fields = sizeof(kernel_fields) / sizeof(kernel_fields[0]);
+
+    _kernel.clear();
+    _kernel_ports = false;
+    _kernel_binary_size = 4;
+    for (int i = 0; i < _fields.size(); i++) {
+	int k = 0;
+	while (k < nkernel_fields && strcmp(_fields[i]->name, kernel_fields[k].name) != 0)
+	    ++k;
+	if (k == nkernel_fields) {
+	    _kernel.clear();
+	    return;
+	}
+	_kernel.push_back(kernel_fields[k].op);
+	_kernel_binary_size += kernel_fields[k].binary_size;
+	if (kernel_fields[k].op == K_SPORT || kernel_fields[k].op == K_DPORT)
+	    _kernel_ports = true;
+    }
+}
+
+static inline void
+put_binary(char *&c, uint32_t v, int size)
+{
+    if (size == 4) {
+	v = htonl(v);
+	memcpy(c, &v, 4);
+    } else if (size == 2) {
+	uint16_t v16 = htons(v);
+	memcpy(c, &v16, 2);
+    } else
+	*c = v;
+    c += size;
+}
+
+// Write a summary of a well-formed IP packet, every one of whose fields
+// is a K_ operation, without going through the FieldWriters. The packet's
+// headers are checked once, up front; if they are short or unusual, return
+// false and let the generic path produce its '-' fields and !bad notes.
+bool
+ToIPSummaryDump::summary_kernel(const IPSummaryDump::PacketDesc& d, StringAccum& sa) const
+{
+    const click_ip *iph = d.iph;
+    if (!iph || d.network_length() < sizeof(click_ip))
+	return false;
+    const click_udp *udph = 0;
+    if (_kernel_ports) {
+	if (d.network_length() <= (uint32_t) (iph->ip_hl << 2)
+	    || !IP_FIRSTFRAG(iph)
+	    || (iph->ip_p != IP_PROTO_TCP && iph->ip_p != IP_PROTO_UDP
+		&& iph->ip_p != IP_PROTO_DCCP && iph->ip_p != IP_PROTO_UDPLITE)
+	    || d.transport_length() < 4)
+	    return false;
+	udph = d.p->udp_header();
+    }
+
+    const Packet *p = d.p;
+    if (_binary) {
+	char *c = sa.extend(_kernel_binary_size);
+	if (!c)
+	    return false;
+	put_binary(c, _kernel_binary_size, 4);
+	for (const uint8_t *k = _kernel.begin(); k != _kernel.end(); ++k)
+	    switch (*k) {
+	    case K_TIMESTAMP:
+		put_binary(c, p->timestamp_anno().sec(), 4);
+		put_binary(c, p->timestamp_anno().nsec() / 1000, 4);
+		break;
+	    case K_IP_SRC:
+		memcpy(c, &iph->ip_src, 4);
+		c += 4;
+		break;
+	    case K_IP_DST:
+		memcpy(c, &iph->ip_dst, 4);
+		c += 4;
+		break;
+	    case K_SPORT:
+		put_binary(c, ntohs(udph->uh_sport), 2);
+		break;
+	    case K_DPORT:
+		put_binary(c, ntohs(udph->uh_dport), 2);
+		break;
+	    case K_IP_PROTO:
+		put_binary(c, iph->ip_p, 1);
+		break;
+	    case K_IP_LEN:
+		put_binary(c, ntohs(iph->ip_len) + (d.force_extra_length ? EXTRA_LENGTH_ANNO(p) : 0), 4);
+		break;
+	    case K_IP_ID:
+		put_binary(c, ntohs(iph->ip_id), 2);
+		break;
+	    case K_IP_TTL:
+		put_binary(c, iph->ip_ttl, 1);
+		break;
+	    case K_IP_TOS:
+		put_binary(c, iph->ip_tos, 1);
+		break;
+	    case K_COUNT:
+		put_binary(c, 1 + EXTRA_PACKETS_ANNO(p), 4);
+		break;
+	    }
+	return true;
+    }
+
+    // every K_ field fits in 33 bytes, plus its separator
+    char *x = sa.reserve(_kernel.size() * 34);
+    if (!x)
+	return false;
+    char *c = x;
+    for (const uint8_t *k = _kernel.begin(); k != _kernel.end(); ++k) {
+	switch (*k) {
+	case K_TIMESTAMP:
+	    c = IPSummaryDump::unparse_timestamp(c, p->timestamp_anno());
+	    break;
+	case K_IP_SRC:
+	    c = IPSummaryDump::unparse_ip(c, iph->ip_src.s_addr);
+	    break;
+	case K_IP_DST:
+	    c = IPSummaryDump::unparse_ip(c, iph->ip_dst.s_addr);
+	    break;
+	case K_SPORT:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) ntohs(udph->uh_sport));
+	    break;
+	case K_DPORT:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) ntohs(udph->uh_dport));
+	    break;
+	case K_IP_PROTO:
+	    if (iph->ip_p == IP_PROTO_TCP)
+		*c++ = 'T';
+	    else if (iph->ip_p == IP_PROTO_UDP)
+		*c++ = 'U';
+	    else if (iph->ip_p == IP_PROTO_ICMP)
+		*c++ = 'I';
+	    else
+		c = IPSummaryDump::unparse_decimal(c, (uint32_t) iph->ip_p);
+	    break;
+	case K_IP_LEN:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) (ntohs(iph->ip_len) + (d.force_extra_length ? EXTRA_LENGTH_ANNO(p) : 0)));
+	    break;
+	case K_IP_ID:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) ntohs(iph->ip_id));
+	    break;
+	case K_IP_TTL:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) iph->ip_ttl);
+	    break;
+	case K_IP_TOS:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) iph->ip_tos);
+	    break;
+	case K_COUNT:
+	    c = IPSummaryDump::unparse_decimal(c, (uint32_t) (1 + EXTRA_PACKETS_ANNO(p)));
+	    break;
+	}
+	*c++ = ' ';
+    }
+    c[-1] = '\n';
+    sa.adjust_length(c - x);
+    return true;
+}
+
 int
 ToIPSummaryDump::initialize(ErrorHandler *errh)
 {
-    assert(!_f);
-    if (_filename != "-") {
+    assert(!_f && _fd < 0);
+    if (_buffer_size) {
+	// write directly to the file descriptor, bypassing stdio
+	if (_filename != "-") {
+	    _fd = open(_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	    if (_fd < 0)
+		return errh->error("%s: %s", _filename.c_str(), strerror(errno));
+	} else {
+	    fflush(stdout);
+	    _fd = STDOUT_FILENO;
+	    _filename = "<stdout>";
+	}
+	_obuf.reserve(_buffer_size + 4096);
+    } else if (_filename != "-") {
 	_f = fopen(_filename.c_str(), "wb");
 	if (!_f)
 	    return errh->error("%s: %s", _filename.c_str(), strerror(errno));
@@ -162,12 +404,28 @@ ToIPSummaryDump::initialize(ErrorHandler *errh)
     sa << '\n';
 
     // binary marker
-    if (_binary)
+    if (_columns)
+	sa << "!columnar\n";
+    else if (_binary)
 	sa << "!binary\n";
 
     // print output
     if (_header)
-	ignore_result(fwrite(sa.data(), 1, sa.length(), _f));
+	write_data(sa.data(), sa.length());
+
+    // worker threads
+    if (_nthreads) {
+	pthread_mutex_init(&_lock, 0);
+	pthread_cond_init(&_work_cond, 0);
+	pthread_cond_init(&_done_cond, 0);
+	_threads.reserve(_nthreads);
+	for (int i = 0; i < _nthreads; i++) {
+	    pthread_t t;
+	    if (int e = pthread_create(&t, 0, worker_thread, this))
+		return errh->error("pthread_create: %s", strerror(e));
+	    _threads.push_back(t);
+	}
+    }
 
     return 0;
 }
@@ -175,28 +433,60 @@ ToIPSummaryDump::initialize(ErrorHandler *errh)
 void
 ToIPSummaryDump::cleanup(CleanupStage)
 {
+    if (_threads.size()) {
+	if (_f || _fd >= 0)
+	    drain(false);
+	stop_threads();
+    }
+    if (_columns && (_f || _fd >= 0)) {
+	StringAccum sa;
+	flush_columns();
+	_columns->write_footer(sa);
+	write_data(sa.data(), sa.length());
+    }
+    if (_fd >= 0) {
+	flush_buffer();
+	if (_fd != STDOUT_FILENO)
+	    close(_fd);
+    }
+    _fd = -1;
     if (_f && _f != stdout)
 	fclose(_f);
     _f = 0;
 }
 
 bool
-ToIPSummaryDump::summary(Packet* p, StringAccum& sa, StringAccum* bad_sa) const
+ToIPSummaryDump::summary(Packet* p, StringAccum& sa, StringAccum* bad_sa, const uint32_t* anon) const
 {
     IPSummaryDump::PacketDesc d(this, p, &sa, bad_sa, _careful_trunc, _extra_length);
 
     for (int i = 0; i < _prepare_fields.size(); i++)
 	_prepare_fields[i]->prepare(d, _prepare_fields[i]);
 
+    // fields read the IP header through d.iph, so an anonymized copy of the
+    // header can stand in for the packet's own
+    uint32_t hbuf[AnonymizeIPAddr::MAX_HEADER / 4];
+    if (anon && d.iph) {
+	AnonymizeIPAddr::overlay_header(p, anon, reinterpret_cast<unsigned char*>(hbuf));
+	d.iph = reinterpret_cast<const click_ip*>(hbuf);
+    }
+
+    if (_kernel.size() && summary_kernel(d, sa))
+	return true;
+
     if (_binary) {
+	int start = sa.length();
 	sa.extend(4);
 	for (int i = 0; i < _fields.size(); i++) {
 	    d.clear_values();
 	    bool ok = _fields[i]->extract(d, _fields[i]);
 	    _fields[i]->outb(d, ok, _fields[i]);
 	}
-	*(reinterpret_cast<uint32_t*>(sa.data())) = htonl(sa.length());
+	uint32_t reclen = htonl(sa.length() - start);
+	memcpy(sa.data() + start, &reclen, 4);
     } else {
+	// most fields are short; reserve room for the record up front
+	sa.reserve(_fields.size() * 16);
 	for (int i = 0; i < _fields.size(); i++) {
 	    if (i)
 		sa << ' ';
@@ -213,7 +503,20 @@ ToIPSummaryDump::summary(Packet* p, StringAccum& sa, StringAccum* bad_sa) const
 }
 
 void
-ToIPSummaryDump::write_packet(Packet* p, int multipacket)
+ToIPSummaryDump::append_line(StringAccum& sa, const char* s, int len) const
+{
+    if (len) {
+	assert(s[len - 1] == '\n');
+	if (_binary) {
+	    uint32_t marker = htonl(len | 0x80000000U);
+	    sa.append(reinterpret_cast<const char*>(&marker), 4);
+	}
+	sa.append(s, len);
+    }
+}
+
+uint32_t
+ToIPSummaryDump::format_packet(Packet* p, int multipacket, StringAccum& sa, StringAccum& bad_sa, const uint32_t* anon) const
 {
     if (multipacket > 0 && EXTRA_PACKETS_ANNO(p) > 0) {
 	uint32_t count = 1 + EXTRA_PACKETS_ANNO(p);
@@ -237,33 +540,341 @@ ToIPSummaryDump::write_packet(Packet* p, int multipacket)
 	    uint32_t l = total_len / i;
 	    SET_EXTRA_LENGTH_ANNO(p, l - len);
 	    total_len -= l;
-	    write_packet(p, -1);
+	    format_packet(p, -1, sa, bad_sa, anon);
 	    if (i == 1)
 		p->timestamp_anno() = end_timestamp;
 	    else
 		p->timestamp_anno() += timestamp_delta;
 	}
+	return count;
 
     } else {
-	_sa.clear();
-	_bad_sa.clear();
+	int start = sa.length();
+	bad_sa.clear();
 
-	summary(p, _sa, (_bad_packets ? &_bad_sa : 0));
+	summary(p, sa, (_bad_packets ? &bad_sa : 0), anon);
 
-	if (_bad_packets && _bad_sa)
-	    write_line(_bad_sa.take_string());
+	// '!bad' lines precede their packet
+	if (_bad_packets && bad_sa) {
+	    String line(sa.data() + start, sa.length() - start);
+	    sa.adjust_length(start - sa.length());
+	    append_line(sa, bad_sa.data(), bad_sa.length());
+	    sa << line;
+	}
+	return 1;
+    }
+}
+
+Packet*
+ToIPSummaryDump::anonymize(Packet* p, uint32_t addr[2], bool& overlay)
+{
+    // Most packets are summarized with an anonymized copy of their IP
+    // header (see summary()); the rest are anonymized in full, which may
+    // copy them.
+    overlay = AnonymizeIPAddr::can_overlay(p);
+    if (overlay)
+	_anon->map_header(p, addr);
+    else if (p->has_network_header() && p->ip_header()->ip_v == 4)
+	p = _anon->anonymize_packet(p);
+    return p;
+}
+
+Packet*
+ToIPSummaryDump::write_packet(Packet* p, int multipacket)
+{
+    uint32_t addr[2];
+    bool overlay = false;
+    if (_anon && !(p = anonymize(p, addr, overlay)))
+	return 0;
+    const uint32_t* anon = (overlay ? addr : 0);
+
+    if (_columns) {
+	_sa.clear();
+	_output_count += format_packet(p, multipacket, _sa, _bad_sa, anon);
+	write_columns(_sa.data(), _sa.length());
+    } else if (_buffer_size) {
+	// format straight into the output buffer
+	_output_count += format_packet(p, multipacket, _obuf, _bad_sa, anon);
+	if ((uint32_t) _obuf.length() >= _buffer_size)
+	    flush_buffer();
+    } else {
+	_sa.clear();
+	_output_count += format_packet(p, multipacket, _sa, _bad_sa, anon);
 	ignore_result(fwrite(_sa.data(), 1, _sa.length(), _f));
+    }
+    return p;
+}
 
-	_output_count++;
+void
+ToIPSummaryDump::write_data(const char* data, int len)
+{
+    _columnar_pos += len;
+    if (_buffer_size) {
+	// _obuf must precede any pending batches
+	if (_pending.size())
+	    flush_buffer();
+	_obuf.append(data, len);
+	if ((uint32_t) _obuf.length() >= _buffer_size)
+	    flush_buffer();
+    } else
+	ignore_result(fwrite(data, 1, len, _f));
+}
+
+void
+ToIPSummaryDump::flush_buffer()
+{
+    enum { MAX_IOV = 64 };
+    struct iovec iov[MAX_IOV];
+    int niov = 0, pi = 0;
+    size_t want = 0;
+    if (_obuf.length()) {
+	iov[0].iov_base = _obuf.data();
+	iov[0].iov_len = want = _obuf.length();
+	niov = 1;
+    }
+
+    while (niov || pi < _pending.size()) {
+	while (niov < MAX_IOV && pi < _pending.size()) {
+	    StringAccum &bsa = _pending[pi]->sa;
+	    if (bsa.length()) {
+		iov[niov].iov_base = bsa.data();
+		iov[niov].iov_len = bsa.length();
+		want += bsa.length();
+		++niov;
+	    }
+	    ++pi;
+	}
+
+	// write, handling partial writes
+	struct iovec *iovp = iov;
+	while (want && !_write_error) {
+	    ssize_t w = writev(_fd, iovp, niov - (iovp - iov));
+	    if (w < 0 && errno == EINTR)
+		continue;
+	    else if (w < 0 && (errno == EAGAIN
+#ifdef EWOULDBLOCK
+			       || errno == EWOULDBLOCK
+#endif
+			       )) {
+		// nonblocking output: wait until the fd is writable
+		struct pollfd pfd;
+		pfd.fd = _fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+		    continue;
+	    }
+	    if (w < 0) {
+		click_chatter("%p{element}: %s: %s", this, _filename.c_str(), strerror(errno));
+		_write_error = true;
+		break;
+	    }
+	    want -= w;
+	    while (w > 0 && (size_t) w >= iovp->iov_len)
+		w -= iovp->iov_len, ++iovp;
+	    if (w > 0) {
+		iovp->iov_base = (char*) iovp->iov_base + w;
+		iovp->iov_len -= w;
+	    }
+	}
+	niov = 0;
+	want = 0;
+    }
+
+    _obuf.clear();
+    for (int i = 0; i < _pending.size(); i++)
+	delete _pending[i];
+    _pending.clear();
+    _pending_bytes = 0;
+}
+
+void
+ToIPSummaryDump::write_columns(const char* data, int len)
+{
+    // Gather binary packet records into row groups.  A metadata line ends
+    // the current group, so that it keeps its place among the packets.
+    const char* end = data + len;
+    while (data < end) {
+	uint32_t word;
+	memcpy(&word, data, 4);
+	word = ntohl(word);
+	uint32_t reclen = word & 0x7FFFFFFFU;
+	if (word & 0x80000000U) {
+	    flush_columns();
+	    write_data(data, reclen);
+	} else {
+	    assert(reclen == (uint32_t) _columns->record_size() + 4);
+	    _columns->add(data + 4);
+	    if (_columns->full())
+		flush_columns();
+	}
+	data += reclen;
+    }
+}
+
+void
+ToIPSummaryDump::flush_columns()
+{
+    if (_columns->nrows()) {
+	StringAccum sa;
+	_columns->write_group(sa, _columnar_pos);
+	write_data(sa.data(), sa.length());
+    }
+}
+
+void
+ToIPSummaryDump::batch_packet(Packet* p)
+{
+    if (!_batch)
+	_batch = new Batch;
+    int i = _batch->n;
+    _batch->overlay[i] = false;
+    if (_anon && !(p = anonymize(p, _batch->anon[i], _batch->overlay[i])))
+	return;
+    _batch->p[i] = p;
+    _batch->n = i + 1;
+    if (_batch->n == BATCH_SIZE)
+	submit_batch();
+}
+
+void
+ToIPSummaryDump::submit_batch()
+{
+    if (Batch *b = _batch) {
+	_batch = 0;
+	pthread_mutex_lock(&_lock);
+	*_work_tail = b;
+	_work_tail = &b->next_work;
+	*_out_tail = b;
+	_out_tail = &b->next_out;
+	++_nout;
+	pthread_cond_signal(&_work_cond);
+	pthread_mutex_unlock(&_lock);
+    }
+    reap_batches(false, true);
+}
+
+void
+ToIPSummaryDump::reap_batches(bool all, bool push)
+{
+    // Write completed batches in arrival order.  Unless 'all', only block
+    // when too many batches are in flight.
+    while (Batch *b = _out_head) {
+	pthread_mutex_lock(&_lock);
+	if (!b->done && !all && _nout <= 2 * _nthreads) {
+	    pthread_mutex_unlock(&_lock);
+	    break;
+	}
+	while (!b->done)
+	    pthread_cond_wait(&_done_cond, &_lock);
+	if (!(_out_head = b->next_out))
+	    _out_tail = &_out_head;
+	--_nout;
+	pthread_mutex_unlock(&_lock);
+
+	_output_count += b->count;
+	for (int i = 0; i < b->n; i++)
+	    if (push)
+		checked_output_push(0, b->p[i]);
+	    else
+		b->p[i]->kill();
+
+	if (_columns) {
+	    write_columns(b->sa.data(), b->sa.length());
+	    delete b;
+	} else if (_buffer_size) {
+	    // keep formatted batches until a buffer's worth accumulates,
+	    // then write them with one writev()
+	    _pending.push_back(b);
+	    _pending_bytes += b->sa.length();
+	    if (_pending_bytes + _obuf.length() >= _buffer_size)
+		flush_buffer();
+	} else {
+	    ignore_result(fwrite(b->sa.data(), 1, b->sa.length(), _f));
+	    delete b;
+	}
     }
 }
 
+void
+ToIPSummaryDump::drain(bool push)
+{
+    submit_batch();
+    reap_batches(true, push);
+}
+
+void
+ToIPSummaryDump::stop_threads()
+{
+    pthread_mutex_lock(&_lock);
+    _stopping = true;
+    pthread_cond_broadcast(&_work_cond);
+    pthread_mutex_unlock(&_lock);
+    for (int i = 0; i < _threads.size(); i++)
+	pthread_join(_threads[i], 0);
+    _threads.clear();
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_work_cond);
+    pthread_cond_destroy(&_done_cond);
+    _nthreads = 0;
+}
+
+void*
+ToIPSummaryDump::worker_thread(void* arg)
+{
+    ToIPSummaryDump* td = static_cast<ToIPSummaryDump*>(arg);
+    StringAccum bad_sa;
+    pthread_mutex_lock(&td->_lock);
+    while (1) {
+	while (!td->_work_head && !td->_stopping)
+	    pthread_cond_wait(&td->_work_cond, &td->_lock);
+	Batch *b = td->_work_head;
+	if (!b)
+	    break;
+	if (!(td->_work_head = b->next_work))
+	    td->_work_tail = &td->_work_head;
+	pthread_mutex_unlock(&td->_lock);
+
+	for (int i = 0; i < b->n; i++)
+	    b->count += td->format_packet(b->p[i], td->_multipacket, b->sa, bad_sa,
+					  b->overlay[i] ? b->anon[i] : 0);
+
+	pthread_mutex_lock(&td->_lock);
+	b->done = true;
+	pthread_cond_broadcast(&td->_done_cond);
+    }
+    pthread_mutex_unlock(&td->_lock);
+    return 0;
+}
+
 void
 ToIPSummaryDump::push(int, Packet *p)
 {
+    if (_active && _nthreads) {
+	batch_packet(p);
+	return;
+    }
     if (_active)
-	write_packet(p, _multipacket);
-    checked_output_push(0, p);
+	p = write_packet(p, _multipacket);
+    if (p)
+	checked_output_push(0, p);
+}
+
+void
+ToIPSummaryDump::push_batch(int, PacketBatch &batch)
+{
+    if (!_active)
+	checked_output_push_batch(0, batch);
+    else if (_nthreads)
+	while (Packet *p = batch.pop_front())
+	    batch_packet(p);
+    else {
+	PacketBatch out;
+	while (Packet *p = batch.pop_front())
+	    if ((p = write_packet(p, _multipacket)))
+		out.append(p);
+	checked_output_push_batch(0, out);
+    }
 }
 
 bool
@@ -272,43 +883,55 @@ ToIPSummaryDump::run_task(Task *)
     if (!_active)
 	return false;
     if (Packet *p = input(0).pull()) {
-	write_packet(p, _multipacket);
-	checked_output_push(0, p);
+	if (_nthreads)
+	    batch_packet(p);
+	else if ((p = write_packet(p, _multipacket)))
+	    checked_output_push(0, p);
 	_task.fast_reschedule();
 	return true;
-    } else if (_signal) {
+    }
+    // input went idle: hand off any partial batch
+    if (_nthreads && (_batch || _out_head))
+	submit_batch();
+    if (_signal)
 	_task.fast_reschedule();
-	return false;
-    } else
-	return false;
+    return false;
 }
 
 void
 ToIPSummaryDump::write_line(const String& s)
 {
+    if (_nthreads)
+	drain(true);
+    if (_columns)
+	flush_columns();
     if (s.length()) {
 	assert(s.back() == '\n');
 	if (_binary) {
 	    uint32_t marker = htonl(s.length() | 0x80000000U);
-	    ignore_result(fwrite(&marker, 4, 1, _f));
+	    write_data(reinterpret_cast<const char*>(&marker), 4);
 	}
-	ignore_result(fwrite(s.data(), 1, s.length(), _f));
+	write_data(s.data(), s.length());
     }
 }
 
 void
 ToIPSummaryDump::add_note(const String &s)
 {
+    if (_nthreads)
+	drain(true);
+    if (_columns)
+	flush_columns();
     if (s.length()) {
 	int extra = 1 + (s.back() == '\n' ? 0 : 1);
 	if (_binary) {
 	    uint32_t marker = htonl((s.length() + extra) | 0x80000000U);
-	    ignore_result(fwrite(&marker, 4, 1, _f));
+	    write_data(reinterpret_cast<const char*>(&marker), 4);
 	}
-	fputc('#', _f);
-	ignore_result(fwrite(s.data(), 1, s.length(), _f));
+	write_data("#", 1);
+	write_data(s.data(), s.length());
 	if (extra > 1)
-	    fputc('\n', _f);
+	    write_data("\n", 1);
     }
 }
 
@@ -316,6 +939,12 @@ int
 ToIPSummaryDump::flush_handler(const String &, Element *e, void *, ErrorHandler *)
 {
     ToIPSummaryDump *tod = (ToIPSummaryDump *) e;
+    if ((tod->_f || tod->_fd >= 0) && tod->_nthreads)
+	tod->drain(true);
+    if ((tod->_f || tod->_fd >= 0) && tod->_columns)
+	tod->flush_columns();
+    if (tod->_fd >= 0)
+	tod->flush_buffer();
     if (tod->_f)
 	fflush(tod->_f);
     return 0;
@@ -329,6 +958,6 @@ ToIPSummaryDump::add_handlers()
     add_write_handler("flush", flush_handler);
 }
 
-ELEMENT_REQUIRES(userlevel IPSummaryDump IPSummaryDump_Anno IPSummaryDump_IP IPSummaryDump_TCP IPSummaryDump_UDP IPSummaryDump_ICMP IPSummaryDump_Payload IPSummaryDump_Link)
+ELEMENT_REQUIRES(userlevel AnonymizeIPAddr IPSummaryDump IPSummaryDump_Anno IPSummaryDump_IP IPSummaryDump_TCP IPSummaryDump_UDP IPSummaryDump_ICMP IPSummaryDump_Payload IPSummaryDump_Link IPSummaryDump_Columns)
 EXPORT_ELEMENT(ToIPSummaryDump)
 CLICK_ENDDECLS
@@ -5,8 +5,10 @@
 #include <click/task.hh>
 #include <click/straccum.hh>
 #include <click/notifier.hh>
-#include "ipsumdumpinfo.hh"
+#include <pthread.h>
+#include "ipsumdumpcolumns.hh"
 CLICK_DECLS
+class AnonymizeIPAddr;
 
 /*
 =c
@@ -137,6 +139,22 @@ of the dump. Ignored if HEADER is false.
 Boolean. If true, then output packet records in a binary format (explained
 below). Defaults to false.
 
+=item COLUMNAR
+
+Boolean. If true, then output packet records in a columnar binary format,
+which groups records into row groups of ROW_GROUP packets and stores each
+field's values together in compact encodings.  Columnar dumps are often much
+smaller than BINARY dumps, and FromIPSummaryDump can skip row groups outside
+its START time without decoding them.  Variable-length fields, such as
+'C<tcp_opt>' and 'C<payload>', cannot be used.  Implies BINARY.  Defaults to
+false.
+
+=item ROW_GROUP
+
+Integer. The number of packet records in each columnar row group. Metadata
+lines, such as 'C<!bad>' lines, end the current row group early. Defaults to
+65536.
+
 =item MULTIPACKET
 
 Boolean. If true, and the FIELDS option doesn't contain 'C<count>', then
@@ -163,6 +181,31 @@ Actual packet output immediately follows the 'C<!bad>' line.  Default is true.
 
 Boolean.  If false, then ignore extra length annotations.  Defaults to true.
 
+=item BUFFER
+
+Unsigned integer. If nonzero, bypass stdio: accumulate formatted records in an
+output buffer of about BUFFER bytes, and write full buffers straight to the
+file descriptor with write(2)/writev(2). The 'C<flush>' handler writes out any
+partial buffer. Defaults to 0, meaning use stdio.
+
+=item THREADS
+
+Integer.  If greater than zero, format packet summaries on THREADS worker
+threads.  ToIPSummaryDump collects incoming packets into batches, hands each
+batch to a worker, and writes completed batches in arrival order, so the
+output is identical to single-threaded output.  Packets are emitted on
+ToIPSummaryDump's output, if any, only after their batch is written.  Fields
+that consult shared name databases, such as 'C<icmp_type_name>', are not
+thread-safe; THREADS is ignored when they are present.  Defaults to 0.
+
+=item ANONYMIZE
+
+Name of an AnonymizeIPAddr element, normally configured with DEFER true.
+ToIPSummaryDump summarizes packets as that element would have anonymized them,
+reading rewritten IP headers from a private copy rather than modifying or
+copying the packets. (ICMP packets, whose payloads may contain addresses, are
+still copied, and the copies are emitted on ToIPSummaryDump's output.)
+
 =back
 
 =e
@@ -362,6 +405,7 @@ class ToIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     void add_handlers() CLICK_COLD;
 
     void push(int, Packet *);
+    void push_batch(int, PacketBatch &);
     bool run_task(Task *);
 
     String filename() const		{ return _filename; }
@@ -371,10 +415,27 @@ class ToIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
 
   private:
 
+    enum { BATCH_SIZE = 256 };
+    struct Batch;
+
+    // Operations of a summary kernel: common fields that summary_kernel()
+    // can write without calling through their FieldWriters.
+    enum { K_TIMESTAMP, K_IP_SRC, K_IP_DST, K_SPORT, K_DPORT, K_IP_PROTO,
+	   K_IP_LEN, K_IP_ID, K_IP_TTL, K_IP_TOS, K_COUNT };
+
     String _filename;
     FILE *_f;
+    int _fd;			// used instead of _f when _buffer_size
+    uint32_t _buffer_size;
+    StringAccum _obuf;
+    Vector<Batch *> _pending;	// formatted batches awaiting writev
+    uint32_t _pending_bytes;
+    bool _write_error;
     Vector<const IPSummaryDump::FieldWriter *> _fields;
     Vector<const IPSummaryDump::FieldWriter *> _prepare_fields;
+    Vector<uint8_t> _kernel;	// empty if some field has no K_ operation
+    bool _kernel_ports;
+    int _kernel_binary_size;
     bool _verbose : 1;
     bool _bad_packets : 1;
     bool _careful_trunc : 1;
@@ -392,9 +453,42 @@ class ToIPSummaryDump : public Element, public IPSummaryDumpInfo { public:
     StringAccum _bad_sa;
 
     String _banner;
-
-    bool summary(Packet* p, StringAccum& sa, StringAccum* bad_sa) const;
-    void write_packet(Packet* p, int multipacket);
+    AnonymizeIPAddr *_anon;
+
+    int _nthreads;
+    Vector<pthread_t> _threads;
+    pthread_mutex_t _lock;
+    pthread_cond_t _work_cond;
+    pthread_cond_t _done_cond;
+    Batch *_batch;		// batch being filled
+    Batch *_work_head;		// batches awaiting a worker (FIFO)
+    Batch **_work_tail;
+    Batch *_out_head;		// batches in flight, in arrival order
+    Batch **_out_tail;
+    int _nout;
+    bool _stopping;
+
+    IPSummaryDump::ColumnWriter *_columns;	// null unless COLUMNAR
+    uint64_t _columnar_pos;	// bytes written so far
+
+    void compile_kernel();
+    bool summary_kernel(const IPSummaryDump::PacketDesc& d, StringAccum& sa) const;
+    bool summary(Packet* p, StringAccum& sa, StringAccum* bad_sa, const uint32_t* anon) const;
+    uint32_t format_packet(Packet* p, int multipacket, StringAccum& sa, StringAccum& bad_sa, const uint32_t* anon) const;
+    void append_line(StringAccum& sa, const char* s, int len) const;
+    Packet* anonymize(Packet* p, uint32_t addr[2], bool& overlay);
+    Packet* write_packet(Packet* p, int multipacket);
+    void write_data(const char* data, int len);
+    void flush_buffer();
+    void write_columns(const char* data, int len);
+    void flush_columns();
+
+    void batch_packet(Packet* p);
+    void submit_batch();
+    void reap_batches(bool all, bool push);
+    void drain(bool push);
+    void stop_threads();
+    static void* worker_thread(void*);
     static int flush_handler(const String &, Element *, void *, ErrorHandler *);
 
 };
@@ -68,19 +68,14 @@ Unqueue::run_task(Task *)
 	    return false;
     }
 
-    while (worked < limit && _active) {
-	if (Packet *p = input(0).pull()) {
-	    ++worked;
-	    ++_count;
-	    output(0).push(p);
-	} else if (!_signal)
-	    goto out;
-	else
-	    break;
-    }
+    PacketBatch batch;
+    input(0).pull_batch(limit, batch);
+    worked = batch.count();
+    _count += worked;
+    output(0).push_batch(batch);
 
-    _task.fast_reschedule();
-  out:
+    if (worked == limit || _signal)
+	_task.fast_reschedule();
     return worked > 0;
 }
 
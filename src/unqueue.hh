@@ -18,8 +18,8 @@ pull-to-push converter
 
 Pulls packets whenever they are available, then pushes them out
 its single output. Pulls a maximum of BURST packets every time
-it is scheduled. Default BURST is 1. If BURST
-is less than 0, pull until nothing comes back.
+it is scheduled, and pushes them downstream as one batch. Default BURST is
+1. If BURST is less than 0, pull until nothing comes back.
 
 Keyword arguments are:
 